@@ -0,0 +1,324 @@
+// AppendText.cpp : Incremental extraction for append-only plain text files
+
+#include <vector>
+
+#include "AppendText.h"
+#include "TokenText.h"
+
+static const wchar_t c_tokenPrefix[] = L"ap1";
+
+// bytes compared at the start of the file and just before the offset
+static const unsigned long c_checkBytes = 4096;
+
+// bytes read from the file at a time
+static const size_t c_readSize = 65536;
+
+static unsigned long long HashBytes(const unsigned char *buf, size_t cb)
+{
+   unsigned long long hash = 0xCBF29CE484222325ULL;
+
+   for (size_t i = 0; i < cb; ++i)
+      hash = (hash ^ buf[i]) * 0x100000001B3ULL;
+
+   return hash;
+}
+
+static bool HashRange(ByteReader & file, unsigned long long offset, unsigned long cb, unsigned long long *hash)
+{
+   std::vector<unsigned char> buf(cb ? cb : 1);
+
+   if (cb && !file.ReadAt(offset, &buf[0], cb))
+      return false;
+
+   *hash = HashBytes(&buf[0], cb);
+   return true;
+}
+
+void InitAppendState(AppendState & state, CleanupProfile profile)
+{
+   state.offset = 0;
+   state.encoding = TEXT_ENCODING_BINARY;
+   state.profile = profile;
+   state.lastWasSpace = CleanupState().lastWasSpace;
+   state.headLength = 0;
+   state.headHash = 0;
+   state.tailLength = 0;
+   state.tailHash = 0;
+}
+
+std::wstring EncodeAppendState(const AppendState & state)
+{
+   unsigned long long fields[8];
+   fields[0] = state.offset;
+   fields[1] = state.encoding;
+   fields[2] = state.profile;
+   fields[3] = state.lastWasSpace ? 1 : 0;
+   fields[4] = state.headLength;
+   fields[5] = state.headHash;
+   fields[6] = state.tailLength;
+   fields[7] = state.tailHash;
+
+   return EncodeToken(c_tokenPrefix, fields, 8);
+}
+
+bool DecodeAppendState(const wchar_t *text, size_t cch, AppendState & state)
+{
+   unsigned long long fields[8];
+
+   if (!DecodeToken(text, cch, c_tokenPrefix, fields, 8))
+      return false;
+
+   if (fields[1] > TEXT_ENCODING_ANSI || fields[2] >= CLEANUP_PROFILES ||
+       fields[4] > c_checkBytes || fields[6] > c_checkBytes || fields[6] > fields[0])
+      return false;
+
+   state.offset = fields[0];
+   state.encoding = static_cast<TextEncoding>(fields[1]);
+   state.profile = static_cast<unsigned long>(fields[2]);
+   state.lastWasSpace = 0 != fields[3];
+   state.headLength = static_cast<unsigned long>(fields[4]);
+   state.headHash = fields[5];
+   state.tailLength = static_cast<unsigned long>(fields[6]);
+   state.tailHash = fields[7];
+   return true;
+}
+
+// The bytes state was built from are still there, unchanged as far as the
+// head and tail checks can tell.
+static bool PrefixUnchanged(ByteReader & file, unsigned long long size, CleanupProfile profile, const AppendState & state)
+{
+   if (state.profile != static_cast<unsigned long>(profile) || size < state.offset)
+      return false;
+
+   if (TEXT_ENCODING_BINARY == state.encoding)
+      return 0 == state.offset;
+
+   unsigned long long hash;
+
+   if (!HashRange(file, 0, state.headLength, &hash) || hash != state.headHash)
+      return false;
+
+   if (!HashRange(file, state.offset - state.tailLength, state.tailLength, &hash) || hash != state.tailHash)
+      return false;
+
+   return true;
+}
+
+AppendResult ExtractAppendedText(ByteReader & file, unsigned long long size, CleanupProfile profile,
+                                 AppendState & state, TextSink & sink)
+{
+   AppendResult result = APPEND_DELTA;
+
+   if (!PrefixUnchanged(file, size, profile, state))
+   {
+      InitAppendState(state, profile);
+      result = APPEND_RESTARTED;
+   }
+
+   if (size == state.offset)
+   {
+      sink.OnEnd();
+      return result;
+   }
+
+   std::vector<unsigned char> buf(c_readSize);
+
+   if (TEXT_ENCODING_BINARY == state.encoding)
+   {
+      // first bytes of the file, sniff them like the built-in plain text path
+      unsigned long cbHead = size < c_checkBytes ? static_cast<unsigned long>(size) : c_checkBytes;
+
+      if (!file.ReadAt(0, &buf[0], cbHead))
+         return APPEND_READ_ERROR;
+
+      size_t bomLength = 0;
+      TextEncoding encoding = DetectTextEncoding(&buf[0], cbHead, &bomLength);
+
+      if (TEXT_ENCODING_BINARY == encoding)
+         return APPEND_NOT_TEXT;
+
+      state.encoding = encoding;
+      state.offset = bomLength;
+      state.headLength = cbHead;
+      state.headHash = HashBytes(&buf[0], cbHead);
+   }
+
+   // same block size the IFilter path hands to the cleanup kernels
+   static const size_t cChunkSize = 4096;
+   wchar_t chunk[cChunkSize + 1];
+
+   CleanupFunction cleanUp = GetCleanupFunction(profile);
+   CleanupState cleanupState;
+   cleanupState.lastWasSpace = state.lastWasSpace;
+
+   unsigned long long pos = state.offset;
+
+   while (pos < size && sink.WantsMore())
+   {
+      size_t cbRead = size - pos < c_readSize ? static_cast<size_t>(size - pos) : c_readSize;
+
+      if (!file.ReadAt(pos, &buf[0], cbRead))
+         return APPEND_READ_ERROR;
+
+      size_t used = 0;
+
+      while (used < cbRead && sink.WantsMore())
+      {
+         size_t cbBlock = cbRead - used < cChunkSize ? cbRead - used : cChunkSize;
+         size_t cch = 0;
+
+         // never final, the writer may be halfway through a character
+         size_t consumed = DecodeText(state.encoding, &buf[used], cbBlock, chunk, &cch, false);
+
+         if (0 == consumed)
+         {
+            // a partial character at the very end waits for the next call,
+            // anywhere else it's garbage and gets decoded byte-wise
+            if (pos + used + cbBlock == size)
+               break;
+
+            if (used + cbBlock == cbRead)
+               break;   // re-read it at the start of the next buffer
+
+            consumed = DecodeText(state.encoding, &buf[used], cbBlock, chunk, &cch, true);
+         }
+
+         used += consumed;
+
+         cch = cleanUp(cch, chunk, cleanupState);
+         sink.OnText(chunk, cch);
+      }
+
+      if (0 == used)
+         break;
+
+      pos += used;
+   }
+
+   state.offset = pos;
+   state.lastWasSpace = cleanupState.lastWasSpace;
+   state.tailLength = pos < c_checkBytes ? static_cast<unsigned long>(pos) : c_checkBytes;
+
+   if (!HashRange(file, pos - state.tailLength, state.tailLength, &state.tailHash))
+      return APPEND_READ_ERROR;
+
+   sink.OnEnd();
+   return result;
+}
+
+PlainChunkSource::PlainChunkSource(ByteReader & file, unsigned long long size)
+   : m_file(file), m_size(size), m_opened(false), m_result(APPEND_DELTA), m_encoding(TEXT_ENCODING_BINARY),
+     m_pos(0), m_chunks(0), m_end(false), m_buf(c_readSize), m_textStart(0)
+{
+}
+
+AppendResult PlainChunkSource::Open()
+{
+   if (m_opened)
+      return m_result;
+
+   m_opened = true;
+
+   // an empty file is empty text, there's nothing to sniff
+   if (0 == m_size)
+      return m_result;
+
+   unsigned long cbHead = m_size < c_checkBytes ? static_cast<unsigned long>(m_size) : c_checkBytes;
+
+   if (!m_file.ReadAt(0, &m_buf[0], cbHead))
+   {
+      m_result = APPEND_READ_ERROR;
+      return m_result;
+   }
+
+   size_t bomLength = 0;
+   m_encoding = DetectTextEncoding(&m_buf[0], cbHead, &bomLength);
+
+   if (TEXT_ENCODING_BINARY == m_encoding)
+      m_result = APPEND_NOT_TEXT;
+
+   m_pos = bomLength;
+   return m_result;
+}
+
+ChunkRead PlainChunkSource::NextChunk(ChunkInfo & chunk)
+{
+   if (APPEND_DELTA != Open())
+      return CHUNK_READ_ERROR;
+
+   m_text.clear();
+   m_textStart = 0;
+
+   if (m_end || m_pos >= m_size)
+      return CHUNK_READ_END;
+
+   size_t cbRead = m_size - m_pos < c_readSize ? static_cast<size_t>(m_size - m_pos) : c_readSize;
+
+   if (!m_file.ReadAt(m_pos, &m_buf[0], cbRead))
+   {
+      m_result = APPEND_READ_ERROR;
+      return CHUNK_READ_ERROR;
+   }
+
+   // decoded in the blocks ExtractAppendedText uses, so a garbage byte
+   // comes out the same way
+   static const size_t cChunkSize = 4096;
+   wchar_t block[cChunkSize + 1];
+   size_t used = 0;
+
+   while (used < cbRead)
+   {
+      size_t cbBlock = cbRead - used < cChunkSize ? cbRead - used : cChunkSize;
+      size_t cch = 0;
+      size_t consumed = DecodeText(m_encoding, &m_buf[used], cbBlock, block, &cch, false);
+
+      if (0 == consumed)
+      {
+         if (m_pos + used + cbBlock == m_size)
+            break;
+
+         if (used + cbBlock == cbRead)
+            break;
+
+         consumed = DecodeText(m_encoding, &m_buf[used], cbBlock, block, &cch, true);
+      }
+
+      used += consumed;
+      m_text.append(block, cch);
+   }
+
+   // nothing but a partial character at the end, which ExtractAppendedText leaves too
+   if (0 == used)
+   {
+      m_end = true;
+      return CHUNK_READ_END;
+   }
+
+   m_pos += used;
+
+   chunk.idChunk = ++m_chunks;
+   chunk.breakType = TEXT_BREAK_NONE;
+   chunk.locale = 0;
+   chunk.idChunkSource = chunk.idChunk;
+   chunk.cwcStartSource = 0;
+   chunk.cwcLenSource = 0;
+   return CHUNK_READ_TEXT;
+}
+
+TextRead PlainChunkSource::GetText(wchar_t *buf, unsigned long *cch)
+{
+   size_t left = m_text.length() - m_textStart;
+
+   if (0 == left)
+   {
+      *cch = 0;
+      return TEXT_READ_END;
+   }
+
+   size_t count = left < *cch ? left : *cch;
+   m_text.copy(buf, count, m_textStart);
+   m_textStart += count;
+   *cch = static_cast<unsigned long>(count);
+
+   return m_textStart == m_text.length() ? TEXT_READ_LAST : TEXT_READ_MORE;
+}
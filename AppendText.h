@@ -0,0 +1,97 @@
+// AppendText.h : Incremental extraction for append-only plain text files,
+//                decoding only the bytes added since the last call
+
+#ifndef __APPENDTEXT_H_
+#define __APPENDTEXT_H_
+
+#include <string>
+#include <vector>
+
+#include "PagedText.h"
+#include "PlainText.h"
+#include "TextCleanup.h"
+#include "TextSink.h"
+
+// What has been extracted so far. Round-trips through EncodeAppendState so
+// callers can keep it between calls (or processes).
+struct AppendState
+{
+   unsigned long long offset;       // bytes decoded, a partial character at the end waits for the rest
+   TextEncoding encoding;           // TEXT_ENCODING_BINARY until there was something to sniff
+   unsigned long profile;
+   bool lastWasSpace;               // CleanupState at offset
+
+   // The first and the last few KB before offset, to tell an appended file
+   // from one that was rewritten, truncated or rotated.
+   unsigned long headLength;
+   unsigned long long headHash;
+   unsigned long tailLength;
+   unsigned long long tailHash;
+};
+
+// Starting state, the first call extracts the whole file.
+void InitAppendState(AppendState & state, CleanupProfile profile);
+
+std::wstring EncodeAppendState(const AppendState & state);
+
+// False if text isn't a state EncodeAppendState produced.
+bool DecodeAppendState(const wchar_t *text, size_t cch, AppendState & state);
+
+// Positional reads from the file, implemented per platform.
+class ByteReader
+{
+public:
+   virtual ~ByteReader() {}
+
+   // Reads exactly cb bytes at offset, false if they couldn't all be read.
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb) = 0;
+};
+
+enum AppendResult
+{
+   APPEND_DELTA = 0,       // text holds just what was appended since state
+   APPEND_RESTARTED,       // the file changed under the state, text holds all of it
+   APPEND_NOT_TEXT,
+   APPEND_READ_ERROR
+};
+
+// Checks that the first size bytes of file still start with what state has
+// seen, then decodes and cleans up everything after state.offset into sink
+// and moves state along. Cost is proportional to the bytes appended. If the
+// sink stops wanting more, state stops there and the next call carries on.
+AppendResult ExtractAppendedText(ByteReader & file, unsigned long long size, CleanupProfile profile,
+                                 AppendState & state, TextSink & sink);
+
+// The text ExtractAppendedText gives from a fresh state, the built-in plain
+// text path, as a chunk source for the paging reader. One chunk per read and
+// no separators, so the pages add up to the same characters at the same
+// offsets. Left uncleaned, the reader does that.
+class PlainChunkSource : public ChunkSource
+{
+public:
+   PlainChunkSource(ByteReader & file, unsigned long long size);
+
+   // Sniffs the head like ExtractAppendedText, APPEND_NOT_TEXT or
+   // APPEND_READ_ERROR if there's nothing to read, APPEND_DELTA otherwise.
+   // NextChunk does it first if the caller hasn't.
+   AppendResult Open();
+
+   virtual ChunkRead NextChunk(ChunkInfo & chunk);
+   virtual TextRead GetText(wchar_t *buf, unsigned long *cch);
+
+private:
+   ByteReader & m_file;
+   unsigned long long m_size;
+   bool m_opened;
+   AppendResult m_result;
+   TextEncoding m_encoding;
+   unsigned long long m_pos;
+   unsigned long m_chunks;
+   bool m_end;
+
+   std::vector<unsigned char> m_buf;
+   std::wstring m_text;             // the current chunk's
+   size_t m_textStart;
+};
+
+#endif //__APPENDTEXT_H_
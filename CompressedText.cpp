@@ -0,0 +1,190 @@
+// CompressedText.cpp : Compresses the cleaned-up text block by block
+
+#include <string.h>
+
+#include "CompressedText.h"
+
+static const unsigned long c_storedFlag = 0x80000000UL;
+
+inline static void Put32(unsigned char *p, unsigned long value)
+{
+   p[0] = static_cast<unsigned char>(value);
+   p[1] = static_cast<unsigned char>(value >> 8);
+   p[2] = static_cast<unsigned char>(value >> 16);
+   p[3] = static_cast<unsigned char>(value >> 24);
+}
+
+inline static unsigned long Get32(const unsigned char *p)
+{
+   return static_cast<unsigned long>(p[0]) | (static_cast<unsigned long>(p[1]) << 8) |
+          (static_cast<unsigned long>(p[2]) << 16) | (static_cast<unsigned long>(p[3]) << 24);
+}
+
+CompressedTextSink::CompressedTextSink(size_t maxLength, Lz4Level level)
+   : m_maxLength(maxLength), m_offset(0), m_level(level), m_totalChars(0)
+{
+   m_block.reserve(c_compressedBlockChars * 2);
+}
+
+void CompressedTextSink::OnText(const wchar_t *text, size_t cch)
+{
+   m_offset += cch;
+
+   for (size_t i = 0; i < cch; ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(text[i]);
+      unsigned long units[2];
+      int count = 1;
+
+      // a 32-bit wchar_t can hold characters that need a surrogate pair
+      if (c > 0xFFFF && c <= 0x10FFFF)
+      {
+         units[0] = 0xD800 + ((c - 0x10000) >> 10);
+         units[1] = 0xDC00 + ((c - 0x10000) & 0x3FF);
+         count = 2;
+      }
+      else
+      {
+         units[0] = c & 0xFFFF;
+      }
+
+      for (int u = 0; u < count; ++u)
+      {
+         m_block.push_back(static_cast<unsigned char>(units[u]));
+         m_block.push_back(static_cast<unsigned char>(units[u] >> 8));
+
+         if (m_block.size() == c_compressedBlockChars * 2)
+            FlushBlock();
+      }
+   }
+}
+
+bool CompressedTextSink::WantsMore() const
+{
+   return 0 == m_maxLength || m_offset <= m_maxLength;
+}
+
+void CompressedTextSink::OnEnd()
+{
+   FlushBlock();
+}
+
+void CompressedTextSink::FlushBlock()
+{
+   if (m_block.empty())
+      return;
+
+   // only keep the compressed form if it's actually smaller
+   m_scratch.resize(m_block.size());
+
+   size_t cb = Lz4CompressBlock(&m_block[0], m_block.size(), &m_scratch[0], m_scratch.size(), m_level);
+
+   CompressedBlock block;
+   block.offset = static_cast<unsigned long>(m_data.size());
+   block.stored = 0 == cb;
+
+   if (block.stored)
+   {
+      block.size = static_cast<unsigned long>(m_block.size());
+      m_data.insert(m_data.end(), m_block.begin(), m_block.end());
+   }
+   else
+   {
+      block.size = static_cast<unsigned long>(cb);
+      m_data.insert(m_data.end(), m_scratch.begin(), m_scratch.begin() + cb);
+   }
+
+   m_index.push_back(block);
+   m_totalChars += m_block.size() / 2;
+   m_block.clear();
+}
+
+size_t CompressedTextSink::FrameSize() const
+{
+   return c_compressedHeaderSize + m_index.size() * 8 + m_data.size();
+}
+
+void CompressedTextSink::WriteFrame(unsigned char *dst) const
+{
+   dst[0] = 'E';
+   dst[1] = 'T';
+   dst[2] = 'Z';
+   dst[3] = 1;
+   Put32(dst + 4, c_compressedBlockChars);
+   Put32(dst + 8, static_cast<unsigned long>(m_totalChars & 0xFFFFFFFFUL));
+   Put32(dst + 12, static_cast<unsigned long>(m_totalChars >> 32));
+   Put32(dst + 16, static_cast<unsigned long>(m_index.size()));
+   Put32(dst + 20, 0);
+
+   unsigned char *p = dst + c_compressedHeaderSize;
+
+   for (size_t i = 0; i < m_index.size(); ++i, p += 8)
+   {
+      Put32(p, m_index[i].offset);
+      Put32(p + 4, m_index[i].size | (m_index[i].stored ? c_storedFlag : 0));
+   }
+
+   if (!m_data.empty())
+      memcpy(p, &m_data[0], m_data.size());
+}
+
+bool ReadCompressedFrame(const unsigned char *frame, size_t cb, unsigned long *blockChars,
+                         unsigned long long *totalChars, std::vector<CompressedBlock> & index)
+{
+   index.clear();
+
+   if (cb < c_compressedHeaderSize || memcmp(frame, "ETZ\x01", 4) != 0)
+      return false;
+
+   *blockChars = Get32(frame + 4);
+   *totalChars = Get32(frame + 8) | (static_cast<unsigned long long>(Get32(frame + 12)) << 32);
+
+   unsigned long blockCount = Get32(frame + 16);
+
+   if (0 == *blockChars || *blockChars > c_lz4MaxBlock / 2 ||
+       blockCount > (cb - c_compressedHeaderSize) / 8 ||
+       *totalChars > static_cast<unsigned long long>(blockCount) * *blockChars ||
+       (blockCount && *totalChars <= static_cast<unsigned long long>(blockCount - 1) * *blockChars))
+      return false;
+
+   size_t dataStart = c_compressedHeaderSize + blockCount * 8;
+   const unsigned char *p = frame + c_compressedHeaderSize;
+
+   for (unsigned long i = 0; i < blockCount; ++i, p += 8)
+   {
+      CompressedBlock block;
+      block.offset = Get32(p);
+      block.size = Get32(p + 4) & ~c_storedFlag;
+      block.stored = (Get32(p + 4) & c_storedFlag) != 0;
+
+      if (block.offset > cb - dataStart || block.size > cb - dataStart - block.offset)
+         return false;
+
+      index.push_back(block);
+   }
+
+   return true;
+}
+
+bool DecompressTextBlock(const unsigned char *frame, size_t cb, const std::vector<CompressedBlock> & index,
+                         size_t block, unsigned char *dst, size_t cbOut)
+{
+   if (block >= index.size())
+      return false;
+
+   const unsigned char *src = frame + c_compressedHeaderSize + index.size() * 8 + index[block].offset;
+
+   if (src + index[block].size > frame + cb)
+      return false;
+
+   if (index[block].stored)
+   {
+      if (index[block].size != cbOut)
+         return false;
+
+      memcpy(dst, src, cbOut);
+      return true;
+   }
+
+   return Lz4DecompressBlock(src, index[block].size, dst, cbOut);
+}
@@ -0,0 +1,74 @@
+// CompressedText.h : Compresses the cleaned-up text block by block as it
+//                    streams out of the extraction loop, so the whole text
+//                    never has to be held uncompressed
+
+#ifndef __COMPRESSEDTEXT_H_
+#define __COMPRESSEDTEXT_H_
+
+#include <vector>
+
+#include "TextSink.h"
+#include "Lz4Block.h"
+
+// Frame layout, all integers little-endian:
+//
+//    header   "ETZ" 0x01, UINT32 blockChars, UINT64 totalChars, UINT32 blockCount, UINT32 0
+//    index    blockCount x (UINT32 offset, UINT32 size), offsets relative to the
+//             first block, size has the top bit set for a block stored as is
+//    blocks   LZ4 blocks of UTF-16LE text
+//
+// Every block but the last holds exactly blockChars UTF-16 code units, so the
+// block holding a given character is found without decompressing anything.
+struct CompressedBlock
+{
+   unsigned long offset;
+   unsigned long size;
+   bool stored;
+};
+
+const size_t c_compressedHeaderSize = 24;
+const unsigned long c_compressedBlockChars = 32768;
+
+class CompressedTextSink : public TextSink
+{
+public:
+   // Like TextBufferSink, stops once more than maxLength (if non-zero)
+   // characters have gone by.
+   CompressedTextSink(size_t maxLength, Lz4Level level);
+
+   virtual void OnText(const wchar_t *text, size_t cch);
+   virtual bool WantsMore() const;
+   virtual void OnEnd();
+
+   bool Truncated() const { return !WantsMore(); }
+
+   // Size of the finished frame, valid after OnEnd.
+   size_t FrameSize() const;
+
+   // Copies the finished frame to dst, which must hold FrameSize() bytes.
+   void WriteFrame(unsigned char *dst) const;
+
+private:
+   void FlushBlock();
+
+   size_t m_maxLength;
+   size_t m_offset;
+   Lz4Level m_level;
+
+   unsigned long long m_totalChars;
+   std::vector<unsigned char> m_block;       // UTF-16LE text waiting to be compressed
+   std::vector<unsigned char> m_scratch;
+   std::vector<CompressedBlock> m_index;
+   std::vector<unsigned char> m_data;        // compressed blocks back to back
+};
+
+// Reads a frame header and index, false if the frame is malformed.
+bool ReadCompressedFrame(const unsigned char *frame, size_t cb, unsigned long *blockChars,
+                         unsigned long long *totalChars, std::vector<CompressedBlock> & index);
+
+// Decompresses one block of a frame checked by ReadCompressedFrame into
+// UTF-16LE bytes. cbOut is twice the characters in the block.
+bool DecompressTextBlock(const unsigned char *frame, size_t cb, const std::vector<CompressedBlock> & index,
+                         size_t block, unsigned char *dst, size_t cbOut);
+
+#endif //__COMPRESSEDTEXT_H_
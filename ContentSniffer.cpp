@@ -0,0 +1,666 @@
+// ContentSniffer.cpp : Signature tries and the content over extension routing policy
+
+#include <string.h>
+
+#include <vector>
+
+#include "ContentSniffer.h"
+#include "PlainText.h"
+
+namespace
+{
+
+struct Signature
+{
+   const char *bytes;
+   size_t cb;                // signatures may hold NULs, so no strlen
+   ContentFormat format;
+};
+
+#define SIGNATURE(s, format) { s, sizeof(s) - 1, format }
+
+// Magic numbers at offset 0. ZIP covers OOXML and OpenDocument, which are
+// told apart by their entry names afterwards.
+const Signature c_binarySignatures[] =
+{
+   SIGNATURE("\xD0\xCF\x11\xE0\xA1\xB1\x1A\xE1", FORMAT_OLE2),
+   SIGNATURE("PK\x03\x04", FORMAT_ZIP),
+   SIGNATURE("PK\x05\x06", FORMAT_ZIP),       // empty archive
+   SIGNATURE("%PDF-", FORMAT_PDF),
+   SIGNATURE("{\\rtf", FORMAT_RTF),
+   SIGNATURE("\x89PNG\r\n\x1A\n", FORMAT_PNG),
+   SIGNATURE("\xFF\xD8\xFF", FORMAT_JPEG),
+   SIGNATURE("GIF87a", FORMAT_GIF),
+   SIGNATURE("GIF89a", FORMAT_GIF)
+};
+
+// Lowercase prefixes of the text, after any BOM and leading white space.
+// The MIME ones are only taken once more header lines follow.
+const Signature c_textSignatures[] =
+{
+   SIGNATURE("<!doctype html", FORMAT_HTML),
+   SIGNATURE("<html", FORMAT_HTML),
+   SIGNATURE("<head", FORMAT_HTML),
+   SIGNATURE("<body", FORMAT_HTML),
+   SIGNATURE("<?xml", FORMAT_XML),
+   SIGNATURE("{\\rtf", FORMAT_RTF),
+   SIGNATURE("received:", FORMAT_MIME),
+   SIGNATURE("return-path:", FORMAT_MIME),
+   SIGNATURE("mime-version:", FORMAT_MIME),
+   SIGNATURE("delivered-to:", FORMAT_MIME),
+   SIGNATURE("message-id:", FORMAT_MIME),
+   SIGNATURE("content-type:", FORMAT_MIME),
+   SIGNATURE("from:", FORMAT_MIME),
+   SIGNATURE("to:", FORMAT_MIME),
+   SIGNATURE("subject:", FORMAT_MIME),
+   SIGNATURE("date:", FORMAT_MIME)
+};
+
+#undef SIGNATURE
+
+// A byte-wise trie over a signature table, children kept as sibling lists.
+// Matching costs one short list walk per input byte and stops at the first
+// byte no signature continues with, so the whole table is tried in about
+// the time one memcmp takes.
+class SignatureTrie
+{
+public:
+   SignatureTrie(const Signature *signatures, size_t count)
+   {
+      m_nodes.push_back(Node());
+
+      for (size_t i = 0; i < count; ++i)
+         Add(signatures[i]);
+   }
+
+   // The format of the longest signature buf starts with, FORMAT_UNKNOWN
+   // if none. *matched receives its length.
+   ContentFormat Match(const unsigned char *buf, size_t cb, size_t *matched) const
+   {
+      ContentFormat format = FORMAT_UNKNOWN;
+      size_t node = 0;
+
+      *matched = 0;
+
+      for (size_t i = 0; i < cb; ++i)
+      {
+         node = Child(node, buf[i]);
+
+         if (!node)
+            break;
+
+         if (m_nodes[node].format != FORMAT_UNKNOWN)
+         {
+            format = m_nodes[node].format;
+            *matched = i + 1;
+         }
+      }
+
+      return format;
+   }
+
+private:
+   struct Node
+   {
+      Node() : byte(0), child(0), next(0), format(FORMAT_UNKNOWN) {}
+
+      unsigned char byte;
+      unsigned short child;         // first child, 0 for none (the root is never a child)
+      unsigned short next;          // next sibling
+      ContentFormat format;         // set where a signature ends
+   };
+
+   size_t Child(size_t node, unsigned char byte) const
+   {
+      for (size_t child = m_nodes[node].child; child; child = m_nodes[child].next)
+      {
+         if (m_nodes[child].byte == byte)
+            return child;
+      }
+
+      return 0;
+   }
+
+   void Add(const Signature & signature)
+   {
+      size_t node = 0;
+
+      for (size_t i = 0; i < signature.cb; ++i)
+      {
+         unsigned char byte = static_cast<unsigned char>(signature.bytes[i]);
+         size_t child = Child(node, byte);
+
+         if (!child)
+         {
+            child = m_nodes.size();
+            m_nodes.push_back(Node());
+            m_nodes[child].byte = byte;
+            m_nodes[child].next = m_nodes[node].child;
+            m_nodes[node].child = static_cast<unsigned short>(child);
+         }
+
+         node = child;
+      }
+
+      m_nodes[node].format = signature.format;
+   }
+
+   std::vector<Node> m_nodes;
+};
+
+// Built while the module loads, read-only afterwards.
+const SignatureTrie s_binaryTrie(c_binarySignatures, sizeof(c_binarySignatures) / sizeof(c_binarySignatures[0]));
+const SignatureTrie s_textTrie(c_textSignatures, sizeof(c_textSignatures) / sizeof(c_textSignatures[0]));
+
+unsigned int ReadU16(const unsigned char *p)
+{
+   return p[0] | (p[1] << 8);
+}
+
+unsigned long ReadU32(const unsigned char *p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned long>(p[3]) << 24);
+}
+
+// ---------------------------------------------------------------------------
+// Compound files
+
+const size_t c_oleHeaderBytes = 512;
+const size_t c_oleEntryBytes = 128;
+
+// Offset of the first directory sector, 0 if the header doesn't make sense.
+unsigned long long OleDirectoryOffset(const unsigned char *header)
+{
+   unsigned int sectorShift = ReadU16(header + 0x1E);
+   unsigned long firstDirectory = ReadU32(header + 0x30);
+
+   if (sectorShift != 9 && sectorShift != 12)
+      return 0;
+
+   if (firstDirectory >= 0xFFFFFFFA)       // one of the special sector numbers
+      return 0;
+
+   return (static_cast<unsigned long long>(firstDirectory) + 1) << sectorShift;
+}
+
+// Compares a directory entry name (UTF-16LE) with an ASCII prefix.
+bool OleNameStarts(const unsigned char *entry, size_t cchName, const char *prefix)
+{
+   size_t cchPrefix = strlen(prefix);
+
+   if (cchName < cchPrefix)
+      return false;
+
+   for (size_t i = 0; i < cchPrefix; ++i)
+   {
+      if (entry[2 * i] != static_cast<unsigned char>(prefix[i]) || entry[2 * i + 1])
+         return false;
+   }
+
+   return true;
+}
+
+// Tells the application from the stream names in the directory entries in
+// buf. Only the entries that happen to be there are looked at, the
+// directory chain isn't followed through the FAT.
+ContentFormat OleFormat(const unsigned char *buf, size_t cb)
+{
+   for (size_t offset = 0; offset + c_oleEntryBytes <= cb; offset += c_oleEntryBytes)
+   {
+      const unsigned char *entry = buf + offset;
+      size_t cbName = ReadU16(entry + 0x40);
+
+      // the name length counts the terminator
+      if (cbName < 4 || cbName > 64 || (cbName & 1))
+         continue;
+
+      size_t cchName = cbName / 2 - 1;
+
+      if (cchName == 12 && OleNameStarts(entry, cchName, "WordDocument"))
+         return FORMAT_WORD;
+
+      if ((cchName == 8 && OleNameStarts(entry, cchName, "Workbook")) ||
+          (cchName == 4 && OleNameStarts(entry, cchName, "Book")))
+         return FORMAT_EXCEL;
+
+      if (cchName == 19 && OleNameStarts(entry, cchName, "PowerPoint Document"))
+         return FORMAT_POWERPOINT;
+
+      if (OleNameStarts(entry, cchName, "__substg1.0_") ||
+          OleNameStarts(entry, cchName, "__properties_version1.0"))
+         return FORMAT_OUTLOOK;
+   }
+
+   return FORMAT_OLE2;
+}
+
+// ---------------------------------------------------------------------------
+// ZIP packages
+
+const size_t c_zipHeaderBytes = 30;
+
+bool NameStarts(const unsigned char *name, size_t cbName, const char *prefix)
+{
+   size_t cbPrefix = strlen(prefix);
+
+   return cbName >= cbPrefix && 0 == memcmp(name, prefix, cbPrefix);
+}
+
+// Walks the local file headers in buf. OpenDocument stores its mimetype
+// first and uncompressed; OOXML packages have [Content_Types].xml and a
+// part directory named after the application.
+ContentFormat ZipFormat(const unsigned char *buf, size_t cb)
+{
+   bool contentTypes = false;
+   size_t offset = 0;
+
+   while (offset + c_zipHeaderBytes <= cb && 0 == memcmp(buf + offset, "PK\x03\x04", 4))
+   {
+      const unsigned char *header = buf + offset;
+      unsigned int flags = ReadU16(header + 6);
+      unsigned int method = ReadU16(header + 8);
+      unsigned long cbCompressed = ReadU32(header + 18);
+      size_t cbName = ReadU16(header + 26);
+      size_t cbExtra = ReadU16(header + 28);
+      const unsigned char *name = header + c_zipHeaderBytes;
+
+      if (offset + c_zipHeaderBytes + cbName > cb)
+         break;
+
+      if (cbName == 8 && NameStarts(name, cbName, "mimetype") && 0 == method)
+      {
+         static const char c_prefix[] = "application/vnd.oasis.opendocument.";
+         const unsigned char *data = name + cbName + cbExtra;
+         size_t cbPrefix = sizeof(c_prefix) - 1;
+
+         if (data + cbCompressed <= buf + cb && cbCompressed > cbPrefix &&
+             0 == memcmp(data, c_prefix, cbPrefix))
+         {
+            const unsigned char *kind = data + cbPrefix;
+            size_t cbKind = cbCompressed - cbPrefix;
+
+            if (NameStarts(kind, cbKind, "text"))
+               return FORMAT_ODT;
+
+            if (NameStarts(kind, cbKind, "spreadsheet"))
+               return FORMAT_ODS;
+
+            if (NameStarts(kind, cbKind, "presentation"))
+               return FORMAT_ODP;
+         }
+      }
+
+      if (NameStarts(name, cbName, "[Content_Types].xml"))
+         contentTypes = true;
+      else if (NameStarts(name, cbName, "word/"))
+         return FORMAT_DOCX;
+      else if (NameStarts(name, cbName, "xl/"))
+         return FORMAT_XLSX;
+      else if (NameStarts(name, cbName, "ppt/"))
+         return FORMAT_PPTX;
+
+      // with a data descriptor the sizes come after the data, so the next
+      // header can't be found
+      if (flags & 0x08)
+         break;
+
+      offset += c_zipHeaderBytes + cbName + cbExtra + cbCompressed;
+   }
+
+   return contentTypes ? FORMAT_OOXML : FORMAT_ZIP;
+}
+
+// ---------------------------------------------------------------------------
+// Text
+
+// Characters of text looked at for markup and mail headers.
+const size_t c_sniffChars = 1024;
+
+bool IsSpace(char c)
+{
+   return ' ' == c || '\t' == c || '\r' == c || '\n' == c || '\f' == c;
+}
+
+// Counts the lines from the top that look like "Name: value" headers
+// (or their continuations), up to the first one that doesn't.
+size_t CountHeaderLines(const char *text, size_t cch)
+{
+   size_t headers = 0;
+   size_t start = 0;
+
+   while (start < cch)
+   {
+      size_t end = start;
+
+      while (end < cch && text[end] != '\n')
+         ++end;
+
+      if (end == cch)
+         break;                 // cut off, can't tell
+
+      if (IsSpace(text[start]) && headers)
+      {
+         // folded continuation of the previous header
+      }
+      else
+      {
+         size_t i = start;
+
+         while (i < end && text[i] > ' ' && text[i] < 0x7F && text[i] != ':')
+            ++i;
+
+         if (i == start || i == end || text[i] != ':')
+            break;
+
+         ++headers;
+      }
+
+      start = end + 1;
+   }
+
+   return headers;
+}
+
+bool Contains(const char *text, size_t cch, const char *needle)
+{
+   size_t cchNeedle = strlen(needle);
+
+   for (size_t i = 0; i + cchNeedle <= cch; ++i)
+   {
+      if (0 == memcmp(text + i, needle, cchNeedle))
+         return true;
+   }
+
+   return false;
+}
+
+ContentFormat TextFormat(const unsigned char *buf, size_t cb)
+{
+   size_t bomLength;
+   TextEncoding encoding = DetectTextEncoding(buf, cb, &bomLength);
+
+   if (TEXT_ENCODING_BINARY == encoding)
+      return FORMAT_UNKNOWN;
+
+   ContentFormat plain = FORMAT_TEXT_UTF8;
+
+   if (TEXT_ENCODING_UTF16LE == encoding || TEXT_ENCODING_UTF16BE == encoding)
+      plain = FORMAT_TEXT_UTF16;
+   else if (TEXT_ENCODING_ANSI == encoding)
+      plain = FORMAT_TEXT_ANSI;
+
+   // decode the start to lowercase ASCII, anything else becomes 0x80 and
+   // matches no signature
+   size_t cbText = cb - bomLength;
+   size_t cbMax = (FORMAT_TEXT_UTF16 == plain ? 2 : 1) * c_sniffChars;
+
+   if (cbText > cbMax)
+      cbText = cbMax;
+
+   wchar_t wide[2 * c_sniffChars];
+   size_t cch = 0;
+
+   DecodeText(encoding, buf + bomLength, cbText, wide, &cch, false);
+
+   char text[2 * c_sniffChars];
+
+   for (size_t i = 0; i < cch; ++i)
+   {
+      wchar_t c = wide[i];
+
+      if (c >= L'A' && c <= L'Z')
+         c += L'a' - L'A';
+
+      text[i] = c < 0x80 ? static_cast<char>(c) : static_cast<char>(0x80);
+   }
+
+   size_t start = 0;
+
+   while (start < cch && IsSpace(text[start]))
+      ++start;
+
+   const char *lead = text + start;
+   size_t cchLead = cch - start;
+   size_t matched;
+   ContentFormat format = s_textTrie.Match(reinterpret_cast<const unsigned char *>(lead), cchLead, &matched);
+
+   switch (format)
+   {
+   case FORMAT_MIME:
+      // a "From:" line alone is just as likely a note that starts that way
+      return CountHeaderLines(lead, cchLead) >= 2 ? FORMAT_MIME : plain;
+
+   case FORMAT_XML:
+      return Contains(lead, cchLead, "<html") ? FORMAT_HTML : FORMAT_XML;
+
+   case FORMAT_UNKNOWN:
+      // a leading comment, then the page
+      if (cchLead > 4 && 0 == memcmp(lead, "<!--", 4) && Contains(lead, cchLead, "<html"))
+         return FORMAT_HTML;
+
+      return plain;
+
+   default:
+      return format;
+   }
+}
+
+struct ExtensionFormat
+{
+   const wchar_t *extension;
+   ContentFormat format;
+};
+
+// What each extension is expected to hold. The first extension of a
+// format is the one its content is routed to.
+const ExtensionFormat c_extensions[] =
+{
+   { L".doc", FORMAT_WORD },
+   { L".dot", FORMAT_WORD },
+   { L".xls", FORMAT_EXCEL },
+   { L".xlt", FORMAT_EXCEL },
+   { L".ppt", FORMAT_POWERPOINT },
+   { L".pps", FORMAT_POWERPOINT },
+   { L".pot", FORMAT_POWERPOINT },
+   { L".msg", FORMAT_OUTLOOK },
+   { L".docx", FORMAT_DOCX },
+   { L".docm", FORMAT_DOCX },
+   { L".dotx", FORMAT_DOCX },
+   { L".dotm", FORMAT_DOCX },
+   { L".xlsx", FORMAT_XLSX },
+   { L".xlsm", FORMAT_XLSX },
+   { L".xltx", FORMAT_XLSX },
+   { L".pptx", FORMAT_PPTX },
+   { L".pptm", FORMAT_PPTX },
+   { L".ppsx", FORMAT_PPTX },
+   { L".odt", FORMAT_ODT },
+   { L".ods", FORMAT_ODS },
+   { L".odp", FORMAT_ODP },
+   { L".zip", FORMAT_ZIP },
+   { L".pdf", FORMAT_PDF },
+   { L".rtf", FORMAT_RTF },
+   { L".htm", FORMAT_HTML },
+   { L".html", FORMAT_HTML },
+   { L".xhtml", FORMAT_HTML },
+   { L".xml", FORMAT_XML },
+   { L".eml", FORMAT_MIME },
+   { L".mht", FORMAT_MIME },
+   { L".mhtml", FORMAT_MIME },
+   { L".png", FORMAT_PNG },
+   { L".jpg", FORMAT_JPEG },
+   { L".jpeg", FORMAT_JPEG },
+   { L".gif", FORMAT_GIF },
+   { L".txt", FORMAT_TEXT_UTF8 }
+};
+
+const size_t c_extensionCount = sizeof(c_extensions) / sizeof(c_extensions[0]);
+
+bool IsOle(ContentFormat format)
+{
+   return format >= FORMAT_OLE2 && format <= FORMAT_OUTLOOK;
+}
+
+bool IsZip(ContentFormat format)
+{
+   return format >= FORMAT_ZIP && format <= FORMAT_ODP;
+}
+
+bool IsText(ContentFormat format)
+{
+   return format >= FORMAT_TEXT_UTF8 && format <= FORMAT_TEXT_ANSI;
+}
+
+// RTF is text too, but only its filter makes sense of it
+bool IsTextual(ContentFormat format)
+{
+   return IsText(format) || FORMAT_HTML == format || FORMAT_XML == format || FORMAT_MIME == format;
+}
+
+// Whether a file named for expected may well hold sniffed: the generic
+// compound file and package formats go with any of their kind, and the
+// text based ones with each other.
+bool Agrees(ContentFormat expected, ContentFormat sniffed)
+{
+   if (expected == sniffed)
+      return true;
+
+   if (IsOle(expected) && IsOle(sniffed))
+      return FORMAT_OLE2 == expected || FORMAT_OLE2 == sniffed;
+
+   if (IsZip(expected) && IsZip(sniffed))
+   {
+      if (FORMAT_ZIP == sniffed || FORMAT_ZIP == expected)
+         return true;
+
+      if (FORMAT_OOXML == sniffed)
+         return expected >= FORMAT_DOCX && expected <= FORMAT_PPTX;
+
+      return false;
+   }
+
+   return IsTextual(expected) && IsTextual(sniffed);
+}
+
+} // namespace
+
+ContentFormat SniffBuffer(const unsigned char *buf, size_t cb)
+{
+   size_t matched;
+   ContentFormat format = s_binaryTrie.Match(buf, cb, &matched);
+
+   switch (format)
+   {
+   case FORMAT_OLE2:
+   {
+      if (cb < c_oleHeaderBytes)
+         return FORMAT_OLE2;
+
+      unsigned long long directory = OleDirectoryOffset(buf);
+
+      if (!directory || directory >= cb)
+         return FORMAT_OLE2;
+
+      return OleFormat(buf + directory, static_cast<size_t>(cb - directory));
+   }
+
+   case FORMAT_ZIP:
+      return ZipFormat(buf, cb);
+
+   case FORMAT_UNKNOWN:
+      return TextFormat(buf, cb);
+
+   default:
+      return format;
+   }
+}
+
+ContentFormat SniffContent(ByteReader & file, unsigned long long size)
+{
+   unsigned char head[c_sniffBytes];
+   size_t cb = size < c_sniffBytes ? static_cast<size_t>(size) : c_sniffBytes;
+
+   if (!cb || !file.ReadAt(0, head, cb))
+      return FORMAT_UNKNOWN;
+
+   ContentFormat format = SniffBuffer(head, cb);
+
+   if (FORMAT_OLE2 != format || cb < c_oleHeaderBytes)
+      return format;
+
+   // the directory usually starts past the head, read its first few sectors
+   unsigned long long directory = OleDirectoryOffset(head);
+
+   if (!directory || directory < cb || directory >= size)
+      return format;
+
+   unsigned char entries[c_sniffBytes];
+   size_t cbEntries = size - directory < c_sniffBytes ? static_cast<size_t>(size - directory) : c_sniffBytes;
+
+   if (!file.ReadAt(directory, entries, cbEntries))
+      return format;
+
+   return OleFormat(entries, cbEntries);
+}
+
+const wchar_t * FormatExtension(ContentFormat format)
+{
+   for (size_t i = 0; i < c_extensionCount; ++i)
+   {
+      if (c_extensions[i].format == format)
+         return c_extensions[i].extension;
+   }
+
+   if (IsText(format))
+      return L".txt";
+
+   return L"";
+}
+
+ContentRoute ChooseRoute(const std::wstring & extension, ContentFormat format, std::wstring & routeExtension)
+{
+   routeExtension = extension;
+
+   if (FORMAT_UNKNOWN == format)
+      return ROUTE_BY_EXTENSION;
+
+   ContentFormat expected = FORMAT_UNKNOWN;
+
+   if (IsPlainTextExtension(extension))
+   {
+      expected = FORMAT_TEXT_UTF8;
+   }
+   else
+   {
+      for (size_t i = 0; i < c_extensionCount; ++i)
+      {
+         if (extension == c_extensions[i].extension)
+         {
+            expected = c_extensions[i].format;
+            break;
+         }
+      }
+
+      // an extension of its own, its filter knows best
+      if (FORMAT_UNKNOWN == expected && !extension.empty())
+         return ROUTE_BY_EXTENSION;
+   }
+
+   if (FORMAT_UNKNOWN != expected && Agrees(expected, format))
+      return ROUTE_BY_EXTENSION;
+
+   if (IsText(format))
+   {
+      routeExtension = L".txt";
+      return ROUTE_PLAIN_TEXT;
+   }
+
+   const wchar_t *sniffedExtension = FormatExtension(format);
+
+   // a generic compound file or package under the wrong name, nothing
+   // better to try than the name
+   if (!*sniffedExtension)
+      return ROUTE_BY_EXTENSION;
+
+   routeExtension = sniffedExtension;
+   return ROUTE_BY_CONTENT;
+}
@@ -0,0 +1,72 @@
+// ContentSniffer.h : Tells a file's real format from its first few KB, so a
+//                    misnamed file goes to the right extractor before any
+//                    filter is created
+
+#ifndef __CONTENTSNIFFER_H_
+#define __CONTENTSNIFFER_H_
+
+#include <stddef.h>
+#include <string>
+
+#include "AppendText.h"
+
+enum ContentFormat
+{
+   FORMAT_UNKNOWN = 0,
+   FORMAT_OLE2,              // compound file whose application didn't show
+   FORMAT_WORD,
+   FORMAT_EXCEL,
+   FORMAT_POWERPOINT,
+   FORMAT_OUTLOOK,
+   FORMAT_ZIP,
+   FORMAT_OOXML,             // Open XML package whose application didn't show
+   FORMAT_DOCX,
+   FORMAT_XLSX,
+   FORMAT_PPTX,
+   FORMAT_ODT,
+   FORMAT_ODS,
+   FORMAT_ODP,
+   FORMAT_PDF,
+   FORMAT_RTF,
+   FORMAT_HTML,
+   FORMAT_XML,
+   FORMAT_MIME,              // mail message or MHTML
+   FORMAT_PNG,
+   FORMAT_JPEG,
+   FORMAT_GIF,
+   FORMAT_TEXT_UTF8,         // or plain ASCII
+   FORMAT_TEXT_UTF16,
+   FORMAT_TEXT_ANSI
+};
+
+// Bytes SniffContent looks at, besides the compound file directory.
+const size_t c_sniffBytes = 4096;
+
+// Matches the first cb bytes (c_sniffBytes is plenty) against the signature
+// tries. Compound files and ZIP packages are told apart by the entry names
+// in the buffer; past it they stay FORMAT_OLE2 and FORMAT_OOXML or FORMAT_ZIP.
+ContentFormat SniffBuffer(const unsigned char *buf, size_t cb);
+
+// Reads the first c_sniffBytes of the file, and the first directory sector
+// of a compound file, and sniffs them. FORMAT_UNKNOWN if they can't be read.
+ContentFormat SniffContent(ByteReader & file, unsigned long long size);
+
+// The extension a file of the format usually has (".docx"), empty for the
+// formats no single filter handles.
+const wchar_t * FormatExtension(ContentFormat format);
+
+enum ContentRoute
+{
+   ROUTE_BY_EXTENSION = 0,   // the content agrees with the name, or says nothing different
+   ROUTE_BY_CONTENT,         // the content is another format, use its filter
+   ROUTE_PLAIN_TEXT          // plain text under another name, or none
+};
+
+// Decides what extracts a file with the given extension (see FilterKey) and
+// sniffed format. routeExtension receives the extension whose filter to
+// use: the file's own, the sniffed format's, or ".txt" for plain text.
+// Extensions the sniffer knows nothing about keep their own filter, which
+// may well read content that looks like something else.
+ContentRoute ChooseRoute(const std::wstring & extension, ContentFormat format, std::wstring & routeExtension);
+
+#endif //__CONTENTSNIFFER_H_
@@ -0,0 +1,353 @@
+// ExtractQueue.cpp : Background workers that run queued extractions
+#define STRICT
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0400
+#endif
+#define _ATL_APARTMENT_THREADED
+
+#include <atlbase.h>
+//You may derive a class from CComModule and use it if you want to override
+//something, but do not change the name of _Module
+extern CComModule _Module;
+#include <atlcom.h>
+
+#include "dispimpl2.h"
+#include "ExtractText.h"
+#include "TextExtractor.h"
+#include "ExtractQueue.h"
+
+// workers per lane, small jobs always have some to themselves
+static const unsigned long c_laneWorkers[2] = { 2, 2 };
+
+// a worker with nothing to do for this long goes away
+static const unsigned long c_workerIdleMs = 30000;
+
+// longest an idle worker leaves its messages waiting
+static const unsigned long c_pumpMs = 100;
+
+// a finished job nobody has collected in this long is thrown away
+static const unsigned long c_uncollectedMs = 10 * 60 * 1000;
+
+ExtractQueue::ExtractQueue()
+{
+   m_workers[LANE_SMALL] = 0;
+   m_workers[LANE_LARGE] = 0;
+}
+
+// constructed when the module loads, before any caller can queue a job
+ExtractQueue ExtractQueue::s_queue;
+
+ExtractQueue & ExtractQueue::Instance()
+{
+   return s_queue;
+}
+
+HRESULT ExtractQueue::Queue(BSTR fileName, long maxLength, NormalizationProfile profile, unsigned long *jobId)
+{
+   unsigned long long size = 0;
+   WIN32_FILE_ATTRIBUTE_DATA data;
+
+   // a file that can't be looked at will fail quickly, so it counts as small
+   if (::GetFileAttributesExW(fileName, GetFileExInfoStandard, &data))
+      size = (static_cast<unsigned long long>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+
+   QueuedJob *job = new QueuedJob;
+   job->fileName.assign(fileName, ::SysStringLen(fileName));
+   job->maxLength = maxLength;
+   job->profile = profile;
+   job->done = false;
+   job->collecting = false;
+   job->cancelled = false;
+   job->finishedAt = 0;
+   job->result = E_UNEXPECTED;
+   job->text = NULL;
+   job->description = NULL;
+
+   AutoLock lock(m_lock);
+
+   ExpireJobs();
+
+   HRESULT hr = S_OK;
+
+   for (int lane = LANE_SMALL; lane <= LANE_LARGE && SUCCEEDED(hr); ++lane)
+   {
+      while (m_workers[lane] < c_laneWorkers[lane] && SUCCEEDED(hr))
+         hr = StartWorker(static_cast<SchedulerLane>(lane));
+   }
+
+   // the job is queued for whichever workers did start, with none it would
+   // never run. A worker can't go idle before it's queued, that takes m_lock
+   if (0 == m_workers[LANE_SMALL] + m_workers[LANE_LARGE])
+   {
+      delete job;
+      return hr;
+   }
+
+   *jobId = m_scheduler.Submit(FilterKey(job->fileName.c_str()), size, job);
+   m_jobs[*jobId] = job;
+   return S_OK;
+}
+
+HRESULT ExtractQueue::Collect(unsigned long jobId, unsigned long waitMs, HRESULT *result, BSTR *text, BSTR *description)
+{
+   QueuedJob *job = NULL;
+
+   {
+      AutoLock lock(m_lock);
+
+      std::map<unsigned long, QueuedJob *>::iterator it = m_jobs.find(jobId);
+
+      if (it == m_jobs.end())
+         return E_INVALIDARG;
+
+      // someone else is already waiting for this one
+      if (it->second->collecting)
+         return E_PENDING;
+
+      job = it->second;
+      job->collecting = true;
+   }
+
+   job->finished.Wait(waitMs);
+
+   AutoLock lock(m_lock);
+
+   if (!job->done)
+   {
+      job->collecting = false;
+      return E_PENDING;
+   }
+
+   m_jobs.erase(jobId);
+
+   *result = job->result;
+   *text = job->text;
+   *description = job->description;
+
+   delete job;
+   return S_OK;
+}
+
+HRESULT ExtractQueue::Cancel(unsigned long jobId)
+{
+   AutoLock lock(m_lock);
+
+   std::map<unsigned long, QueuedJob *>::iterator it = m_jobs.find(jobId);
+
+   if (it == m_jobs.end())
+      return E_INVALIDARG;
+
+   QueuedJob *job = it->second;
+
+   // Collect has it and frees it, or leaves it for the next caller
+   if (job->collecting)
+      return E_PENDING;
+
+   m_jobs.erase(it);
+
+   if (job->done || m_scheduler.Cancel(jobId))
+      FreeJob(job);
+   else
+      job->cancelled = true;
+
+   return S_OK;
+}
+
+void ExtractQueue::SetConcurrency(const wchar_t *extension, unsigned long maxRunning)
+{
+   // "pdf" or ".PDF", either way the key FilterKey gives for "x.pdf"
+   std::wstring name = L'.' == *extension ? L"" : L".";
+   name += extension;
+
+   m_scheduler.SetConcurrency(FilterKey(name.c_str()), maxRunning);
+}
+
+// Called with m_lock held. Throws away the finished jobs nobody collected,
+// so a caller that gave up on them doesn't leave their text behind for
+// the life of the process.
+void ExtractQueue::ExpireJobs()
+{
+   unsigned long now = TickMs();
+   std::map<unsigned long, QueuedJob *>::iterator it = m_jobs.begin();
+
+   while (it != m_jobs.end())
+   {
+      QueuedJob *job = it->second;
+
+      if (job->done && !job->collecting && now - job->finishedAt > c_uncollectedMs)
+      {
+         m_jobs.erase(it++);
+         FreeJob(job);
+      }
+      else
+      {
+         ++it;
+      }
+   }
+}
+
+void ExtractQueue::FreeJob(QueuedJob *job)
+{
+   ::SysFreeString(job->text);
+   ::SysFreeString(job->description);
+   delete job;
+}
+
+// Called with m_lock held. Each worker keeps its own reference on the DLL
+// and drops it on the way out, so the DLL can't be unloaded under it.
+HRESULT ExtractQueue::StartWorker(SchedulerLane lane)
+{
+   TCHAR modulePath[MAX_PATH];
+
+   if (0 == ::GetModuleFileName(_Module.GetModuleInstance(), modulePath, MAX_PATH))
+      return HRESULT_FROM_WIN32(::GetLastError());
+
+   WorkerStart *start = new WorkerStart;
+   start->queue = this;
+   start->lane = lane;
+   start->module = ::LoadLibrary(modulePath);
+
+   if (NULL == start->module)
+   {
+      delete start;
+      return HRESULT_FROM_WIN32(::GetLastError());
+   }
+
+   DWORD threadId;
+   HANDLE hThread = ::CreateThread(NULL, 0, WorkerProc, start, 0, &threadId);
+
+   if (NULL == hThread)
+   {
+      DWORD error = ::GetLastError();
+      ::FreeLibrary(start->module);
+      delete start;
+      return HRESULT_FROM_WIN32(error);
+   }
+
+   ::CloseHandle(hThread);
+   ++m_workers[lane];
+   return S_OK;
+}
+
+DWORD WINAPI ExtractQueue::WorkerProc(void *param)
+{
+   WorkerStart *start = static_cast<WorkerStart *>(param);
+   HMODULE module = start->module;
+
+   start->queue->Work(start->lane);
+   delete start;
+
+   ::FreeLibraryAndExitThread(module, 0);
+   return 0;
+}
+
+// ExtractScheduler::Next for a worker's STA, which has to dispatch its
+// messages while it waits: COM's window for the apartment gets sent some
+// (broadcasts among them) and the sender is stuck until they're handled.
+static bool NextPumping(ExtractScheduler & scheduler, SchedulerLane lane, ScheduledJob & job, unsigned long timeoutMs)
+{
+   unsigned long start = TickMs();
+
+   for (;;)
+   {
+      MSG msg;
+
+      while (::PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+         ::DispatchMessage(&msg);
+
+      unsigned long waited = TickMs() - start;
+
+      if (waited >= timeoutMs || scheduler.IsShutdown())
+         return false;
+
+      if (scheduler.Next(lane, job, timeoutMs - waited < c_pumpMs ? timeoutMs - waited : c_pumpMs))
+         return true;
+   }
+}
+
+void ExtractQueue::Work(SchedulerLane lane)
+{
+   // Each worker is an STA of its own. The extractor is single threaded and
+   // most filters are registered as apartment threaded, so they are created
+   // right here and the workers run them side by side. In the MTA every call
+   // to them would go through the one host STA COM keeps for such objects,
+   // a single thread for all the lanes. Free threaded filters are created
+   // in the MTA and called from here, which doesn't serialize them either.
+   HRESULT hr = ::CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+   bool initialized = SUCCEEDED(hr);
+
+   CComObject<CTextExtractor> *extractor = NULL;
+
+   if (SUCCEEDED(hr))
+      hr = CComObject<CTextExtractor>::CreateInstance(&extractor);
+
+   CComPtr<ITextExtractor2> spExtractor;
+
+   if (SUCCEEDED(hr))
+      hr = extractor->QueryInterface(&spExtractor);
+
+   for (;;)
+   {
+      ScheduledJob scheduled;
+
+      if (!NextPumping(m_scheduler, lane, scheduled, c_workerIdleMs))
+      {
+         AutoLock lock(m_lock);
+
+         // Queue only starts workers when there are too few, so this check
+         // and the count have to change together
+         if (0 == m_scheduler.Queued() || FAILED(hr))
+         {
+            --m_workers[lane];
+            break;
+         }
+
+         continue;
+      }
+
+      QueuedJob *job = static_cast<QueuedJob *>(scheduled.context);
+      unsigned long begin = TickMs();
+
+      // a worker that couldn't set up still fails the jobs it takes, rather
+      // than leave them queued with nobody to run them
+      if (SUCCEEDED(hr))
+         RunJob(spExtractor, job);
+      else
+         job->result = hr;
+
+      m_scheduler.Done(scheduled, static_cast<unsigned long long>(TickMs() - begin) * 1000);
+
+      AutoLock lock(m_lock);
+
+      if (job->cancelled)
+      {
+         FreeJob(job);
+         continue;
+      }
+
+      job->done = true;
+      job->finishedAt = TickMs();
+      job->finished.Set();
+   }
+
+   spExtractor.Release();
+
+   if (initialized)
+      ::CoUninitialize();
+}
+
+void ExtractQueue::RunJob(ITextExtractor2 *extractor, QueuedJob *job)
+{
+   CComBSTR fileName(job->fileName.c_str());
+
+   job->result = extractor->ExtractTextEx(fileName, job->maxLength, job->profile, &job->text);
+
+   if (FAILED(job->result))
+   {
+      // the description goes back to whoever collects the result
+      CComPtr<IErrorInfo> spErrorInfo;
+
+      if (S_OK == ::GetErrorInfo(0, &spErrorInfo))
+         spErrorInfo->GetDescription(&job->description);
+   }
+}
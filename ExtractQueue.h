@@ -0,0 +1,79 @@
+// ExtractQueue.h : Background workers that run queued extractions in the
+//                  order ExtractScheduler picks
+
+#ifndef __EXTRACTQUEUE_H_
+#define __EXTRACTQUEUE_H_
+
+#include <map>
+#include <string>
+
+#include "ExtractScheduler.h"
+#include "Sync.h"
+
+class ExtractQueue
+{
+public:
+   static ExtractQueue & Instance();
+
+   // Estimates the job's cost from the file's size and its type's history
+   // and queues it, starting workers as needed. Nothing is queued if no
+   // worker could be started.
+   HRESULT Queue(BSTR fileName, long maxLength, NormalizationProfile profile, unsigned long *jobId);
+
+   // Waits up to waitMs for the job. Once it's finished, hands back its
+   // result (the ExtractTextEx HRESULT, text and error description) and
+   // forgets it; E_PENDING if it isn't finished yet. Finished jobs nobody
+   // collects are forgotten after ten minutes, E_INVALIDARG from then on.
+   HRESULT Collect(unsigned long jobId, unsigned long waitMs, HRESULT *result, BSTR *text, BSTR *description);
+
+   // Forgets the job and its result. One still queued never runs, one
+   // already running is let finish and its result thrown away. E_PENDING
+   // while another caller is waiting in Collect for it.
+   HRESULT Cancel(unsigned long jobId);
+
+   // Jobs of every type run side by side until a limit is set here, the
+   // queue can't tell which filters are single threaded.
+   void SetConcurrency(const wchar_t *extension, unsigned long maxRunning);
+
+private:
+   struct QueuedJob
+   {
+      std::wstring fileName;
+      long maxLength;
+      NormalizationProfile profile;
+
+      bool done;
+      bool collecting;
+      bool cancelled;                // while running, the worker frees it
+      unsigned long finishedAt;      // TickMs
+      HRESULT result;
+      BSTR text;
+      BSTR description;
+      WaitEvent finished;
+   };
+
+   struct WorkerStart
+   {
+      ExtractQueue *queue;
+      SchedulerLane lane;
+      HMODULE module;
+   };
+
+   ExtractQueue();
+
+   HRESULT StartWorker(SchedulerLane lane);
+   static DWORD WINAPI WorkerProc(void *param);
+   void Work(SchedulerLane lane);
+   void RunJob(ITextExtractor2 *extractor, QueuedJob *job);
+   void ExpireJobs();
+   static void FreeJob(QueuedJob *job);
+
+   static ExtractQueue s_queue;
+
+   CriticalLock m_lock;
+   ExtractScheduler m_scheduler;
+   std::map<unsigned long, QueuedJob *> m_jobs;
+   unsigned long m_workers[2];   // running, per lane
+};
+
+#endif //__EXTRACTQUEUE_H_
@@ -0,0 +1,244 @@
+// ExtractScheduler.cpp : Orders queued extractions by estimated cost
+
+#include <wctype.h>
+
+#include "ExtractScheduler.h"
+
+// loading the filter and opening the file, whatever the size
+static const unsigned long long c_jobOverheadUs = 2000;
+
+// throughput assumed for a type until one of its jobs has finished
+static const double c_defaultUsPerKB = 50;
+
+std::wstring FilterKey(const wchar_t *fileName)
+{
+   const wchar_t *dot = NULL;
+
+   for (const wchar_t *p = fileName; *p; ++p)
+   {
+      if (L'.' == *p)
+         dot = p;
+      else if (L'\\' == *p || L'/' == *p)
+         dot = NULL;
+   }
+
+   std::wstring key;
+
+   if (dot)
+   {
+      for (; *dot; ++dot)
+         key += static_cast<wchar_t>(towlower(*dot));
+   }
+
+   return key;
+}
+
+ExtractScheduler::ExtractScheduler(unsigned long long largeCost, unsigned long agingMs)
+   : m_largeCost(largeCost), m_agingMs(agingMs ? agingMs : 1), m_nextId(1), m_shutdown(false)
+{
+}
+
+unsigned long ExtractScheduler::Submit(const std::wstring & key, unsigned long long size, void *context)
+{
+   AutoLock lock(m_lock);
+
+   ScheduledJob job;
+   job.id = m_nextId++;
+   job.key = key;
+   job.size = size;
+   job.cost = Cost(key, size);
+   job.large = job.cost > m_largeCost;
+   job.queuedAt = TickMs();
+   job.context = context;
+
+   if (0 == m_nextId)
+      m_nextId = 1;
+
+   (job.large ? m_large : m_small).push_back(job);
+
+   WakeWorkers();
+   return job.id;
+}
+
+bool ExtractScheduler::Next(SchedulerLane lane, ScheduledJob & job, unsigned long timeoutMs)
+{
+   unsigned long start = TickMs();
+
+   for (;;)
+   {
+      Waiter waiter;
+      unsigned long waitMs = timeoutMs;
+
+      {
+         AutoLock lock(m_lock);
+
+         if (m_shutdown)
+            return false;
+
+         if (Pick(lane, job))
+            return true;
+
+         if (c_waitForever != timeoutMs)
+         {
+            unsigned long waited = TickMs() - start;
+
+            if (waited >= timeoutMs)
+               return false;
+
+            waitMs = timeoutMs - waited;
+         }
+
+         m_idle.push_back(&waiter);
+      }
+
+      waiter.event.Wait(waitMs);
+
+      // woken or not, take it off the list before it goes out of scope
+      AutoLock lock(m_lock);
+      m_idle.remove(&waiter);
+   }
+}
+
+void ExtractScheduler::Done(const ScheduledJob & job, unsigned long long elapsedUs)
+{
+   AutoLock lock(m_lock);
+
+   TypeStats & stats = m_types[job.key];
+
+   if (stats.running)
+      --stats.running;
+
+   double kb = job.size / 1024.0;
+   double usPerKB = (elapsedUs > c_jobOverheadUs ? elapsedUs - c_jobOverheadUs : 0) / (kb < 1 ? 1 : kb);
+
+   // moving average, a type's speed drifts with the files it gets
+   if (0 == stats.samples++)
+      stats.usPerKB = usPerKB;
+   else
+      stats.usPerKB += (usPerKB - stats.usPerKB) / 4;
+
+   // a job held back by this type's cap may run now
+   WakeWorkers();
+}
+
+bool ExtractScheduler::Cancel(unsigned long id)
+{
+   AutoLock lock(m_lock);
+   return RemoveFrom(m_small, id) || RemoveFrom(m_large, id);
+}
+
+void ExtractScheduler::SetConcurrency(const std::wstring & key, unsigned long maxRunning)
+{
+   AutoLock lock(m_lock);
+
+   m_types[key].maxRunning = maxRunning;
+   WakeWorkers();
+}
+
+unsigned long long ExtractScheduler::EstimateCost(const std::wstring & key, unsigned long long size) const
+{
+   AutoLock lock(m_lock);
+   return Cost(key, size);
+}
+
+// Called with the lock held.
+unsigned long long ExtractScheduler::Cost(const std::wstring & key, unsigned long long size) const
+{
+   std::map<std::wstring, TypeStats>::const_iterator it = m_types.find(key);
+   double usPerKB = it != m_types.end() && it->second.samples ? it->second.usPerKB : c_defaultUsPerKB;
+
+   return c_jobOverheadUs + static_cast<unsigned long long>(size / 1024.0 * usPerKB);
+}
+
+unsigned long ExtractScheduler::Queued() const
+{
+   AutoLock lock(m_lock);
+   return static_cast<unsigned long>(m_small.size() + m_large.size());
+}
+
+void ExtractScheduler::Shutdown()
+{
+   AutoLock lock(m_lock);
+
+   m_shutdown = true;
+   WakeWorkers();
+}
+
+bool ExtractScheduler::IsShutdown() const
+{
+   AutoLock lock(m_lock);
+   return m_shutdown;
+}
+
+// Called with the lock held. Small workers keep small jobs moving however
+// many large ones are queued; large workers fall back on small jobs rather
+// than sit idle.
+bool ExtractScheduler::Pick(SchedulerLane lane, ScheduledJob & job)
+{
+   unsigned long now = TickMs();
+
+   if (LANE_LARGE == lane && PickFrom(m_large, now, job))
+      return true;
+
+   return PickFrom(m_small, now, job);
+}
+
+// Cheapest job whose type is under its cap, after aging. A linear scan, the
+// queues hold a few hundred jobs at most.
+bool ExtractScheduler::PickFrom(std::list<ScheduledJob> & queue, unsigned long now, ScheduledJob & job)
+{
+   std::list<ScheduledJob>::iterator best = queue.end();
+   unsigned long long bestCost = 0;
+
+   for (std::list<ScheduledJob>::iterator it = queue.begin(); it != queue.end(); ++it)
+   {
+      std::map<std::wstring, TypeStats>::const_iterator type = m_types.find(it->key);
+
+      if (type != m_types.end() && type->second.maxRunning && type->second.running >= type->second.maxRunning)
+         continue;
+
+      unsigned long halvings = (now - it->queuedAt) / m_agingMs;
+      unsigned long long cost = halvings < 64 ? it->cost >> halvings : 0;
+
+      // strictly cheaper, so equal costs go in arrival order
+      if (queue.end() == best || cost < bestCost)
+      {
+         best = it;
+         bestCost = cost;
+      }
+   }
+
+   if (queue.end() == best)
+      return false;
+
+   job = *best;
+   queue.erase(best);
+
+   ++m_types[job.key].running;
+   return true;
+}
+
+// Called with the lock held.
+bool ExtractScheduler::RemoveFrom(std::list<ScheduledJob> & queue, unsigned long id)
+{
+   for (std::list<ScheduledJob>::iterator it = queue.begin(); it != queue.end(); ++it)
+   {
+      if (id == it->id)
+      {
+         queue.erase(it);
+         return true;
+      }
+   }
+
+   return false;
+}
+
+// Called with the lock held. Every idle worker looks again, the ones that
+// find nothing go back to waiting.
+void ExtractScheduler::WakeWorkers()
+{
+   for (std::list<Waiter *>::iterator it = m_idle.begin(); it != m_idle.end(); ++it)
+      (*it)->event.Set();
+
+   m_idle.clear();
+}
@@ -0,0 +1,103 @@
+// ExtractScheduler.h : Orders queued extractions by estimated cost, in
+//                      separate lanes for small and large jobs, with a cap
+//                      on how many of each filter type run at once
+
+#ifndef __EXTRACTSCHEDULER_H_
+#define __EXTRACTSCHEDULER_H_
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "Sync.h"
+
+enum SchedulerLane
+{
+   LANE_SMALL = 0,   // workers that only take small jobs
+   LANE_LARGE = 1    // workers that take large jobs first, then small ones
+};
+
+struct ScheduledJob
+{
+   unsigned long id;
+   std::wstring key;               // filter type, see FilterKey
+   unsigned long long size;        // bytes
+   unsigned long long cost;        // estimated run time, microseconds
+   bool large;
+   unsigned long queuedAt;         // TickMs
+   void *context;                  // the caller's
+};
+
+// Lowercased extension of fileName with its dot, empty when there isn't one.
+// Jobs are grouped by extension, standing in for the filter that handles it.
+std::wstring FilterKey(const wchar_t *fileName);
+
+class ExtractScheduler
+{
+public:
+   // Jobs estimated to run longer than largeCost microseconds go in the large
+   // lane. A job's cost is halved for every agingMs it has waited, so cheap
+   // jobs go first without the expensive ones waiting forever.
+   explicit ExtractScheduler(unsigned long long largeCost = 500000, unsigned long agingMs = 1000);
+
+   // Returns the job's id, never 0.
+   unsigned long Submit(const std::wstring & key, unsigned long long size, void *context);
+
+   // Hands a worker of the given lane the next job it may run, waiting up to
+   // timeoutMs for one. False on timeout or once Shutdown has been called.
+   bool Next(SchedulerLane lane, ScheduledJob & job, unsigned long timeoutMs);
+
+   // The job has finished, elapsed microseconds feed its type's cost model.
+   void Done(const ScheduledJob & job, unsigned long long elapsedUs);
+
+   // Takes a job no worker has been handed yet off its queue. False once it
+   // has been, or if there is no such job.
+   bool Cancel(unsigned long id);
+
+   // At most maxRunning jobs of this type at once, 0 for no limit.
+   void SetConcurrency(const std::wstring & key, unsigned long maxRunning);
+
+   unsigned long long EstimateCost(const std::wstring & key, unsigned long long size) const;
+
+   unsigned long Queued() const;
+
+   // Wakes every waiting worker, Next returns false from then on.
+   void Shutdown();
+
+   bool IsShutdown() const;
+
+private:
+   struct TypeStats
+   {
+      TypeStats() : usPerKB(0), samples(0), running(0), maxRunning(0) {}
+
+      double usPerKB;             // learned throughput, 0 until a job finishes
+      unsigned long samples;
+      unsigned long running;
+      unsigned long maxRunning;
+   };
+
+   struct Waiter
+   {
+      WaitEvent event;
+   };
+
+   bool Pick(SchedulerLane lane, ScheduledJob & job);
+   bool PickFrom(std::list<ScheduledJob> & queue, unsigned long now, ScheduledJob & job);
+   static bool RemoveFrom(std::list<ScheduledJob> & queue, unsigned long id);
+   unsigned long long Cost(const std::wstring & key, unsigned long long size) const;
+   void WakeWorkers();
+
+   mutable CriticalLock m_lock;
+   unsigned long long m_largeCost;
+   unsigned long m_agingMs;
+   unsigned long m_nextId;
+   bool m_shutdown;
+
+   std::list<ScheduledJob> m_small;
+   std::list<ScheduledJob> m_large;
+   std::map<std::wstring, TypeStats> m_types;
+   std::list<Waiter *> m_idle;
+};
+
+#endif //__EXTRACTSCHEDULER_H_
@@ -0,0 +1,276 @@
+// FilterHealth.cpp : Rolling statistics and circuit breaking per extension or filter
+
+#include "FilterHealth.h"
+
+#ifdef _WIN32
+#include "FiltErr.h"
+#endif
+
+// Milliseconds from then to now. Ticks taken on other threads can arrive a
+// little out of order, one from just after now counts as no time at all.
+inline static unsigned long Since(unsigned long now, unsigned long then)
+{
+   return static_cast<long>(now - then) < 0 ? 0 : now - then;
+}
+
+HealthTracker::HealthTracker(const BreakerPolicy & policy)
+   : m_policy(policy)
+{
+   if (0 == m_policy.windowCalls)
+      m_policy.windowCalls = 1;
+
+   if (0 == m_policy.closingProbes)
+      m_policy.closingProbes = 1;
+}
+
+bool HealthTracker::Allow(const std::wstring & key, unsigned long now)
+{
+   AutoLock lock(m_lock);
+
+   std::map<std::wstring, Health>::iterator it = m_health.find(key);
+
+   if (it == m_health.end())
+      return true;
+
+   Health & health = it->second;
+
+   switch (health.state)
+   {
+      case BREAKER_CLOSED:
+         return true;
+
+      case BREAKER_OPEN:
+         if (Since(now, health.openedAt) < health.openMs)
+         {
+            ++health.rejected;
+            return false;
+         }
+
+         health.state = BREAKER_HALF_OPEN;
+         health.goodProbes = 0;
+         break;
+
+      case BREAKER_HALF_OPEN:
+         // a probe that never reported back doesn't hold the breaker forever
+         if (health.probing && Since(now, health.probeAt) < health.openMs)
+         {
+            ++health.rejected;
+            return false;
+         }
+         break;
+   }
+
+   health.probing = true;
+   health.probeAt = now;
+   return true;
+}
+
+void HealthTracker::Record(const std::wstring & key, bool failed, unsigned long elapsedMs, unsigned long now)
+{
+   AutoLock lock(m_lock);
+
+   RecordCall(m_health[key], failed, elapsedMs, now);
+}
+
+void HealthTracker::Ignore(const std::wstring & key, unsigned long elapsedMs, unsigned long now)
+{
+   AutoLock lock(m_lock);
+
+   if (elapsedMs > m_policy.slowMs)
+   {
+      RecordCall(m_health[key], true, elapsedMs, now);
+      return;
+   }
+
+   std::map<std::wstring, Health>::iterator it = m_health.find(key);
+
+   if (it != m_health.end())
+      it->second.probing = false;
+}
+
+void HealthTracker::RecordCall(Health & health, bool failed, unsigned long elapsedMs, unsigned long now)
+{
+   if (elapsedMs > m_policy.slowMs)
+      failed = true;
+
+   Call call;
+   call.elapsedMs = elapsedMs;
+   call.failed = failed;
+
+   if (health.window.size() < m_policy.windowCalls)
+      health.window.push_back(call);
+   else
+      health.window[health.next] = call;
+
+   health.next = (health.next + 1) % m_policy.windowCalls;
+   health.consecutiveFailures = failed ? health.consecutiveFailures + 1 : 0;
+
+   switch (health.state)
+   {
+      case BREAKER_CLOSED:
+         if (ShouldTrip(health))
+         {
+            // tripping again soon after closing, the trouble wasn't over
+            bool relapse = health.openMs && Since(now, health.closedAt) < m_policy.maxOpenMs;
+            Open(health, now, relapse ? Longer(health.openMs) : m_policy.openMs);
+         }
+         break;
+
+      case BREAKER_OPEN:
+         // calls let through before it opened, they don't change anything
+         break;
+
+      case BREAKER_HALF_OPEN:
+         if (!health.probing)
+            break;
+
+         health.probing = false;
+
+         if (failed)
+         {
+            Open(health, now, Longer(health.openMs));
+         }
+         else if (++health.goodProbes >= m_policy.closingProbes)
+         {
+            // a clean start, the failures that opened it are history
+            health.state = BREAKER_CLOSED;
+            health.closedAt = now;
+            health.window.clear();
+            health.window.push_back(call);
+            health.next = 1 % m_policy.windowCalls;
+            health.rejected = 0;
+         }
+         break;
+   }
+}
+
+void HealthTracker::Snapshot(std::vector<HealthStats> & stats, unsigned long now) const
+{
+   AutoLock lock(m_lock);
+
+   stats.clear();
+   stats.reserve(m_health.size());
+
+   for (std::map<std::wstring, Health>::const_iterator it = m_health.begin(); it != m_health.end(); ++it)
+   {
+      const Health & health = it->second;
+
+      HealthStats entry;
+      entry.key = it->first;
+      entry.state = health.state;
+      entry.calls = static_cast<unsigned long>(health.window.size());
+      entry.failures = 0;
+      entry.maxMs = 0;
+      entry.consecutiveFailures = health.consecutiveFailures;
+      entry.rejected = health.rejected;
+      entry.retryMs = 0;
+
+      unsigned long long totalMs = 0;
+
+      for (size_t i = 0; i < health.window.size(); ++i)
+      {
+         totalMs += health.window[i].elapsedMs;
+
+         if (health.window[i].failed)
+            ++entry.failures;
+
+         if (health.window[i].elapsedMs > entry.maxMs)
+            entry.maxMs = health.window[i].elapsedMs;
+      }
+
+      entry.meanMs = entry.calls ? static_cast<unsigned long>(totalMs / entry.calls) : 0;
+
+      if (BREAKER_OPEN == health.state && Since(now, health.openedAt) < health.openMs)
+         entry.retryMs = health.openMs - Since(now, health.openedAt);
+
+      stats.push_back(entry);
+   }
+}
+
+void HealthTracker::Open(Health & health, unsigned long now, unsigned long openMs)
+{
+   health.state = BREAKER_OPEN;
+   health.openedAt = now;
+   health.openMs = openMs ? openMs : 1;
+   health.probing = false;
+}
+
+unsigned long HealthTracker::Longer(unsigned long openMs) const
+{
+   return openMs < m_policy.maxOpenMs / 2 ? openMs * 2 : m_policy.maxOpenMs;
+}
+
+bool HealthTracker::ShouldTrip(const Health & health) const
+{
+   if (health.consecutiveFailures >= m_policy.consecutiveFailures)
+      return true;
+
+   if (health.window.size() < m_policy.minCalls)
+      return false;
+
+   unsigned long failures = 0;
+
+   for (size_t i = 0; i < health.window.size(); ++i)
+   {
+      if (health.window[i].failed)
+         ++failures;
+   }
+
+   return failures * 100 >= m_policy.failurePercent * health.window.size();
+}
+
+bool IsFilterFault(FilterStatus hr, FilterStage stage)
+{
+   if (SUCCEEDED(hr))
+      return false;
+
+   // the filter's host died or hung, or it raised an exception COM handed
+   // back as a status code, NTSTATUS raw or through HRESULT_FROM_NT
+   if (FACILITY_RPC == HRESULT_FACILITY(hr))
+      return true;
+
+   if (0 != (hr & FACILITY_NT_BIT) || 0xC0000000 == (static_cast<unsigned long>(hr) & 0xF0000000))
+      return true;
+
+   switch (hr)
+   {
+      case CO_E_SERVER_EXEC_FAILURE:
+      case CO_E_SERVER_STOPPING:
+         return true;
+
+      // the file's, or the caller's, whichever call says so
+      case FILTER_E_PASSWORD:
+      case FILTER_E_UNKNOWNFORMAT:
+      case E_POINTER:
+      case E_INVALIDARG:
+      case E_OUTOFMEMORY:
+         return false;
+   }
+
+   if (FACILITY_WIN32 == HRESULT_FACILITY(hr))
+   {
+      switch (HRESULT_CODE(hr))
+      {
+         case RPC_S_SERVER_UNAVAILABLE:
+         case RPC_S_SERVER_TOO_BUSY:
+         case RPC_S_CALL_FAILED:
+         case RPC_S_CALL_FAILED_DNE:
+         case RPC_S_CALL_CANCELLED:
+         case ERROR_TIMEOUT:
+         case WAIT_TIMEOUT:
+            return true;
+
+         case ERROR_FILE_NOT_FOUND:
+         case ERROR_PATH_NOT_FOUND:
+         case ERROR_ACCESS_DENIED:
+         case ERROR_SHARING_VIOLATION:
+         case ERROR_LOCK_VIOLATION:
+            return false;
+      }
+   }
+
+   // LoadIFilter fails with E_FAIL and the like for files no filter takes,
+   // which says nothing about the one that would have been loaded; once
+   // Init has been called FILTER_E_ACCESS and anything unexpected is its own
+   return FILTER_STAGE_CALLS == stage;
+}
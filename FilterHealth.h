@@ -0,0 +1,174 @@
+// FilterHealth.h : Rolling latency and error statistics per extension or
+//                  filter, with a circuit breaker that stops calls to the
+//                  ones that keep failing
+
+#ifndef __FILTERHEALTH_H_
+#define __FILTERHEALTH_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Sync.h"
+
+#ifdef _WIN32
+typedef HRESULT FilterStatus;
+#else
+// HRESULT is 32 bits whatever the size of long. The codes IsFilterFault
+// tells apart, as winerror.h and filterr.h define them, for builds without
+// the Windows headers.
+typedef int FilterStatus;
+
+#define SUCCEEDED(hr)                  (static_cast<FilterStatus>(hr) >= 0)
+#define FAILED(hr)                     (static_cast<FilterStatus>(hr) < 0)
+#define HRESULT_CODE(hr)               ((hr) & 0xFFFF)
+#define HRESULT_FACILITY(hr)           (((hr) >> 16) & 0x1FFF)
+#define HRESULT_FROM_WIN32(x)          ((x) <= 0 ? static_cast<FilterStatus>(x) : static_cast<FilterStatus>(((x) & 0x0000FFFF) | (FACILITY_WIN32 << 16) | 0x80000000))
+#define HRESULT_FROM_NT(x)             (static_cast<FilterStatus>((x) | FACILITY_NT_BIT))
+
+#define FACILITY_RPC                   1
+#define FACILITY_WIN32                 7
+#define FACILITY_NT_BIT                0x10000000
+
+#define ERROR_FILE_NOT_FOUND           2
+#define ERROR_PATH_NOT_FOUND           3
+#define ERROR_ACCESS_DENIED            5
+#define ERROR_SHARING_VIOLATION        32
+#define ERROR_LOCK_VIOLATION           33
+#define WAIT_TIMEOUT                   258
+#define ERROR_TIMEOUT                  1460
+#define RPC_S_SERVER_UNAVAILABLE       1722
+#define RPC_S_SERVER_TOO_BUSY          1723
+#define RPC_S_CALL_FAILED              1726
+#define RPC_S_CALL_FAILED_DNE          1727
+#define RPC_S_CALL_CANCELLED           1818
+
+#define S_OK                           static_cast<FilterStatus>(0)
+#define S_FALSE                        static_cast<FilterStatus>(1)
+#define E_NOTIMPL                      static_cast<FilterStatus>(0x80004001)
+#define E_POINTER                      static_cast<FilterStatus>(0x80004003)
+#define E_FAIL                         static_cast<FilterStatus>(0x80004005)
+#define E_UNEXPECTED                   static_cast<FilterStatus>(0x8000FFFF)
+#define E_ACCESSDENIED                 static_cast<FilterStatus>(0x80070005)
+#define E_OUTOFMEMORY                  static_cast<FilterStatus>(0x8007000E)
+#define E_INVALIDARG                   static_cast<FilterStatus>(0x80070057)
+#define RPC_E_DISCONNECTED             static_cast<FilterStatus>(0x80010108)
+#define RPC_E_SERVERFAULT              static_cast<FilterStatus>(0x80010105)
+#define CO_E_SERVER_EXEC_FAILURE       static_cast<FilterStatus>(0x80080005)
+#define CO_E_SERVER_STOPPING           static_cast<FilterStatus>(0x80080008)
+
+#define FILTER_E_ACCESS                static_cast<FilterStatus>(0x80041703)
+#define FILTER_E_NO_TEXT               static_cast<FilterStatus>(0x80041705)
+#define FILTER_E_PASSWORD              static_cast<FilterStatus>(0x8004170B)
+#define FILTER_E_UNKNOWNFORMAT         static_cast<FilterStatus>(0x8004170C)
+#endif
+
+enum BreakerState
+{
+   BREAKER_CLOSED = 0,      // calls go through
+   BREAKER_OPEN = 1,        // calls fail fast until the open time is up
+   BREAKER_HALF_OPEN = 2    // probe calls, one at a time, decide which way it goes
+};
+
+struct BreakerPolicy
+{
+   BreakerPolicy()
+      : windowCalls(20), minCalls(5), failurePercent(50), consecutiveFailures(5),
+        slowMs(30000), openMs(30000), maxOpenMs(600000), closingProbes(3)
+   {
+   }
+
+   unsigned long windowCalls;           // calls the rolling statistics cover
+   unsigned long minCalls;              // before failurePercent can trip the breaker
+   unsigned long failurePercent;        // of the window, trips the breaker
+   unsigned long consecutiveFailures;   // trip the breaker however few calls there were
+   unsigned long slowMs;                // calls taking longer count as failures
+   unsigned long openMs;                // first wait before a probe
+   unsigned long maxOpenMs;             // the wait doubles with each failed probe, and when it
+                                        // trips again within this long of closing, up to this
+   unsigned long closingProbes;         // successful probes in a row that close it again
+};
+
+struct HealthStats
+{
+   std::wstring key;
+   BreakerState state;
+   unsigned long calls;                 // in the window
+   unsigned long failures;              // in the window
+   unsigned long meanMs;                // over the window
+   unsigned long maxMs;                 // over the window
+   unsigned long consecutiveFailures;
+   unsigned long rejected;              // calls failed fast since the breaker last closed
+   unsigned long retryMs;               // until the next probe is let through, when open
+};
+
+class HealthTracker
+{
+public:
+   explicit HealthTracker(const BreakerPolicy & policy = BreakerPolicy());
+
+   // Whether a call for key may go ahead at tick now (TickMs). While half
+   // open this lets a single probe through and turns the rest away.
+   bool Allow(const std::wstring & key, unsigned long now);
+
+   // Outcome of a call that Allow let through.
+   void Record(const std::wstring & key, bool failed, unsigned long elapsedMs, unsigned long now);
+
+   // A call Allow let through whose outcome says nothing about the filter
+   // either way (the file was missing, say): it stays out of the statistics
+   // and, while half open, hands the probe to the next call. One slower than
+   // slowMs is recorded as a failure all the same.
+   void Ignore(const std::wstring & key, unsigned long elapsedMs, unsigned long now);
+
+   void Snapshot(std::vector<HealthStats> & stats, unsigned long now) const;
+
+private:
+   struct Call
+   {
+      unsigned long elapsedMs;
+      bool failed;
+   };
+
+   struct Health
+   {
+      Health() : state(BREAKER_CLOSED), next(0), consecutiveFailures(0), rejected(0),
+                 openedAt(0), openMs(0), closedAt(0), probing(false), probeAt(0), goodProbes(0) {}
+
+      BreakerState state;
+      std::vector<Call> window;          // ring of the latest calls
+      size_t next;
+      unsigned long consecutiveFailures;
+      unsigned long rejected;
+      unsigned long openedAt;
+      unsigned long openMs;
+      unsigned long closedAt;
+      bool probing;
+      unsigned long probeAt;
+      unsigned long goodProbes;
+   };
+
+   void RecordCall(Health & health, bool failed, unsigned long elapsedMs, unsigned long now);
+   void Open(Health & health, unsigned long now, unsigned long openMs);
+   unsigned long Longer(unsigned long openMs) const;
+   bool ShouldTrip(const Health & health) const;
+
+   BreakerPolicy m_policy;
+   mutable CriticalLock m_lock;
+   std::map<std::wstring, Health> m_health;
+};
+
+// How far an extraction got before it failed.
+enum FilterStage
+{
+   FILTER_STAGE_LOAD = 0,   // finding and loading the filter, nothing of it has run yet
+   FILTER_STAGE_CALLS = 1   // Init, GetChunk and GetText
+};
+
+// Whether a failure counts against the filter's health. Its host failing,
+// hanging or faulting counts at any stage. Once the filter is running,
+// FILTER_E_ACCESS and anything else it didn't have to return count too, but
+// not what belongs to the file (missing, locked, password protected, not
+// the filter's format) or to the caller.
+bool IsFilterFault(FilterStatus hr, FilterStage stage);
+
+#endif //__FILTERHEALTH_H_
@@ -0,0 +1,331 @@
+// FilterRegistry.cpp : Filter routes over HKEY_CLASSES_ROOT
+#define STRICT
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0400
+#endif
+#define _ATL_APARTMENT_THREADED
+
+#include <atlbase.h>
+//You may derive a class from CComModule and use it if you want to override
+//something, but do not change the name of _Module
+extern CComModule _Module;
+#include <atlcom.h>
+
+#include <vector>
+
+#include "Filter.h"
+#include "FilterRegistry.h"
+#include "Sync.h"
+
+// modules loading at once, more mostly wait on the same disk
+static const unsigned long c_preloadThreads = 4;
+
+// anything this big isn't a snapshot, they run to a few KB
+static const DWORD c_maxSnapshot = 16 * 1024 * 1024;
+
+class ClassesRootSource : public RegistrySource
+{
+public:
+   virtual bool ReadString(const std::wstring & key, const wchar_t *name, std::wstring & value)
+   {
+      HKEY hKey;
+
+      if (ERROR_SUCCESS != ::RegOpenKeyExW(HKEY_CLASSES_ROOT, key.c_str(), 0, KEY_QUERY_VALUE, &hKey))
+         return false;
+
+      DWORD type = 0;
+      DWORD cb = 0;
+      std::vector<wchar_t> buf;
+      LONG rc = ::RegQueryValueExW(hKey, name, NULL, &type, NULL, &cb);
+
+      if (ERROR_SUCCESS == rc && (REG_SZ == type || REG_EXPAND_SZ == type))
+      {
+         buf.resize(cb / sizeof(wchar_t) + 1);
+         rc = ::RegQueryValueExW(hKey, name, NULL, &type, reinterpret_cast<BYTE *>(&buf[0]), &cb);
+      }
+      else if (ERROR_SUCCESS == rc)
+      {
+         rc = ERROR_INVALID_DATA;
+      }
+
+      ::RegCloseKey(hKey);
+
+      if (ERROR_SUCCESS != rc)
+         return false;
+
+      // the stored value needn't be terminated
+      buf[min(cb / sizeof(wchar_t), buf.size() - 1)] = L'\0';
+      value = &buf[0];
+
+      if (REG_EXPAND_SZ == type)
+      {
+         DWORD cch = ::ExpandEnvironmentStringsW(value.c_str(), NULL, 0);
+         std::vector<wchar_t> expanded(cch + 1);
+
+         if (0 != cch && 0 != ::ExpandEnvironmentStringsW(value.c_str(), &expanded[0], cch + 1))
+            value = &expanded[0];
+      }
+
+      return true;
+   }
+
+   virtual bool LastWrite(const std::wstring & key, unsigned long long *stamp)
+   {
+      HKEY hKey;
+
+      if (ERROR_SUCCESS != ::RegOpenKeyExW(HKEY_CLASSES_ROOT, key.c_str(), 0, KEY_QUERY_VALUE, &hKey))
+         return false;
+
+      FILETIME written;
+      LONG rc = ::RegQueryInfoKeyW(hKey, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &written);
+
+      ::RegCloseKey(hKey);
+
+      if (ERROR_SUCCESS != rc)
+         return false;
+
+      *stamp = (static_cast<unsigned long long>(written.dwHighDateTime) << 32) | written.dwLowDateTime;
+      return true;
+   }
+};
+
+static ClassesRootSource s_classesRoot;
+static FilterRouter s_routes(s_classesRoot);
+
+// Class factories of the preloaded free-threaded filters, locked so the
+// filters stay set up between extractions. Free-threaded objects take calls
+// from any thread, so whichever one replaces the routes lets them go, and
+// the modules were loaded by hand, so they outlive the preload threads.
+static CriticalLock s_factoriesLock;
+static std::vector<IClassFactory *> s_factories;
+
+static void HoldFactory(IClassFactory *pFactory)
+{
+   if (FAILED(pFactory->LockServer(TRUE)))
+      return;
+
+   try
+   {
+      AutoLock lock(s_factoriesLock);
+      s_factories.push_back(pFactory);
+      pFactory->AddRef();
+   }
+   catch (...)
+   {
+      pFactory->LockServer(FALSE);
+   }
+}
+
+static void ReleaseFactories()
+{
+   std::vector<IClassFactory *> factories;
+
+   {
+      AutoLock lock(s_factoriesLock);
+      factories.swap(s_factories);
+   }
+
+   for (size_t i = 0; i < factories.size(); ++i)
+   {
+      factories[i]->LockServer(FALSE);
+      factories[i]->Release();
+   }
+}
+
+FilterRouter & FilterRoutes()
+{
+   return s_routes;
+}
+
+HRESULT LoadRouteSnapshot(const wchar_t *path)
+{
+   HANDLE hFile = ::CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+   if (INVALID_HANDLE_VALUE == hFile)
+   {
+      DWORD error = ::GetLastError();
+      return ERROR_FILE_NOT_FOUND == error || ERROR_PATH_NOT_FOUND == error ? S_FALSE : HRESULT_FROM_WIN32(error);
+   }
+
+   DWORD sizeHigh = 0;
+   DWORD size = ::GetFileSize(hFile, &sizeHigh);
+
+   if (0 != sizeHigh || size > c_maxSnapshot)
+   {
+      ::CloseHandle(hFile);
+      return S_FALSE;
+   }
+
+   std::vector<unsigned char> data(size + 1);
+   DWORD read = 0;
+   BOOL ok = ::ReadFile(hFile, &data[0], size, &read, NULL);
+   DWORD error = ::GetLastError();
+
+   ::CloseHandle(hFile);
+
+   if (!ok)
+      return HRESULT_FROM_WIN32(error);
+
+   if (read != size || !s_routes.Load(&data[0], read))
+      return S_FALSE;
+
+   // the routes the factories were held for are gone
+   ReleaseFactories();
+   return S_OK;
+}
+
+HRESULT SaveRouteSnapshot(const wchar_t *path)
+{
+   std::vector<unsigned char> snapshot;
+   s_routes.Save(snapshot);
+
+   std::wstring tempPath = std::wstring(path) + L".tmp";
+   HANDLE hFile = ::CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+   if (INVALID_HANDLE_VALUE == hFile)
+      return HRESULT_FROM_WIN32(::GetLastError());
+
+   DWORD written = 0;
+   BOOL ok = ::WriteFile(hFile, &snapshot[0], static_cast<DWORD>(snapshot.size()), &written, NULL);
+   DWORD error = ::GetLastError();
+
+   ::CloseHandle(hFile);
+
+   if (!ok || written != snapshot.size())
+   {
+      ::DeleteFileW(tempPath.c_str());
+      return ok ? E_FAIL : HRESULT_FROM_WIN32(error);
+   }
+
+   if (!::MoveFileExW(tempPath.c_str(), path, MOVEFILE_REPLACE_EXISTING))
+   {
+      error = ::GetLastError();
+      ::DeleteFileW(tempPath.c_str());
+      return HRESULT_FROM_WIN32(error);
+   }
+
+   return S_OK;
+}
+
+struct PreloadWork
+{
+   std::vector<FilterRoute> routes;
+   volatile LONG next;
+   volatile LONG loaded;
+};
+
+// Filters that can live in the MTA get their class factory made and held as
+// well. Apartment threaded ones would need a host STA, only their module loads.
+static bool IsFreeThreaded(const std::wstring & threadingModel)
+{
+   return 0 == _wcsicmp(threadingModel.c_str(), L"Both") || 0 == _wcsicmp(threadingModel.c_str(), L"Free") ||
+          0 == _wcsicmp(threadingModel.c_str(), L"Neutral");
+}
+
+static DWORD WINAPI PreloadProc(void *param)
+{
+   PreloadWork *work = static_cast<PreloadWork *>(param);
+   HRESULT hrInit = ::CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+   for (;;)
+   {
+      LONG i = ::InterlockedIncrement(&work->next) - 1;
+
+      if (i >= static_cast<LONG>(work->routes.size()))
+         break;
+
+      const FilterRoute & route = work->routes[i];
+
+      // never freed, so the module stays loaded for the extractions to come
+      if (NULL == ::LoadLibraryExW(route.module.c_str(), NULL, 0))
+         continue;
+
+      ::InterlockedIncrement(&work->loaded);
+
+      CLSID clsid;
+
+      if (SUCCEEDED(hrInit) && IsFreeThreaded(route.threadingModel) &&
+          SUCCEEDED(::CLSIDFromString(const_cast<LPOLESTR>(route.filter.c_str()), &clsid)))
+      {
+         CComPtr<IClassFactory> spFactory;
+
+         if (SUCCEEDED(::CoGetClassObject(clsid, CLSCTX_INPROC_SERVER, NULL, IID_IClassFactory,
+                                          reinterpret_cast<void**>(&spFactory))))
+            HoldFactory(spFactory);
+      }
+   }
+
+   if (SUCCEEDED(hrInit))
+      ::CoUninitialize();
+
+   return 0;
+}
+
+unsigned long PreloadFilters(size_t count)
+{
+   // the last preload's factories make way for the filters that are hot now
+   ReleaseFactories();
+
+   PreloadWork work;
+   s_routes.Hottest(count, work.routes);
+   work.next = 0;
+   work.loaded = 0;
+
+   if (work.routes.empty())
+      return 0;
+
+   HANDLE threads[c_preloadThreads];
+   DWORD threadCount = 0;
+
+   for (size_t i = 0; i < work.routes.size() && threadCount < c_preloadThreads; ++i)
+   {
+      DWORD threadId;
+      HANDLE hThread = ::CreateThread(NULL, 0, PreloadProc, &work, 0, &threadId);
+
+      if (NULL == hThread)
+         break;
+
+      threads[threadCount++] = hThread;
+   }
+
+   // without threads of its own, this one does the loading
+   if (0 == threadCount)
+      PreloadProc(&work);
+
+   if (threadCount)
+      ::WaitForMultipleObjects(threadCount, threads, TRUE, INFINITE);
+
+   for (DWORD i = 0; i < threadCount; ++i)
+      ::CloseHandle(threads[i]);
+
+   return static_cast<unsigned long>(work.loaded);
+}
+
+HRESULT CreateRoutedFilter(const FilterRoute & route, const wchar_t *fileName, IUnknown **ppUnk)
+{
+   *ppUnk = NULL;
+
+   CLSID clsid;
+   HRESULT hr = ::CLSIDFromString(const_cast<LPOLESTR>(route.filter.c_str()), &clsid);
+
+   if (FAILED(hr))
+      return hr;
+
+   CComPtr<IFilter> spIFilter;
+   hr = ::CoCreateInstance(clsid, NULL, CLSCTX_INPROC_SERVER, __uuidof(IFilter), reinterpret_cast<void**>(&spIFilter));
+
+   if (FAILED(hr))
+      return hr;
+
+   CComQIPtr<IPersistFile> spIPersistFile = spIFilter;
+
+   if (!spIPersistFile)
+      return E_NOINTERFACE;
+
+   hr = spIPersistFile->Load(fileName, STGM_READ | STGM_SHARE_DENY_NONE);
+
+   if (FAILED(hr))
+      return hr;
+
+   return spIFilter->QueryInterface(IID_IUnknown, reinterpret_cast<void**>(ppUnk));
+}
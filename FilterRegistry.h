@@ -0,0 +1,29 @@
+// FilterRegistry.h : The process-wide filter routes over HKEY_CLASSES_ROOT,
+//                    their snapshot file and preloading of the hot filters
+
+#ifndef __FILTERREGISTRY_H_
+#define __FILTERREGISTRY_H_
+
+#include "FilterRouting.h"
+
+// Routes shared by every extractor in the process.
+FilterRouter & FilterRoutes();
+
+// Replaces the routes with the snapshot in path. S_FALSE if there is no
+// such file or it isn't a snapshot, the routes are left as they were.
+HRESULT LoadRouteSnapshot(const wchar_t *path);
+
+// Writes the routes next to path and swaps the file in.
+HRESULT SaveRouteSnapshot(const wchar_t *path);
+
+// Loads the modules of the count most used filters, several at a time, and
+// keeps them loaded. The free-threaded ones also get their class factory
+// made and locked with LockServer, until the routes are loaded or preloaded
+// again. Returns the number loaded.
+unsigned long PreloadFilters(size_t count);
+
+// What LoadIFilter does once it has found the filter: creates it and hands
+// it the file through its IPersistFile.
+HRESULT CreateRoutedFilter(const FilterRoute & route, const wchar_t *fileName, IUnknown **ppUnk);
+
+#endif //__FILTERREGISTRY_H_
@@ -0,0 +1,540 @@
+// FilterRouting.cpp : Extension to filter routes and their snapshot
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "FilterRouting.h"
+#include "PlainText.h"
+
+// IID of the IFilter add-in under a persistent handler's PersistentAddinsRegistered
+static const wchar_t c_filterAddin[] = L"{89BCB740-6119-101A-BCB7-00DD010655AF}";
+
+// Snapshot layout, all little-endian, v for a LEB128 varint:
+//
+//    "FRT1"  magic and version
+//    v       string count, then per string v byte count and the UTF-8
+//    v       route count
+//    per route:
+//       v        uses
+//       v        strings of the extension, handler, filter, module, threading model
+//       v        key count, then per key v string and u64 last write time
+//                (0 when the key wasn't there)
+//    u64     FNV-1a of everything before it
+//
+// Routes through the same filter share most of their keys, so every string
+// is stored once and routes refer to it by index.
+static const unsigned char c_snapshotMagic[4] = { 'F', 'R', 'T', '1' };
+
+static unsigned long long Fnv1a(const unsigned char *data, size_t cb)
+{
+   unsigned long long hash = 14695981039346656037ULL;
+
+   for (size_t i = 0; i < cb; ++i)
+   {
+      hash ^= data[i];
+      hash *= 1099511628211ULL;
+   }
+
+   return hash;
+}
+
+static void PutVarint(std::vector<unsigned char> & out, unsigned long long value)
+{
+   while (value >= 0x80)
+   {
+      out.push_back(static_cast<unsigned char>(value | 0x80));
+      value >>= 7;
+   }
+
+   out.push_back(static_cast<unsigned char>(value));
+}
+
+static void PutFixed(std::vector<unsigned char> & out, unsigned long long value)
+{
+   for (unsigned i = 0; i < 8; ++i)
+      out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+}
+
+static void PutUtf8(std::vector<unsigned char> & out, const std::wstring & s)
+{
+   std::string utf8;
+
+   for (size_t i = 0; i < s.length(); ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(s[i]);
+
+      // a UTF-16 pair where wchar_t is 16 bits
+      if (c >= 0xD800 && c < 0xDC00 && i + 1 < s.length() &&
+          static_cast<unsigned long>(s[i + 1]) >= 0xDC00 && static_cast<unsigned long>(s[i + 1]) <= 0xDFFF)
+      {
+         c = 0x10000 + ((c - 0xD800) << 10) + (static_cast<unsigned long>(s[++i]) - 0xDC00);
+      }
+
+      if (c < 0x80)
+      {
+         utf8 += static_cast<char>(c);
+      }
+      else if (c < 0x800)
+      {
+         utf8 += static_cast<char>(0xC0 | (c >> 6));
+         utf8 += static_cast<char>(0x80 | (c & 0x3F));
+      }
+      else if (c < 0x10000)
+      {
+         utf8 += static_cast<char>(0xE0 | (c >> 12));
+         utf8 += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+         utf8 += static_cast<char>(0x80 | (c & 0x3F));
+      }
+      else
+      {
+         utf8 += static_cast<char>(0xF0 | (c >> 18));
+         utf8 += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+         utf8 += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+         utf8 += static_cast<char>(0x80 | (c & 0x3F));
+      }
+   }
+
+   PutVarint(out, utf8.length());
+   out.insert(out.end(), utf8.begin(), utf8.end());
+}
+
+class SnapshotReader
+{
+public:
+   SnapshotReader(const unsigned char *data, size_t cb) : m_data(data), m_cb(cb), m_pos(0), m_ok(true) {}
+
+   bool Ok() const { return m_ok; }
+
+   unsigned long long Varint()
+   {
+      unsigned long long value = 0;
+
+      for (unsigned shift = 0; shift < 64; shift += 7)
+      {
+         if (m_pos >= m_cb)
+            break;
+
+         unsigned char b = m_data[m_pos++];
+         value |= static_cast<unsigned long long>(b & 0x7F) << shift;
+
+         if (0 == (b & 0x80))
+            return value;
+      }
+
+      m_ok = false;
+      return 0;
+   }
+
+   unsigned long long Fixed()
+   {
+      if (m_cb - m_pos < 8)
+      {
+         m_ok = false;
+         return 0;
+      }
+
+      unsigned long long value = 0;
+
+      for (unsigned i = 0; i < 8; ++i)
+         value |= static_cast<unsigned long long>(m_data[m_pos + i]) << (8 * i);
+
+      m_pos += 8;
+      return value;
+   }
+
+   std::wstring Utf8()
+   {
+      unsigned long long cb = Varint();
+      std::wstring s;
+
+      if (!m_ok || m_cb - m_pos < cb)
+      {
+         m_ok = false;
+         return s;
+      }
+
+      if (cb)
+      {
+         std::vector<wchar_t> chars(static_cast<size_t>(cb));
+         size_t cch = 0;
+
+         DecodeText(TEXT_ENCODING_UTF8, m_data + m_pos, static_cast<size_t>(cb), &chars[0], &cch, true);
+         s.assign(&chars[0], cch);
+         m_pos += static_cast<size_t>(cb);
+      }
+
+      return s;
+   }
+
+   // An index into a table of count strings.
+   size_t Index(size_t count)
+   {
+      unsigned long long index = Varint();
+
+      if (index >= count)
+      {
+         m_ok = false;
+         return 0;
+      }
+
+      return static_cast<size_t>(index);
+   }
+
+private:
+   const unsigned char *m_data;
+   size_t m_cb;
+   size_t m_pos;
+   bool m_ok;
+};
+
+// Collects the strings for a snapshot, each once.
+class StringTable
+{
+public:
+   unsigned long Add(const std::wstring & s)
+   {
+      std::map<std::wstring, unsigned long>::const_iterator it = m_indexes.find(s);
+
+      if (it != m_indexes.end())
+         return it->second;
+
+      unsigned long index = static_cast<unsigned long>(m_strings.size());
+      m_indexes[s] = index;
+      m_strings.push_back(s);
+      return index;
+   }
+
+   void Write(std::vector<unsigned char> & out) const
+   {
+      PutVarint(out, m_strings.size());
+
+      for (size_t i = 0; i < m_strings.size(); ++i)
+         PutUtf8(out, m_strings[i]);
+   }
+
+private:
+   std::map<std::wstring, unsigned long> m_indexes;
+   std::vector<std::wstring> m_strings;
+};
+
+// Milliseconds from then to now, see HealthTracker.
+inline static unsigned long Since(unsigned long now, unsigned long then)
+{
+   return static_cast<long>(now - then) < 0 ? 0 : now - then;
+}
+
+FilterRouter::FilterRouter(RegistrySource & registry, unsigned long recheckMs)
+   : m_registry(registry), m_recheckMs(recheckMs)
+{
+}
+
+bool FilterRouter::Route(const std::wstring & extension, unsigned long now, FilterRoute & route)
+{
+   Entry entry;
+   bool found;
+
+   {
+      AutoLock lock(m_lock);
+
+      std::map<std::wstring, Entry>::iterator it = m_routes.find(extension);
+      found = it != m_routes.end();
+
+      if (found)
+      {
+         ++it->second.uses;
+
+         if (it->second.checked && Since(now, it->second.checkedAt) < m_recheckMs)
+         {
+            route = it->second.route;
+            return !route.filter.empty();
+         }
+
+         entry = it->second;
+      }
+   }
+
+   // the registry is read outside the lock, so one slow lookup doesn't hold
+   // up the extractions whose routes are known
+   if (!found || !Current(entry))
+   {
+      unsigned long uses = found ? entry.uses : 1;
+      Resolve(extension, entry);
+      entry.uses = uses;
+   }
+
+   entry.checked = true;
+   entry.checkedAt = now;
+   route = entry.route;
+
+   AutoLock lock(m_lock);
+   m_routes[extension] = entry;
+   return !route.filter.empty();
+}
+
+// Reads a value, noting the key's last write time for Current.
+bool FilterRouter::Read(Entry & entry, const std::wstring & key, const wchar_t *name, std::wstring & value)
+{
+   KeyStamp stamp;
+   stamp.key = key;
+
+   if (!m_registry.LastWrite(key, &stamp.stamp))
+      stamp.stamp = 0;
+
+   // the same key for another value is already there
+   if (entry.keys.empty() || entry.keys.back().key != key)
+      entry.keys.push_back(stamp);
+
+   value.clear();
+   return 0 != stamp.stamp && m_registry.ReadString(key, name, value) && !value.empty();
+}
+
+void FilterRouter::Resolve(const std::wstring & extension, Entry & entry)
+{
+   entry.route = FilterRoute();
+   entry.route.extension = extension;
+   entry.keys.clear();
+
+   std::wstring handler;
+
+   // the key is read first so a PersistentHandler added later changes its stamp
+   std::wstring progId;
+   Read(entry, extension, NULL, progId);
+
+   if (!Read(entry, extension + L"\\PersistentHandler", NULL, handler) && !progId.empty())
+   {
+      std::wstring classId;
+
+      if (Read(entry, progId + L"\\CLSID", NULL, classId))
+         Read(entry, L"CLSID\\" + classId + L"\\PersistentHandler", NULL, handler);
+   }
+
+   if (handler.empty())
+      return;
+
+   entry.route.handler = handler;
+
+   std::wstring filter;
+
+   if (!Read(entry, L"CLSID\\" + handler + L"\\PersistentAddinsRegistered\\" + c_filterAddin, NULL, filter))
+      return;
+
+   std::wstring inproc = L"CLSID\\" + filter + L"\\InprocServer32";
+   std::wstring module;
+
+   if (!Read(entry, inproc, NULL, module))
+      return;
+
+   Read(entry, inproc, L"ThreadingModel", entry.route.threadingModel);
+
+   entry.route.filter = filter;
+   entry.route.module = module;
+}
+
+// True if none of the keys the route came from has been written, added or
+// removed since.
+bool FilterRouter::Current(const Entry & entry)
+{
+   if (entry.keys.empty())
+      return false;
+
+   for (size_t i = 0; i < entry.keys.size(); ++i)
+   {
+      unsigned long long stamp;
+
+      if (!m_registry.LastWrite(entry.keys[i].key, &stamp))
+         stamp = 0;
+
+      if (stamp != entry.keys[i].stamp)
+         return false;
+   }
+
+   return true;
+}
+
+bool FilterRouter::Load(const unsigned char *data, size_t cb)
+{
+   if (cb < sizeof(c_snapshotMagic) + 8 || 0 != memcmp(data, c_snapshotMagic, sizeof(c_snapshotMagic)))
+      return false;
+
+   SnapshotReader check(data + cb - 8, 8);
+
+   if (check.Fixed() != Fnv1a(data, cb - 8))
+      return false;
+
+   SnapshotReader reader(data + sizeof(c_snapshotMagic), cb - 8 - sizeof(c_snapshotMagic));
+   std::vector<std::wstring> strings;
+   unsigned long long stringCount = reader.Varint();
+
+   for (unsigned long long i = 0; i < stringCount && reader.Ok(); ++i)
+      strings.push_back(reader.Utf8());
+
+   std::map<std::wstring, Entry> routes;
+   unsigned long long count = reader.Varint();
+
+   for (unsigned long long i = 0; i < count && reader.Ok(); ++i)
+   {
+      Entry entry;
+
+      // halved at every load, so the preload order follows recent use
+      entry.uses = static_cast<unsigned long>(reader.Varint() / 2);
+      entry.route.extension = strings[reader.Index(strings.size())];
+      entry.route.handler = strings[reader.Index(strings.size())];
+      entry.route.filter = strings[reader.Index(strings.size())];
+      entry.route.module = strings[reader.Index(strings.size())];
+      entry.route.threadingModel = strings[reader.Index(strings.size())];
+      entry.checked = false;
+      entry.checkedAt = 0;
+
+      unsigned long long keyCount = reader.Varint();
+
+      for (unsigned long long k = 0; k < keyCount && reader.Ok(); ++k)
+      {
+         KeyStamp stamp;
+         stamp.key = strings[reader.Index(strings.size())];
+         stamp.stamp = reader.Fixed();
+         entry.keys.push_back(stamp);
+      }
+
+      routes[entry.route.extension] = entry;
+   }
+
+   if (!reader.Ok())
+      return false;
+
+   AutoLock lock(m_lock);
+   m_routes.swap(routes);
+   return true;
+}
+
+void FilterRouter::Save(std::vector<unsigned char> & snapshot) const
+{
+   StringTable strings;
+   std::vector<unsigned char> routes;
+
+   {
+      AutoLock lock(m_lock);
+
+      PutVarint(routes, m_routes.size());
+
+      for (std::map<std::wstring, Entry>::const_iterator it = m_routes.begin(); it != m_routes.end(); ++it)
+      {
+         const Entry & entry = it->second;
+
+         PutVarint(routes, entry.uses);
+         PutVarint(routes, strings.Add(entry.route.extension));
+         PutVarint(routes, strings.Add(entry.route.handler));
+         PutVarint(routes, strings.Add(entry.route.filter));
+         PutVarint(routes, strings.Add(entry.route.module));
+         PutVarint(routes, strings.Add(entry.route.threadingModel));
+         PutVarint(routes, entry.keys.size());
+
+         for (size_t k = 0; k < entry.keys.size(); ++k)
+         {
+            PutVarint(routes, strings.Add(entry.keys[k].key));
+            PutFixed(routes, entry.keys[k].stamp);
+         }
+      }
+   }
+
+   snapshot.assign(c_snapshotMagic, c_snapshotMagic + sizeof(c_snapshotMagic));
+   strings.Write(snapshot);
+   snapshot.insert(snapshot.end(), routes.begin(), routes.end());
+   PutFixed(snapshot, Fnv1a(&snapshot[0], snapshot.size()));
+}
+
+size_t FilterRouter::Validate(unsigned long now)
+{
+   std::vector<std::wstring> extensions;
+
+   {
+      AutoLock lock(m_lock);
+
+      for (std::map<std::wstring, Entry>::const_iterator it = m_routes.begin(); it != m_routes.end(); ++it)
+         extensions.push_back(it->first);
+   }
+
+   size_t routed = 0;
+
+   for (size_t i = 0; i < extensions.size(); ++i)
+   {
+      Entry entry;
+
+      {
+         AutoLock lock(m_lock);
+
+         std::map<std::wstring, Entry>::iterator it = m_routes.find(extensions[i]);
+
+         if (it == m_routes.end())
+            continue;
+
+         entry = it->second;
+      }
+
+      if (!Current(entry))
+         Resolve(extensions[i], entry);
+
+      entry.checked = true;
+      entry.checkedAt = now;
+
+      if (!entry.route.filter.empty())
+         ++routed;
+
+      // counts taken while this one was being checked aren't lost
+      AutoLock lock(m_lock);
+      std::map<std::wstring, Entry>::iterator it = m_routes.find(extensions[i]);
+
+      if (it != m_routes.end())
+         entry.uses = it->second.uses;
+
+      m_routes[extensions[i]] = entry;
+   }
+
+   return routed;
+}
+
+static bool MoreUses(const std::pair<unsigned long, const FilterRoute *> & a, const std::pair<unsigned long, const FilterRoute *> & b)
+{
+   return a.first > b.first;
+}
+
+void FilterRouter::Hottest(size_t count, std::vector<FilterRoute> & routes) const
+{
+   routes.clear();
+
+   AutoLock lock(m_lock);
+
+   // one filter often serves several extensions, its uses are theirs summed
+   std::map<std::wstring, std::pair<unsigned long, const FilterRoute *> > filters;
+
+   for (std::map<std::wstring, Entry>::const_iterator it = m_routes.begin(); it != m_routes.end(); ++it)
+   {
+      const FilterRoute & route = it->second.route;
+
+      if (route.filter.empty())
+         continue;
+
+      std::pair<unsigned long, const FilterRoute *> & filter = filters[route.filter];
+
+      if (NULL == filter.second)
+         filter.second = &route;
+
+      filter.first += it->second.uses;
+   }
+
+   std::vector<std::pair<unsigned long, const FilterRoute *> > used;
+
+   for (std::map<std::wstring, std::pair<unsigned long, const FilterRoute *> >::const_iterator it = filters.begin(); it != filters.end(); ++it)
+      used.push_back(it->second);
+
+   std::stable_sort(used.begin(), used.end(), MoreUses);
+
+   for (size_t i = 0; i < used.size() && i < count; ++i)
+      routes.push_back(*used[i].second);
+}
+
+size_t FilterRouter::Count() const
+{
+   AutoLock lock(m_lock);
+   return m_routes.size();
+}
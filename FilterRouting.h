@@ -0,0 +1,92 @@
+// FilterRouting.h : Extension to IFilter class and module routes, resolved
+//                   from the registry once and kept in a snapshot that is
+//                   checked against the last write times of the keys they
+//                   came from
+
+#ifndef __FILTERROUTING_H_
+#define __FILTERROUTING_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Sync.h"
+
+// HKEY_CLASSES_ROOT, or a mock of it.
+class RegistrySource
+{
+public:
+   virtual ~RegistrySource() {}
+
+   // A string value of key (name NULL for its default value), environment
+   // variables expanded. False if the key or value isn't there.
+   virtual bool ReadString(const std::wstring & key, const wchar_t *name, std::wstring & value) = 0;
+
+   // The key's last write time, false if the key isn't there.
+   virtual bool LastWrite(const std::wstring & key, unsigned long long *stamp) = 0;
+};
+
+struct FilterRoute
+{
+   std::wstring extension;        // lowercased with its dot, see FilterKey
+   std::wstring handler;          // persistent handler class id
+   std::wstring filter;           // IFilter class id, empty when none is registered
+   std::wstring module;           // the filter's InprocServer32
+   std::wstring threadingModel;
+};
+
+// Resolves an extension the way LoadIFilter does: the extension's
+// PersistentHandler (or that of the class its ProgID names), the handler's
+// IFilter add-in, and the add-in's InprocServer32. Routes are checked
+// against the registry again once they are recheckMs old.
+class FilterRouter
+{
+public:
+   explicit FilterRouter(RegistrySource & registry, unsigned long recheckMs = 60000);
+
+   // False when no filter is registered for extension. Counts a use of the
+   // route for the preload order.
+   bool Route(const std::wstring & extension, unsigned long now, FilterRoute & route);
+
+   // Replaces the routes with a snapshot's. Each one is checked against the
+   // registry before its first use. False if data isn't a snapshot Save wrote.
+   bool Load(const unsigned char *data, size_t cb);
+   void Save(std::vector<unsigned char> & snapshot) const;
+
+   // Checks every route against the registry now, resolving the stale ones
+   // again. Returns the number of extensions with a filter.
+   size_t Validate(unsigned long now);
+
+   // The count most used filters, one route each, most used first.
+   void Hottest(size_t count, std::vector<FilterRoute> & routes) const;
+
+   size_t Count() const;
+
+private:
+   struct KeyStamp
+   {
+      std::wstring key;
+      unsigned long long stamp;      // 0 while the key isn't there
+   };
+
+   struct Entry
+   {
+      FilterRoute route;
+      std::vector<KeyStamp> keys;    // every key the route was read from
+      unsigned long uses;
+      bool checked;
+      unsigned long checkedAt;       // TickMs
+   };
+
+   void Resolve(const std::wstring & extension, Entry & entry);
+   bool Read(Entry & entry, const std::wstring & key, const wchar_t *name, std::wstring & value);
+   bool Current(const Entry & entry);
+
+   RegistrySource & m_registry;
+   unsigned long m_recheckMs;
+
+   mutable CriticalLock m_lock;
+   std::map<std::wstring, Entry> m_routes;
+};
+
+#endif //__FILTERROUTING_H_
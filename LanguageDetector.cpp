@@ -0,0 +1,493 @@
+// LanguageDetector.cpp : Script histograms and character trigrams gathered in
+//                        the same pass as the clean up
+
+#include <string.h>
+
+#include "LanguageDetector.h"
+
+// The twenty most telling trigrams of each language we tell apart by
+// trigrams, '_' marks a word boundary. Scripts used by a single language
+// (Greek, Hangul, Thai...) don't need any.
+struct LanguageProfile
+{
+   const char *language;
+   ScriptCode script;
+   const wchar_t *trigrams;   // twenty of them, back to back
+};
+
+static const LanguageProfile s_profiles[] =
+{
+   { "en", SCRIPT_LATIN,
+        L"_th" L"the" L"he_" L"_an" L"and"
+        L"nd_" L"ing" L"ng_" L"_of" L"of_"
+        L"_to" L"to_" L"ion" L"_in" L"tio"
+        L"ed_" L"er_" L"is_" L"es_" L"_wa" },
+   { "fr", SCRIPT_LATIN,
+        L"_de" L"de_" L"es_" L"_le" L"le_"
+        L"ent" L"_la" L"la_" L"ion" L"les"
+        L"_et" L"et_" L"nt_" L"_qu" L"que"
+        L"ue_" L"re_" L"_pa" L"our" L"_un" },
+   { "de", SCRIPT_LATIN,
+        L"en_" L"er_" L"_de" L"der" L"ein"
+        L"ich" L"sch" L"_di" L"die" L"ie_"
+        L"che" L"_un" L"und" L"nd_" L"cht"
+        L"_ei" L"den" L"gen" L"ung" L"_ge" },
+   { "es", SCRIPT_LATIN,
+        L"_de" L"de_" L"os_" L"_la" L"la_"
+        L"el_" L"_el" L"es_" L"as_" L"que"
+        L"ue_" L"_qu" L"_co" L"ent" L"_en"
+        L"en_" L"i\x00F3n" L"aci" L"ado" L"_lo" },
+   { "it", SCRIPT_LATIN,
+        L"_di" L"di_" L"to_" L"la_" L"_la"
+        L"_de" L"che" L"he_" L"re_" L"_ch"
+        L"zio" L"ion" L"_in" L"ell" L"del"
+        L"lla" L"ato" L"_co" L"one" L"no_" },
+   { "pt", SCRIPT_LATIN,
+        L"_de" L"de_" L"os_" L"_qu" L"que"
+        L"ue_" L"do_" L"da_" L"_co" L"\x00E3o_"
+        L"\x00E7\x00E3o" L"es_" L"_do" L"_da" L"_pa"
+        L"ara" L"com" L"nte" L"_um" L"em_" },
+   { "nl", SCRIPT_LATIN,
+        L"en_" L"_de" L"de_" L"an_" L"_he"
+        L"het" L"et_" L"van" L"_va" L"ing"
+        L"_ee" L"een" L"_en" L"er_" L"ijk"
+        L"sch" L"_in" L"oor" L"_ge" L"aar" },
+   { "sv", SCRIPT_LATIN,
+        L"_oc" L"och" L"ch_" L"en_" L"_de"
+        L"att" L"_at" L"tt_" L"er_" L"ar_"
+        L"f\x00F6r" L"_f\x00F6" L"_so" L"som" L"om_"
+        L"_ha" L"and" L"_en" L"det" L"et_" },
+   { "pl", SCRIPT_LATIN,
+        L"_ni" L"nie" L"ie_" L"_pr" L"prz"
+        L"rze" L"_w_" L"_po" L"ego" L"go_"
+        L"_na" L"na_" L"ch_" L"ych" L"ani"
+        L"_za" L"owa" L"o\x015B\x0107" L"_do" L"_si" },
+   { "ru", SCRIPT_CYRILLIC,
+        L"_\x043F\x0440" L"\x043E\x0433\x043E" L"\x0433\x043E_" L"\x0435\x043D\x0438" L"_\x043F\x043E"
+        L"\x043E\x0441\x0442" L"_\x043D\x0430" L"\x043D\x0430_" L"\x0441\x0442\x0432" L"_\x0438_"
+        L"\x0442\x044C_" L"\x0447\x0442\x043E" L"_\x0447\x0442" L"\x043E\x0432_" L"\x0435\x0442_"
+        L"_\x043D\x0435" L"\x043D\x0435_" L"\x0430\x043D\x0438" L"\x0442\x043E_" L"\x0438\x0438_" },
+   { "uk", SCRIPT_CYRILLIC,
+        L"_\x043F\x0440" L"\x043D\x043D\x044F" L"\x043D\x044F_" L"_\x043D\x0430" L"\x043D\x0430_"
+        L"\x043E\x0433\x043E" L"\x0433\x043E_" L"\x0441\x044C\x043A" L"_\x0432\x0456" L"\x0432\x0456\x0434"
+        L"_\x0456_" L"\x0442\x0438_" L"\x0430\x0442\x0438" L"_\x043F\x043E" L"\x0443\x0432\x0430"
+        L"\x0438\x0441\x044F" L"_\x0437\x0430" L"\x043E\x0457_" L"_\x043D\x0435" L"\x044E\x0442\x044C" },
+
+};
+
+static const size_t s_profileCount = sizeof(s_profiles) / sizeof(s_profiles[0]);
+static const size_t s_trigramsPerProfile = 20;
+
+// Languages that follow from the script alone
+static const char *ScriptLanguage(ScriptCode script)
+{
+   switch (script)
+   {
+      case SCRIPT_GREEK:      return "el";
+      case SCRIPT_ARMENIAN:   return "hy";
+      case SCRIPT_HEBREW:     return "he";
+      case SCRIPT_ARABIC:     return "ar";
+      case SCRIPT_DEVANAGARI: return "hi";
+      case SCRIPT_BENGALI:    return "bn";
+      case SCRIPT_THAI:       return "th";
+      case SCRIPT_GEORGIAN:   return "ka";
+      case SCRIPT_HANGUL:     return "ko";
+      case SCRIPT_KANA:       return "ja";
+      case SCRIPT_HAN:        return "zh";
+      default:                return "und";
+   }
+}
+
+const char *ScriptName(ScriptCode script)
+{
+   static const char *names[SCRIPT_COUNT] =
+   {
+      "Latn", "Grek", "Cyrl", "Armn", "Hebr", "Arab", "Deva",
+      "Beng", "Thai", "Geor", "Hang", "Jpan", "Hani", "Zyyy"
+   };
+
+   return script < SCRIPT_COUNT ? names[script] : "Zyyy";
+}
+
+// Maps the primary language of an LCID to the codes above
+struct LocaleLanguage
+{
+   unsigned short primaryLanguage;
+   const char *language;
+   ScriptCode script;
+};
+
+static const LocaleLanguage s_localeLanguages[] =
+{
+   { 0x01, "ar", SCRIPT_ARABIC },
+   { 0x02, "bg", SCRIPT_CYRILLIC },
+   { 0x04, "zh", SCRIPT_HAN },
+   { 0x05, "cs", SCRIPT_LATIN },
+   { 0x06, "da", SCRIPT_LATIN },
+   { 0x07, "de", SCRIPT_LATIN },
+   { 0x08, "el", SCRIPT_GREEK },
+   { 0x09, "en", SCRIPT_LATIN },
+   { 0x0A, "es", SCRIPT_LATIN },
+   { 0x0B, "fi", SCRIPT_LATIN },
+   { 0x0C, "fr", SCRIPT_LATIN },
+   { 0x0D, "he", SCRIPT_HEBREW },
+   { 0x0E, "hu", SCRIPT_LATIN },
+   { 0x10, "it", SCRIPT_LATIN },
+   { 0x11, "ja", SCRIPT_KANA },
+   { 0x12, "ko", SCRIPT_HANGUL },
+   { 0x13, "nl", SCRIPT_LATIN },
+   { 0x14, "no", SCRIPT_LATIN },
+   { 0x15, "pl", SCRIPT_LATIN },
+   { 0x16, "pt", SCRIPT_LATIN },
+   { 0x19, "ru", SCRIPT_CYRILLIC },
+   { 0x1D, "sv", SCRIPT_LATIN },
+   { 0x1E, "th", SCRIPT_THAI },
+   { 0x1F, "tr", SCRIPT_LATIN },
+   { 0x22, "uk", SCRIPT_CYRILLIC },
+   { 0x2B, "hy", SCRIPT_ARMENIAN },
+   { 0x37, "ka", SCRIPT_GEORGIAN },
+   { 0x39, "hi", SCRIPT_DEVANAGARI },
+   { 0x45, "bn", SCRIPT_BENGALI }
+};
+
+static const LocaleLanguage *FindLocaleLanguage(unsigned long locale)
+{
+   unsigned short primaryLanguage = static_cast<unsigned short>(locale & 0x3FF);
+
+   for (size_t i = 0; i < sizeof(s_localeLanguages) / sizeof(s_localeLanguages[0]); ++i)
+   {
+      if (s_localeLanguages[i].primaryLanguage == primaryLanguage)
+         return &s_localeLanguages[i];
+   }
+
+   return NULL;
+}
+
+// Script of a letter, SCRIPT_COUNT for anything that isn't a letter
+inline static ScriptCode ScriptOf(unsigned long c)
+{
+   if (c < 0x80)
+      return ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') ? SCRIPT_LATIN : SCRIPT_COUNT;
+
+   if (c < 0x250)
+      return (c < 0xC0 || 0xD7 == c || 0xF7 == c) ? SCRIPT_COUNT : SCRIPT_LATIN;
+
+   if (c < 0x370)
+      return SCRIPT_OTHER;    // IPA, spacing modifiers and combining marks
+
+   if (c < 0x400)
+      return SCRIPT_GREEK;
+
+   if (c < 0x530)
+      return SCRIPT_CYRILLIC;
+
+   if (c < 0x590)
+      return SCRIPT_ARMENIAN;
+
+   if (c < 0x600)
+      return SCRIPT_HEBREW;
+
+   if (c < 0x780)
+      return (c >= 0x660 && c <= 0x669) ? SCRIPT_COUNT : SCRIPT_ARABIC;
+
+   if (c >= 0x900 && c < 0x980)
+      return SCRIPT_DEVANAGARI;
+
+   if (c >= 0x980 && c < 0xA00)
+      return SCRIPT_BENGALI;
+
+   if (c >= 0xE00 && c < 0xE80)
+      return SCRIPT_THAI;
+
+   if (c >= 0x10A0 && c < 0x1100)
+      return SCRIPT_GEORGIAN;
+
+   if (c >= 0x1100 && c < 0x1200)
+      return SCRIPT_HANGUL;
+
+   if (c >= 0x1E00 && c < 0x1F00)
+      return SCRIPT_LATIN;
+
+   if (c >= 0x1F00 && c < 0x2000)
+      return SCRIPT_GREEK;
+
+   if (c >= 0x2000 && c < 0x3040)
+      return SCRIPT_COUNT;    // punctuation, symbols, CJK punctuation
+
+   if (c < 0x3100)
+      return SCRIPT_KANA;
+
+   if (c >= 0x3130 && c < 0x3190)
+      return SCRIPT_HANGUL;
+
+   if ((c >= 0x3400 && c < 0x4DC0) || (c >= 0x4E00 && c < 0xA000) || (c >= 0xF900 && c < 0xFB00))
+      return SCRIPT_HAN;
+
+   if (c >= 0xAC00 && c < 0xD7B0)
+      return SCRIPT_HANGUL;
+
+   if (c >= 0xFE30 && c < 0xFF00)
+      return SCRIPT_COUNT;
+
+   return SCRIPT_OTHER;
+}
+
+inline static unsigned long LowerLetter(unsigned long c)
+{
+   if (c >= 'A' && c <= 'Z')
+      return c + 0x20;
+
+   if (c >= 0xC0 && c <= 0xDE && c != 0xD7)
+      return c + 0x20;
+
+   if (c >= 0x391 && c <= 0x3A9)
+      return c + 0x20;
+
+   if (c >= 0x410 && c <= 0x42F)
+      return c + 0x20;
+
+   if (c >= 0x400 && c <= 0x40F)
+      return c + 0x50;
+
+   return c;
+}
+
+inline static unsigned TrigramBucket(unsigned long long window)
+{
+   return static_cast<unsigned>(((window & 0xFFFFFFFFFFFFULL) * 0x9E3779B97F4A7C15ULL) >> 52);
+}
+
+inline static unsigned long long PushCharacter(unsigned long long window, unsigned long c)
+{
+   return (window << 16) | (c & 0xFFFF);
+}
+
+LanguageSink::LanguageSink(size_t maxLength, bool trackChunks)
+   : m_maxLength(maxLength), m_offset(0), m_trackChunks(trackChunks),
+     m_totalTrigrams(0), m_window(0), m_filled(0), m_inChunk(false)
+{
+   memset(m_scripts, 0, sizeof(m_scripts));
+   memset(m_trigrams, 0, sizeof(m_trigrams));
+   memset(m_chunkStart, 0, sizeof(m_chunkStart));
+   memset(&m_chunk, 0, sizeof(m_chunk));
+}
+
+bool LanguageSink::WantsMore() const
+{
+   return 0 == m_maxLength || m_offset <= m_maxLength;
+}
+
+void LanguageSink::OnChunk(const ChunkInfo & chunk)
+{
+   CloseChunk();
+
+   m_inChunk = true;
+   m_chunk.idChunk = chunk.idChunk;
+   m_chunk.locale = chunk.locale;
+   m_chunk.script = SCRIPT_OTHER;
+   m_chunk.letters = 0;
+   memcpy(m_chunkStart, m_scripts, sizeof(m_scripts));
+}
+
+void LanguageSink::OnEnd()
+{
+   CloseChunk();
+}
+
+void LanguageSink::CloseChunk()
+{
+   if (!m_inChunk)
+      return;
+
+   m_inChunk = false;
+
+   unsigned long best = 0;
+
+   for (int i = 0; i < SCRIPT_COUNT; ++i)
+   {
+      unsigned long letters = m_scripts[i] - m_chunkStart[i];
+
+      m_chunk.letters += letters;
+
+      if (letters > best)
+      {
+         best = letters;
+         m_chunk.script = static_cast<ScriptCode>(i);
+      }
+   }
+
+   if (0 == m_chunk.letters)
+      return;
+
+   // tally the chunk's letters against its locale
+   size_t i = 0;
+
+   for (; i < m_locales.size(); ++i)
+   {
+      if (m_locales[i] == m_chunk.locale)
+         break;
+   }
+
+   if (i == m_locales.size())
+   {
+      m_locales.push_back(m_chunk.locale);
+      m_localeLetters.push_back(0);
+   }
+
+   m_localeLetters[i] += m_chunk.letters;
+
+   if (m_trackChunks)
+      m_chunks.push_back(m_chunk);
+}
+
+void LanguageSink::OnText(const wchar_t *text, size_t cch)
+{
+   unsigned long long window = m_window;
+   unsigned filled = m_filled;
+   unsigned long totalTrigrams = m_totalTrigrams;
+
+   for (size_t i = 0; i < cch; ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(text[i]);
+      ScriptCode script = ScriptOf(c);
+
+      if (SCRIPT_COUNT == script)
+      {
+         // word boundary, runs of them count once
+         if (filled && (window & 0xFFFF) == '_')
+            continue;
+
+         c = '_';
+      }
+      else
+      {
+         ++m_scripts[script];
+         c = LowerLetter(c);
+      }
+
+      window = PushCharacter(window, c);
+
+      if (++filled >= 3)
+      {
+         ++m_trigrams[TrigramBucket(window)];
+         ++totalTrigrams;
+      }
+   }
+
+   m_window = window;
+   m_filled = filled > 3 ? 3 : filled;
+   m_totalTrigrams = totalTrigrams;
+   m_offset += cch;
+}
+
+LanguageGuess LanguageSink::Guess() const
+{
+   LanguageGuess guess;
+   guess.language = "und";
+   guess.script = SCRIPT_OTHER;
+   guess.confidence = 0;
+
+   unsigned long letters = 0;
+   unsigned long best = 0;
+
+   for (int i = 0; i < SCRIPT_COUNT; ++i)
+   {
+      letters += m_scripts[i];
+
+      if (m_scripts[i] > best)
+      {
+         best = m_scripts[i];
+         guess.script = static_cast<ScriptCode>(i);
+      }
+   }
+
+   if (0 == letters)
+      return guess;
+
+   // Japanese mixes kana into Han, so any real amount of kana means Japanese
+   if (SCRIPT_HAN == guess.script && m_scripts[SCRIPT_KANA] * 10 > m_scripts[SCRIPT_HAN])
+   {
+      guess.script = SCRIPT_KANA;
+      best += m_scripts[SCRIPT_KANA];
+   }
+
+   double scriptShare = static_cast<double>(best) / letters;
+
+   if (SCRIPT_LATIN == guess.script || SCRIPT_CYRILLIC == guess.script)
+   {
+      unsigned long bestScore = 0;
+      unsigned long secondScore = 0;
+
+      for (size_t p = 0; p < s_profileCount; ++p)
+      {
+         if (s_profiles[p].script != guess.script)
+            continue;
+
+         unsigned long score = 0;
+
+         for (size_t t = 0; t < s_trigramsPerProfile; ++t)
+         {
+            const wchar_t *trigram = s_profiles[p].trigrams + t * 3;
+            unsigned long long window = 0;
+
+            for (int k = 0; k < 3; ++k)
+               window = PushCharacter(window, static_cast<unsigned long>(trigram[k]));
+
+            score += m_trigrams[TrigramBucket(window)];
+         }
+
+         if (score > bestScore)
+         {
+            secondScore = bestScore;
+            bestScore = score;
+            guess.language = s_profiles[p].language;
+         }
+         else if (score > secondScore)
+         {
+            secondScore = score;
+         }
+      }
+
+      if (bestScore)
+      {
+         double margin = static_cast<double>(bestScore - secondScore) / bestScore;
+         double coverage = m_totalTrigrams >= 100 ? 1.0 : m_totalTrigrams / 100.0;
+
+         guess.confidence = scriptShare * coverage * (0.5 + 0.5 * margin);
+      }
+   }
+   else
+   {
+      guess.language = ScriptLanguage(guess.script);
+      guess.confidence = SCRIPT_OTHER == guess.script ? 0 : scriptShare;
+   }
+
+   // when the text itself is inconclusive, go with the locale the filter
+   // reported for most of the letters, if it fits the script
+   if (guess.confidence < 0.25)
+   {
+      unsigned long localeBest = 0;
+      const LocaleLanguage *localeLanguage = NULL;
+
+      for (size_t i = 0; i < m_locales.size(); ++i)
+      {
+         const LocaleLanguage *candidate = FindLocaleLanguage(m_locales[i]);
+
+         if (candidate && candidate->script == guess.script && m_localeLetters[i] > localeBest)
+         {
+            localeBest = m_localeLetters[i];
+            localeLanguage = candidate;
+         }
+      }
+
+      if (localeLanguage)
+      {
+         guess.language = localeLanguage->language;
+
+         if (guess.confidence < 0.5 * scriptShare)
+            guess.confidence = 0.5 * scriptShare;
+      }
+   }
+
+   return guess;
+}
@@ -0,0 +1,91 @@
+// LanguageDetector.h : Guesses the script and language of the cleaned-up text
+//                      from script histograms and character trigrams gathered
+//                      while it streams out of the extraction loop
+
+#ifndef __LANGUAGEDETECTOR_H_
+#define __LANGUAGEDETECTOR_H_
+
+#include <vector>
+
+#include "TextSink.h"
+
+enum ScriptCode
+{
+   SCRIPT_LATIN = 0,
+   SCRIPT_GREEK,
+   SCRIPT_CYRILLIC,
+   SCRIPT_ARMENIAN,
+   SCRIPT_HEBREW,
+   SCRIPT_ARABIC,
+   SCRIPT_DEVANAGARI,
+   SCRIPT_BENGALI,
+   SCRIPT_THAI,
+   SCRIPT_GEORGIAN,
+   SCRIPT_HANGUL,
+   SCRIPT_KANA,
+   SCRIPT_HAN,
+   SCRIPT_OTHER,
+   SCRIPT_COUNT
+};
+
+// ISO 15924 code for the script, "Zyyy" for SCRIPT_OTHER
+const char *ScriptName(ScriptCode script);
+
+struct LanguageGuess
+{
+   const char *language;   // ISO 639-1 code, "und" when there's nothing to go on
+   ScriptCode script;
+   double confidence;      // 0..1
+};
+
+// Dominant script of the letters in one text chunk
+struct ChunkScript
+{
+   unsigned long idChunk;
+   unsigned long locale;   // as reported by the filter
+   ScriptCode script;
+   unsigned long letters;
+};
+
+class LanguageSink : public TextSink
+{
+public:
+   // Like TextBufferSink, stops once more than maxLength (if non-zero)
+   // characters have gone by. trackChunks keeps a ChunkScript per chunk.
+   LanguageSink(size_t maxLength, bool trackChunks);
+
+   virtual void OnChunk(const ChunkInfo & chunk);
+   virtual void OnText(const wchar_t *text, size_t cch);
+   virtual bool WantsMore() const;
+   virtual void OnEnd();
+
+   LanguageGuess Guess() const;
+
+   const std::vector<ChunkScript> & Chunks() const { return m_chunks; }
+
+private:
+   void CloseChunk();
+
+   enum { TRIGRAM_BUCKETS = 4096 };
+
+   size_t m_maxLength;
+   size_t m_offset;
+   bool m_trackChunks;
+
+   unsigned long m_scripts[SCRIPT_COUNT];
+   unsigned long m_trigrams[TRIGRAM_BUCKETS];
+   unsigned long m_totalTrigrams;
+   unsigned long long m_window;  // last three characters, 16 bits each
+   unsigned m_filled;            // characters in the window
+
+   // locale votes, weighted by the letters in each chunk
+   std::vector<unsigned long> m_localeLetters;
+   std::vector<unsigned long> m_locales;
+
+   bool m_inChunk;
+   ChunkScript m_chunk;
+   unsigned long m_chunkStart[SCRIPT_COUNT];
+   std::vector<ChunkScript> m_chunks;
+};
+
+#endif //__LANGUAGEDETECTOR_H_
@@ -0,0 +1,799 @@
+// AppendBench.cpp : Checks ExtractAppendedText against files that grow, get
+//                   rewritten and split characters, then grows a multi-GB
+//                   file and checks each call costs what was appended, on Linux.
+//
+// The checks, run first on files in memory, fail the tool if any of them
+// doesn't hold:
+//  - splits: UTF-8, UTF-16LE and UTF-16BE text with multi-byte characters
+//    and surrogate pairs placed across the 4096-byte decode blocks and the
+//    64 KB reads decodes whole in one call, and in two calls cut at every
+//    byte around those boundaries, where a partial character at the end has
+//    to wait for the rest. In random appends with the state round-tripped
+//    through its token between calls, the deltas add up to the text cleaned
+//    in one go, with the compact profile carrying its blank across calls
+//  - rewrites: a byte changed in the head or just before the offset, a file
+//    truncated, rotated for a longer one, rewritten while still shorter than
+//    the head check, or read with another profile restarts, and gives the
+//    whole new text. Plain appends, and a file that was empty and grew,
+//    don't restart
+//
+// Then it appends generated UTF-8 text to a file on disk, in pieces of up
+// to -a MB cut anywhere, including halfway through a character, until it
+// holds -g GB. After each piece it calls ExtractAppendedText with the state
+// from the last call. Every call has to read no more than what was appended
+// plus the head and tail checks and the partial character it carried, and
+// an idle call is timed at each GB to show it doesn't grow with the file.
+// At the end the deltas have to add up to the generated text, and the big
+// file is rewritten and truncated to check it restarts.
+//
+// The file goes to $TMPDIR, which needs room for -g GB.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o appendbench AppendBench.cpp ../AppendText.cpp ../TokenText.cpp ../PlainText.cpp ../TextCleanup.cpp
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "AppendText.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t c_blockBytes = 4096;     // AppendText.cpp decodes in blocks this big
+static const size_t c_readBytes = 65536;     // and reads this much at a time
+static const size_t c_checkBytes = 4096;     // and hashes this much at the head and the tail
+
+static const char * const c_profileNames[CLEANUP_PROFILES] = { "display", "index", "compact" };
+
+class MemoryReader : public ByteReader
+{
+public:
+   explicit MemoryReader(const std::vector<unsigned char> & bytes) : m_bytes(bytes) {}
+
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb)
+   {
+      if (offset > m_bytes.size() || cb > m_bytes.size() - offset)
+         return false;
+
+      memcpy(buf, &m_bytes[0] + offset, cb);
+      return true;
+   }
+
+private:
+   const std::vector<unsigned char> & m_bytes;
+};
+
+class FileReader : public ByteReader
+{
+public:
+   explicit FileReader(int fd) : m_fd(fd), m_bytesRead(0) {}
+
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb)
+   {
+      while (cb)
+      {
+         ssize_t n = pread(m_fd, buf, cb, static_cast<off_t>(offset));
+
+         if (n < 0 && EINTR == errno)
+            continue;
+
+         if (n <= 0)
+            return false;
+
+         buf += n;
+         cb -= n;
+         offset += n;
+         m_bytesRead += n;
+      }
+
+      return true;
+   }
+
+   unsigned long long BytesRead() const { return m_bytesRead; }
+
+private:
+   int m_fd;
+   unsigned long long m_bytesRead;
+};
+
+class StringSink : public TextSink
+{
+public:
+   virtual void OnText(const wchar_t *text, size_t cch) { m_text.append(text, cch); }
+
+   const std::wstring & Text() const { return m_text; }
+
+private:
+   std::wstring m_text;
+};
+
+// Keeps a hash and a count of the text instead of the text. FNV-1a over the
+// characters, so it doesn't matter how the text is cut up.
+class HashSink : public TextSink
+{
+public:
+   explicit HashSink(unsigned long long limit = 0) : m_limit(limit), m_hash(0xCBF29CE484222325ULL), m_chars(0) {}
+
+   virtual void OnText(const wchar_t *text, size_t cch)
+   {
+      for (size_t i = 0; i < cch; ++i)
+         m_hash = (m_hash ^ static_cast<unsigned long>(text[i])) * 0x100000001B3ULL;
+
+      m_chars += cch;
+   }
+
+   virtual bool WantsMore() const { return 0 == m_limit || m_chars < m_limit; }
+
+   unsigned long long Hash() const { return m_hash; }
+   unsigned long long Chars() const { return m_chars; }
+
+private:
+   unsigned long long m_limit;
+   unsigned long long m_hash;
+   unsigned long long m_chars;
+};
+
+static void Encode(TextEncoding encoding, const wchar_t *text, size_t cch, std::vector<unsigned char> & bytes)
+{
+   for (size_t i = 0; i < cch; ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(text[i]);
+
+      if (TEXT_ENCODING_UTF8 == encoding)
+      {
+         if (c < 0x80)
+         {
+            bytes.push_back(static_cast<unsigned char>(c));
+         }
+         else if (c < 0x800)
+         {
+            bytes.push_back(static_cast<unsigned char>(0xC0 | c >> 6));
+            bytes.push_back(static_cast<unsigned char>(0x80 | (c & 0x3F)));
+         }
+         else if (c < 0x10000)
+         {
+            bytes.push_back(static_cast<unsigned char>(0xE0 | c >> 12));
+            bytes.push_back(static_cast<unsigned char>(0x80 | (c >> 6 & 0x3F)));
+            bytes.push_back(static_cast<unsigned char>(0x80 | (c & 0x3F)));
+         }
+         else
+         {
+            bytes.push_back(static_cast<unsigned char>(0xF0 | c >> 18));
+            bytes.push_back(static_cast<unsigned char>(0x80 | (c >> 12 & 0x3F)));
+            bytes.push_back(static_cast<unsigned char>(0x80 | (c >> 6 & 0x3F)));
+            bytes.push_back(static_cast<unsigned char>(0x80 | (c & 0x3F)));
+         }
+
+         continue;
+      }
+
+      unsigned long units[2] = { c, 0 };
+      int n = 1;
+
+      if (c > 0xFFFF)
+      {
+         units[0] = 0xD800 + ((c - 0x10000) >> 10);
+         units[1] = 0xDC00 + ((c - 0x10000) & 0x3FF);
+         n = 2;
+      }
+
+      for (int u = 0; u < n; ++u)
+      {
+         unsigned char lo = static_cast<unsigned char>(units[u]);
+         unsigned char hi = static_cast<unsigned char>(units[u] >> 8);
+         bytes.push_back(TEXT_ENCODING_UTF16LE == encoding ? lo : hi);
+         bytes.push_back(TEXT_ENCODING_UTF16LE == encoding ? hi : lo);
+      }
+   }
+}
+
+// Words of ASCII, Latin-1, Cyrillic, CJK and emoji, so UTF-8 takes one to
+// four bytes a character, with blanks, line breaks and tabs between them.
+// The same seed gives the same text.
+class TextStream
+{
+public:
+   explicit TextStream(unsigned long long seed) : m_state(seed | 1) {}
+
+   void Next(std::wstring & text, size_t cch)
+   {
+      for (size_t i = 0; i < cch; ++i)
+      {
+         m_state ^= m_state << 13;
+         m_state ^= m_state >> 7;
+         m_state ^= m_state << 17;
+         unsigned long r = static_cast<unsigned long>(m_state >> 24);
+
+         switch (r % 32)
+         {
+            case 0:           text += static_cast<wchar_t>(0x1F300 + (r >> 5) % 0x300); break;
+            case 1:  case 2:  text += static_cast<wchar_t>(0x4E00 + (r >> 5) % 0x5000); break;
+            case 3:           text += static_cast<wchar_t>(0x0430 + (r >> 5) % 32); break;
+            case 4:           text += static_cast<wchar_t>(0xC0 + (r >> 5) % 0x40); break;
+            case 5:  case 6:
+            case 7:           text += L' '; break;
+            case 8:           text += 0 == (r >> 5) % 4 ? L"\r\n" : L"  "; break;
+            case 9:           text += L'\t'; break;
+            default:          text += static_cast<wchar_t>(L'a' + (r >> 5) % 26); break;
+         }
+      }
+   }
+
+private:
+   unsigned long long m_state;
+};
+
+static std::wstring Clean(CleanupProfile profile, const std::wstring & text)
+{
+   std::vector<wchar_t> buf(text.begin(), text.end());
+   buf.push_back(0);
+
+   CleanupState state;
+   size_t cch = GetCleanupFunction(profile)(text.length(), &buf[0], state);
+   return std::wstring(&buf[0], cch);
+}
+
+// Appends text and returns where in the file it starts.
+static size_t Add(TextEncoding encoding, const std::wstring & text, std::wstring & whole, std::vector<unsigned char> & bytes)
+{
+   size_t at = bytes.size();
+   whole += text;
+   Encode(encoding, text.data(), text.length(), bytes);
+   return at;
+}
+
+// Pads with ASCII up to offset, then adds ch there, so it straddles a
+// boundary a byte or two further on.
+static void Place(TextEncoding encoding, size_t offset, wchar_t ch, std::wstring & whole, std::vector<unsigned char> & bytes)
+{
+   while (bytes.size() < offset)
+      Add(encoding, std::wstring(1, 0 == bytes.size() % 80 ? L'\n' : L'p'), whole, bytes);
+
+   Add(encoding, std::wstring(1, ch), whole, bytes);
+}
+
+struct TestFile
+{
+   const char *name;
+   TextEncoding encoding;
+   std::vector<unsigned char> bytes;
+   std::wstring text;                  // what the bytes decode to
+   std::vector<size_t> boundaries;     // bytes cut around for the split checks
+};
+
+static TestFile MakeTestFile(const char *name, TextEncoding encoding, unsigned long long seed)
+{
+   TestFile file;
+   file.name = name;
+   file.encoding = encoding;
+
+   // a byte order mark for UTF-16, UTF-8 has to be sniffed
+   if (TEXT_ENCODING_UTF16LE == encoding)
+   {
+      file.bytes.push_back(0xFF);
+      file.bytes.push_back(0xFE);
+   }
+   else if (TEXT_ENCODING_UTF16BE == encoding)
+   {
+      file.bytes.push_back(0xFE);
+      file.bytes.push_back(0xFF);
+   }
+
+   const size_t base = file.bytes.size();
+
+   TextStream stream(seed);
+   std::wstring text;
+   stream.Next(text, 500);
+   Add(encoding, text, file.text, file.bytes);
+
+   // an emoji across the first decode block, CJK and Latin-1 across the
+   // first read, an emoji across the second read; blocks and reads count
+   // from after the byte order mark
+   const bool utf8 = TEXT_ENCODING_UTF8 == encoding;
+   const wchar_t c_emoji = static_cast<wchar_t>(0x1F600);
+
+   Place(encoding, base + c_blockBytes - 2, c_emoji, file.text, file.bytes);
+   Place(encoding, base + c_readBytes - (utf8 ? 1 : 2), static_cast<wchar_t>(0x6587), file.text, file.bytes);
+   Place(encoding, base + c_readBytes + c_blockBytes - (utf8 ? 1 : 2), static_cast<wchar_t>(0x00E9), file.text, file.bytes);
+   Place(encoding, base + 2 * c_readBytes - 2, c_emoji, file.text, file.bytes);
+
+   text.clear();
+   stream.Next(text, 100000);
+   Add(encoding, text, file.text, file.bytes);
+
+   static const size_t c_boundaries[] = { c_blockBytes, c_readBytes, c_readBytes + c_blockBytes, 2 * c_readBytes };
+
+   for (size_t b = 0; b < sizeof(c_boundaries) / sizeof(c_boundaries[0]); ++b)
+      file.boundaries.push_back(base + c_boundaries[b]);
+
+   return file;
+}
+
+static std::vector<unsigned char> Prefix(const std::vector<unsigned char> & bytes, size_t cb)
+{
+   return std::vector<unsigned char>(bytes.begin(), bytes.begin() + cb);
+}
+
+// Extracts bytes with state and appends the delta to text.
+static AppendResult Extract(const std::vector<unsigned char> & bytes, CleanupProfile profile, AppendState & state,
+                            std::wstring & text)
+{
+   MemoryReader reader(bytes);
+   StringSink sink;
+   AppendResult result = ExtractAppendedText(reader, bytes.size(), profile, state, sink);
+   text += sink.Text();
+   return result;
+}
+
+static bool RoundTrip(AppendState & state)
+{
+   std::wstring token = EncodeAppendState(state);
+   return DecodeAppendState(token.data(), token.length(), state);
+}
+
+static int CheckSplits()
+{
+   int failures = 0;
+
+   static const struct
+   {
+      const char *name;
+      TextEncoding encoding;
+   } c_encodings[] = { { "utf-8", TEXT_ENCODING_UTF8 }, { "utf-16le", TEXT_ENCODING_UTF16LE }, { "utf-16be", TEXT_ENCODING_UTF16BE } };
+
+   for (size_t e = 0; e < sizeof(c_encodings) / sizeof(c_encodings[0]); ++e)
+   {
+      TestFile file = MakeTestFile(c_encodings[e].name, c_encodings[e].encoding, e + 1);
+
+      for (int p = 0; p < CLEANUP_PROFILES; ++p)
+      {
+         CleanupProfile profile = static_cast<CleanupProfile>(p);
+         std::wstring expected = Clean(profile, file.text);
+         int before = failures;
+
+         // in one go
+         AppendState state;
+         InitAppendState(state, profile);
+         std::wstring text;
+
+         if (APPEND_DELTA != Extract(file.bytes, profile, state, text) || text != expected || state.offset != file.bytes.size())
+         {
+            printf("%-8s %-7s doesn't decode whole in one call\n", file.name, c_profileNames[p]);
+            ++failures;
+         }
+
+         // in two, cut at every byte around each boundary
+         for (size_t b = 0; b < file.boundaries.size(); ++b)
+         {
+            for (size_t cut = file.boundaries[b] - 6; cut <= file.boundaries[b] + 6; ++cut)
+            {
+               InitAppendState(state, profile);
+               text.clear();
+
+               AppendResult first = Extract(Prefix(file.bytes, cut), profile, state, text);
+               unsigned long long waiting = cut - state.offset;   // bytes of a partial character left for later
+
+               bool ok = APPEND_DELTA == first && RoundTrip(state) && waiting < 4 &&
+                         APPEND_DELTA == Extract(file.bytes, profile, state, text) && text == expected;
+
+               if (!ok)
+               {
+                  printf("%-8s %-7s cut at byte %lu: the two deltas don't add up\n", file.name, c_profileNames[p],
+                         static_cast<unsigned long>(cut));
+                  ++failures;
+                  break;
+               }
+            }
+         }
+
+         // in random appends, the state through its token each time
+         InitAppendState(state, profile);
+         text.clear();
+         unsigned long seed = 11 + p;
+         size_t size = 0;
+         size_t calls = 0;
+
+         while (size < file.bytes.size())
+         {
+            seed = (seed * 1103515245 + 12345) & 0x7FFFFFFF;
+            static const size_t c_steps[] = { 1, 2, 3, 5, 4095, 4097, 65535, 65537, 100000 };
+            size = std::min(file.bytes.size(), size + c_steps[(seed >> 8) % (sizeof(c_steps) / sizeof(c_steps[0]))]);
+
+            if (APPEND_DELTA != Extract(Prefix(file.bytes, size), profile, state, text) || !RoundTrip(state))
+            {
+               printf("%-8s %-7s an append at byte %lu restarts\n", file.name, c_profileNames[p], static_cast<unsigned long>(size));
+               ++failures;
+               break;
+            }
+
+            ++calls;
+         }
+
+         if (text != expected)
+         {
+            printf("%-8s %-7s %lu random appends don't add up\n", file.name, c_profileNames[p], static_cast<unsigned long>(calls));
+            ++failures;
+         }
+
+         if (before == failures && CLEANUP_DISPLAY == profile)
+            printf("%-8s %lu bytes decode the same whole, cut around each boundary and in %lu random appends\n",
+                   file.name, static_cast<unsigned long>(file.bytes.size()), static_cast<unsigned long>(calls));
+      }
+   }
+
+   return failures;
+}
+
+static int CheckRewrites()
+{
+   int failures = 0;
+   TestFile file = MakeTestFile("utf-8", TEXT_ENCODING_UTF8, 1);
+   const size_t c_seen = 200000;
+
+   // state after two calls, the second ending at c_seen
+   AppendState seen;
+   InitAppendState(seen, CLEANUP_DISPLAY);
+   std::wstring text;
+   Extract(Prefix(file.bytes, 1000), CLEANUP_DISPLAY, seen, text);
+   Extract(Prefix(file.bytes, c_seen), CLEANUP_DISPLAY, seen, text);
+
+   struct Rewrite
+   {
+      const char *name;
+      std::vector<unsigned char> bytes;
+      CleanupProfile profile;
+      AppendResult expected;
+   };
+
+   std::vector<Rewrite> rewrites;
+
+   Rewrite appended = { "appended", file.bytes, CLEANUP_DISPLAY, APPEND_DELTA };
+   rewrites.push_back(appended);
+
+   Rewrite head = { "head changed", file.bytes, CLEANUP_DISPLAY, APPEND_RESTARTED };
+   head.bytes[100] = 'Q';
+   rewrites.push_back(head);
+
+   Rewrite tail = { "tail changed", file.bytes, CLEANUP_DISPLAY, APPEND_RESTARTED };
+   tail.bytes[seen.offset - 10] = 'Q';
+   rewrites.push_back(tail);
+
+   Rewrite truncated = { "truncated", Prefix(file.bytes, c_seen / 2), CLEANUP_DISPLAY, APPEND_RESTARTED };
+   rewrites.push_back(truncated);
+
+   // a new file in its place, longer than the old one was
+   Rewrite rotated = { "rotated", MakeTestFile("rotated", TEXT_ENCODING_UTF8, 7).bytes, CLEANUP_DISPLAY, APPEND_RESTARTED };
+   rotated.bytes.insert(rotated.bytes.end(), file.bytes.begin(), file.bytes.end());
+   rewrites.push_back(rotated);
+
+   Rewrite profile = { "other profile", file.bytes, CLEANUP_COMPACT, APPEND_RESTARTED };
+   rewrites.push_back(profile);
+
+   for (size_t r = 0; r < rewrites.size(); ++r)
+   {
+      AppendState state = seen;
+      std::wstring delta;
+
+      RoundTrip(state);
+      AppendResult result = Extract(rewrites[r].bytes, rewrites[r].profile, state, delta);
+
+      std::wstring whole;
+      AppendState fresh;
+      InitAppendState(fresh, rewrites[r].profile);
+      Extract(rewrites[r].bytes, rewrites[r].profile, fresh, whole);
+
+      std::wstring expected = APPEND_DELTA == rewrites[r].expected ? whole.substr(text.length()) : whole;
+
+      // a truncated file can end halfway through a character
+      if (result != rewrites[r].expected || delta != expected || rewrites[r].bytes.size() - state.offset >= 4)
+      {
+         printf("%-14s gives %s, not %s with the %s\n", rewrites[r].name, APPEND_DELTA == result ? "a delta" : "a restart",
+                APPEND_DELTA == rewrites[r].expected ? "a delta" : "a restart",
+                APPEND_DELTA == rewrites[r].expected ? "appended text" : "whole new text");
+         ++failures;
+      }
+   }
+
+   // shorter than the head check: the head hash covers all of it
+   {
+      std::vector<unsigned char> small(file.bytes.begin(), file.bytes.begin() + 1000);
+      AppendState state;
+      InitAppendState(state, CLEANUP_DISPLAY);
+      std::wstring first;
+      Extract(small, CLEANUP_DISPLAY, state, first);
+
+      small[500] = 'Q';
+      small.push_back('z');
+      std::wstring again;
+
+      if (APPEND_RESTARTED != Extract(small, CLEANUP_DISPLAY, state, again) || again.length() < first.length())
+      {
+         printf("%-14s a small file rewritten and grown doesn't restart\n", "small");
+         ++failures;
+      }
+   }
+
+   // nothing to sniff at first, then text
+   {
+      std::vector<unsigned char> empty;
+      AppendState state;
+      InitAppendState(state, CLEANUP_DISPLAY);
+      std::wstring first;
+      std::wstring later;
+
+      bool ok = APPEND_DELTA == Extract(empty, CLEANUP_DISPLAY, state, first) && first.empty() && RoundTrip(state) &&
+                APPEND_DELTA == Extract(file.bytes, CLEANUP_DISPLAY, state, later) && later == Clean(CLEANUP_DISPLAY, file.text);
+
+      if (!ok)
+      {
+         printf("%-14s a file that was empty and grew doesn't give all its text\n", "empty");
+         ++failures;
+      }
+   }
+
+   if (!failures)
+      printf("head and tail changes, truncation, rotation and profile changes restart, appends don't\n");
+
+   return failures;
+}
+
+static unsigned long long FileSize(int fd)
+{
+   struct stat st;
+   return 0 == fstat(fd, &st) ? static_cast<unsigned long long>(st.st_size) : 0;
+}
+
+static bool WriteAll(int fd, const unsigned char *data, size_t cb)
+{
+   while (cb)
+   {
+      ssize_t n = write(fd, data, cb);
+
+      if (n < 0 && EINTR == errno)
+         continue;
+
+      if (n <= 0)
+         return false;
+
+      data += n;
+      cb -= n;
+   }
+
+   return true;
+}
+
+// Calls ExtractAppendedText on the file, the state going through its token
+// like it does between calls to the component.
+static AppendResult Extract(int fd, CleanupProfile profile, std::wstring & token, HashSink & sink,
+                            unsigned long long *bytesRead)
+{
+   AppendState state;
+   InitAppendState(state, profile);
+
+   if (!token.empty() && !DecodeAppendState(token.data(), token.length(), state))
+      return APPEND_READ_ERROR;
+
+   FileReader reader(fd);
+   AppendResult result = ExtractAppendedText(reader, FileSize(fd), profile, state, sink);
+   token = EncodeAppendState(state);
+   *bytesRead = reader.BytesRead();
+   return result;
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned long long gigabytes = 4;
+   unsigned long long appendMB = 64;
+   CleanupProfile profile = CLEANUP_COMPACT;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "g:a:p:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'g': gigabytes = strtoull(optarg, NULL, 10); break;
+         case 'a': appendMB = strtoull(optarg, NULL, 10); break;
+
+         case 'p':
+            for (int p = 0; p < CLEANUP_PROFILES; ++p)
+            {
+               if (0 == strcmp(optarg, c_profileNames[p]))
+                  profile = static_cast<CleanupProfile>(p);
+            }
+            break;
+
+         default:
+            fprintf(stderr,
+               "usage: appendbench [options]\n"
+               "  -g GB     how big the file grows (default: 4)\n"
+               "  -a MB     the most appended between calls (default: 64)\n"
+               "  -p NAME   folding profile: display, index or compact (default: compact)\n");
+            return 2;
+      }
+   }
+
+   if (0 == gigabytes)
+      gigabytes = 1;
+
+   if (0 == appendMB)
+      appendMB = 1;
+
+   int failures = CheckSplits() + CheckRewrites();
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   const char *tmp = getenv("TMPDIR");
+   std::string path = std::string(tmp && *tmp ? tmp : "/tmp") + "/appendbenchXXXXXX";
+   int fd = mkstemp(&path[0]);
+
+   if (fd < 0)
+   {
+      perror("mkstemp");
+      return 1;
+   }
+
+   const unsigned long long target = gigabytes * 1024 * 1024 * 1024;
+   const unsigned long long maxAppend = appendMB * 1024 * 1024;
+
+   TextStream stream(5);
+   CleanupFunction cleanUp = GetCleanupFunction(profile);
+   CleanupState cleanupState;
+   HashSink expected;               // the generated text, cleaned as it's generated
+   HashSink extracted;              // the deltas
+   std::wstring token;
+
+   std::vector<unsigned char> pending;   // generated, not written yet
+   std::wstring piece;
+   unsigned long long written = 0;
+   unsigned long long extractTotal = 0;
+   double extractSeconds = 0;
+   unsigned long calls = 0;
+   unsigned long long nextReport = 1024ULL * 1024 * 1024;
+   unsigned long seed = 3;
+
+   printf("\n%10s %8s %14s %14s %16s\n", "file MB", "calls", "delta MB/s", "idle call us", "idle call reads");
+
+   while (written < target)
+   {
+      seed = (seed * 1103515245 + 12345) & 0x7FFFFFFF;
+      size_t cb = static_cast<size_t>(1 + (static_cast<unsigned long long>(seed) << 8) % maxAppend);
+      cb = static_cast<size_t>(std::min<unsigned long long>(cb, target - written));
+
+      while (pending.size() < cb)
+      {
+         piece.clear();
+         stream.Next(piece, 65536);
+
+         Encode(TEXT_ENCODING_UTF8, piece.data(), piece.length(), pending);
+
+         // an extra NUL, the kernels null terminate
+         piece.push_back(0);
+         size_t cch = cleanUp(piece.length() - 1, &piece[0], cleanupState);
+         expected.OnText(piece.data(), cch);
+      }
+
+      if (!WriteAll(fd, &pending[0], cb))
+      {
+         perror("write");
+         failures = 1;
+         break;
+      }
+
+      pending.erase(pending.begin(), pending.begin() + cb);
+      written += cb;
+
+      unsigned long long bytesRead = 0;
+      Clock::time_point start = Clock::now();
+      AppendResult result = Extract(fd, profile, token, extracted, &bytesRead);
+      extractSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+      extractTotal += cb;
+      ++calls;
+
+      // what was appended, the partial character carried from the last call
+      // and its read, the head and tail hashes
+      if (APPEND_DELTA != result || bytesRead > cb + c_readBytes + 3 * c_checkBytes)
+      {
+         printf("call %lu after %llu bytes appended: %s, read %llu bytes\n", calls, static_cast<unsigned long long>(cb),
+                APPEND_DELTA == result ? "a delta" : "no delta", bytesRead);
+         ++failures;
+         break;
+      }
+
+      if (written >= nextReport || written == target)
+      {
+         // nothing appended: the head and tail checks, and a partial
+         // character at the end if the last piece stopped halfway through one
+         HashSink idle;
+         std::wstring idleToken = token;
+         start = Clock::now();
+         result = Extract(fd, profile, idleToken, idle, &bytesRead);
+         double idleUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+         if (APPEND_DELTA != result || 0 != idle.Chars() || idleToken != token || bytesRead > 3 * c_checkBytes + 3)
+         {
+            printf("an idle call at %llu MB reads %llu bytes\n", written >> 20, bytesRead);
+            ++failures;
+         }
+
+         printf("%10llu %8lu %14.0f %14.0f %16llu\n", written >> 20, calls, extractTotal / 1048576.0 / extractSeconds,
+                idleUs, bytesRead);
+
+         extractTotal = 0;
+         extractSeconds = 0;
+         nextReport += 1024ULL * 1024 * 1024;
+      }
+   }
+
+   if (!failures)
+   {
+      // the text was cleaned a generated piece at a time, ahead of the
+      // writes; the rest of the last piece lines the two up
+      if (!pending.empty())
+      {
+         WriteAll(fd, &pending[0], pending.size());
+         unsigned long long bytesRead = 0;
+         Extract(fd, profile, token, extracted, &bytesRead);
+      }
+
+      if (extracted.Chars() != expected.Chars() || extracted.Hash() != expected.Hash())
+      {
+         printf("the deltas come to %llu characters, hash %016llx, the text %llu, hash %016llx\n", extracted.Chars(),
+                extracted.Hash(), expected.Chars(), expected.Hash());
+         ++failures;
+      }
+      else
+      {
+         printf("%lu calls, the deltas add up to the %llu characters written\n", calls, expected.Chars());
+      }
+   }
+
+   if (!failures)
+   {
+      // rewritten near the start, then truncated: both restart, a MB of the
+      // new text is enough to tell
+      unsigned char q = 'Q';
+      unsigned long long bytesRead = 0;
+
+      HashSink rewritten(1024 * 1024);
+      std::wstring rewrittenToken = token;
+      bool ok = 1 == pwrite(fd, &q, 1, 100) && APPEND_RESTARTED == Extract(fd, profile, rewrittenToken, rewritten, &bytesRead);
+
+      HashSink truncated(1024 * 1024);
+      ok = ok && 0 == ftruncate(fd, static_cast<off_t>(FileSize(fd) / 2)) &&
+           APPEND_RESTARTED == Extract(fd, profile, token, truncated, &bytesRead);
+
+      if (!ok || 0 == rewritten.Chars() || 0 == truncated.Chars())
+      {
+         printf("the big file rewritten or truncated doesn't restart\n");
+         ++failures;
+      }
+      else
+      {
+         printf("the big file rewritten and truncated restarts\n");
+      }
+   }
+
+   close(fd);
+   unlink(path.c_str());
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   return 0;
+}
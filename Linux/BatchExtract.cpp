@@ -0,0 +1,314 @@
+// BatchExtract.cpp : Command line batch extractor for Linux boxes.
+//
+// Reads a list of files (or walks a directory tree), extracts the text of each
+// through the built-in plain text path and the same CleanUpCharacters folding
+// (or one of the index/compact profiles) the COM component uses, and writes one NDJSON record per file:
+//
+//    {"path":"...","status":"ok","length":1234,"text":"..."}
+//
+// status is one of ok, truncated, unsupported (not text) or error.
+// Throughput (files/sec and MB/sec) is reported on stderr at the end.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -pthread -I.. -o batchextract BatchExtract.cpp Prefetch.cpp ../PlainText.cpp ../TextCleanup.cpp
+
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Ndjson.h"
+#include "Prefetch.h"
+#include "PlainText.h"
+
+// Loaded files waiting for a worker. Bounded so the reader can't run away
+// from the workers and pull the whole tree into memory.
+class LoadedQueue
+{
+public:
+   explicit LoadedQueue(size_t capacity) : m_capacity(capacity), m_closed(false) {}
+
+   void Push(LoadedFile & file)
+   {
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_notFull.wait(lock, [this] { return m_items.size() < m_capacity; });
+      m_items.push_back(std::move(file));
+      m_notEmpty.notify_one();
+   }
+
+   bool Pop(LoadedFile & file)
+   {
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_notEmpty.wait(lock, [this] { return !m_items.empty() || m_closed; });
+
+      if (m_items.empty())
+         return false;
+
+      file = std::move(m_items.front());
+      m_items.pop_front();
+      m_notFull.notify_one();
+      return true;
+   }
+
+   void Close()
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_closed = true;
+      m_notEmpty.notify_all();
+   }
+
+private:
+   size_t m_capacity;
+   bool m_closed;
+   std::deque<LoadedFile> m_items;
+   std::mutex m_lock;
+   std::condition_variable m_notEmpty;
+   std::condition_variable m_notFull;
+};
+
+static std::vector<std::string> *s_walkPaths = NULL;
+
+static int CollectFile(const char *path, const struct stat *, int type, struct FTW *)
+{
+   if (FTW_F == type)
+      s_walkPaths->push_back(path);
+
+   return 0;
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: batchextract [options] [file...]\n"
+      "  -l FILE   read the paths to extract from FILE, one per line (- for stdin)\n"
+      "  -r DIR    extract every regular file under DIR\n"
+      "  -j N      number of worker threads (default: number of CPUs)\n"
+      "  -q N      number of reads kept in flight (default: 4 per worker)\n"
+      "  -m N      stop after more than N characters per file (default: no limit)\n"
+      "  -p NAME   folding profile: display, index or compact (default: display)\n"
+      "  -o FILE   write the NDJSON records to FILE instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+   std::vector<std::string> paths;
+   unsigned workers = std::thread::hardware_concurrency();
+   unsigned depth = 0;
+   size_t maxLength = 0;
+   CleanupProfile profile = CLEANUP_DISPLAY;
+   const char *outName = NULL;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "l:r:j:q:m:p:o:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'l':
+         {
+            std::ifstream listFile;
+            std::istream *list = &std::cin;
+
+            if (strcmp(optarg, "-") != 0)
+            {
+               listFile.open(optarg);
+
+               if (!listFile)
+               {
+                  fprintf(stderr, "batchextract: can't open %s: %s\n", optarg, strerror(errno));
+                  return 2;
+               }
+
+               list = &listFile;
+            }
+
+            std::string line;
+
+            while (std::getline(*list, line))
+            {
+               if (!line.empty())
+                  paths.push_back(line);
+            }
+            break;
+         }
+
+         case 'r':
+            s_walkPaths = &paths;
+
+            if (nftw(optarg, CollectFile, 64, FTW_PHYS) != 0)
+            {
+               fprintf(stderr, "batchextract: can't walk %s: %s\n", optarg, strerror(errno));
+               return 2;
+            }
+            break;
+
+         case 'j':
+            workers = static_cast<unsigned>(strtoul(optarg, NULL, 10));
+            break;
+
+         case 'q':
+            depth = static_cast<unsigned>(strtoul(optarg, NULL, 10));
+            break;
+
+         case 'm':
+            maxLength = static_cast<size_t>(strtoull(optarg, NULL, 10));
+            break;
+
+         case 'p':
+            if (0 == strcmp(optarg, "display"))
+               profile = CLEANUP_DISPLAY;
+            else if (0 == strcmp(optarg, "index"))
+               profile = CLEANUP_INDEX;
+            else if (0 == strcmp(optarg, "compact"))
+               profile = CLEANUP_COMPACT;
+            else
+            {
+               Usage();
+               return 2;
+            }
+            break;
+
+         case 'o':
+            outName = optarg;
+            break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   for (int i = optind; i < argc; ++i)
+      paths.push_back(argv[i]);
+
+   if (paths.empty())
+   {
+      Usage();
+      return 2;
+   }
+
+   if (0 == workers)
+      workers = 1;
+
+   if (0 == depth)
+      depth = workers * 4;
+
+   FILE *out = stdout;
+
+   if (outName && NULL == (out = fopen(outName, "w")))
+   {
+      fprintf(stderr, "batchextract: can't create %s: %s\n", outName, strerror(errno));
+      return 2;
+   }
+
+   // A UTF-8 character is at most four bytes, and ExtractPlainText appends a
+   // whole block past maxLength, so this much input always covers the output.
+   size_t readLimit = maxLength ? maxLength * 4 + 8192 : 0;
+
+   Prefetcher prefetcher(depth, readLimit);
+   LoadedQueue queue(depth);
+   std::mutex outLock;
+
+   unsigned long long bytesRead = 0;
+   unsigned long long failed = 0;
+
+   std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+   std::thread reader([&]
+   {
+      prefetcher.Run(paths, [&](LoadedFile & file)
+      {
+         bytesRead += file.data.size();
+         queue.Push(file);
+      });
+
+      queue.Close();
+   });
+
+   std::vector<std::thread> pool;
+
+   for (unsigned i = 0; i < workers; ++i)
+   {
+      pool.push_back(std::thread([&]
+      {
+         LoadedFile file;
+         std::wstring text;
+         std::string record;
+
+         while (queue.Pop(file))
+         {
+            const char *status = "ok";
+            bool truncated = false;
+
+            text.clear();
+
+            if (file.error)
+               status = "error";
+            else if (!ExtractPlainText(file.data.empty() ? NULL : &file.data[0], file.data.size(), maxLength, profile, text, &truncated))
+               status = "unsupported";
+            else if (truncated)
+               status = "truncated";
+
+            record.clear();
+            record += "{\"path\":";
+            AppendJsonString(record, file.path);
+            record += ",\"status\":\"";
+            record += status;
+            record += "\",\"length\":";
+            record += std::to_string(text.length());
+
+            if (file.error)
+            {
+               record += ",\"error\":";
+               AppendJsonString(record, std::string(strerror(file.error)));
+            }
+            else
+            {
+               record += ",\"text\":";
+               AppendJsonString(record, text);
+            }
+
+            record += "}\n";
+
+            std::lock_guard<std::mutex> lock(outLock);
+            fwrite(record.data(), 1, record.length(), out);
+
+            if (file.error)
+               ++failed;
+         }
+      }));
+   }
+
+   reader.join();
+
+   for (size_t i = 0; i < pool.size(); ++i)
+      pool[i].join();
+
+   fflush(out);
+
+   if (out != stdout)
+      fclose(out);
+
+   double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+   if (seconds <= 0)
+      seconds = 1e-9;
+
+   fprintf(stderr, "batchextract: %zu files (%llu failed), %.1f MB in %.3f s using %s: %.1f files/sec, %.1f MB/sec\n",
+           paths.size(), failed, bytesRead / 1048576.0, seconds,
+           prefetcher.UsingUring() ? "io_uring" : "pread",
+           paths.size() / seconds, bytesRead / 1048576.0 / seconds);
+
+   return failed ? 1 : 0;
+}
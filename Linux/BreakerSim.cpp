@@ -0,0 +1,303 @@
+// BreakerSim.cpp : Drives the filter circuit breaker with fault-injecting mock filters on Linux.
+//
+// First checks IsFilterFault against a table of the status codes filters
+// and the loading of them return, at each stage, and fails if any of them
+// is counted the wrong way.
+//
+// Simulated time, no sleeping: calls arrive for each mock filter at a steady
+// rate for an hour and report back to the breaker when they finish. Each
+// filter goes through a scripted fault phase, failing outright with the
+// status code it's given or hanging past the slow limit, then recovers.
+// One only ever gets files that fail on their own (password protected),
+// which the breaker ignores and must not open on. Outcomes go through
+// IsFilterFault the way FilterText sends them. Every call is run once straight through the filter and once through
+// HealthTracker, which falls back to the built-in path (cheap, counted
+// separately) while the breaker is open. Prints every breaker state change,
+// then per filter the time burned in failing calls with and without the
+// breaker, and how long after recovery it closed again.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o breakersim BreakerSim.cpp ../FilterHealth.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FilterHealth.h"
+
+struct MockFilter
+{
+   const wchar_t *key;
+   const char *name;
+   unsigned long normalMs;     // typical call
+   unsigned long faultStart;   // seconds into the run
+   unsigned long faultEnd;
+   bool hangs;                 // the fault hangs instead of failing fast
+   double faultRate;           // share of calls that fail during the fault
+   FilterStatus faultHr;       // what the failing calls return
+   double fileErrorRate;       // share of calls whose file fails, saying nothing about the filter
+   FilterStatus fileHr;        // what those return
+};
+
+static const MockFilter s_filters[] =
+{
+   { L".txt", "txt (healthy)", 20, 0, 0, false, 0, S_OK, 0, S_OK },
+   { L".pdf", "pdf (errors)", 400, 600, 1500, false, 0.9, E_FAIL, 0, S_OK },
+   { L".doc", "doc (hangs)", 250, 1200, 1800, true, 0.6, S_OK, 0, S_OK },
+   { L".xls", "xls (flaky)", 300, 0, 3600, false, 0.15, FILTER_E_ACCESS, 0, S_OK },
+   { L".rtf", "rtf (bad file)", 50, 0, 0, false, 0, S_OK, 0.7, FILTER_E_PASSWORD },
+};
+
+static const size_t c_filterCount = sizeof(s_filters) / sizeof(s_filters[0]);
+
+// a call the breaker let through, reported when it finishes
+struct Completion
+{
+   unsigned long endMs;
+   size_t filter;
+   FilterStatus hr;
+   unsigned long elapsedMs;
+
+   bool operator>(const Completion & other) const { return endMs > other.endMs; }
+};
+
+static const char *StateName(BreakerState state)
+{
+   switch (state)
+   {
+      case BREAKER_CLOSED: return "closed";
+      case BREAKER_OPEN: return "open";
+      default: return "half-open";
+   }
+}
+
+struct Totals
+{
+   Totals() : calls(0), failures(0), burnedMs(0), fallbacks(0), closedAfterFault(0) {}
+
+   unsigned long calls;
+   unsigned long failures;
+   unsigned long long burnedMs;   // spent in calls that failed
+   unsigned long fallbacks;
+   unsigned long closedAfterFault;
+};
+
+struct Outcome
+{
+   const char *name;
+   FilterStatus hr;
+   FilterStage stage;
+   bool fault;
+};
+
+static const Outcome s_outcomes[] =
+{
+   { "S_OK", S_OK, FILTER_STAGE_CALLS, false },
+   { "S_FALSE", S_FALSE, FILTER_STAGE_CALLS, false },
+
+   // unexpected errors count once the filter runs, not while it's looked for
+   { "E_FAIL", E_FAIL, FILTER_STAGE_CALLS, true },
+   { "E_FAIL", E_FAIL, FILTER_STAGE_LOAD, false },
+   { "E_UNEXPECTED", E_UNEXPECTED, FILTER_STAGE_CALLS, true },
+   { "E_UNEXPECTED", E_UNEXPECTED, FILTER_STAGE_LOAD, false },
+   { "E_NOTIMPL", E_NOTIMPL, FILTER_STAGE_CALLS, true },
+   { "FILTER_E_ACCESS", FILTER_E_ACCESS, FILTER_STAGE_CALLS, true },
+   { "FILTER_E_ACCESS", FILTER_E_ACCESS, FILTER_STAGE_LOAD, false },
+   { "FILTER_E_NO_TEXT", FILTER_E_NO_TEXT, FILTER_STAGE_CALLS, true },
+
+   // the file's, or the caller's
+   { "FILTER_E_PASSWORD", FILTER_E_PASSWORD, FILTER_STAGE_CALLS, false },
+   { "FILTER_E_PASSWORD", FILTER_E_PASSWORD, FILTER_STAGE_LOAD, false },
+   { "FILTER_E_UNKNOWNFORMAT", FILTER_E_UNKNOWNFORMAT, FILTER_STAGE_CALLS, false },
+   { "FILTER_E_UNKNOWNFORMAT", FILTER_E_UNKNOWNFORMAT, FILTER_STAGE_LOAD, false },
+   { "ERROR_FILE_NOT_FOUND", HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), FILTER_STAGE_CALLS, false },
+   { "ERROR_FILE_NOT_FOUND", HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), FILTER_STAGE_LOAD, false },
+   { "ERROR_PATH_NOT_FOUND", HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND), FILTER_STAGE_CALLS, false },
+   { "E_ACCESSDENIED", E_ACCESSDENIED, FILTER_STAGE_CALLS, false },
+   { "ERROR_SHARING_VIOLATION", HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION), FILTER_STAGE_CALLS, false },
+   { "ERROR_LOCK_VIOLATION", HRESULT_FROM_WIN32(ERROR_LOCK_VIOLATION), FILTER_STAGE_CALLS, false },
+   { "E_OUTOFMEMORY", E_OUTOFMEMORY, FILTER_STAGE_CALLS, false },
+   { "E_INVALIDARG", E_INVALIDARG, FILTER_STAGE_CALLS, false },
+   { "E_POINTER", E_POINTER, FILTER_STAGE_CALLS, false },
+
+   // the host failing, hanging or faulting counts whenever it happens
+   { "RPC_E_DISCONNECTED", RPC_E_DISCONNECTED, FILTER_STAGE_CALLS, true },
+   { "RPC_E_SERVERFAULT", RPC_E_SERVERFAULT, FILTER_STAGE_LOAD, true },
+   { "RPC_S_SERVER_UNAVAILABLE", HRESULT_FROM_WIN32(RPC_S_SERVER_UNAVAILABLE), FILTER_STAGE_LOAD, true },
+   { "RPC_S_CALL_FAILED", HRESULT_FROM_WIN32(RPC_S_CALL_FAILED), FILTER_STAGE_CALLS, true },
+   { "ERROR_TIMEOUT", HRESULT_FROM_WIN32(ERROR_TIMEOUT), FILTER_STAGE_CALLS, true },
+   { "WAIT_TIMEOUT", HRESULT_FROM_WIN32(WAIT_TIMEOUT), FILTER_STAGE_LOAD, true },
+   { "CO_E_SERVER_EXEC_FAILURE", CO_E_SERVER_EXEC_FAILURE, FILTER_STAGE_LOAD, true },
+   { "CO_E_SERVER_STOPPING", CO_E_SERVER_STOPPING, FILTER_STAGE_CALLS, true },
+   { "STATUS_ACCESS_VIOLATION", static_cast<FilterStatus>(0xC0000005), FILTER_STAGE_CALLS, true },
+   { "STATUS_ACCESS_VIOLATION", HRESULT_FROM_NT(0xC0000005), FILTER_STAGE_LOAD, true },
+};
+
+static const size_t c_outcomeCount = sizeof(s_outcomes) / sizeof(s_outcomes[0]);
+
+// Prints the outcomes IsFilterFault gets wrong and returns how many.
+static int CheckOutcomes()
+{
+   int failures = 0;
+
+   for (size_t i = 0; i < c_outcomeCount; ++i)
+   {
+      const Outcome & outcome = s_outcomes[i];
+
+      if (IsFilterFault(outcome.hr, outcome.stage) == outcome.fault)
+         continue;
+
+      printf("%-24s %08X %-5s counted as %s\n", outcome.name, static_cast<unsigned>(outcome.hr),
+             FILTER_STAGE_LOAD == outcome.stage ? "load" : "calls", outcome.fault ? "the file's" : "a fault");
+      ++failures;
+   }
+
+   return failures;
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned long seconds = 3600;
+   unsigned long intervalMs = 2000;
+   unsigned seed = 1;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "t:i:r:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 't': seconds = strtoul(optarg, NULL, 10); break;
+         case 'i': intervalMs = strtoul(optarg, NULL, 10); break;
+         case 'r': seed = static_cast<unsigned>(atoi(optarg)); break;
+
+         default:
+            fprintf(stderr,
+               "usage: breakersim [options]\n"
+               "  -t SECS   simulated run time (default: 3600)\n"
+               "  -i MS     time between calls to each filter (default: 2000)\n"
+               "  -r SEED   fault seed (default: 1)\n");
+            return 2;
+      }
+   }
+
+   if (0 == intervalMs)
+      intervalMs = 1;
+
+   int failures = CheckOutcomes();
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   printf("%lu status codes counted the right way\n\n", static_cast<unsigned long>(c_outcomeCount));
+
+   BreakerPolicy policy;
+   HealthTracker tracker(policy);
+   std::mt19937 rng(seed);
+   std::uniform_real_distribution<double> uniform(0, 1);
+
+   std::vector<Totals> plain(c_filterCount), guarded(c_filterCount);
+   std::vector<BreakerState> last(c_filterCount, BREAKER_CLOSED);
+   std::vector<HealthStats> stats;
+
+   std::priority_queue<Completion, std::vector<Completion>, std::greater<Completion> > running;
+
+   for (unsigned long now = 0; now < seconds * 1000; now += intervalMs)
+   {
+      // calls finishing by now report before the next ones ask
+      while (!running.empty() && running.top().endMs <= now)
+      {
+         const Completion & done = running.top();
+
+         if (SUCCEEDED(done.hr) || IsFilterFault(done.hr, FILTER_STAGE_CALLS))
+            tracker.Record(s_filters[done.filter].key, FAILED(done.hr), done.elapsedMs, done.endMs);
+         else
+            tracker.Ignore(s_filters[done.filter].key, done.elapsedMs, done.endMs);
+
+         running.pop();
+      }
+
+      for (size_t f = 0; f < c_filterCount; ++f)
+      {
+         const MockFilter & filter = s_filters[f];
+         unsigned long second = now / 1000;
+         bool inFault = second >= filter.faultStart && second < filter.faultEnd;
+
+         // the same outcome for both runs of this call
+         bool failed = inFault && uniform(rng) < filter.faultRate;
+         bool fileError = !failed && uniform(rng) < filter.fileErrorRate;
+         unsigned long elapsedMs = failed && filter.hangs ? policy.slowMs + 5000 : filter.normalMs;
+         FilterStatus hr = failed ? filter.faultHr : fileError ? filter.fileHr : S_OK;
+
+         ++plain[f].calls;
+
+         if (failed)
+         {
+            ++plain[f].failures;
+            plain[f].burnedMs += elapsedMs;
+         }
+
+         ++guarded[f].calls;
+
+         if (tracker.Allow(filter.key, now))
+         {
+            Completion completion = { now + elapsedMs, f, hr, elapsedMs };
+            running.push(completion);
+
+            if (failed)
+            {
+               ++guarded[f].failures;
+               guarded[f].burnedMs += elapsedMs;
+            }
+         }
+         else
+         {
+            ++guarded[f].fallbacks;
+         }
+      }
+
+      tracker.Snapshot(stats, now);
+
+      for (size_t s = 0; s < stats.size(); ++s)
+      {
+         for (size_t f = 0; f < c_filterCount; ++f)
+         {
+            if (stats[s].key != s_filters[f].key || stats[s].state == last[f])
+               continue;
+
+            printf("%7.1f s  %-14s %-9s -> %-9s (window %lu calls, %lu failed, mean %lu ms)\n",
+                   now / 1000.0, s_filters[f].name, StateName(last[f]), StateName(stats[s].state),
+                   stats[s].calls, stats[s].failures, stats[s].meanMs);
+
+            if (BREAKER_CLOSED == stats[s].state && now / 1000 >= s_filters[f].faultEnd && s_filters[f].faultEnd && !guarded[f].closedAfterFault)
+               guarded[f].closedAfterFault = now / 1000 - s_filters[f].faultEnd;
+
+            last[f] = stats[s].state;
+         }
+      }
+   }
+
+   printf("\n%-14s %8s | %9s %10s | %9s %10s %9s %s\n", "filter", "calls", "failures", "burned s", "failures", "burned s", "fallback", "closed after fault");
+
+   for (size_t f = 0; f < c_filterCount; ++f)
+   {
+      printf("%-14s %8lu | %9lu %10.1f | %9lu %10.1f %9lu ", s_filters[f].name, plain[f].calls,
+             plain[f].failures, plain[f].burnedMs / 1000.0,
+             guarded[f].failures, guarded[f].burnedMs / 1000.0, guarded[f].fallbacks);
+
+      if (s_filters[f].faultEnd && s_filters[f].faultEnd < seconds)
+         printf("%lu s\n", guarded[f].closedAfterFault);
+      else
+         printf("-\n");
+   }
+
+   printf("%-14s %8s | %20s | %s\n", "", "", "without breaker", "with breaker");
+   return 0;
+}
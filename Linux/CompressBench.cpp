@@ -0,0 +1,359 @@
+// CompressBench.cpp : Times CompressedTextSink at both LZ4 levels and checks
+//                     that its frames decompress to the plain text, on Linux.
+//
+// For a few kinds of cleaned-up text (prose, log lines, CJK, text full of
+// emoji that a 32-bit wchar_t turns into surrogate pairs, and random
+// characters that don't compress and get stored) feeds the sink 4096
+// character buffers the way the extraction loop does, with a TextBufferSink
+// teed next to it as ExtractTextEx would fill. Then
+//  - decompresses every block of the frame and checks the UTF-16 adds up to
+//    the plain text, surrogate pairs put back together
+//  - decompresses blocks on their own, the way a reader after one offset
+//    would, and checks each against the text at its offset
+//  - does the same with maxLength cutting the text short, and checks the
+//    frame holds what the TextBufferSink does
+// and prints the median compression and decompression rates over the runs,
+// in MB of UTF-16, with the frame's size against the UTF-16 text.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o compressbench CompressBench.cpp ../CompressedText.cpp ../Lz4Block.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "CompressedText.h"
+
+static const size_t c_bufferChars = 4096;
+
+static const Lz4Level c_levels[] = { LZ4_LEVEL_FAST, LZ4_LEVEL_HIGH };
+static const char * const c_levelNames[] = { "fast", "high" };
+
+enum Mix
+{
+   MIX_PROSE,
+   MIX_LOG,
+   MIX_CJK,
+   MIX_EMOJI,
+   MIX_RANDOM,
+   MIXES
+};
+
+static const char * const c_mixNames[MIXES] = { "prose", "log", "cjk", "emoji", "random" };
+
+static const wchar_t * const s_prose[] =
+{
+   L"the ", L"extraction ", L"loop ", L"hands ", L"over ", L"text ", L"in ", L"buffers ", L"of ", L"characters, ",
+   L"and ", L"most ", L"documents ", L"repeat ", L"their ", L"words. ", L"na\x00EFve ", L"caf\x00E9 ", L"\r\n"
+};
+
+static const wchar_t * const s_cjk[] =
+{
+   L"\x4E2D\x6587", L"\x65E5\x672C\x8A9E", L"\x3002", L"\x6587\x66F8", L"\x62BD\x51FA", L"\x3001", L"\x30C6\x30AD\x30B9\x30C8", L"\x8A00\x8A9E"
+};
+
+static std::wstring MakeText(Mix mix, size_t cch)
+{
+   std::wstring text;
+   text.reserve(cch + 64);
+   unsigned long long seed = 0x2545F4914F6CDD1DULL + mix;
+   unsigned long line = 0;
+
+   while (text.length() < cch)
+   {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      unsigned long r = static_cast<unsigned long>(seed >> 20);
+
+      switch (mix)
+      {
+         case MIX_PROSE:
+            text += s_prose[r % (sizeof(s_prose) / sizeof(s_prose[0]))];
+            break;
+
+         case MIX_LOG:
+         {
+            wchar_t buf[128];
+            swprintf(buf, sizeof(buf) / sizeof(buf[0]), L"2026-10-19 08:%02lu:%02lu.%03lu worker %lu: extracted %lu characters\r\n",
+                     line / 3600 % 60, line / 60 % 60, r % 1000, r % 8, r % 100000);
+            text += buf;
+            ++line;
+            break;
+         }
+
+         case MIX_CJK:
+            text += s_cjk[r % (sizeof(s_cjk) / sizeof(s_cjk[0]))];
+            break;
+
+         case MIX_EMOJI:
+            text += s_prose[r % (sizeof(s_prose) / sizeof(s_prose[0]))];
+            text += static_cast<wchar_t>(0x1F600 + r % 80);
+            break;
+
+         default:
+            // anything in the BMP but the surrogates, and some past it
+            text += static_cast<wchar_t>(0 == r % 50 ? 0x10000 + r % 0xFFFFF : 0x20 + r % 0xD7E0);
+            break;
+      }
+   }
+
+   text.resize(cch);
+   return text;
+}
+
+static std::vector<unsigned short> ToUtf16(const wchar_t *text, size_t cch)
+{
+   std::vector<unsigned short> units;
+   units.reserve(cch);
+
+   for (size_t i = 0; i < cch; ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(text[i]);
+
+      if (c > 0xFFFF)
+      {
+         units.push_back(static_cast<unsigned short>(0xD800 + ((c - 0x10000) >> 10)));
+         units.push_back(static_cast<unsigned short>(0xDC00 + ((c - 0x10000) & 0x3FF)));
+      }
+      else
+      {
+         units.push_back(static_cast<unsigned short>(c));
+      }
+   }
+
+   return units;
+}
+
+// Feeds text like the extraction loop, checking WantsMore between buffers.
+static void Feed(const std::wstring & text, TextSink & sink)
+{
+   for (size_t start = 0; start < text.length() && sink.WantsMore(); start += c_bufferChars)
+      sink.OnText(text.data() + start, std::min(c_bufferChars, text.length() - start));
+
+   sink.OnEnd();
+}
+
+struct Frame
+{
+   std::vector<unsigned char> bytes;
+   unsigned long blockChars;
+   unsigned long long totalChars;
+   std::vector<CompressedBlock> index;
+};
+
+static bool Finish(const CompressedTextSink & sink, Frame & frame)
+{
+   frame.bytes.resize(sink.FrameSize());
+   sink.WriteFrame(&frame.bytes[0]);
+
+   return ReadCompressedFrame(&frame.bytes[0], frame.bytes.size(), &frame.blockChars, &frame.totalChars, frame.index);
+}
+
+static size_t BlockChars(const Frame & frame, size_t block)
+{
+   return static_cast<size_t>(std::min<unsigned long long>(frame.blockChars, frame.totalChars - block * frame.blockChars));
+}
+
+// Decompresses the whole frame to UTF-16 code units.
+static bool Decompress(const Frame & frame, std::vector<unsigned short> & units)
+{
+   std::vector<unsigned char> bytes(static_cast<size_t>(frame.totalChars) * 2);
+
+   for (size_t block = 0; block < frame.index.size(); ++block)
+   {
+      if (!DecompressTextBlock(&frame.bytes[0], frame.bytes.size(), frame.index, block,
+                               &bytes[block * frame.blockChars * 2], BlockChars(frame, block) * 2))
+         return false;
+   }
+
+   units.resize(bytes.size() / 2);
+
+   for (size_t i = 0; i < units.size(); ++i)
+      units[i] = static_cast<unsigned short>(bytes[2 * i] | bytes[2 * i + 1] << 8);
+
+   return true;
+}
+
+static std::wstring FromUtf16(const std::vector<unsigned short> & units)
+{
+   std::wstring text;
+
+   for (size_t i = 0; i < units.size(); ++i)
+   {
+      unsigned long c = units[i];
+
+      if (c >= 0xD800 && c < 0xDC00 && i + 1 < units.size() && units[i + 1] >= 0xDC00 && units[i + 1] < 0xE000)
+         c = 0x10000 + ((c - 0xD800) << 10) + (units[++i] - 0xDC00);
+
+      text += static_cast<wchar_t>(c);
+   }
+
+   return text;
+}
+
+// Returns the number of failures for one text, level and maxLength.
+static int CheckRoundTrip(const char *name, const std::wstring & text, Lz4Level level, size_t maxLength)
+{
+   CompressedTextSink compressed(maxLength, level);
+   TextBufferSink plain(maxLength);
+
+   TeeSink tee;
+   tee.Add(&compressed);
+   tee.Add(&plain);
+   Feed(text, tee);
+
+   Frame frame;
+   std::vector<unsigned short> units;
+
+   if (!Finish(compressed, frame) || !Decompress(frame, units))
+   {
+      printf("%-7s level %s, maxLength %lu: the frame doesn't read back\n", name, c_levelNames[level], static_cast<unsigned long>(maxLength));
+      return 1;
+   }
+
+   int failures = 0;
+
+   if (FromUtf16(units) != plain.Text() || units != ToUtf16(plain.Text().data(), plain.Text().length()))
+   {
+      printf("%-7s level %s, maxLength %lu: the frame doesn't hold the plain text\n", name, c_levelNames[level],
+             static_cast<unsigned long>(maxLength));
+      ++failures;
+   }
+
+   // each block on its own against the plain text at its offset
+   std::vector<unsigned short> expected = ToUtf16(plain.Text().data(), plain.Text().length());
+   std::vector<unsigned char> block(frame.blockChars * 2);
+
+   for (size_t b = frame.index.size(); b-- > 0; )
+   {
+      size_t cch = BlockChars(frame, b);
+
+      if (!DecompressTextBlock(&frame.bytes[0], frame.bytes.size(), frame.index, b, &block[0], cch * 2))
+      {
+         ++failures;
+         continue;
+      }
+
+      for (size_t i = 0; i < cch; ++i)
+      {
+         if ((block[2 * i] | block[2 * i + 1] << 8) != expected[b * frame.blockChars + i])
+         {
+            printf("%-7s level %s: block %lu differs from the text at its offset\n", name, c_levelNames[level], static_cast<unsigned long>(b));
+            ++failures;
+            break;
+         }
+      }
+   }
+
+   return failures;
+}
+
+template <class Operation>
+static double Median(unsigned runs, Operation operation)
+{
+   std::vector<double> times;
+
+   for (unsigned run = 0; run < runs; ++run)
+   {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      operation();
+      times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+   }
+
+   std::sort(times.begin(), times.end());
+   return times[times.size() / 2];
+}
+
+int main(int argc, char *argv[])
+{
+   size_t megabytes = 16;
+   unsigned runs = 5;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "m:r:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'm': megabytes = strtoul(optarg, NULL, 10); break;
+         case 'r': runs = static_cast<unsigned>(atoi(optarg)); break;
+
+         default:
+            fprintf(stderr,
+               "usage: compressbench [options]\n"
+               "  -m MB     text per mix, in MB of UTF-16 (default: 16)\n"
+               "  -r RUNS   timed runs, the median counts (default: 5)\n");
+            return 2;
+      }
+   }
+
+   if (0 == megabytes)
+      megabytes = 1;
+
+   if (0 == runs)
+      runs = 1;
+
+   int failures = 0;
+
+   for (int m = 0; m < MIXES; ++m)
+   {
+      std::wstring text = MakeText(static_cast<Mix>(m), 300000);
+
+      // a block and a bit, a cut inside the first buffer, none
+      static const size_t c_maxLengths[] = { 0, c_compressedBlockChars + 1000, 100 };
+
+      for (size_t l = 0; l < 2; ++l)
+      {
+         for (size_t n = 0; n < sizeof(c_maxLengths) / sizeof(c_maxLengths[0]); ++n)
+            failures += CheckRoundTrip(c_mixNames[m], text, c_levels[l], c_maxLengths[n]);
+      }
+   }
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   printf("every frame decompresses to the plain text, whole and block by block\n\n");
+   printf("%-7s %-5s %12s %12s %10s %8s\n", "text", "level", "pack MB/s", "unpack MB/s", "ratio", "stored");
+
+   for (int m = 0; m < MIXES; ++m)
+   {
+      // megabytes of UTF-16, fewer characters when some take two units
+      std::wstring text = MakeText(static_cast<Mix>(m), megabytes * 1024 * 1024 / 2);
+      double mb = static_cast<double>(ToUtf16(text.data(), text.length()).size() * 2) / (1024 * 1024);
+
+      for (size_t l = 0; l < 2; ++l)
+      {
+         Frame frame;
+
+         double pack = Median(runs, [&]()
+         {
+            CompressedTextSink sink(0, c_levels[l]);
+            Feed(text, sink);
+            Finish(sink, frame);
+         });
+
+         std::vector<unsigned short> units;
+         double unpack = Median(runs, [&]() { Decompress(frame, units); });
+
+         size_t stored = 0;
+
+         for (size_t b = 0; b < frame.index.size(); ++b)
+            stored += frame.index[b].stored ? 1 : 0;
+
+         printf("%-7s %-5s %12.0f %12.0f %9.1f%% %4lu/%-4lu\n", c_mixNames[m], c_levelNames[l], mb / pack, mb / unpack,
+                100.0 * frame.bytes.size() / (mb * 1024 * 1024), static_cast<unsigned long>(stored),
+                static_cast<unsigned long>(frame.index.size()));
+      }
+   }
+
+   return 0;
+}
@@ -0,0 +1,577 @@
+// GovernorLoad.cpp : Checks MemoryGovernor's admission order, growth and wait
+//                    timeouts, then loads it from many threads, on Linux.
+//
+// The scenarios, run first, each queue requests from threads of their own
+// against a governor with a small budget, one at a time so the order they
+// arrive in is known, then release memory a step at a time and check who
+// got it:
+//  - fifo:      admissions are granted in arrival order, one that doesn't
+//               fit holds up the smaller ones behind it
+//  - growth:    growth of running extractions goes ahead of admissions
+//               queued before it, a new admission can't jump the queue
+//  - oversized: a request bigger than the budget goes through once nothing
+//               else is held, and holds up whoever comes after it
+//  - timeout:   a request gives up after its wait, a request that can't
+//               wait fails at once, and whoever was queued behind one that
+//               gave up gets its turn; raising the budget lets waiters in
+//  - growing:   a GovernedSink grows its reservation a MB at a time, stops
+//               the extraction when the budget runs out, and everything
+//               goes back when the reservation does. One told the caller
+//               keeps only the first few MB stops growing there
+//
+// Then many threads run extractions against one governor for a while: each
+// admits a small or large estimate, pushes text through a GovernedSink that
+// grows its reservation, holds it for a bit and lets it go. A sampler keeps
+// checking the budget is never exceeded. Prints the admission waits of small
+// and large extractions, timeouts and over-budget stops, and fails if the
+// budget was exceeded, a wait ran well past its limit, the large ones never
+// got in, or anything is still held or queued at the end.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -pthread -I.. -o governorload GovernorLoad.cpp ../MemoryGovernor.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "MemoryGovernor.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned long long c_mb = 1024 * 1024;
+
+static double MsSince(Clock::time_point start)
+{
+   return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Polls until the condition holds, false if it doesn't within the time.
+template <class Condition>
+static bool WaitFor(Condition condition, unsigned long ms)
+{
+   Clock::time_point start = Clock::now();
+
+   while (!condition())
+   {
+      if (MsSince(start) > ms)
+         return false;
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+
+   return true;
+}
+
+static unsigned long Waiting(const MemoryGovernor & governor)
+{
+   unsigned long long inUse, budget;
+   unsigned long waiting;
+   governor.Usage(&inUse, &budget, &waiting);
+   return waiting;
+}
+
+static unsigned long long InUse(const MemoryGovernor & governor)
+{
+   unsigned long long inUse, budget;
+   unsigned long waiting;
+   governor.Usage(&inUse, &budget, &waiting);
+   return inUse;
+}
+
+enum RequestState
+{
+   REQUEST_WAITING,
+   REQUEST_GRANTED,
+   REQUEST_REFUSED
+};
+
+// An Acquire on a thread of its own.
+class Request
+{
+public:
+   // Starts the request and returns once the governor has either answered
+   // it or queued it, so requests queue in the order they're started.
+   Request(MemoryGovernor & governor, unsigned long long bytes, unsigned long waitMs, bool growth)
+      : m_state(REQUEST_WAITING), m_ms(0)
+   {
+      unsigned long queued = Waiting(governor);
+
+      m_thread = std::thread([this, &governor, bytes, waitMs, growth]()
+      {
+         Clock::time_point start = Clock::now();
+         bool granted = governor.Acquire(bytes, waitMs, growth);
+         m_ms = MsSince(start);
+         m_state = granted ? REQUEST_GRANTED : REQUEST_REFUSED;
+      });
+
+      WaitFor([&]() { return REQUEST_WAITING != m_state || Waiting(governor) > queued; }, 5000);
+   }
+
+   ~Request()
+   {
+      m_thread.join();
+   }
+
+   RequestState Now() const { return m_state; }
+
+   // Waits a while for an answer, then says what it is.
+   RequestState Settle(unsigned long ms = 2000)
+   {
+      WaitFor([&]() { return REQUEST_WAITING != m_state; }, ms);
+      return m_state;
+   }
+
+   // Still queued after giving the governor time to get it wrong.
+   bool StillWaiting()
+   {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      return REQUEST_WAITING == m_state;
+   }
+
+   double Ms() const { return m_ms; }
+
+private:
+   std::atomic<RequestState> m_state;
+   std::atomic<double> m_ms;
+   std::thread m_thread;
+};
+
+static int Check(const char *scenario, bool ok, const char *what)
+{
+   if (ok)
+      return 0;
+
+   printf("%-10s %s\n", scenario, what);
+   return 1;
+}
+
+static int CheckFifo()
+{
+   MemoryGovernor governor;
+   governor.Configure(100, 0);
+   int failures = 0;
+
+   failures += Check("fifo", governor.Acquire(100, 0, false), "the whole budget isn't granted");
+
+   Request e(governor, 80, 5000, false);
+   Request f(governor, 10, 5000, false);
+   Request g(governor, 10, 5000, false);
+
+   failures += Check("fifo", 3 == Waiting(governor), "the requests don't queue");
+
+   // room for f and g but not e, which is first
+   governor.Release(70);
+   failures += Check("fifo", e.StillWaiting() && REQUEST_WAITING == f.Now() && REQUEST_WAITING == g.Now(),
+                     "a smaller request jumps the queue");
+
+   governor.Release(20);
+   failures += Check("fifo", REQUEST_GRANTED == e.Settle() && REQUEST_GRANTED == f.Settle(),
+                     "the first two aren't granted in order");
+   failures += Check("fifo", g.StillWaiting() && 100 == InUse(governor), "the third doesn't wait for room");
+
+   governor.Release(80);
+   failures += Check("fifo", REQUEST_GRANTED == g.Settle(), "the third isn't granted once there's room");
+
+   governor.Release(30);
+   failures += Check("fifo", 0 == InUse(governor) && 0 == Waiting(governor), "memory is left held");
+   return failures;
+}
+
+static int CheckGrowth()
+{
+   MemoryGovernor governor;
+   governor.Configure(100, 0);
+   int failures = 0;
+
+   governor.Acquire(100, 0, false);
+
+   Request admission(governor, 10, 5000, false);
+   Request growth(governor, 10, 5000, true);
+
+   governor.Release(10);
+   failures += Check("growth", REQUEST_GRANTED == growth.Settle() && admission.StillWaiting(),
+                     "growth doesn't go ahead of the admission");
+
+   governor.Release(10);
+   failures += Check("growth", REQUEST_GRANTED == admission.Settle(), "the admission isn't granted after the growth");
+
+   governor.Release(100);
+
+   // room for ten, but an admission is queued ahead
+   governor.Acquire(90, 0, false);
+   Request big(governor, 20, 5000, false);
+
+   failures += Check("growth", !governor.Acquire(5, 0, false), "a new admission jumps the queue");
+   failures += Check("growth", governor.Acquire(5, 0, true), "growth waits behind admissions");
+
+   governor.Release(95);
+   failures += Check("growth", REQUEST_GRANTED == big.Settle(), "the queued admission isn't granted");
+
+   governor.Release(20);
+   failures += Check("growth", 0 == InUse(governor) && 0 == Waiting(governor), "memory is left held");
+   return failures;
+}
+
+static int CheckOversized()
+{
+   MemoryGovernor governor;
+   governor.Configure(100, 0);
+   int failures = 0;
+
+   failures += Check("oversized", governor.Acquire(500, 0, false), "isn't let through with nothing held");
+   governor.Release(500);
+
+   governor.Acquire(10, 0, false);
+   Request oversized(governor, 500, 5000, false);
+   Request after(governor, 10, 5000, false);
+
+   failures += Check("oversized", oversized.StillWaiting(), "is let through while something is held");
+
+   governor.Release(10);
+   failures += Check("oversized", REQUEST_GRANTED == oversized.Settle(), "isn't let through once nothing is held");
+   failures += Check("oversized", after.StillWaiting(), "the request behind it gets in alongside");
+
+   governor.Release(500);
+   failures += Check("oversized", REQUEST_GRANTED == after.Settle(), "the request behind it isn't granted after");
+
+   governor.Release(10);
+   failures += Check("oversized", 0 == InUse(governor) && 0 == Waiting(governor), "memory is left held");
+   return failures;
+}
+
+static int CheckTimeout()
+{
+   MemoryGovernor governor;
+   governor.Configure(100, 0);
+   int failures = 0;
+
+   governor.Acquire(100, 0, false);
+
+   Clock::time_point start = Clock::now();
+   failures += Check("timeout", !governor.Acquire(10, 0, false) && MsSince(start) < 50, "a request that can't wait waits");
+
+   {
+      Request first(governor, 80, 300, false);
+      Request behind(governor, 10, 5000, false);
+
+      // room for the one behind, but the first is in the way until it gives up
+      governor.Release(50);
+      failures += Check("timeout", behind.StillWaiting(), "the request behind gets in ahead");
+
+      bool refused = REQUEST_REFUSED == first.Settle();
+      failures += Check("timeout", refused && first.Ms() >= 290 && first.Ms() < 1000, "the first doesn't give up after its wait");
+
+      if (refused)
+      {
+         printf("%-10s gave up after %.0f ms of 300\n", "timeout", first.Ms());
+         failures += Check("timeout", REQUEST_GRANTED == behind.Settle(200) && behind.Ms() < first.Ms() + 200,
+                           "the request behind doesn't get in once the first gives up");
+      }
+
+      failures += Check("timeout", 0 == Waiting(governor) && 60 == InUse(governor), "the queue isn't cleared");
+   }
+
+   {
+      governor.Acquire(40, 0, false);
+      Request waiter(governor, 50, 5000, false);
+
+      governor.Configure(200, 0);
+      failures += Check("timeout", REQUEST_GRANTED == waiter.Settle(), "raising the budget doesn't let the waiter in");
+   }
+
+   governor.Release(150);
+   failures += Check("timeout", 0 == InUse(governor) && 0 == Waiting(governor), "memory is left held");
+   return failures;
+}
+
+// Takes the text and keeps none of it, the governor only sees the counts.
+class CountingSink : public TextSink
+{
+public:
+   CountingSink() : m_chars(0) {}
+
+   virtual void OnText(const wchar_t * /*text*/, size_t cch) { m_chars += cch; }
+
+   unsigned long long Chars() const { return m_chars; }
+
+private:
+   unsigned long long m_chars;
+};
+
+static int CheckGrowing()
+{
+   MemoryGovernor governor;
+   governor.Configure(8 * c_mb, 200);
+   int failures = 0;
+
+   static wchar_t text[4096];
+
+   {
+      MemoryReservation reservation(governor);
+      failures += Check("growing", reservation.Admit(4 * c_mb), "the estimate isn't admitted");
+
+      CountingSink counting;
+      GovernedSink governed(counting, reservation, 2);
+      unsigned long long steps = 0;
+      unsigned long long held = reservation.Held();
+
+      while (governed.WantsMore())
+      {
+         governed.OnText(text, sizeof(text) / sizeof(text[0]));
+
+         if (reservation.Held() != held)
+         {
+            failures += Check("growing", reservation.Held() - held == c_mb, "doesn't grow a MB at a time");
+            held = reservation.Held();
+            ++steps;
+         }
+      }
+
+      governed.OnEnd();
+
+      printf("%-10s grew in %llu steps to %llu MB, stopped over budget after %llu MB of text\n", "growing", steps,
+             reservation.Held() / c_mb, counting.Chars() * 2 / c_mb);
+
+      failures += Check("growing", reservation.OverBudget() && 8 * c_mb == reservation.Held() && 4 == steps,
+                        "doesn't stop at the budget");
+      failures += Check("growing", counting.Chars() * 2 > 8 * c_mb && counting.Chars() * 2 <= 8 * c_mb + sizeof(text),
+                        "lets more than a buffer through past the budget");
+
+      MemoryReservation other(governor);
+      failures += Check("growing", !other.Admit(c_mb), "another extraction gets in over the budget");
+   }
+
+   {
+      MemoryReservation after(governor);
+      failures += Check("growing", after.Admit(8 * c_mb), "the memory doesn't go back with the reservation");
+   }
+
+   // a sink that keeps only the first 3 MB in memory, spilling the rest
+   {
+      MemoryReservation reservation(governor);
+      reservation.Admit(c_mb);
+
+      CountingSink counting;
+      GovernedSink governed(counting, reservation, 2, 3 * c_mb / 2);
+
+      while (governed.WantsMore() && counting.Chars() * 2 < 16 * c_mb)
+         governed.OnText(text, sizeof(text) / sizeof(text[0]));
+
+      failures += Check("growing", !reservation.OverBudget() && 3 * c_mb == reservation.Held() && counting.Chars() * 2 >= 16 * c_mb,
+                        "counts text past what the caller keeps");
+   }
+
+   return failures;
+}
+
+struct Stats
+{
+   std::vector<double> smallWaits;
+   std::vector<double> largeWaits;
+   unsigned long smallTimeouts;
+   unsigned long largeTimeouts;
+   unsigned long overBudget;
+   unsigned long extractions;
+
+   Stats() : smallTimeouts(0), largeTimeouts(0), overBudget(0), extractions(0) {}
+};
+
+static double Percentile(std::vector<double> & values, double p)
+{
+   if (values.empty())
+      return 0;
+
+   std::sort(values.begin(), values.end());
+   return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+}
+
+static void Worker(MemoryGovernor & governor, unsigned seed, Clock::time_point deadline, Stats & stats)
+{
+   std::mt19937 random(seed);
+   static wchar_t text[4096];
+
+   while (Clock::now() < deadline)
+   {
+      // mostly small documents, now and then a big one, most of them growing past their estimate
+      bool large = 0 == random() % 10;
+      unsigned long long estimate = large ? (8 + random() % 24) * c_mb : (64 + random() % 960) * 1024;
+      unsigned long long textBytes = estimate / 2 + random() % (estimate * 2);
+
+      MemoryReservation reservation(governor);
+      Clock::time_point start = Clock::now();
+
+      if (!reservation.Admit(estimate))
+      {
+         ++(large ? stats.largeTimeouts : stats.smallTimeouts);
+         continue;
+      }
+
+      (large ? stats.largeWaits : stats.smallWaits).push_back(MsSince(start));
+
+      CountingSink counting;
+      GovernedSink governed(counting, reservation, 2);
+
+      for (unsigned long long done = 0; done < textBytes && governed.WantsMore(); done += sizeof(text) / 2)
+      {
+         governed.OnText(text, sizeof(text) / sizeof(text[0]));
+
+         // the filter takes a while to produce each MB
+         if (0 == done % c_mb)
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+      }
+
+      governed.OnEnd();
+
+      stats.overBudget += reservation.OverBudget() ? 1 : 0;
+      ++stats.extractions;
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned threads = 32;
+   unsigned seconds = 5;
+   unsigned long long budgetMB = 128;
+   unsigned long waitMs = 100;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "t:s:b:w:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 't': threads = static_cast<unsigned>(atoi(optarg)); break;
+         case 's': seconds = static_cast<unsigned>(atoi(optarg)); break;
+         case 'b': budgetMB = strtoull(optarg, NULL, 10); break;
+         case 'w': waitMs = strtoul(optarg, NULL, 10); break;
+
+         default:
+            fprintf(stderr,
+               "usage: governorload [options]\n"
+               "  -t THREADS  extractions running at once (default: 32)\n"
+               "  -s SECONDS  how long to load the governor (default: 5)\n"
+               "  -b MB       memory budget (default: 128)\n"
+               "  -w MS       how long admission and growth wait for room (default: 100)\n");
+            return 2;
+      }
+   }
+
+   if (0 == threads)
+      threads = 1;
+
+   if (budgetMB < 32)
+      budgetMB = 32;   // the largest extraction fits
+
+   int failures = CheckFifo() + CheckGrowth() + CheckOversized() + CheckTimeout() + CheckGrowing();
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   printf("granted in order, growth first, oversized alone, waits time out, reservations grow and go back\n\n");
+
+   MemoryGovernor governor;
+   governor.Configure(budgetMB * c_mb, waitMs);
+
+   std::atomic<bool> done(false);
+   std::atomic<unsigned long long> peak(0);
+   std::atomic<unsigned long> exceeded(0);
+
+   std::thread sampler([&]()
+   {
+      while (!done)
+      {
+         unsigned long long inUse = InUse(governor);
+
+         if (inUse > budgetMB * c_mb)
+            ++exceeded;
+
+         peak = std::max<unsigned long long>(peak, inUse);
+         std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+   });
+
+   std::vector<Stats> stats(threads);
+   std::vector<std::thread> workers;
+   Clock::time_point deadline = Clock::now() + std::chrono::seconds(seconds);
+
+   for (unsigned t = 0; t < threads; ++t)
+      workers.push_back(std::thread(Worker, std::ref(governor), t + 1, deadline, std::ref(stats[t])));
+
+   for (size_t t = 0; t < workers.size(); ++t)
+      workers[t].join();
+
+   done = true;
+   sampler.join();
+
+   Stats total;
+
+   for (size_t t = 0; t < stats.size(); ++t)
+   {
+      total.smallWaits.insert(total.smallWaits.end(), stats[t].smallWaits.begin(), stats[t].smallWaits.end());
+      total.largeWaits.insert(total.largeWaits.end(), stats[t].largeWaits.begin(), stats[t].largeWaits.end());
+      total.smallTimeouts += stats[t].smallTimeouts;
+      total.largeTimeouts += stats[t].largeTimeouts;
+      total.overBudget += stats[t].overBudget;
+      total.extractions += stats[t].extractions;
+   }
+
+   printf("%u threads, %llu MB budget, %lu ms wait: %lu extractions in %u s, %lu stopped over budget, at most %.0f%% of the budget held\n\n",
+          threads, budgetMB, waitMs, total.extractions, seconds, total.overBudget, 100.0 * peak / (budgetMB * c_mb));
+   printf("%-6s %9s %9s %9s %9s %9s\n", "", "admitted", "timed out", "p50 ms", "p99 ms", "max ms");
+
+   double maxWait = 0;
+
+   for (int large = 0; large < 2; ++large)
+   {
+      std::vector<double> & waits = large ? total.largeWaits : total.smallWaits;
+      double p50 = Percentile(waits, 0.5);
+      double p99 = Percentile(waits, 0.99);
+      double most = Percentile(waits, 1);
+      maxWait = std::max(maxWait, most);
+
+      printf("%-6s %9lu %9lu %9.1f %9.1f %9.1f\n", large ? "large" : "small", static_cast<unsigned long>(waits.size()),
+             large ? total.largeTimeouts : total.smallTimeouts, p50, p99, most);
+   }
+
+   if (exceeded)
+   {
+      printf("the budget was exceeded %lu times\n", static_cast<unsigned long>(exceeded));
+      ++failures;
+   }
+
+   // a wait can run over by as much as the scheduler keeps the thread waiting
+   if (maxWait > waitMs + 250)
+   {
+      printf("an admission waited %.0f ms, past its %lu ms limit\n", maxWait, waitMs);
+      ++failures;
+   }
+
+   if (total.largeWaits.empty())
+   {
+      printf("no large extraction got in\n");
+      ++failures;
+   }
+
+   if (0 != InUse(governor) || 0 != Waiting(governor))
+   {
+      printf("%llu bytes still held, %lu requests still queued\n", InUse(governor), Waiting(governor));
+      ++failures;
+   }
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,384 @@
+// LanguageBench.cpp : Measures how well LanguageSink guesses the language of
+//                     a labelled corpus, and what it adds to extraction, on
+//                     Linux.
+//
+// Each line of the corpus (LanguageCorpus.tsv next to this file by default)
+// is the expected ISO 639-1 code, a tab and a sample in UTF-8; '#' starts a
+// comment. Every sample goes through the built-in plain text path
+// (ExtractAppendedText) into a LanguageSink, whole and cut down to its first
+// 32 and 128 characters, and the guesses are tallied per language with each
+// miss listed.
+//
+// Then the samples, all of them and the Latin and the other ones on their
+// own, are repeated into a few MB of UTF-8 and extracted with the text going
+// to a TextBufferSink alone and then teed to a LanguageSink as well, the way
+// ExtractTextWithLanguage does. Prints the median throughput of both and what
+// the guess costs per MB of input.
+//
+// Fails if fewer than -t percent of the whole samples are guessed right.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o languagebench LanguageBench.cpp ../AppendText.cpp ../LanguageDetector.cpp ../PagedText.cpp ../PlainText.cpp ../TextCleanup.cpp ../TokenText.cpp
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "AppendText.h"
+#include "LanguageDetector.h"
+
+class MemoryReader : public ByteReader
+{
+public:
+   explicit MemoryReader(const std::string & bytes) : m_bytes(bytes) {}
+
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb)
+   {
+      if (offset > m_bytes.size() || cb > m_bytes.size() - offset)
+         return false;
+
+      memcpy(buf, m_bytes.data() + offset, cb);
+      return true;
+   }
+
+private:
+   const std::string & m_bytes;
+};
+
+struct Sample
+{
+   unsigned long line;
+   std::string language;
+   std::string bytes;
+   std::wstring text;   // cleaned up
+};
+
+static bool ReadCorpus(const char *path, std::vector<Sample> & samples)
+{
+   FILE *file = fopen(path, "rb");
+
+   if (NULL == file)
+      return false;
+
+   char line[16384];
+   unsigned long number = 0;
+
+   while (fgets(line, sizeof(line), file))
+   {
+      ++number;
+
+      size_t cb = strlen(line);
+
+      while (cb && ('\n' == line[cb - 1] || '\r' == line[cb - 1]))
+         line[--cb] = 0;
+
+      char *tab = strchr(line, '\t');
+
+      if ('#' == line[0] || NULL == tab)
+         continue;
+
+      Sample sample;
+      sample.line = number;
+      sample.language.assign(line, tab - line);
+      sample.bytes.assign(tab + 1);
+      samples.push_back(sample);
+   }
+
+   fclose(file);
+   return true;
+}
+
+static AppendResult Extract(const std::string & bytes, CleanupProfile profile, TextSink & sink)
+{
+   MemoryReader reader(bytes);
+   AppendState state;
+   InitAppendState(state, profile);
+
+   return ExtractAppendedText(reader, bytes.size(), profile, state, sink);
+}
+
+static LanguageGuess GuessLanguage(const std::wstring & text, size_t cch)
+{
+   LanguageSink sink(0, false);
+
+   sink.OnText(text.data(), std::min(cch, text.length()));
+   sink.OnEnd();
+
+   return sink.Guess();
+}
+
+static const char * const c_latinLanguages[] = { "en", "fr", "de", "es", "it", "pt", "nl", "sv", "pl" };
+
+static bool IsLatin(const std::string & language)
+{
+   for (size_t i = 0; i < sizeof(c_latinLanguages) / sizeof(c_latinLanguages[0]); ++i)
+   {
+      if (language == c_latinLanguages[i])
+         return true;
+   }
+
+   return false;
+}
+
+// The columns are the prefix lengths, then the whole sample
+static const size_t c_prefixes[] = { 32, 128 };
+static const size_t c_columns = sizeof(c_prefixes) / sizeof(c_prefixes[0]) + 1;
+
+struct Tally
+{
+   std::string language;
+   unsigned samples;
+   unsigned hits[c_columns];
+};
+
+static int CheckAccuracy(const std::vector<Sample> & samples, double threshold)
+{
+   std::vector<Tally> tallies;
+   unsigned hits[c_columns] = { 0 };
+   double rightConfidence = 0, wrongConfidence = 0;
+   unsigned wrong = 0;
+
+   printf("%-6s %8s %8s %8s %8s\n", "lang", "samples", "32 ch", "128 ch", "whole");
+
+   for (size_t s = 0; s < samples.size(); ++s)
+   {
+      if (tallies.empty() || tallies.back().language != samples[s].language)
+      {
+         Tally tally;
+         tally.language = samples[s].language;
+         tally.samples = 0;
+         memset(tally.hits, 0, sizeof(tally.hits));
+         tallies.push_back(tally);
+      }
+
+      Tally & tally = tallies.back();
+      ++tally.samples;
+
+      for (size_t c = 0; c < c_columns; ++c)
+      {
+         size_t cch = c < c_columns - 1 ? c_prefixes[c] : samples[s].text.length();
+         LanguageGuess guess = GuessLanguage(samples[s].text, cch);
+         bool right = samples[s].language == guess.language;
+
+         if (right)
+         {
+            ++tally.hits[c];
+            ++hits[c];
+         }
+
+         if (c == c_columns - 1)
+         {
+            if (right)
+               rightConfidence += guess.confidence;
+            else
+               wrongConfidence += guess.confidence;
+
+            if (!right)
+               ++wrong;
+         }
+      }
+   }
+
+   for (size_t t = 0; t < tallies.size(); ++t)
+   {
+      printf("%-6s %8u", tallies[t].language.c_str(), tallies[t].samples);
+
+      for (size_t c = 0; c < c_columns; ++c)
+         printf(" %8u", tallies[t].hits[c]);
+
+      printf("\n");
+   }
+
+   printf("%-6s %8lu", "all", static_cast<unsigned long>(samples.size()));
+
+   for (size_t c = 0; c < c_columns; ++c)
+      printf(" %7.1f%%", 100.0 * hits[c] / samples.size());
+
+   printf("\n\n");
+
+   for (size_t s = 0; s < samples.size(); ++s)
+   {
+      LanguageGuess guess = GuessLanguage(samples[s].text, samples[s].text.length());
+
+      if (samples[s].language != guess.language)
+         printf("miss: line %lu, %s taken for %s (%s, confidence %.2f)\n", samples[s].line,
+                samples[s].language.c_str(), guess.language, ScriptName(guess.script), guess.confidence);
+   }
+
+   size_t right = samples.size() - wrong;
+
+   printf("mean confidence %.2f right, %.2f wrong\n\n", right ? rightConfidence / right : 0.0,
+          wrong ? wrongConfidence / wrong : 0.0);
+
+   return 100.0 * hits[c_columns - 1] / samples.size() < threshold ? 1 : 0;
+}
+
+static double Seconds(const std::string & bytes, CleanupProfile profile, bool guess, unsigned runs)
+{
+   std::vector<double> times;
+
+   for (unsigned run = 0; run < runs; ++run)
+   {
+      TextBufferSink text(0);
+      LanguageSink language(0, false);
+
+      TeeSink tee;
+      tee.Add(&text);
+
+      if (guess)
+         tee.Add(&language);
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      Extract(bytes, profile, tee);
+
+      if (guess)
+         language.Guess();
+
+      times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+   }
+
+   std::sort(times.begin(), times.end());
+   return times[times.size() / 2];
+}
+
+static void MeasureOverhead(const std::vector<Sample> & samples, CleanupProfile profile, size_t megabytes, unsigned runs)
+{
+   static const char * const c_groups[] = { "all", "latin", "other" };
+
+   printf("%-6s %12s %12s %10s %9s\n", "text", "plain MB/s", "guess MB/s", "ms per MB", "overhead");
+
+   for (int g = 0; g < 3; ++g)
+   {
+      std::string bytes;
+
+      while (bytes.size() < megabytes * 1024 * 1024)
+      {
+         size_t before = bytes.size();
+
+         for (size_t s = 0; s < samples.size(); ++s)
+         {
+            if (0 == g || (1 == g) == IsLatin(samples[s].language))
+               bytes.append(samples[s].bytes).append("\n");
+         }
+
+         if (bytes.size() == before)
+            break;
+      }
+
+      if (bytes.empty())
+         continue;
+
+      double mb = static_cast<double>(bytes.size()) / (1024 * 1024);
+      double plain = Seconds(bytes, profile, false, runs);
+      double guess = Seconds(bytes, profile, true, runs);
+
+      printf("%-6s %12.0f %12.0f %10.2f %8.1f%%\n", c_groups[g], mb / plain, mb / guess,
+             (guess - plain) * 1000 / mb, 100.0 * (guess - plain) / plain);
+   }
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: languagebench [options] [corpus]\n"
+      "  -p PROFILE   display, index or compact (default: display)\n"
+      "  -m MB        input per timing run (default: 16)\n"
+      "  -r RUNS      timed runs, the median counts (default: 5)\n"
+      "  -t PERCENT   least accuracy on the whole samples (default: 90)\n"
+      "corpus defaults to LanguageCorpus.tsv\n");
+}
+
+int main(int argc, char *argv[])
+{
+   static const char * const c_profileNames[CLEANUP_PROFILES] = { "display", "index", "compact" };
+
+   CleanupProfile profile = CLEANUP_DISPLAY;
+   size_t megabytes = 16;
+   unsigned runs = 5;
+   double threshold = 90;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "p:m:r:t:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'p':
+         {
+            int p = 0;
+
+            while (p < CLEANUP_PROFILES && 0 != strcmp(optarg, c_profileNames[p]))
+               ++p;
+
+            if (CLEANUP_PROFILES == p)
+            {
+               Usage();
+               return 2;
+            }
+
+            profile = static_cast<CleanupProfile>(p);
+            break;
+         }
+
+         case 'm': megabytes = strtoul(optarg, NULL, 10); break;
+         case 'r': runs = static_cast<unsigned>(atoi(optarg)); break;
+         case 't': threshold = atof(optarg); break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   if (0 == megabytes)
+      megabytes = 1;
+
+   if (0 == runs)
+      runs = 1;
+
+   const char *path = optind < argc ? argv[optind] : "LanguageCorpus.tsv";
+   std::vector<Sample> samples;
+
+   if (!ReadCorpus(path, samples))
+   {
+      fprintf(stderr, "languagebench: can't read %s: %s\n", path, strerror(errno));
+      return 2;
+   }
+
+   if (samples.empty())
+   {
+      fprintf(stderr, "languagebench: no samples in %s\n", path);
+      return 2;
+   }
+
+   for (size_t s = 0; s < samples.size(); ++s)
+   {
+      TextBufferSink text(0);
+
+      if (APPEND_NOT_TEXT == Extract(samples[s].bytes, profile, text))
+      {
+         fprintf(stderr, "languagebench: the sample on line %lu of %s isn't text\n", samples[s].line, path);
+         return 2;
+      }
+
+      samples[s].text = text.Text();
+   }
+
+   int failed = CheckAccuracy(samples, threshold);
+
+   MeasureOverhead(samples, profile, megabytes, runs);
+
+   if (failed)
+   {
+      printf("FAILED: fewer than %.0f%% of the whole samples guessed right\n", threshold);
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,298 @@
+// MatchBench.cpp : Measures the streaming pattern matcher on Linux.
+//
+// Matches a set of keywords and regular expressions against text three ways:
+//
+//    search    the whole text in memory, then std::wstring::find for each
+//              keyword and std::wregex for each expression, the way a
+//              caller of ExtractText searches it today
+//    stream    MatchSink fed 4096 characters at a time, as the extraction
+//              loop does, finding every match
+//    first     the same with maxMatches 1, stopping at the first match
+//
+// and prints MB/sec (of UTF-16 text) and the matches found for each. The
+// keyword counts of search and stream are checked against each other; the
+// expression counts can differ, std::wregex being leftmost-first where
+// MatchSink is leftmost-longest. The text comes from the files given, decoded
+// as plain text, or is generated (-g MB) from a small vocabulary with a
+// few planted identifiers. Keywords are read from a file (-K, one per line)
+// or generated (-k count, some from the vocabulary).
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o matchbench MatchBench.cpp ../PatternMatcher.cpp ../PlainText.cpp ../TextCleanup.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "PatternMatcher.h"
+#include "PlainText.h"
+
+static const char * const c_vocabulary[] =
+{
+   "the", "of", "and", "to", "in", "report", "account", "customer", "payment", "quarter",
+   "revenue", "contract", "invoice", "shipment", "region", "forecast", "meeting", "review",
+   "approved", "pending", "balance", "transfer", "statement", "policy", "claim", "service"
+};
+
+static const size_t c_vocabularySize = sizeof(c_vocabulary) / sizeof(c_vocabulary[0]);
+
+// The sort of expressions a DLP scanner runs.
+static const wchar_t * const c_regexes[] =
+{
+   L"\\b\\d{3}-\\d{2}-\\d{4}\\b",                      // US social security number
+   L"\\b(?:\\d{4}[ -]?){3}\\d{4}\\b",                   // payment card number
+   L"[a-z0-9._%+-]+@[a-z0-9.-]+\\.[a-z]{2,}",          // email address
+   L"\\biban:? ?[a-z]{2}\\d{2}[a-z0-9]{10,30}\\b"       // IBAN
+};
+
+static std::wstring GenerateText(size_t characters, std::mt19937 & random)
+{
+   std::wstring text;
+   text.reserve(characters + 64);
+
+   while (text.length() < characters)
+   {
+      unsigned pick = random() % 1000;
+
+      if (pick < 2)
+      {
+         wchar_t id[32];
+         swprintf(id, 32, L"%03u-%02u-%04u", random() % 1000, random() % 100, random() % 10000);
+         text += id;
+      }
+      else if (pick < 3)
+      {
+         text += L"j.smith@example.com";
+      }
+      else
+      {
+         const char *word = c_vocabulary[random() % c_vocabularySize];
+         text.append(word, word + strlen(word));
+      }
+
+      text += (random() % 12) ? L' ' : L'\n';
+   }
+
+   return text;
+}
+
+static bool ReadText(const char *path, std::wstring & text)
+{
+   std::ifstream file(path, std::ios::binary);
+   std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+   if (!file.good() && !file.eof())
+      return false;
+
+   bool truncated = false;
+   std::wstring decoded;
+
+   if (!ExtractPlainText(bytes.empty() ? NULL : &bytes[0], bytes.size(), 0, CLEANUP_DISPLAY, decoded, &truncated))
+      return false;
+
+   text += decoded;
+   return true;
+}
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: matchbench [options] [file...]\n"
+      "  -g MB     generate this much text instead of reading files (default: 64)\n"
+      "  -k N      generate N keywords (default: 2000)\n"
+      "  -K FILE   read the keywords from FILE instead, one per line\n"
+      "  -x        keywords only, no regular expressions\n"
+      "  -s        skip the search baseline, which is slow with many keywords\n");
+}
+
+int main(int argc, char *argv[])
+{
+   double megabytes = 64;
+   size_t keywordCount = 2000;
+   const char *keywordFile = NULL;
+   bool useRegexes = true;
+   bool baseline = true;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "g:k:K:xsh")) != -1)
+   {
+      switch (opt)
+      {
+         case 'g':
+            megabytes = atof(optarg);
+            break;
+
+         case 'k':
+            keywordCount = strtoul(optarg, NULL, 10);
+            break;
+
+         case 'K':
+            keywordFile = optarg;
+            break;
+
+         case 'x':
+            useRegexes = false;
+            break;
+
+         case 's':
+            baseline = false;
+            break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   std::mt19937 random(12345);
+   std::wstring text;
+
+   if (optind < argc)
+   {
+      for (int i = optind; i < argc; ++i)
+      {
+         if (!ReadText(argv[i], text))
+         {
+            fprintf(stderr, "matchbench: can't read %s as text\n", argv[i]);
+            return 2;
+         }
+      }
+   }
+   else
+   {
+      text = GenerateText(static_cast<size_t>(megabytes * 1024 * 1024 / 2), random);
+   }
+
+   std::vector<std::wstring> keywords;
+
+   if (keywordFile)
+   {
+      std::ifstream file(keywordFile);
+      std::string line;
+
+      while (std::getline(file, line))
+      {
+         if (!line.empty())
+            keywords.push_back(std::wstring(line.begin(), line.end()));
+      }
+   }
+   else
+   {
+      // mostly words that never occur, a few that do
+      for (size_t i = 0; i < keywordCount; ++i)
+      {
+         if (0 == i % 500)
+         {
+            const char *word = c_vocabulary[(i / 500 * 7) % c_vocabularySize];
+            keywords.push_back(std::wstring(word, word + strlen(word)) + L" " + L"approved");
+            continue;
+         }
+
+         std::wstring keyword;
+         size_t length = 5 + random() % 8;
+
+         for (size_t j = 0; j < length; ++j)
+            keyword += static_cast<wchar_t>('a' + random() % 26);
+
+         keywords.push_back(keyword);
+      }
+   }
+
+   std::vector<std::wstring> regexes;
+
+   if (useRegexes)
+      regexes.assign(c_regexes, c_regexes + sizeof(c_regexes) / sizeof(c_regexes[0]));
+
+   PatternSet patterns;
+   size_t bad = 0;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   if (!patterns.Compile(keywords, regexes, CLEANUP_DISPLAY, &bad))
+   {
+      fprintf(stderr, "matchbench: pattern %zu doesn't compile\n", bad);
+      return 2;
+   }
+
+   double megabytesOfText = text.length() * 2.0 / 1e6;
+
+   printf("%zu characters (%.1f MB UTF-16), %zu keywords, %zu expressions, compiled in %.1f ms\n",
+          text.length(), megabytesOfText, keywords.size(), regexes.size(), Seconds(start) * 1000);
+   printf("%-8s %10s %10s %12s %12s\n", "mode", "seconds", "MB/sec", "keyword hits", "regex hits");
+
+   size_t baselineKeywordHits = 0;
+
+   if (baseline)
+   {
+      start = std::chrono::steady_clock::now();
+
+      size_t regexHits = 0;
+
+      for (size_t k = 0; k < keywords.size(); ++k)
+      {
+         for (size_t pos = text.find(keywords[k]); pos != std::wstring::npos; pos = text.find(keywords[k], pos + 1))
+            ++baselineKeywordHits;
+      }
+
+      for (size_t r = 0; r < regexes.size(); ++r)
+      {
+         std::wregex expression(regexes[r]);
+         regexHits += std::distance(std::wsregex_iterator(text.begin(), text.end(), expression), std::wsregex_iterator());
+      }
+
+      double seconds = Seconds(start);
+      printf("%-8s %10.3f %10.1f %12zu %12zu\n", "search", seconds, megabytesOfText / seconds, baselineKeywordHits, regexHits);
+   }
+
+   int failures = 0;
+
+   for (int mode = 0; mode < 2; ++mode)
+   {
+      start = std::chrono::steady_clock::now();
+
+      MatchSink sink(patterns, 0 == mode ? 0 : 1);
+
+      for (size_t pos = 0; pos < text.length() && sink.WantsMore(); pos += 4096)
+         sink.OnText(text.data() + pos, text.length() - pos < 4096 ? text.length() - pos : 4096);
+
+      sink.OnEnd();
+
+      double seconds = Seconds(start);
+      size_t keywordHits = 0;
+
+      for (size_t i = 0; i < sink.Matches().size(); ++i)
+      {
+         if (sink.Matches()[i].pattern < keywords.size())
+            ++keywordHits;
+      }
+
+      printf("%-8s %10.3f %10.1f %12zu %12zu", 0 == mode ? "stream" : "first", seconds, megabytesOfText / seconds,
+             keywordHits, sink.Matches().size() - keywordHits);
+
+      if (1 == mode && !sink.Matches().empty())
+         printf("   at character %llu", sink.Matches()[0].offset);
+
+      printf("\n");
+
+      if (0 == mode && baseline && keywordHits != baselineKeywordHits)
+      {
+         fprintf(stderr, "matchbench: stream found %zu keyword hits, search %zu\n", keywordHits, baselineKeywordHits);
+         ++failures;
+      }
+   }
+
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// Ndjson.h : Newline-delimited JSON record formatting for the Linux front ends
+
+#ifndef __NDJSON_H_
+#define __NDJSON_H_
+
+#include <stdio.h>
+#include <string>
+
+// Appends s to out as a quoted JSON string. s is taken to be UTF-8 already.
+inline void AppendJsonString(std::string & out, const std::string & s)
+{
+   out += '"';
+
+   for (size_t i = 0; i < s.length(); ++i)
+   {
+      unsigned char c = static_cast<unsigned char>(s[i]);
+
+      switch (c)
+      {
+         case '"':  out += "\\\""; break;
+         case '\\': out += "\\\\"; break;
+         case '\n': out += "\\n";  break;
+         case '\r': out += "\\r";  break;
+         case '\t': out += "\\t";  break;
+
+         default:
+            if (c < 0x20)
+            {
+               char esc[8];
+               snprintf(esc, sizeof(esc), "\\u%04x", c);
+               out += esc;
+            }
+            else
+            {
+               out += static_cast<char>(c);
+            }
+            break;
+      }
+   }
+
+   out += '"';
+}
+
+// Appends cleaned up text to out as the inside of a JSON string, encoding it
+// as UTF-8 on the way. For text that arrives in pieces.
+inline void AppendJsonCharacters(std::string & out, const wchar_t *s, size_t cch)
+{
+   for (size_t i = 0; i < cch; ++i)
+   {
+      unsigned long cp = static_cast<unsigned long>(s[i]);
+
+      switch (cp)
+      {
+         case '"':  out += "\\\""; break;
+         case '\\': out += "\\\\"; break;
+         case '\n': out += "\\n";  break;
+         case '\r': out += "\\r";  break;
+         case '\t': out += "\\t";  break;
+
+         default:
+            if (cp < 0x20 || (cp >= 0xD800 && cp <= 0xDFFF))
+            {
+               char esc[8];
+               snprintf(esc, sizeof(esc), "\\u%04lx", cp);
+               out += esc;
+            }
+            else if (cp < 0x80)
+            {
+               out += static_cast<char>(cp);
+            }
+            else if (cp < 0x800)
+            {
+               out += static_cast<char>(0xC0 | (cp >> 6));
+               out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else if (cp < 0x10000)
+            {
+               out += static_cast<char>(0xE0 | (cp >> 12));
+               out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+               out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+               out += static_cast<char>(0xF0 | (cp >> 18));
+               out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+               out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+               out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            break;
+      }
+   }
+}
+
+// Appends the cleaned up text to out as a quoted JSON string, encoding it as
+// UTF-8 on the way.
+inline void AppendJsonString(std::string & out, const std::wstring & s)
+{
+   out += '"';
+   AppendJsonCharacters(out, s.data(), s.length());
+   out += '"';
+}
+
+#endif //__NDJSON_H_
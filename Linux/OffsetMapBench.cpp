@@ -0,0 +1,313 @@
+// OffsetMapBench.cpp : Times OffsetMapSink on synthetic chunk streams and
+//                      measures the maps it makes, on Linux.
+//
+// Each stream drives the sink the way FilterText does: OnChunk, the cleaned
+// up separator in one OnText call when the chunk has a break, then the
+// chunk's text in buffers of up to 4096 characters. The streams are
+//  - runs:       short runs of one source, ids and source ranges back to
+//                back, mostly without breaks (formatting runs in Word)
+//  - paragraphs: paragraphs of up to 2000 characters with EOP breaks
+//  - sparse:     ids and source ranges jumping around, chunks from other
+//                sources mixed in (headers, notes, embedded objects)
+//  - large:      chunks of 64 KB to 1 MB, lengths past the two-byte varints
+//
+// Decodes every map and checks it gives back the chunks that went in, and
+// that FindOffset finds the chunk of offsets inside, on and between them.
+// Then prints the median encode and decode rates over the runs, the map's
+// size per chunk and against the UTF-16 text it covers, and the lookup time.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o offsetmapbench OffsetMapBench.cpp ../OffsetMap.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "OffsetMap.h"
+
+static const size_t c_bufferChars = 4096;
+
+struct SyntheticChunk
+{
+   ChunkInfo info;
+   unsigned long separator;   // characters the cleaned-up separator came to
+   unsigned long length;      // characters of text
+};
+
+enum Stream
+{
+   STREAM_RUNS,
+   STREAM_PARAGRAPHS,
+   STREAM_SPARSE,
+   STREAM_LARGE,
+   STREAMS
+};
+
+static const char * const c_streamNames[STREAMS] = { "runs", "paragraphs", "sparse", "large" };
+
+class Random
+{
+public:
+   explicit Random(unsigned long seed) : m_state(seed) {}
+
+   // 0..n-1
+   unsigned long Next(unsigned long n)
+   {
+      m_state = m_state * 6364136223846793005ULL + 1442695040888963407ULL;
+      return static_cast<unsigned long>((m_state >> 33) % n);
+   }
+
+private:
+   unsigned long long m_state;
+};
+
+static std::vector<SyntheticChunk> MakeStream(Stream stream, size_t chunks)
+{
+   std::vector<SyntheticChunk> out;
+   Random random(stream + 1);
+
+   unsigned long id = 1;
+   unsigned long source = 0;
+
+   for (size_t i = 0; i < chunks; ++i)
+   {
+      SyntheticChunk chunk;
+      chunk.info.locale = 0x409;
+      chunk.info.breakType = TEXT_BREAK_NONE;
+
+      switch (stream)
+      {
+         case STREAM_RUNS:
+            chunk.length = 1 + random.Next(200);
+
+            if (0 == random.Next(8))
+               chunk.info.breakType = TEXT_BREAK_EOW;
+            break;
+
+         case STREAM_PARAGRAPHS:
+            chunk.length = 20 + random.Next(1980);
+            chunk.info.breakType = TEXT_BREAK_EOP;
+            break;
+
+         case STREAM_SPARSE:
+            chunk.length = 1 + random.Next(500);
+            chunk.info.breakType = static_cast<TextBreak>(random.Next(5));
+            id += random.Next(1000);
+            source += random.Next(100000);
+            break;
+
+         case STREAM_LARGE:
+            chunk.length = 65536 + random.Next(1048576 - 65536);
+            chunk.info.breakType = TEXT_BREAK_EOC;
+            break;
+
+         default:
+            break;
+      }
+
+      chunk.info.idChunk = id++;
+      chunk.info.idChunkSource = STREAM_SPARSE == stream && 0 == random.Next(4) ? random.Next(50) : chunk.info.idChunk;
+      chunk.info.cwcStartSource = source & 0xFFFFFFFFUL;   // 32 bits in a STAT_CHUNK
+      chunk.info.cwcLenSource = chunk.length + (STREAM_SPARSE == stream ? random.Next(20) : 0);
+
+      // what the separator comes to after clean up, the compact profile
+      // can fold it into a blank before it
+      switch (chunk.info.breakType)
+      {
+         case TEXT_BREAK_NONE: chunk.separator = 0; break;
+         case TEXT_BREAK_EOW:  chunk.separator = random.Next(2); break;
+         default:              chunk.separator = 2 - random.Next(2); break;
+      }
+
+      source += chunk.info.cwcLenSource;
+      out.push_back(chunk);
+   }
+
+   return out;
+}
+
+static void Feed(const std::vector<SyntheticChunk> & stream, const wchar_t *text, OffsetMapSink & sink)
+{
+   for (size_t i = 0; i < stream.size(); ++i)
+   {
+      sink.OnChunk(stream[i].info);
+
+      if (TEXT_BREAK_NONE != stream[i].info.breakType)
+         sink.OnText(text, stream[i].separator);
+
+      for (unsigned long done = 0; done < stream[i].length; )
+      {
+         size_t cch = std::min<size_t>(c_bufferChars, stream[i].length - done);
+         sink.OnText(text, cch);
+         done += static_cast<unsigned long>(cch);
+      }
+   }
+
+   sink.OnEnd();
+}
+
+// Returns the number of differences between the map and the stream.
+static int CheckMap(const std::vector<SyntheticChunk> & stream, const std::vector<unsigned char> & map,
+                    unsigned long long *textChars)
+{
+   std::vector<OffsetEntry> entries;
+
+   if (!DecodeOffsetMap(&map[0], map.size(), entries) || entries.size() != stream.size())
+   {
+      printf("the map doesn't decode to %lu chunks\n", static_cast<unsigned long>(stream.size()));
+      return 1;
+   }
+
+   int failures = 0;
+   unsigned long offset = 0;
+
+   for (size_t i = 0; i < stream.size(); ++i)
+   {
+      const ChunkInfo & info = stream[i].info;
+      const OffsetEntry & entry = entries[i];
+
+      if (TEXT_BREAK_NONE != info.breakType)
+         offset += stream[i].separator;
+
+      if (entry.outputStart != offset || entry.outputLength != stream[i].length || entry.idChunk != info.idChunk ||
+          entry.idChunkSource != info.idChunkSource || entry.cwcStartSource != info.cwcStartSource ||
+          entry.cwcLenSource != info.cwcLenSource)
+      {
+         if (++failures <= 5)
+            printf("chunk %lu decodes wrong\n", static_cast<unsigned long>(i));
+
+         continue;
+      }
+
+      // the first and last characters belong to the chunk, the separator before it to none
+      const OffsetEntry *first = FindOffset(entries, offset);
+      const OffsetEntry *last = FindOffset(entries, offset + stream[i].length - 1);
+      const OffsetEntry *separator = stream[i].separator ? FindOffset(entries, offset - 1) : NULL;
+
+      if (first != &entry || last != &entry || NULL != separator)
+      {
+         if (++failures <= 5)
+            printf("chunk %lu isn't found at its offsets\n", static_cast<unsigned long>(i));
+      }
+
+      offset += stream[i].length;
+   }
+
+   if (NULL != FindOffset(entries, offset))
+   {
+      printf("an offset past the end is found\n");
+      ++failures;
+   }
+
+   *textChars = offset;
+   return failures;
+}
+
+template <class Operation>
+static double Median(unsigned runs, Operation operation)
+{
+   std::vector<double> times;
+
+   for (unsigned run = 0; run < runs; ++run)
+   {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      operation();
+      times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+   }
+
+   std::sort(times.begin(), times.end());
+   return times[times.size() / 2];
+}
+
+int main(int argc, char *argv[])
+{
+   size_t chunks = 1000000;
+   unsigned runs = 5;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "c:r:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'c': chunks = strtoul(optarg, NULL, 10); break;
+         case 'r': runs = static_cast<unsigned>(atoi(optarg)); break;
+
+         default:
+            fprintf(stderr,
+               "usage: offsetmapbench [options]\n"
+               "  -c CHUNKS  chunks per stream, a thousandth of them for large (default: 1000000)\n"
+               "  -r RUNS    timed runs, the median counts (default: 5)\n");
+            return 2;
+      }
+   }
+
+   if (chunks < 100)
+      chunks = 100;
+
+   if (0 == runs)
+      runs = 1;
+
+   static wchar_t text[c_bufferChars];
+   int failures = 0;
+
+   printf("%-10s %9s %12s %12s %11s %11s %9s %10s\n", "stream", "chunks", "map bytes", "bytes/chunk", "of text",
+          "encode M/s", "decode M/s", "lookup ns");
+
+   for (int s = 0; s < STREAMS; ++s)
+   {
+      std::vector<SyntheticChunk> stream = MakeStream(static_cast<Stream>(s), STREAM_LARGE == s ? chunks / 1000 : chunks);
+
+      OffsetMapSink sink(0);
+      Feed(stream, text, sink);
+
+      unsigned long long textChars = 0;
+      int streamFailures = CheckMap(stream, sink.Encoded(), &textChars);
+
+      if (streamFailures)
+      {
+         printf("%-10s MISMATCH\n", c_streamNames[s]);
+         failures += streamFailures;
+         continue;
+      }
+
+      const std::vector<unsigned char> & map = sink.Encoded();
+      std::vector<OffsetEntry> entries;
+
+      double encode = Median(runs, [&]() { OffsetMapSink timed(0); Feed(stream, text, timed); });
+      double decode = Median(runs, [&]() { DecodeOffsetMap(&map[0], map.size(), entries); });
+
+      const size_t c_lookups = 1000000;
+      Random random(42);
+      std::vector<unsigned long> offsets(c_lookups);
+
+      for (size_t i = 0; i < c_lookups; ++i)
+         offsets[i] = random.Next(static_cast<unsigned long>(textChars));
+
+      size_t found = 0;
+      double lookup = Median(runs, [&]()
+      {
+         for (size_t i = 0; i < c_lookups; ++i)
+            found += NULL != FindOffset(entries, offsets[i]);
+      });
+
+      printf("%-10s %9lu %12lu %12.2f %10.4f%% %11.1f %11.1f %10.0f\n", c_streamNames[s],
+             static_cast<unsigned long>(stream.size()), static_cast<unsigned long>(map.size()),
+             static_cast<double>(map.size()) / stream.size(), 100.0 * map.size() / (textChars * 2),
+             stream.size() / encode / 1e6, stream.size() / decode / 1e6, lookup * 1e9 / c_lookups);
+
+      if (0 == found)
+         printf("%-10s no lookups found a chunk\n", c_streamNames[s]);
+   }
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   return 0;
+}
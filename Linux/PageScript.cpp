@@ -0,0 +1,524 @@
+// PageScript.cpp : Pages through scripted chunk sources the way
+//                  ExtractTextPage does, and checks the pages add up to the
+//                  whole text, on Linux.
+//
+// A scripted source stands in for a filter: text chunks with each kind of
+// break, chunks without text, unavailable chunks, and failures in GetChunk or
+// GetText. It hands the text out in pieces of a set size, ending each chunk
+// with FILTER_E_NO_MORE_TEXT on its own or with the last piece (both happen).
+// The whole text is built independently: separators and text cleaned up in
+// one go, the way ExtractTextEx's loop does.
+//
+// For each script, profile, piece size and page length this
+//  - pages through with one reader kept open, as when the session survives
+//  - pages through with the session evicted after every page: the
+//    continuation token goes through EncodePageToken and DecodePageToken,
+//    and a fresh source is fast-forwarded to the token's or the index's
+//    checkpoint, whichever is later. No GetText may be called on a chunk
+//    before that checkpoint, and every page has to come out the same
+//  - reads pages at offsets all over the text from the checkpoint index
+// and checks that the pages add up to the whole text. A source that fails
+// has to fail the read, after pages that match the text so far.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o pagescript PageScript.cpp ../PagedText.cpp ../TextCleanup.cpp ../TokenText.cpp
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "PagedText.h"
+
+struct ScriptChunk
+{
+   enum Kind { TEXT, SKIP, ERROR, TEXT_ERROR } kind;
+   TextBreak breakType;
+   std::wstring text;
+};
+
+class ScriptedChunkSource : public ChunkSource
+{
+public:
+   ScriptedChunkSource(const std::vector<ScriptChunk> & script, unsigned long pieceChars, bool lastWithText)
+      : m_script(script), m_pieceChars(pieceChars), m_lastWithText(lastWithText),
+        m_next(0), m_current(NULL), m_position(0), m_firstTextOrdinal(~0UL)
+   {
+   }
+
+   virtual ChunkRead NextChunk(ChunkInfo & chunk)
+   {
+      m_current = NULL;
+
+      if (m_next == m_script.size())
+         return CHUNK_READ_END;
+
+      const ScriptChunk & next = m_script[m_next++];
+
+      if (ScriptChunk::ERROR == next.kind)
+         return CHUNK_READ_ERROR;
+
+      if (ScriptChunk::SKIP == next.kind)
+         return CHUNK_READ_SKIP;
+
+      chunk.idChunk = static_cast<unsigned long>(m_next);
+      chunk.breakType = next.breakType;
+      chunk.locale = 0x409;
+      chunk.idChunkSource = chunk.idChunk;
+      chunk.cwcStartSource = 0;
+      chunk.cwcLenSource = 0;
+
+      m_current = &next;
+      m_position = 0;
+      return CHUNK_READ_TEXT;
+   }
+
+   virtual TextRead GetText(wchar_t *buf, unsigned long *cch)
+   {
+      // NextChunk calls before this chunk, like PageCheckpoint::chunkOrdinal
+      m_firstTextOrdinal = std::min(m_firstTextOrdinal, static_cast<unsigned long>(m_next - 1));
+
+      if (NULL == m_current || ScriptChunk::TEXT_ERROR == m_current->kind)
+         return TEXT_READ_ERROR;
+
+      size_t left = m_current->text.length() - m_position;
+
+      if (0 == left)
+      {
+         *cch = 0;
+         return TEXT_READ_END;
+      }
+
+      size_t n = std::min<size_t>(std::min<size_t>(*cch, m_pieceChars), left);
+      std::copy(m_current->text.begin() + m_position, m_current->text.begin() + m_position + n, buf);
+      m_position += n;
+      *cch = static_cast<unsigned long>(n);
+
+      return m_lastWithText && m_position == m_current->text.length() ? TEXT_READ_LAST : TEXT_READ_MORE;
+   }
+
+   // The first chunk GetText was called on, ~0 for none
+   unsigned long FirstTextOrdinal() const { return m_firstTextOrdinal; }
+
+private:
+   const std::vector<ScriptChunk> & m_script;
+   unsigned long m_pieceChars;
+   bool m_lastWithText;
+
+   size_t m_next;
+   const ScriptChunk *m_current;
+   size_t m_position;
+   unsigned long m_firstTextOrdinal;
+};
+
+// The whole text, and whether the script fails before its end
+static std::wstring WholeText(const std::vector<ScriptChunk> & script, CleanupProfile profile, bool *fails)
+{
+   std::wstring raw;
+   *fails = false;
+
+   for (size_t i = 0; i < script.size() && !*fails; ++i)
+   {
+      if (ScriptChunk::ERROR == script[i].kind || ScriptChunk::TEXT_ERROR == script[i].kind)
+      {
+         *fails = true;
+         break;
+      }
+
+      if (ScriptChunk::SKIP == script[i].kind)
+         continue;
+
+      if (TEXT_BREAK_EOW == script[i].breakType)
+         raw += L' ';
+      else if (TEXT_BREAK_NONE != script[i].breakType)
+         raw += L"\r\n";
+
+      raw += script[i].text;
+   }
+
+   CleanupState state;
+   size_t cch = raw.empty() ? 0 : GetCleanupFunction(profile)(raw.length(), &raw[0], state);
+   raw.resize(cch);
+   return raw;
+}
+
+class Random
+{
+public:
+   explicit Random(unsigned long seed) : m_state(seed) {}
+
+   // 0..n-1
+   unsigned long Next(unsigned long n)
+   {
+      m_state = m_state * 6364136223846793005ULL + 1442695040888963407ULL;
+      return static_cast<unsigned long>((m_state >> 33) % n);
+   }
+
+private:
+   unsigned long long m_state;
+};
+
+static const wchar_t * const s_words[] =
+{
+   L"page", L"token", L"checkpoint", L"filter", L"na\x00EFve", L"\x4E2D\x6587", L"  ", L"\t", L"\r\n", L"\x00A0", L"end."
+};
+
+static std::wstring Words(Random & random, size_t count)
+{
+   std::wstring text;
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      text += s_words[random.Next(sizeof(s_words) / sizeof(s_words[0]))];
+
+      if (random.Next(3))
+         text += L' ';
+   }
+
+   return text;
+}
+
+static ScriptChunk Text(TextBreak breakType, const std::wstring & text)
+{
+   ScriptChunk chunk;
+   chunk.kind = ScriptChunk::TEXT;
+   chunk.breakType = breakType;
+   chunk.text = text;
+   return chunk;
+}
+
+static ScriptChunk Kind(ScriptChunk::Kind kind)
+{
+   ScriptChunk chunk = Text(TEXT_BREAK_EOP, L"");
+   chunk.kind = kind;
+   return chunk;
+}
+
+struct Script
+{
+   const char *name;
+   std::vector<ScriptChunk> chunks;
+};
+
+static std::vector<Script> BuiltInScripts()
+{
+   std::vector<Script> scripts;
+   Random random(2026);
+   Script script;
+
+   // formatting runs: words with EOW breaks, runs that split words, unavailable chunks
+   script.name = "words";
+   script.chunks.clear();
+
+   for (int i = 0; i < 20000; ++i)
+   {
+      if (0 == i % 17)
+         script.chunks.push_back(Kind(ScriptChunk::SKIP));
+
+      script.chunks.push_back(Text(random.Next(4) ? TEXT_BREAK_EOW : TEXT_BREAK_NONE, Words(random, 1)));
+   }
+
+   scripts.push_back(script);
+
+   // paragraphs of up to a few buffers, blanks at their ends for the separators to collapse into
+   script.name = "paragraphs";
+   script.chunks.clear();
+
+   for (int i = 0; i < 300; ++i)
+      script.chunks.push_back(Text(static_cast<TextBreak>(TEXT_BREAK_EOS + random.Next(3)), L" " + Words(random, random.Next(2000)) + L" "));
+
+   scripts.push_back(script);
+
+   // text chunks without text first, last and in runs
+   script.name = "empty";
+   script.chunks.clear();
+
+   for (int i = 0; i < 2000; ++i)
+   {
+      unsigned long r = random.Next(4);
+
+      if (0 == r)
+         script.chunks.push_back(Text(static_cast<TextBreak>(random.Next(5)), L""));
+      else if (1 == r)
+         script.chunks.push_back(Kind(ScriptChunk::SKIP));
+      else
+         script.chunks.push_back(Text(static_cast<TextBreak>(random.Next(5)), Words(random, random.Next(20))));
+   }
+
+   script.chunks.insert(script.chunks.begin(), Text(TEXT_BREAK_EOP, L""));
+   script.chunks.push_back(Text(TEXT_BREAK_EOP, L""));
+   scripts.push_back(script);
+
+   script.name = "one-chunk";
+   script.chunks.clear();
+   script.chunks.push_back(Text(TEXT_BREAK_EOC, Words(random, 60000)));
+   scripts.push_back(script);
+
+   script.name = "no-chunks";
+   script.chunks.clear();
+   scripts.push_back(script);
+
+   // a filter that fails partway, in GetChunk and in GetText
+   script.name = "chunk-error";
+   script.chunks.clear();
+
+   for (int i = 0; i < 60; ++i)
+      script.chunks.push_back(Text(TEXT_BREAK_EOP, Words(random, random.Next(500))));
+
+   script.chunks[50] = Kind(ScriptChunk::ERROR);
+   scripts.push_back(script);
+
+   script.name = "text-error";
+   script.chunks[50] = Kind(ScriptChunk::TEXT_ERROR);
+   script.chunks[50].text = L"never read";
+   scripts.push_back(script);
+
+   return scripts;
+}
+
+static const char * const c_profileNames[CLEANUP_PROFILES] = { "display", "index", "compact" };
+
+struct Run
+{
+   const Script *script;
+   CleanupProfile profile;
+   unsigned long pieceChars;
+   bool lastWithText;
+   size_t pageLength;
+   const std::wstring *whole;
+   bool fails;
+};
+
+static void Report(const Run & run, const char *how, const char *what)
+{
+   printf("%-11s %-8s pieces of %-4lu %s, pages of %-7lu %s: %s\n", run.script->name, c_profileNames[run.profile],
+          run.pieceChars, run.lastWithText ? "last" : "end ", static_cast<unsigned long>(run.pageLength), how, what);
+}
+
+// What the pages came to has to be the text so far, and all of it unless
+// the source fails.
+static int CheckPages(const Run & run, const char *how, const std::wstring & paged, bool failed, size_t limit)
+{
+   const std::wstring & whole = *run.whole;
+
+   if (0 != paged.compare(0, std::wstring::npos, whole, 0, paged.length()))
+   {
+      Report(run, how, "the pages differ from the text");
+      return 1;
+   }
+
+   // a failing source only has to fail once the pages get that far
+   if (failed != run.fails && (failed || paged.length() == whole.length()))
+   {
+      Report(run, how, failed ? "a read failed" : "no read failed");
+      return 1;
+   }
+
+   if (!failed && paged.length() < std::min(limit, whole.length()))
+   {
+      Report(run, how, "the pages stop short");
+      return 1;
+   }
+
+   return 0;
+}
+
+// Pages with the reader kept open between pages.
+static int PageOpen(const Run & run, size_t limit)
+{
+   ScriptedChunkSource source(run.script->chunks, run.pieceChars, run.lastWithText);
+   PageReader reader(source, run.profile);
+   std::wstring paged;
+   bool failed = false;
+
+   while (paged.length() < limit)
+   {
+      // a failed read returns no page
+      std::wstring page;
+
+      if (!reader.Read(reader.Offset(), run.pageLength, page))
+      {
+         failed = true;
+         break;
+      }
+
+      paged += page;
+
+      if (reader.AtEnd())
+         break;
+   }
+
+   if (!failed && reader.AtEnd() && reader.Offset() != run.whole->length())
+   {
+      Report(run, "kept open", "the reader ends at the wrong offset");
+      return 1;
+   }
+
+   return CheckPages(run, "kept open", paged, failed, limit);
+}
+
+// Pages with a fresh source for every page, like ExtractTextPage once the
+// session was evicted, and leaves the checkpoints it found in index.
+static int PageEvicted(const Run & run, size_t limit, PageCheckpoints & index)
+{
+   std::wstring paged;
+   std::wstring continuation;
+   bool failed = false;
+
+   while (paged.length() < limit)
+   {
+      unsigned long long start = 0;
+      PageCheckpoint checkpoint = index.Find(0);
+
+      if (!continuation.empty())
+      {
+         PageToken token;
+
+         if (!DecodePageToken(continuation.data(), continuation.length(), token) || 3 != token.session ||
+             7 != token.stamp || token.profile != static_cast<unsigned long>(run.profile))
+         {
+            Report(run, "evicted", "the token doesn't decode");
+            return 1;
+         }
+
+         start = token.offset;
+         checkpoint = index.Find(start);
+
+         if (token.checkpoint.offset <= start && token.checkpoint.offset > checkpoint.offset)
+            checkpoint = token.checkpoint;
+      }
+
+      ScriptedChunkSource source(run.script->chunks, run.pieceChars, run.lastWithText);
+      PageReader reader(source, run.profile);
+
+      if (!reader.Seek(checkpoint))
+      {
+         Report(run, "evicted", "the checkpoint can't be reached");
+         return 1;
+      }
+
+      std::wstring page;
+      bool read = reader.Read(start, run.pageLength, page);
+      index.Merge(reader.Checkpoints());
+
+      if (source.FirstTextOrdinal() < checkpoint.chunkOrdinal)
+      {
+         Report(run, "evicted", "text before the checkpoint was pulled");
+         return 1;
+      }
+
+      if (!read)
+      {
+         failed = true;
+         break;
+      }
+
+      paged += page;
+
+      if (reader.AtEnd())
+         break;
+
+      PageToken token;
+      token.session = 3;
+      token.stamp = 7;
+      token.profile = run.profile;
+      token.offset = reader.Offset();
+      token.checkpoint = reader.LastCheckpoint();
+
+      continuation = EncodePageToken(token);
+   }
+
+   return CheckPages(run, "evicted", paged, failed, limit);
+}
+
+// Pages at offsets all over the text, each from the closest checkpoint.
+static int PageAnywhere(const Run & run, const PageCheckpoints & index)
+{
+   const std::wstring & whole = *run.whole;
+   int failures = 0;
+
+   for (int k = 0; k < 13; ++k)
+   {
+      unsigned long long start = whole.length() * k / 13;
+      PageCheckpoint checkpoint = index.Find(start);
+
+      ScriptedChunkSource source(run.script->chunks, run.pieceChars, run.lastWithText);
+      PageReader reader(source, run.profile);
+      std::wstring page;
+
+      if (!reader.Seek(checkpoint) || !reader.Read(start, run.pageLength, page) ||
+          0 != page.compare(whole.substr(static_cast<size_t>(start), run.pageLength)))
+      {
+         Report(run, "anywhere", "a page differs from the text at its offset");
+         ++failures;
+      }
+   }
+
+   return failures;
+}
+
+int main(int argc, char *[])
+{
+   if (argc > 1)
+   {
+      fprintf(stderr, "usage: pagescript\n");
+      return 2;
+   }
+
+   static const size_t c_pageLengths[] = { 1, 7, 1000, 4096, 16385, 1000000 };
+   static const struct { unsigned long chars; bool last; } c_pieces[] = { { 4096, false }, { 333, true }, { 1, false } };
+
+   std::vector<Script> scripts = BuiltInScripts();
+   int failures = 0;
+
+   for (size_t s = 0; s < scripts.size(); ++s)
+   {
+      unsigned runs = 0;
+      unsigned long checkpoints = 0;
+      size_t length = 0;
+      bool fails = false;
+
+      for (int p = 0; p < CLEANUP_PROFILES; ++p)
+      {
+         Run run;
+         run.script = &scripts[s];
+         run.profile = static_cast<CleanupProfile>(p);
+
+         std::wstring whole = WholeText(scripts[s].chunks, run.profile, &run.fails);
+         run.whole = &whole;
+         length = whole.length();
+         fails = run.fails;
+
+         for (size_t c = 0; c < sizeof(c_pieces) / sizeof(c_pieces[0]); ++c)
+         {
+            run.pieceChars = c_pieces[c].chars;
+            run.lastWithText = c_pieces[c].last;
+
+            for (size_t l = 0; l < sizeof(c_pageLengths) / sizeof(c_pageLengths[0]); ++l)
+            {
+               run.pageLength = c_pageLengths[l];
+
+               // the short pages and pieces only over the start, they're slow
+               size_t limit = run.pageLength < 100 ? 3000 : run.pieceChars < 100 ? 20000 : std::wstring::npos;
+
+               PageCheckpoints index;
+               failures += PageOpen(run, limit);
+               failures += PageEvicted(run, limit, index);
+
+               if (!run.fails)
+                  failures += PageAnywhere(run, index);
+
+               checkpoints = std::max<unsigned long>(checkpoints, static_cast<unsigned long>(index.Count()));
+               ++runs;
+            }
+         }
+      }
+
+      printf("%-11s %8lu characters%s, up to %3lu checkpoints, %3u runs\n", scripts[s].name, static_cast<unsigned long>(length),
+             fails ? " before it fails" : "", checkpoints, runs);
+   }
+
+   printf("%s\n", failures ? "MISMATCH" : "all pages add up");
+   return failures ? 1 : 0;
+}
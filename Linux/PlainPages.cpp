@@ -0,0 +1,360 @@
+// PlainPages.cpp : Checks on Linux that paging through a plain text file gives
+//                  the text ExtractTextEx does.
+//
+// ExtractTextEx reads files whose content is plain text with the built-in
+// path (ExtractAppendedText from a fresh state), ExtractTextPage pages through
+// the same files with a PlainChunkSource. For each file and profile this
+// pulls the whole text the first way, then pages through it the second way
+// with a few page lengths, and resumes from every checkpoint the pages left
+// behind with a fresh source, as ExtractTextPage does after a session was
+// evicted. The pages have to add up to the text and the resumed reads have
+// to match it at the same offsets.
+//
+// Without arguments it runs built-in files: ASCII, UTF-8 with characters
+// across the 4 KB decode blocks and the 64 KB reads, a BOM, UTF-16 in both
+// byte orders with surrogate pairs, Latin-1, a stray byte, a partial
+// character at the end, an empty file, and a binary one both paths have to
+// turn down. With file arguments it checks those instead.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o plainpages PlainPages.cpp ../AppendText.cpp ../PagedText.cpp ../PlainText.cpp ../TextCleanup.cpp ../TokenText.cpp
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "AppendText.h"
+#include "PagedText.h"
+
+class MemoryReader : public ByteReader
+{
+public:
+   explicit MemoryReader(const std::string & bytes) : m_bytes(bytes) {}
+
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb)
+   {
+      if (offset > m_bytes.size() || cb > m_bytes.size() - offset)
+         return false;
+
+      memcpy(buf, m_bytes.data() + offset, cb);
+      return true;
+   }
+
+private:
+   const std::string & m_bytes;
+};
+
+static bool ReadFile(const char *path, std::string & bytes)
+{
+   int fd = open(path, O_RDONLY);
+
+   if (fd < 0)
+      return false;
+
+   char buf[65536];
+   ssize_t n;
+
+   while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && EINTR == errno))
+   {
+      if (n > 0)
+         bytes.append(buf, n);
+   }
+
+   close(fd);
+   return 0 == n;
+}
+
+static void AppendUtf8(std::string & bytes, unsigned long c)
+{
+   if (c < 0x80)
+   {
+      bytes += static_cast<char>(c);
+   }
+   else if (c < 0x800)
+   {
+      bytes += static_cast<char>(0xC0 | c >> 6);
+      bytes += static_cast<char>(0x80 | (c & 0x3F));
+   }
+   else if (c < 0x10000)
+   {
+      bytes += static_cast<char>(0xE0 | c >> 12);
+      bytes += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+      bytes += static_cast<char>(0x80 | (c & 0x3F));
+   }
+   else
+   {
+      bytes += static_cast<char>(0xF0 | c >> 18);
+      bytes += static_cast<char>(0x80 | (c >> 12 & 0x3F));
+      bytes += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+      bytes += static_cast<char>(0x80 | (c & 0x3F));
+   }
+}
+
+static void AppendUtf16(std::string & bytes, unsigned long c, bool bigEndian)
+{
+   unsigned units[2];
+   int count = 1;
+
+   if (c >= 0x10000)
+   {
+      units[0] = 0xD800 | (c - 0x10000) >> 10;
+      units[1] = 0xDC00 | ((c - 0x10000) & 0x3FF);
+      count = 2;
+   }
+   else
+   {
+      units[0] = c;
+   }
+
+   for (int i = 0; i < count; ++i)
+   {
+      char high = static_cast<char>(units[i] >> 8);
+      char low = static_cast<char>(units[i] & 0xFF);
+      bytes += bigEndian ? high : low;
+      bytes += bigEndian ? low : high;
+   }
+}
+
+// Prose with accents, CJK and emoji mixed in, runs of blanks for the
+// compact profile, and line breaks. Deterministic, cb bytes or a little more.
+static const unsigned long c_mix[] = { L'a', L'b', L'c', L' ', 0xE9, L'D', 0x4E2D, L' ', L' ', 0x1F600, L'\r', L'\n', L'x', 0x00C5, L'\t', 0x10348 };
+
+static std::string Mixed(size_t cb, int encoding)
+{
+   std::string bytes;
+   unsigned long seed = 12345;
+
+   while (bytes.size() < cb)
+   {
+      seed = seed * 1103515245 + 12345;
+      unsigned long c = c_mix[(seed >> 16) % (sizeof(c_mix) / sizeof(c_mix[0]))];
+
+      if (0 == encoding)
+         AppendUtf8(bytes, c);
+      else
+         AppendUtf16(bytes, c, 2 == encoding);
+   }
+
+   return bytes;
+}
+
+struct PlainFile
+{
+   const char *name;
+   std::string bytes;
+   bool text;
+};
+
+static std::vector<PlainFile> BuiltInFiles()
+{
+   std::vector<PlainFile> files;
+   PlainFile file;
+   file.text = true;
+
+   file.name = "ascii";
+   file.bytes.clear();
+
+   while (file.bytes.size() < 300000)
+      file.bytes += "The quick brown fox  jumps over the lazy dog.\r\n";
+
+   files.push_back(file);
+
+   file.name = "utf8";
+   file.bytes = Mixed(200000, 0);
+   files.push_back(file);
+
+   file.name = "utf8-bom";
+   file.bytes = "\xEF\xBB\xBF" + Mixed(70000, 0);
+   files.push_back(file);
+
+   file.name = "utf16le";
+   file.bytes = "\xFF\xFE" + Mixed(150000, 1);
+   files.push_back(file);
+
+   file.name = "utf16be";
+   file.bytes = "\xFE\xFF" + Mixed(150000, 2);
+   files.push_back(file);
+
+   file.name = "latin1";
+   file.bytes.clear();
+
+   while (file.bytes.size() < 100000)
+      file.bytes += "Caf\xE9 cr\xE8me br\xFBl\xE9""e, na\xEFve fa\xE7""ade.\n";
+
+   files.push_back(file);
+
+   // a lone continuation byte in the middle of UTF-8
+   file.name = "stray-byte";
+   file.bytes = Mixed(5000, 0) + "\x80" + Mixed(80000, 0);
+   files.push_back(file);
+
+   // the writer is halfway through a character, both leave it out
+   file.name = "partial-end";
+   file.bytes = Mixed(9000, 0) + "\xE4\xB8";
+   files.push_back(file);
+
+   file.name = "empty";
+   file.bytes.clear();
+   files.push_back(file);
+
+   file.name = "binary";
+   file.bytes.assign(10000, '\0');
+
+   for (size_t i = 0; i < file.bytes.size(); i += 7)
+      file.bytes[i] = static_cast<char>(i);
+
+   file.text = false;
+   files.push_back(file);
+
+   return files;
+}
+
+static const char * const c_profileNames[CLEANUP_PROFILES] = { "display", "index", "compact" };
+
+// Returns the number of mismatches, 0 if the paths agree.
+static int CheckFile(const PlainFile & file, CleanupProfile profile)
+{
+   MemoryReader reader(file.bytes);
+
+   AppendState state;
+   InitAppendState(state, profile);
+
+   TextBufferSink sink(0);
+   AppendResult result = ExtractAppendedText(reader, file.bytes.size(), profile, state, sink);
+   const std::wstring & text = sink.Text();
+
+   PlainChunkSource probe(reader, file.bytes.size());
+   AppendResult opened = probe.Open();
+
+   bool isText = APPEND_NOT_TEXT != result;
+
+   if (opened != (isText ? APPEND_DELTA : APPEND_NOT_TEXT) || isText != file.text)
+   {
+      printf("%-12s %-8s FAILED: built-in %d, chunk source %d\n", file.name, c_profileNames[profile], result, opened);
+      return 1;
+   }
+
+   if (!isText)
+   {
+      printf("%-12s %-8s ok, not text\n", file.name, c_profileNames[profile]);
+      return 0;
+   }
+
+   static const size_t c_pageLengths[] = { 1, 333, 4096, 65537, 1000000 };
+   int failures = 0;
+   PageCheckpoints checkpoints;
+
+   for (size_t i = 0; i < sizeof(c_pageLengths) / sizeof(c_pageLengths[0]); ++i)
+   {
+      // the one-character pages only over the start, they're slow
+      size_t limit = 1 == c_pageLengths[i] && text.length() > 20000 ? 20000 : text.length();
+
+      PlainChunkSource source(reader, file.bytes.size());
+      PageReader pages(source, profile);
+      std::wstring paged;
+
+      while (paged.length() < limit)
+      {
+         if (!pages.Read(pages.Offset(), c_pageLengths[i], paged))
+            break;
+
+         if (pages.AtEnd())
+            break;
+      }
+
+      checkpoints.Merge(pages.Checkpoints());
+
+      if (paged.length() < limit || 0 != paged.compare(0, limit, text, 0, limit) ||
+          (limit == text.length() && paged.length() != text.length()))
+      {
+         printf("%-12s %-8s FAILED: pages of %lu give %lu characters, the text has %lu\n", file.name, c_profileNames[profile],
+                static_cast<unsigned long>(c_pageLengths[i]), static_cast<unsigned long>(paged.length()),
+                static_cast<unsigned long>(text.length()));
+         ++failures;
+      }
+   }
+
+   // resume from each checkpoint with a fresh source, a page a little past it
+   unsigned long long step = text.length() / 17 + 1;
+
+   for (unsigned long long start = 0; start < text.length(); start += step)
+   {
+      PageCheckpoint checkpoint = checkpoints.Find(start);
+
+      PlainChunkSource source(reader, file.bytes.size());
+      PageReader pages(source, profile);
+      std::wstring page;
+
+      if (!pages.Seek(checkpoint) || !pages.Read(start, 5000, page) ||
+          0 != page.compare(text.substr(static_cast<size_t>(start), 5000)))
+      {
+         printf("%-12s %-8s FAILED: resuming at %llu from the checkpoint at %llu\n", file.name, c_profileNames[profile],
+                start, checkpoint.offset);
+         ++failures;
+      }
+   }
+
+   if (0 == failures)
+      printf("%-12s %-8s ok, %lu characters, %lu checkpoints\n", file.name, c_profileNames[profile],
+             static_cast<unsigned long>(text.length()), static_cast<unsigned long>(checkpoints.Count()));
+
+   return failures;
+}
+
+static void Usage()
+{
+   fprintf(stderr, "usage: plainpages [file...]\n");
+}
+
+int main(int argc, char *argv[])
+{
+   if (argc > 1 && '-' == argv[1][0])
+   {
+      Usage();
+      return 2;
+   }
+
+   std::vector<PlainFile> files;
+
+   if (argc > 1)
+   {
+      for (int i = 1; i < argc; ++i)
+      {
+         PlainFile file;
+         file.name = argv[i];
+         file.text = true;
+
+         if (!ReadFile(argv[i], file.bytes))
+         {
+            fprintf(stderr, "plainpages: can't read %s: %s\n", argv[i], strerror(errno));
+            return 2;
+         }
+
+         // a file argument is whatever the built-in path makes of it
+         MemoryReader reader(file.bytes);
+         file.text = APPEND_NOT_TEXT != PlainChunkSource(reader, file.bytes.size()).Open();
+         files.push_back(file);
+      }
+   }
+   else
+   {
+      files = BuiltInFiles();
+   }
+
+   int failures = 0;
+
+   for (size_t i = 0; i < files.size(); ++i)
+   {
+      for (int profile = 0; profile < CLEANUP_PROFILES; ++profile)
+         failures += CheckFile(files[i], static_cast<CleanupProfile>(profile));
+   }
+
+   printf("%s\n", failures ? "MISMATCH" : "all paths agree");
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,355 @@
+// Prefetch.cpp : io_uring / read-ahead file loading for the Linux front ends
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <deque>
+
+#include "Prefetch.h"
+
+// Talk to the kernel directly so we don't need liburing on the build box.
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+   return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+   return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0));
+}
+
+struct Prefetcher::Request
+{
+   LoadedFile file;
+   int fd;
+   size_t want;      // bytes we intend to read
+   size_t have;      // bytes read so far
+   struct iovec iov;
+
+   Request() : fd(-1), want(0), have(0) {}
+};
+
+Prefetcher::Prefetcher(unsigned depth, size_t readLimit)
+   : m_depth(depth ? depth : 1), m_readLimit(readLimit), m_ringFd(-1),
+     m_sqRing(MAP_FAILED), m_cqRing(MAP_FAILED), m_sqes(MAP_FAILED),
+     m_sqRingSize(0), m_cqRingSize(0), m_sqesSize(0), m_pendingSubmit(0)
+{
+   struct io_uring_params params;
+   memset(&params, 0, sizeof(params));
+
+   int fd = io_uring_setup(m_depth, &params);
+
+   if (fd < 0)
+      return;     // ENOSYS, EPERM (seccomp) etc., we'll use pread instead
+
+   m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+   bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+   if (singleMap)
+   {
+      if (m_cqRingSize > m_sqRingSize)
+         m_sqRingSize = m_cqRingSize;
+
+      m_cqRingSize = m_sqRingSize;
+   }
+
+   m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+   if (MAP_FAILED != m_sqRing)
+   {
+      if (singleMap)
+         m_cqRing = m_sqRing;
+      else
+         m_cqRing = mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+   }
+
+   if (MAP_FAILED != m_cqRing)
+   {
+      m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+      m_sqes = mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+   }
+
+   if (MAP_FAILED == m_sqes)
+   {
+      if (MAP_FAILED != m_cqRing && m_cqRing != m_sqRing)
+         munmap(m_cqRing, m_cqRingSize);
+
+      if (MAP_FAILED != m_sqRing)
+         munmap(m_sqRing, m_sqRingSize);
+
+      m_sqRing = m_cqRing = MAP_FAILED;
+      close(fd);
+      return;
+   }
+
+   char *sq = static_cast<char *>(m_sqRing);
+   char *cq = static_cast<char *>(m_cqRing);
+
+   m_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+   m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+   m_sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+   m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+   m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+   m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+   m_cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+   m_cqes = cq + params.cq_off.cqes;
+
+   // the kernel may round the ring up, but we never keep more than depth in flight
+   if (params.sq_entries < m_depth)
+      m_depth = params.sq_entries;
+
+   m_ringFd = fd;
+}
+
+Prefetcher::~Prefetcher()
+{
+   if (m_ringFd < 0)
+      return;
+
+   munmap(m_sqes, m_sqesSize);
+
+   if (m_cqRing != m_sqRing)
+      munmap(m_cqRing, m_cqRingSize);
+
+   munmap(m_sqRing, m_sqRingSize);
+   close(m_ringFd);
+}
+
+void Prefetcher::Run(const std::vector<std::string> & paths,
+                     const std::function<void(LoadedFile &)> & done)
+{
+   if (UsingUring())
+      RunUring(paths, done);
+   else
+      RunPread(paths, done);
+}
+
+bool Prefetcher::OpenRequest(Request & req, const std::string & path)
+{
+   req.file = LoadedFile();
+   req.file.path = path;
+   req.have = 0;
+   req.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+   if (req.fd < 0)
+   {
+      req.file.error = errno;
+      return false;
+   }
+
+   struct stat st;
+
+   if (fstat(req.fd, &st) != 0)
+   {
+      req.file.error = errno;
+   }
+   else if (!S_ISREG(st.st_mode))
+   {
+      req.file.error = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+   }
+
+   if (req.file.error)
+   {
+      close(req.fd);
+      req.fd = -1;
+      return false;
+   }
+
+   req.file.size = static_cast<unsigned long long>(st.st_size);
+   req.want = static_cast<size_t>(req.file.size);
+
+   if (m_readLimit && req.want > m_readLimit)
+      req.want = m_readLimit;
+
+   req.file.data.resize(req.want);
+   return true;
+}
+
+void Prefetcher::SubmitRead(Request & req, unsigned long long slot)
+{
+   unsigned tail = *m_sqTail;
+   unsigned index = tail & *m_sqMask;
+
+   struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(m_sqes) + index;
+   memset(sqe, 0, sizeof(*sqe));
+
+   req.iov.iov_base = &req.file.data[req.have];
+   req.iov.iov_len = req.want - req.have;
+
+   sqe->opcode = IORING_OP_READV;
+   sqe->fd = req.fd;
+   sqe->off = req.have;
+   sqe->addr = reinterpret_cast<unsigned long long>(&req.iov);
+   sqe->len = 1;
+   sqe->user_data = slot;
+
+   m_sqArray[index] = index;
+   __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+   ++m_pendingSubmit;
+}
+
+void Prefetcher::Enter(unsigned toSubmit, unsigned minComplete)
+{
+   unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+
+   for (;;)
+   {
+      int submitted = io_uring_enter(m_ringFd, toSubmit, minComplete, flags);
+
+      if (submitted >= 0)
+      {
+         unsigned consumed = static_cast<unsigned>(submitted);
+         m_pendingSubmit = consumed < m_pendingSubmit ? m_pendingSubmit - consumed : 0;
+         return;
+      }
+
+      if (EINTR != errno && EAGAIN != errno && EBUSY != errno)
+         return;
+   }
+}
+
+void Prefetcher::RunUring(const std::vector<std::string> & paths,
+                          const std::function<void(LoadedFile &)> & done)
+{
+   std::vector<Request> slots(m_depth);
+   std::deque<unsigned> freeSlots;
+
+   for (unsigned i = 0; i < m_depth; ++i)
+      freeSlots.push_back(i);
+
+   size_t next = 0;
+   unsigned inFlight = 0;
+
+   while (next < paths.size() || inFlight)
+   {
+      // top up the ring
+      while (next < paths.size() && !freeSlots.empty())
+      {
+         unsigned slot = freeSlots.front();
+         Request & req = slots[slot];
+
+         if (!OpenRequest(req, paths[next++]))
+         {
+            done(req.file);
+            continue;
+         }
+
+         if (0 == req.want)
+         {
+            close(req.fd);
+            req.fd = -1;
+            done(req.file);
+            continue;
+         }
+
+         freeSlots.pop_front();
+         SubmitRead(req, slot);
+         ++inFlight;
+      }
+
+      if (0 == inFlight)
+         continue;
+
+      Enter(m_pendingSubmit, 1);
+
+      unsigned head = *m_cqHead;
+      unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+
+      while (head != tail)
+      {
+         struct io_uring_cqe *cqe = static_cast<struct io_uring_cqe *>(m_cqes) + (head & *m_cqMask);
+         unsigned slot = static_cast<unsigned>(cqe->user_data);
+         int res = cqe->res;
+
+         ++head;
+         __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+         Request & req = slots[slot];
+
+         if (res > 0)
+         {
+            req.have += static_cast<size_t>(res);
+
+            if (req.have < req.want)
+            {
+               SubmitRead(req, slot);  // short read, go around again
+               continue;
+            }
+         }
+         else if (res < 0)
+         {
+            req.file.error = -res;
+         }
+
+         req.file.data.resize(req.have);
+         close(req.fd);
+         req.fd = -1;
+         --inFlight;
+         freeSlots.push_back(slot);
+
+         done(req.file);
+      }
+   }
+}
+
+void Prefetcher::RunPread(const std::vector<std::string> & paths,
+                          const std::function<void(LoadedFile &)> & done)
+{
+   // open a window of files ahead of the one being read and ask the kernel
+   // to start pulling them into the page cache
+   std::vector<Request> window(m_depth);
+   size_t next = 0;
+
+   while (next < paths.size())
+   {
+      size_t count = 0;
+
+      for (; count < m_depth && next < paths.size(); ++count, ++next)
+      {
+         Request & req = window[count];
+
+         if (OpenRequest(req, paths[next]) && req.want)
+            posix_fadvise(req.fd, 0, static_cast<off_t>(req.want), POSIX_FADV_WILLNEED);
+      }
+
+      for (size_t i = 0; i < count; ++i)
+      {
+         Request & req = window[i];
+
+         while (req.fd >= 0 && req.have < req.want)
+         {
+            ssize_t cb = pread(req.fd, &req.file.data[req.have], req.want - req.have, static_cast<off_t>(req.have));
+
+            if (cb < 0 && EINTR == errno)
+               continue;
+
+            if (cb < 0)
+               req.file.error = errno;
+
+            if (cb <= 0)
+               break;
+
+            req.have += static_cast<size_t>(cb);
+         }
+
+         if (req.fd >= 0)
+         {
+            req.file.data.resize(req.have);
+            close(req.fd);
+            req.fd = -1;
+         }
+
+         done(req.file);
+      }
+   }
+}
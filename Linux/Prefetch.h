@@ -0,0 +1,74 @@
+// Prefetch.h : Keeps the next few input files loading while the current ones
+//              are being cleaned up. Uses io_uring when the kernel allows it
+//              and falls back to posix_fadvise read-ahead plus pread.
+
+#ifndef __PREFETCH_H_
+#define __PREFETCH_H_
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct LoadedFile
+{
+   std::string path;
+   std::vector<unsigned char> data;
+   unsigned long long size;   // size on disk, data may hold less if the read was capped
+   int error;                 // errno, zero on success
+
+   LoadedFile() : size(0), error(0) {}
+};
+
+class Prefetcher
+{
+public:
+   // depth is the number of reads kept in flight, readLimit caps the number of
+   // bytes read from each file (zero reads whole files).
+   Prefetcher(unsigned depth, size_t readLimit);
+   ~Prefetcher();
+
+   bool UsingUring() const { return m_ringFd >= 0; }
+
+   // Loads every path in order (completions may arrive out of order) and
+   // hands each one to done on the calling thread.
+   void Run(const std::vector<std::string> & paths,
+            const std::function<void(LoadedFile &)> & done);
+
+private:
+   struct Request;
+
+   void RunUring(const std::vector<std::string> & paths,
+                 const std::function<void(LoadedFile &)> & done);
+   void RunPread(const std::vector<std::string> & paths,
+                 const std::function<void(LoadedFile &)> & done);
+
+   bool OpenRequest(Request & req, const std::string & path);
+   void SubmitRead(Request & req, unsigned long long slot);
+   void Enter(unsigned toSubmit, unsigned minComplete);
+
+   unsigned m_depth;
+   size_t m_readLimit;
+
+   int m_ringFd;
+   void *m_sqRing;
+   void *m_cqRing;
+   void *m_sqes;
+   size_t m_sqRingSize;
+   size_t m_cqRingSize;
+   size_t m_sqesSize;
+   unsigned *m_sqHead;
+   unsigned *m_sqTail;
+   unsigned *m_sqMask;
+   unsigned *m_sqArray;
+   unsigned *m_cqHead;
+   unsigned *m_cqTail;
+   unsigned *m_cqMask;
+   void *m_cqes;
+   unsigned m_pendingSubmit;
+
+   Prefetcher(const Prefetcher &);
+   Prefetcher & operator=(const Prefetcher &);
+};
+
+#endif //__PREFETCH_H_
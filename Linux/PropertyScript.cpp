@@ -0,0 +1,634 @@
+// PropertyScript.cpp : Drives the text and property loop behind
+//                      ExtractTextWithProperties with scripted chunks on Linux.
+//
+// A script stands in for a filter, one chunk per line:
+//
+//    text BREAK TEXT           a text chunk (BREAK none, eow, eos, eop or eoc),
+//                              \n and \t in TEXT are unescaped
+//    value SET PROP TYPE VALUE a value chunk. SET is summary, docsummary,
+//                              storage or a GUID; PROP a property id, or a
+//                              name for a named property; TYPE string, int,
+//                              real, bool or time (2026-10-05T09:12:01Z)
+//    novalue SET PROP          a value chunk whose GetValue fails
+//    skip                      a chunk that is unavailable
+//    error                     GetChunk fails
+//    texterror BREAK           a text chunk whose GetText fails
+//
+// Runs the built-in scripts and checks their text, properties and result
+// (Office style values before and after the text, repeated authors, values
+// after a maxLength cut, failing values, a full bag, a failing filter), or
+// with -f runs a script file and prints what came out.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o propertyscript PropertyScript.cpp ../PropertyBag.cpp ../TextCleanup.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "PropertyBag.h"
+
+struct ScriptChunk
+{
+   enum Kind { TEXT, VALUE, NO_VALUE, SKIP, ERROR, TEXT_ERROR } kind;
+   TextBreak breakType;
+   std::wstring text;
+   PropertyKey key;
+   PropertyValue value;
+};
+
+static std::wstring Widen(const std::string & text)
+{
+   return std::wstring(text.begin(), text.end());
+}
+
+static std::string Narrow(const std::wstring & text)
+{
+   std::string narrow;
+
+   for (size_t i = 0; i < text.size(); ++i)
+      narrow += text[i] < 0x80 ? static_cast<char>(text[i]) : '?';
+
+   return narrow;
+}
+
+static std::string Unescape(const std::string & text)
+{
+   std::string out;
+
+   for (size_t i = 0; i < text.size(); ++i)
+   {
+      if ('\\' == text[i] && i + 1 < text.size())
+      {
+         char c = text[++i];
+         out += 'n' == c ? '\n' : 't' == c ? '\t' : c;
+      }
+      else
+      {
+         out += text[i];
+      }
+   }
+
+   return out;
+}
+
+static bool ParseBreak(const std::string & word, TextBreak & breakType)
+{
+   static const char * const c_breaks[] = { "none", "eow", "eos", "eop", "eoc" };
+
+   for (int i = 0; i < 5; ++i)
+   {
+      if (word == c_breaks[i])
+      {
+         breakType = static_cast<TextBreak>(i);
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static bool ParseKey(const std::string & set, const std::string & prop, PropertyKey & key)
+{
+   std::wstring guid = Widen(set);
+
+   if ("summary" == set)
+      guid = L"F29F85E0-4FF9-1068-AB91-08002B27B3D9";
+   else if ("docsummary" == set)
+      guid = L"D5CDD502-2E9C-101B-9397-08002B2CF9AE";
+   else if ("storage" == set)
+      guid = L"B725F130-47EF-101A-A5F1-02608C9EEBAC";
+
+   if (!ParsePropertySet(guid.c_str(), key.set))
+      return false;
+
+   char *end = NULL;
+   unsigned long id = strtoul(prop.c_str(), &end, 10);
+
+   key.id = 0;
+   key.name.clear();
+
+   if (!prop.empty() && '\0' == *end)
+      key.id = id;
+   else
+      key.name = Widen(prop);
+
+   return true;
+}
+
+// FILETIME ticks for a UTC time.
+static bool ParseTime(const std::string & text, long long & ticks)
+{
+   struct tm tm;
+   memset(&tm, 0, sizeof(tm));
+
+   if (6 != sscanf(text.c_str(), "%d-%d-%dT%d:%d:%dZ", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec))
+      return false;
+
+   tm.tm_year -= 1900;
+   tm.tm_mon -= 1;
+
+   // seconds from 1601 to 1970
+   ticks = (static_cast<long long>(timegm(&tm)) + 11644473600LL) * 10000000;
+   return true;
+}
+
+static std::string FormatTime(long long ticks)
+{
+   time_t seconds = static_cast<time_t>(ticks / 10000000 - 11644473600LL);
+   struct tm tm;
+   char buf[32];
+
+   gmtime_r(&seconds, &tm);
+   strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+   return buf;
+}
+
+static bool ParseValue(const std::string & type, const std::string & text, PropertyValue & value)
+{
+   value.text.clear();
+   value.integer = 0;
+   value.real = 0;
+
+   if ("string" == type)
+   {
+      value.type = PROPERTY_STRING;
+      value.text = Widen(Unescape(text));
+      return true;
+   }
+
+   if ("int" == type)
+   {
+      value.type = PROPERTY_INTEGER;
+      value.integer = strtoll(text.c_str(), NULL, 10);
+      return true;
+   }
+
+   if ("real" == type)
+   {
+      value.type = PROPERTY_REAL;
+      value.real = strtod(text.c_str(), NULL);
+      return true;
+   }
+
+   if ("bool" == type)
+   {
+      value.type = PROPERTY_BOOLEAN;
+      value.integer = "true" == text || "1" == text;
+      return true;
+   }
+
+   if ("time" == type)
+   {
+      value.type = PROPERTY_TIME;
+      return ParseTime(text, value.integer);
+   }
+
+   return false;
+}
+
+static bool ParseScript(const std::string & script, std::vector<ScriptChunk> & chunks)
+{
+   std::istringstream lines(script);
+   std::string line;
+   unsigned number = 0;
+
+   while (std::getline(lines, line))
+   {
+      ++number;
+
+      if (!line.empty() && '\r' == line[line.size() - 1])
+         line.erase(line.size() - 1);
+
+      std::istringstream words(line);
+      std::string verb;
+
+      if (!(words >> verb) || '#' == verb[0])
+         continue;
+
+      ScriptChunk chunk;
+      chunk.breakType = TEXT_BREAK_NONE;
+      bool ok = true;
+
+      if ("text" == verb || "texterror" == verb)
+      {
+         std::string breakWord;
+         std::string rest;
+
+         chunk.kind = "text" == verb ? ScriptChunk::TEXT : ScriptChunk::TEXT_ERROR;
+         ok = (words >> breakWord) && ParseBreak(breakWord, chunk.breakType);
+
+         std::getline(words >> std::ws, rest);
+         chunk.text = Widen(Unescape(rest));
+      }
+      else if ("value" == verb || "novalue" == verb)
+      {
+         std::string set;
+         std::string prop;
+         std::string type;
+         std::string rest;
+
+         chunk.kind = "value" == verb ? ScriptChunk::VALUE : ScriptChunk::NO_VALUE;
+         ok = (words >> set >> prop) && ParseKey(set, prop, chunk.key);
+
+         if (ok && ScriptChunk::VALUE == chunk.kind)
+         {
+            std::getline((words >> type) >> std::ws, rest);
+            ok = ParseValue(type, rest, chunk.value);
+         }
+      }
+      else if ("skip" == verb)
+      {
+         chunk.kind = ScriptChunk::SKIP;
+      }
+      else if ("error" == verb)
+      {
+         chunk.kind = ScriptChunk::ERROR;
+      }
+      else
+      {
+         ok = false;
+      }
+
+      if (!ok)
+      {
+         fprintf(stderr, "line %u: can't parse \"%s\"\n", number, line.c_str());
+         return false;
+      }
+
+      chunks.push_back(chunk);
+   }
+
+   return true;
+}
+
+// Plays the chunks back the way a filter returns them: GetText hands out
+// the text in pieces of whatever room it's given, then FILTER_E_NO_MORE_TEXT.
+class ScriptChunkSource : public ValueChunkSource
+{
+public:
+   explicit ScriptChunkSource(const std::vector<ScriptChunk> & chunks)
+      : m_chunks(chunks), m_next(0), m_current(NULL), m_textOffset(0), m_valueReads(0)
+   {
+   }
+
+   virtual ChunkRead NextChunk(ChunkInfo & chunk)
+   {
+      if (m_next >= m_chunks.size())
+         return CHUNK_READ_END;
+
+      m_current = &m_chunks[m_next++];
+      m_textOffset = 0;
+
+      memset(&chunk, 0, sizeof(chunk));
+      chunk.idChunk = static_cast<unsigned long>(m_next);
+      chunk.breakType = m_current->breakType;
+
+      switch (m_current->kind)
+      {
+         case ScriptChunk::TEXT:
+         case ScriptChunk::TEXT_ERROR:
+            return CHUNK_READ_TEXT;
+
+         case ScriptChunk::VALUE:
+         case ScriptChunk::NO_VALUE:
+            return CHUNK_READ_VALUE;
+
+         case ScriptChunk::SKIP:
+            return CHUNK_READ_SKIP;
+
+         default:
+            return CHUNK_READ_ERROR;
+      }
+   }
+
+   virtual TextRead GetText(wchar_t *buf, unsigned long *cch)
+   {
+      if (ScriptChunk::TEXT_ERROR == m_current->kind)
+      {
+         *cch = 0;
+         return TEXT_READ_ERROR;
+      }
+
+      const std::wstring & text = m_current->text;
+
+      if (m_textOffset >= text.size())
+      {
+         *cch = 0;
+         return TEXT_READ_END;
+      }
+
+      size_t take = text.size() - m_textOffset < *cch ? text.size() - m_textOffset : *cch;
+      memcpy(buf, text.data() + m_textOffset, take * sizeof(wchar_t));
+      m_textOffset += take;
+      *cch = static_cast<unsigned long>(take);
+      return TEXT_READ_MORE;
+   }
+
+   virtual bool GetValue(PropertyKey & key, PropertyValue & value)
+   {
+      ++m_valueReads;
+
+      if (ScriptChunk::VALUE != m_current->kind)
+         return false;
+
+      key = m_current->key;
+      value = m_current->value;
+      return true;
+   }
+
+   // Chunks handed out, GetValue calls.
+   size_t ChunksRead() const { return m_next; }
+   size_t ValueReads() const { return m_valueReads; }
+
+private:
+   const std::vector<ScriptChunk> & m_chunks;
+   size_t m_next;
+   const ScriptChunk *m_current;
+   size_t m_textOffset;
+   size_t m_valueReads;
+};
+
+static std::string FormatProperty(const Property & property)
+{
+   std::string line = Narrow(property.name) + " = ";
+   char buf[64];
+
+   switch (property.value.type)
+   {
+      case PROPERTY_STRING:
+         return line + "string:" + Narrow(property.value.text);
+
+      case PROPERTY_INTEGER:
+         snprintf(buf, sizeof(buf), "int:%lld", property.value.integer);
+         return line + buf;
+
+      case PROPERTY_REAL:
+         snprintf(buf, sizeof(buf), "real:%g", property.value.real);
+         return line + buf;
+
+      case PROPERTY_BOOLEAN:
+         return line + (property.value.integer ? "bool:true" : "bool:false");
+
+      default:
+         return line + "time:" + FormatTime(property.value.integer);
+   }
+}
+
+static const char * ResultName(PullResult result)
+{
+   switch (result)
+   {
+      case PULL_DONE: return "done";
+      case PULL_STOPPED: return "stopped";
+      default: return "error";
+   }
+}
+
+static std::string Escape(const std::wstring & text)
+{
+   std::string narrow = Narrow(text);
+   std::string out;
+
+   for (size_t i = 0; i < narrow.size(); ++i)
+   {
+      if ('\r' == narrow[i])
+         out += "\\r";
+      else if ('\n' == narrow[i])
+         out += "\\n";
+      else
+         out += narrow[i];
+   }
+
+   return out;
+}
+
+struct Outcome
+{
+   PullResult result;
+   std::string text;
+   std::vector<std::string> properties;
+   size_t chunks;
+};
+
+static bool Run(const std::string & script, size_t maxLength, size_t maxProperties, Outcome & outcome)
+{
+   std::vector<ScriptChunk> chunks;
+
+   if (!ParseScript(script, chunks))
+      return false;
+
+   ScriptChunkSource source(chunks);
+   TextBufferSink text(maxLength);
+   PropertyBag bag(maxProperties);
+
+   outcome.result = PullChunks(source, CLEANUP_DISPLAY, text, bag);
+   outcome.text = Escape(text.Text());
+   outcome.chunks = source.ChunksRead();
+   outcome.properties.clear();
+
+   for (size_t i = 0; i < bag.Count(); ++i)
+      outcome.properties.push_back(FormatProperty(bag.At(i)));
+
+   return true;
+}
+
+static void Print(const Outcome & outcome)
+{
+   printf("   result      %s after %zu chunks\n   text        \"%s\"\n", ResultName(outcome.result), outcome.chunks, outcome.text.c_str());
+
+   for (size_t i = 0; i < outcome.properties.size(); ++i)
+      printf("   property    %s\n", outcome.properties[i].c_str());
+}
+
+struct Case
+{
+   const char *name;
+   const char *script;
+   size_t maxLength;
+   size_t maxProperties;
+   PullResult result;
+   const char *text;
+   const char *properties;       // one per line
+};
+
+static const Case c_cases[] =
+{
+   {
+      "office",
+      "value summary 2 string Budget review\n"
+      "value summary 4 string Ann\n"
+      "text none Budget review\n"
+      "value summary 4 string Bob\n"
+      "text eop See the figures.\n"
+      "value summary 12 time 2026-10-05T09:12:01Z\n"
+      "value summary 14 int 3\n"
+      "value docsummary 15 string Contoso\n"
+      "value {D5CDD505-2E9C-101B-9397-08002B2CF9AE} Client string Fabrikam\n"
+      "value summary 4 string Ann\n",
+      0, 256, PULL_DONE,
+      "Budget review\\r\\nSee the figures.",
+      "System.Title = string:Budget review\n"
+      "System.Author = string:Ann; Bob\n"
+      "System.Document.DateCreated = time:2026-10-05T09:12:01Z\n"
+      "System.Document.PageCount = int:3\n"
+      "System.Company = string:Contoso\n"
+      "{D5CDD505-2E9C-101B-9397-08002B2CF9AE} Client = string:Fabrikam"
+   },
+   {
+      "types",
+      "value summary 9 real 1.5\n"
+      "value {E3E0584C-B788-4A5A-BB20-7F5A44C9ACDD} 7 bool true\n"
+      "value summary 14 int 9000000000\n"
+      "value summary 14 int 4\n"
+      "text eow one\n"
+      "text eow two\n",
+      0, 256, PULL_DONE,
+      " one two",
+      "System.Document.RevisionNumber = real:1.5\n"
+      "{E3E0584C-B788-4A5A-BB20-7F5A44C9ACDD} 7 = bool:true\n"
+      "System.Document.PageCount = int:9000000000"
+   },
+   {
+      "cut",
+      "value summary 2 string Minutes\n"
+      "text none 0123456789\n"
+      "text eop 0123456789\n"
+      "value summary 4 string Late\n",
+      5, 256, PULL_STOPPED,
+      "0123456789",
+      "System.Title = string:Minutes"
+   },
+   {
+      "failing values",
+      "novalue summary 2\n"
+      "skip\n"
+      "text none kept\n"
+      "novalue storage 12\n"
+      "value storage 12 int 2048\n",
+      0, 256, PULL_DONE,
+      "kept",
+      "System.Size = int:2048"
+   },
+   {
+      "full bag",
+      "value summary 2 string a\n"
+      "value summary 3 string b\n"
+      "value summary 4 string c\n"
+      "text none text\n",
+      0, 2, PULL_DONE,
+      "text",
+      "System.Title = string:a\n"
+      "System.Subject = string:b"
+   },
+   {
+      "filter error",
+      "value summary 2 string Broken\n"
+      "text none before\n"
+      "texterror eop\n"
+      "text eop after\n",
+      0, 256, PULL_ERROR,
+      "before\\r\\n",
+      "System.Title = string:Broken"
+   },
+   {
+      "chunk error",
+      "text none before\n"
+      "error\n",
+      0, 256, PULL_ERROR,
+      "before",
+      ""
+   }
+};
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: propertyscript [options]\n"
+      "  -f FILE  run a script file instead of the built-in cases\n"
+      "  -m N     maxLength for the text (default: 0, no limit)\n"
+      "  -p N     properties the bag holds (default: 256)\n");
+}
+
+int main(int argc, char *argv[])
+{
+   const char *file = NULL;
+   size_t maxLength = 0;
+   size_t maxProperties = 256;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "f:m:p:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'f': file = optarg; break;
+         case 'm': maxLength = static_cast<size_t>(strtoul(optarg, NULL, 10)); break;
+         case 'p': maxProperties = static_cast<size_t>(strtoul(optarg, NULL, 10)); break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   if (file)
+   {
+      std::ifstream in(file, std::ios::binary);
+      std::stringstream script;
+
+      if (!in)
+      {
+         perror(file);
+         return 1;
+      }
+
+      script << in.rdbuf();
+
+      Outcome outcome;
+
+      if (!Run(script.str(), maxLength, maxProperties, outcome))
+         return 1;
+
+      printf("%s\n", file);
+      Print(outcome);
+      return PULL_ERROR == outcome.result ? 1 : 0;
+   }
+
+   int failures = 0;
+
+   for (size_t i = 0; i < sizeof(c_cases) / sizeof(c_cases[0]); ++i)
+   {
+      const Case & test = c_cases[i];
+      Outcome outcome;
+
+      if (!Run(test.script, test.maxLength, test.maxProperties, outcome))
+         return 1;
+
+      std::string properties;
+
+      for (size_t p = 0; p < outcome.properties.size(); ++p)
+         properties += (p ? "\n" : "") + outcome.properties[p];
+
+      bool ok = outcome.result == test.result && outcome.text == test.text && properties == test.properties;
+
+      printf("%-16s %s\n", test.name, ok ? "ok" : "MISMATCH");
+
+      if (!ok)
+      {
+         Print(outcome);
+         ++failures;
+      }
+   }
+
+   if (failures)
+      printf("\n%d cases failed\n", failures);
+
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,397 @@
+// RouteBench.cpp : Times extension to filter routing against a mock registry on Linux.
+//
+// Builds a mock HKEY_CLASSES_ROOT with a few hundred extensions, most with a
+// PersistentHandler of their own, some through their ProgID's class and some
+// with no filter at all, served by a few dozen filter modules. Every registry
+// call costs a busy wait and a module's first load a sleep, standing in for
+// the key opens and the DLL loads LoadIFilter does on demand. Then replays
+// the same skewed stream of extractions three ways:
+//
+//    walk       the registry chain is walked for every extraction, as
+//               LoadIFilter does, and modules load on first use
+//    routed     FilterRouter resolves each extension once and keeps it
+//    snapshot   a new process: the routes come from the snapshot the routed
+//               run saved, are validated against the key stamps and the
+//               hottest modules are preloaded on several threads first
+//
+// Reports the startup cost, the time for the first extractions (the cold
+// start window) and for all of them, registry calls and the snapshot size,
+// and checks that a route whose keys changed after the snapshot is resolved
+// again.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -pthread -I.. -o routebench RouteBench.cpp ../FilterRouting.cpp ../PlainText.cpp ../TextCleanup.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FilterRouting.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static void Spin(unsigned us)
+{
+   Clock::time_point until = Clock::now() + std::chrono::microseconds(us);
+
+   while (Clock::now() < until)
+   {
+   }
+}
+
+class MockRegistry : public RegistrySource
+{
+public:
+   explicit MockRegistry(unsigned callUs) : m_callUs(callUs), m_calls(0), m_clock(1000) {}
+
+   void Set(const std::wstring & key, const wchar_t *name, const std::wstring & value)
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      Key & k = m_keys[key];
+      k.values[name ? name : L""] = value;
+      k.stamp = ++m_clock;
+   }
+
+   virtual bool ReadString(const std::wstring & key, const wchar_t *name, std::wstring & value)
+   {
+      ++m_calls;
+      Spin(m_callUs);
+
+      std::lock_guard<std::mutex> lock(m_lock);
+      std::map<std::wstring, Key>::const_iterator it = m_keys.find(key);
+
+      if (it == m_keys.end())
+         return false;
+
+      std::map<std::wstring, std::wstring>::const_iterator v = it->second.values.find(name ? name : L"");
+
+      if (v == it->second.values.end())
+         return false;
+
+      value = v->second;
+      return true;
+   }
+
+   virtual bool LastWrite(const std::wstring & key, unsigned long long *stamp)
+   {
+      ++m_calls;
+      Spin(m_callUs);
+
+      std::lock_guard<std::mutex> lock(m_lock);
+      std::map<std::wstring, Key>::const_iterator it = m_keys.find(key);
+
+      if (it == m_keys.end())
+         return false;
+
+      *stamp = it->second.stamp;
+      return true;
+   }
+
+   unsigned long long Calls() const { return m_calls; }
+   void ResetCalls() { m_calls = 0; }
+
+private:
+   struct Key
+   {
+      std::map<std::wstring, std::wstring> values;
+      unsigned long long stamp;
+   };
+
+   unsigned m_callUs;
+   std::atomic<unsigned long long> m_calls;
+   std::mutex m_lock;
+   std::map<std::wstring, Key> m_keys;
+   unsigned long long m_clock;
+};
+
+// Modules load once per process, the first load of each costs loadMs.
+class MockLoader
+{
+public:
+   explicit MockLoader(unsigned loadMs) : m_loadMs(loadMs) {}
+
+   void Load(const std::wstring & module)
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_lock);
+
+         if (!m_loaded.insert(module).second)
+            return;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(m_loadMs));
+   }
+
+private:
+   unsigned m_loadMs;
+   std::mutex m_lock;
+   std::set<std::wstring> m_loaded;
+};
+
+static std::wstring ClassId(const char *kind, unsigned n)
+{
+   char buf[64];
+   snprintf(buf, sizeof(buf), "{%08X-0000-0000-0000-%012u}", n, kind[0] == 'h' ? 1 : kind[0] == 'f' ? 2 : 3);
+   std::string s(buf);
+   return std::wstring(s.begin(), s.end());
+}
+
+static const wchar_t c_addin[] = L"{89BCB740-6119-101A-BCB7-00DD010655AF}";
+
+static void Populate(MockRegistry & registry, unsigned extensions, unsigned filters, std::vector<std::wstring> & names)
+{
+   std::mt19937 rng(42);
+
+   for (unsigned f = 0; f < filters; ++f)
+   {
+      std::wstring handler = ClassId("handler", f);
+      std::wstring filter = ClassId("filter", f);
+      std::string module = "/opt/filters/filter" + std::to_string(f) + ".dll";
+
+      registry.Set(L"CLSID\\" + handler + L"\\PersistentAddinsRegistered\\" + c_addin, NULL, filter);
+      registry.Set(L"CLSID\\" + filter + L"\\InprocServer32", NULL, std::wstring(module.begin(), module.end()));
+      registry.Set(L"CLSID\\" + filter + L"\\InprocServer32", L"ThreadingModel", L"Both");
+   }
+
+   for (unsigned e = 0; e < extensions; ++e)
+   {
+      std::string ext = ".x" + std::to_string(e);
+      std::wstring name(ext.begin(), ext.end());
+      unsigned f = rng() % filters;
+      unsigned kind = rng() % 10;
+
+      names.push_back(name);
+
+      if (kind < 7)
+      {
+         // a PersistentHandler of its own
+         registry.Set(name, NULL, L"");
+         registry.Set(name + L"\\PersistentHandler", NULL, ClassId("handler", f));
+      }
+      else if (kind < 9)
+      {
+         // through the ProgID's class
+         std::wstring progId = L"Mock.Document" + std::to_wstring(e);
+         std::wstring classId = ClassId("class", e);
+
+         registry.Set(name, NULL, progId);
+         registry.Set(progId + L"\\CLSID", NULL, classId);
+         registry.Set(L"CLSID\\" + classId + L"\\PersistentHandler", NULL, ClassId("handler", f));
+      }
+      else
+      {
+         // no filter, the plain text fallback or nothing
+         registry.Set(name, NULL, L"txtfile");
+      }
+   }
+}
+
+struct RunStats
+{
+   double startupMs;
+   double coldMs;       // the first coldCount extractions, after startup
+   double totalMs;
+   unsigned long long registryCalls;
+   unsigned routed;
+};
+
+static void Report(const char *name, const RunStats & stats, size_t coldCount)
+{
+   printf("%-9s startup %8.1f ms  first %zu %8.1f ms  all %8.1f ms  registry calls %8llu  routed %u\n",
+          name, stats.startupMs, coldCount, stats.coldMs, stats.totalMs, stats.registryCalls, stats.routed);
+}
+
+static double Ms(Clock::time_point from, Clock::time_point to)
+{
+   return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: routebench [options]\n"
+      "  -e N    extensions in the mock registry (default: 400)\n"
+      "  -f N    filter modules (default: 60)\n"
+      "  -n N    extractions to replay (default: 20000)\n"
+      "  -w N    extractions in the cold start window (default: 500)\n"
+      "  -r US   cost of a registry call (default: 15)\n"
+      "  -l MS   cost of loading a module (default: 40)\n"
+      "  -p N    filters preloaded by the snapshot run (default: 16)\n"
+      "  -j N    preload threads (default: 4)\n");
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned extensions = 400;
+   unsigned filters = 60;
+   size_t extractions = 20000;
+   size_t coldCount = 500;
+   unsigned callUs = 15;
+   unsigned loadMs = 40;
+   size_t preload = 16;
+   unsigned threads = 4;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "e:f:n:w:r:l:p:j:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'e': extensions = static_cast<unsigned>(strtoul(optarg, NULL, 10)); break;
+         case 'f': filters = static_cast<unsigned>(strtoul(optarg, NULL, 10)); break;
+         case 'n': extractions = static_cast<size_t>(strtoul(optarg, NULL, 10)); break;
+         case 'w': coldCount = static_cast<size_t>(strtoul(optarg, NULL, 10)); break;
+         case 'r': callUs = static_cast<unsigned>(strtoul(optarg, NULL, 10)); break;
+         case 'l': loadMs = static_cast<unsigned>(strtoul(optarg, NULL, 10)); break;
+         case 'p': preload = static_cast<size_t>(strtoul(optarg, NULL, 10)); break;
+         case 'j': threads = static_cast<unsigned>(strtoul(optarg, NULL, 10)); break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   if (0 == extensions || 0 == filters || 0 == threads)
+   {
+      Usage();
+      return 2;
+   }
+
+   MockRegistry registry(callUs);
+   std::vector<std::wstring> names;
+   Populate(registry, extensions, filters, names);
+
+   // a few types make up most of the files, as on any file share
+   std::vector<std::wstring> stream;
+   std::mt19937 rng(7);
+   std::vector<double> weights;
+
+   for (size_t i = 0; i < names.size(); ++i)
+      weights.push_back(1.0 / (i + 1));
+
+   std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+   for (size_t i = 0; i < extractions; ++i)
+      stream.push_back(names[pick(rng)]);
+
+   coldCount = std::min(coldCount, stream.size());
+
+   std::vector<unsigned char> snapshot;
+
+   for (int run = 0; run < 3; ++run)
+   {
+      MockLoader loader(loadMs);
+      FilterRouter router(registry);
+      RunStats stats;
+
+      registry.ResetCalls();
+      Clock::time_point start = Clock::now();
+
+      if (2 == run)
+      {
+         // the snapshot's routes are checked and the hottest modules loaded
+         // before the first extraction comes in
+         if (!router.Load(snapshot.data(), snapshot.size()))
+         {
+            fprintf(stderr, "routebench: snapshot didn't load\n");
+            return 1;
+         }
+
+         router.Validate(TickMs());
+
+         std::vector<FilterRoute> hottest;
+         router.Hottest(preload, hottest);
+
+         std::atomic<size_t> next(0);
+         std::vector<std::thread> pool;
+
+         for (unsigned t = 0; t < threads; ++t)
+         {
+            pool.push_back(std::thread([&]
+            {
+               for (size_t i; (i = next++) < hottest.size(); )
+                  loader.Load(hottest[i].module);
+            }));
+         }
+
+         for (size_t t = 0; t < pool.size(); ++t)
+            pool[t].join();
+      }
+
+      Clock::time_point ready = Clock::now();
+      Clock::time_point coldEnd = ready;
+      std::set<std::wstring> routedTypes;
+
+      for (size_t i = 0; i < stream.size(); ++i)
+      {
+         FilterRoute route;
+         bool found;
+
+         if (0 == run)
+         {
+            // LoadIFilter has nothing to keep the walk in
+            FilterRouter walk(registry);
+            found = walk.Route(stream[i], TickMs(), route);
+         }
+         else
+         {
+            found = router.Route(stream[i], TickMs(), route);
+         }
+
+         if (found)
+         {
+            loader.Load(route.module);
+            routedTypes.insert(stream[i]);
+         }
+
+         if (i + 1 == coldCount)
+            coldEnd = Clock::now();
+      }
+
+      Clock::time_point end = Clock::now();
+
+      stats.startupMs = Ms(start, ready);
+      stats.coldMs = Ms(ready, coldEnd);
+      stats.totalMs = Ms(ready, end);
+      stats.registryCalls = registry.Calls();
+      stats.routed = static_cast<unsigned>(routedTypes.size());
+
+      Report(0 == run ? "walk" : 1 == run ? "routed" : "snapshot", stats, coldCount);
+
+      if (1 == run)
+         router.Save(snapshot);
+   }
+
+   printf("snapshot: %zu bytes for %u extensions\n", snapshot.size(), extensions);
+
+   // a filter installed over an extension after the snapshot was taken
+   {
+      FilterRouter router(registry);
+      router.Load(snapshot.data(), snapshot.size());
+
+      std::wstring handler = ClassId("handler", filters - 1);
+      registry.Set(names[0] + L"\\PersistentHandler", NULL, handler);
+      registry.Set(names[0], NULL, L"");
+
+      FilterRoute after;
+      bool ok = router.Route(names[0], TickMs(), after) && after.filter == ClassId("filter", filters - 1);
+      printf("changed route resolved again: %s\n", ok ? "yes" : "NO");
+
+      std::vector<unsigned char> corrupt(snapshot);
+      corrupt[corrupt.size() / 2] ^= 0x55;
+      printf("corrupt snapshot rejected: %s\n", !router.Load(corrupt.data(), corrupt.size()) ? "yes" : "NO");
+
+      return ok ? 0 : 1;
+   }
+}
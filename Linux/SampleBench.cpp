@@ -0,0 +1,416 @@
+// SampleBench.cpp : Times sampled extraction against full extraction on Linux.
+//
+// For each file, runs four ways of getting at its text:
+//
+//    full          decodes and cleans up all of it, the built-in plain text
+//                  path ExtractTextEx falls back to
+//    sample        SamplePlainText, reading only the bytes around the head,
+//                  the tail and the interior windows
+//    full-chunks   the IFilter loop over a chunk source standing in for a
+//                  filter (the file decoded in 64 KB blocks, one chunk each)
+//    sample-chunks SampleChunks over the same source, skimming the text
+//                  between the samples without cleaning it up or keeping it
+//
+// and prints the median time of each over the runs, the bytes read and the
+// samples' total length. With -c the file is dropped from the page cache
+// (posix_fadvise) before every run, so the times include the disk.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o samplebench SampleBench.cpp ../SampledText.cpp ../AppendText.cpp ../TokenText.cpp ../PlainText.cpp ../TextCleanup.cpp
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "AppendText.h"
+#include "PlainText.h"
+#include "SampledText.h"
+
+class FileReader : public ByteReader
+{
+public:
+   explicit FileReader(int fd) : m_fd(fd), m_bytesRead(0) {}
+
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb)
+   {
+      while (cb)
+      {
+         ssize_t n = pread(m_fd, buf, cb, static_cast<off_t>(offset));
+
+         if (n < 0 && EINTR == errno)
+            continue;
+
+         if (n <= 0)
+            return false;
+
+         buf += n;
+         cb -= n;
+         offset += n;
+         m_bytesRead += n;
+      }
+
+      return true;
+   }
+
+   unsigned long long BytesRead() const { return m_bytesRead; }
+
+private:
+   int m_fd;
+   unsigned long long m_bytesRead;
+};
+
+// A filter's worth of chunks from a text file, one per 64 KB block.
+class FileChunkSource : public ChunkSource
+{
+public:
+   FileChunkSource(ByteReader & file, unsigned long long size)
+      : m_file(file), m_size(size), m_offset(0), m_encoding(TEXT_ENCODING_BINARY), m_chunk(0), m_next(0)
+   {
+   }
+
+   virtual ChunkRead NextChunk(ChunkInfo & chunk)
+   {
+      const size_t cbBlock = 65536;
+
+      if (0 == m_chunk)
+      {
+         unsigned char sniff[4096];
+         size_t cb = m_size < sizeof(sniff) ? static_cast<size_t>(m_size) : sizeof(sniff);
+         size_t bomLength = 0;
+
+         if (!m_file.ReadAt(0, sniff, cb))
+            return CHUNK_READ_ERROR;
+
+         m_encoding = DetectTextEncoding(sniff, cb, &bomLength);
+         m_offset = bomLength;
+
+         if (TEXT_ENCODING_BINARY == m_encoding)
+            return CHUNK_READ_ERROR;
+      }
+
+      if (m_offset >= m_size)
+         return CHUNK_READ_END;
+
+      size_t cb = m_size - m_offset < cbBlock ? static_cast<size_t>(m_size - m_offset) : cbBlock;
+      bool final = m_offset + cb == m_size;
+
+      m_bytes.resize(cb);
+      m_text.resize(cb);
+
+      if (!m_file.ReadAt(m_offset, &m_bytes[0], cb))
+         return CHUNK_READ_ERROR;
+
+      size_t cch = 0;
+      size_t consumed = DecodeText(m_encoding, &m_bytes[0], cb, &m_text[0], &cch, final);
+
+      if (0 == consumed)
+         consumed = DecodeText(m_encoding, &m_bytes[0], cb, &m_text[0], &cch, true);
+
+      m_text.resize(cch);
+      m_offset += consumed;
+      m_next = 0;
+
+      memset(&chunk, 0, sizeof(chunk));
+      chunk.idChunk = ++m_chunk;
+      chunk.breakType = m_chunk > 1 ? TEXT_BREAK_EOP : TEXT_BREAK_NONE;
+      return CHUNK_READ_TEXT;
+   }
+
+   virtual TextRead GetText(wchar_t *buf, unsigned long *cch)
+   {
+      if (m_next >= m_text.size())
+      {
+         *cch = 0;
+         return TEXT_READ_END;
+      }
+
+      size_t take = m_text.size() - m_next < *cch ? m_text.size() - m_next : *cch;
+      memcpy(buf, &m_text[m_next], take * sizeof(wchar_t));
+      m_next += take;
+      *cch = static_cast<unsigned long>(take);
+
+      return m_next >= m_text.size() ? TEXT_READ_LAST : TEXT_READ_MORE;
+   }
+
+private:
+   ByteReader & m_file;
+   unsigned long long m_size;
+   unsigned long long m_offset;
+   TextEncoding m_encoding;
+   unsigned long m_chunk;
+   std::vector<unsigned char> m_bytes;
+   std::vector<wchar_t> m_text;
+   size_t m_next;
+};
+
+// Counts the text rather than keeping it, so memory doesn't skew the times.
+class CountingSink : public TextSink
+{
+public:
+   CountingSink() : m_length(0) {}
+
+   virtual void OnText(const wchar_t * /*text*/, size_t cch) { m_length += cch; }
+
+   unsigned long long Length() const { return m_length; }
+
+private:
+   unsigned long long m_length;
+};
+
+enum BenchMode
+{
+   BENCH_FULL = 0,
+   BENCH_SAMPLE,
+   BENCH_FULL_CHUNKS,
+   BENCH_SAMPLE_CHUNKS
+};
+
+static const char * const c_modeNames[] = { "full", "sample", "full-chunks", "sample-chunks" };
+
+// The extraction loop's separators and cleanup over a chunk source.
+static bool PullChunks(ChunkSource & source, CleanupProfile profile, CountingSink & sink)
+{
+   CleanupFunction cleanUp = GetCleanupFunction(profile);
+   CleanupState state;
+
+   for (;;)
+   {
+      ChunkInfo chunk;
+      ChunkRead read = source.NextChunk(chunk);
+
+      if (CHUNK_READ_ERROR == read)
+         return false;
+
+      if (CHUNK_READ_END == read)
+         return true;
+
+      if (CHUNK_READ_SKIP == read)
+         continue;
+
+      if (TEXT_BREAK_NONE != chunk.breakType)
+      {
+         wchar_t separator[3] = { L'\r', L'\n', 0 };
+         sink.OnText(separator, cleanUp(2, separator, state));
+      }
+
+      for (;;)
+      {
+         wchar_t buf[4097];
+         unsigned long cch = 4096;
+         TextRead text = source.GetText(buf, &cch);
+
+         if (TEXT_READ_ERROR == text)
+            return false;
+
+         if (TEXT_READ_END == text)
+            break;
+
+         sink.OnText(buf, cleanUp(cch, buf, state));
+
+         if (TEXT_READ_LAST == text)
+            break;
+      }
+   }
+}
+
+struct RunResult
+{
+   bool ok;
+   double seconds;
+   unsigned long long bytesRead;
+   unsigned long long length;
+};
+
+static RunResult Run(const char *path, BenchMode mode, const SampleSpec & spec, CleanupProfile profile, bool cold)
+{
+   RunResult result = { false, 0, 0, 0 };
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   struct stat st;
+
+   if (fd < 0 || fstat(fd, &st) != 0)
+   {
+      if (fd >= 0)
+         close(fd);
+
+      return result;
+   }
+
+   if (cold)
+   {
+      fdatasync(fd);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+   }
+
+   unsigned long long size = static_cast<unsigned long long>(st.st_size);
+   FileReader reader(fd);
+   std::vector<TextSample> samples;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   switch (mode)
+   {
+      case BENCH_FULL:
+      {
+         AppendState state;
+         CountingSink sink;
+
+         InitAppendState(state, profile);
+         AppendResult append = ExtractAppendedText(reader, size, profile, state, sink);
+
+         result.ok = APPEND_DELTA == append || APPEND_RESTARTED == append;
+         result.length = sink.Length();
+         break;
+      }
+
+      case BENCH_SAMPLE:
+         result.ok = SAMPLE_OK == SamplePlainText(reader, size, spec, profile, samples);
+         break;
+
+      case BENCH_FULL_CHUNKS:
+      {
+         FileChunkSource source(reader, size);
+         CountingSink sink;
+
+         result.ok = PullChunks(source, profile, sink);
+         result.length = sink.Length();
+         break;
+      }
+
+      case BENCH_SAMPLE_CHUNKS:
+      {
+         FileChunkSource source(reader, size);
+         result.ok = SampleChunks(source, spec, profile, samples);
+         break;
+      }
+   }
+
+   result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   result.bytesRead = reader.BytesRead();
+
+   for (size_t i = 0; i < samples.size(); ++i)
+      result.length += samples[i].text.length();
+
+   close(fd);
+   return result;
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: samplebench [options] file...\n"
+      "  -H N   head length in characters (default: 4096)\n"
+      "  -T N   tail length in characters (default: 4096)\n"
+      "  -k N   interior windows (default: 8)\n"
+      "  -w N   window length in characters (default: 1024)\n"
+      "  -n N   runs of each mode, the median is reported (default: 5)\n"
+      "  -c     drop the file from the page cache before every run\n");
+}
+
+int main(int argc, char *argv[])
+{
+   SampleSpec spec = { 4096, 4096, 8, 1024 };
+   int runs = 5;
+   bool cold = false;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "H:T:k:w:n:ch")) != -1)
+   {
+      switch (opt)
+      {
+         case 'H':
+            spec.headLength = strtoul(optarg, NULL, 10);
+            break;
+
+         case 'T':
+            spec.tailLength = strtoul(optarg, NULL, 10);
+            break;
+
+         case 'k':
+            spec.windowCount = strtoul(optarg, NULL, 10);
+            break;
+
+         case 'w':
+            spec.windowLength = strtoul(optarg, NULL, 10);
+            break;
+
+         case 'n':
+            runs = atoi(optarg);
+            break;
+
+         case 'c':
+            cold = true;
+            break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   if (optind == argc || runs < 1)
+   {
+      Usage();
+      return 2;
+   }
+
+   int failures = 0;
+
+   printf("%-14s %12s %14s %12s %10s\n", "mode", "median ms", "bytes read", "characters", "speedup");
+
+   for (int i = optind; i < argc; ++i)
+   {
+      printf("%s\n", argv[i]);
+
+      double fullSeconds[2] = { 0, 0 };
+
+      for (int mode = BENCH_FULL; mode <= BENCH_SAMPLE_CHUNKS; ++mode)
+      {
+         std::vector<double> times;
+         RunResult result = { false, 0, 0, 0 };
+
+         for (int run = 0; run < runs; ++run)
+         {
+            result = Run(argv[i], static_cast<BenchMode>(mode), spec, CLEANUP_DISPLAY, cold);
+
+            if (!result.ok)
+               break;
+
+            times.push_back(result.seconds);
+         }
+
+         if (!result.ok)
+         {
+            printf("%-14s failed\n", c_modeNames[mode]);
+            ++failures;
+            continue;
+         }
+
+         std::sort(times.begin(), times.end());
+         double median = times[times.size() / 2];
+
+         // each sampling mode against the full extraction it replaces
+         if (BENCH_FULL == mode || BENCH_FULL_CHUNKS == mode)
+            fullSeconds[BENCH_FULL_CHUNKS == mode] = median;
+
+         double base = fullSeconds[BENCH_SAMPLE_CHUNKS == mode];
+         bool sampling = BENCH_SAMPLE == mode || BENCH_SAMPLE_CHUNKS == mode;
+
+         printf("%-14s %12.3f %14llu %12llu", c_modeNames[mode], median * 1000, result.bytesRead, result.length);
+
+         if (sampling && base > 0 && median > 0)
+            printf(" %9.1fx", base / median);
+
+         printf("\n");
+      }
+   }
+
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,359 @@
+// ScheduleSim.cpp : Simulates the extraction scheduler against mock filters on Linux.
+//
+// Replays a synthetic workload, a stream of mostly small files with a heavy
+// tail of large ones across a few file types, through three setups with the
+// same number of workers:
+//
+//    fifo       one queue in arrival order, nothing else
+//    fifo+lock  the same, with a lock around each single-threaded filter, so
+//               workers sit blocked on it while other work waits
+//    scheduler  ExtractScheduler: small and large lanes, cheapest first with
+//               aging, per-type concurrency caps, learned per-type throughput.
+//               The single-threaded types are capped at one, the way a caller
+//               has to with SetFilterConcurrency, there is no cap by default
+//
+// Each mock filter sleeps for a time proportional to the file's size at its
+// type's speed. Types marked single-threaded count a failure whenever two
+// jobs are inside them at once, the way some installed filters misbehave.
+// Reports latency percentiles for small and large jobs, failures and the
+// total run time of each setup. First checks that cancelling takes a job off
+// its queue only until a worker has been handed it.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -pthread -I.. -o schedulesim ScheduleSim.cpp ../ExtractScheduler.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ExtractScheduler.h"
+
+struct MockFilter
+{
+   const wchar_t *extension;
+   double usPerKB;          // simulated throughput
+   bool singleThreaded;
+   std::atomic<int> inside;
+   std::atomic<int> failures;
+};
+
+static MockFilter s_filters[] =
+{
+   { L".txt", 5, false, {0}, {0} },
+   { L".doc", 40, false, {0}, {0} },
+   { L".pdf", 60, true, {0}, {0} },
+   { L".xls", 30, true, {0}, {0} },
+};
+
+static const size_t c_filterCount = sizeof(s_filters) / sizeof(s_filters[0]);
+
+static std::mutex s_filterLocks[c_filterCount];
+
+struct SimJob
+{
+   size_t filter;
+   unsigned long long size;
+   double arrival;          // seconds from the start
+   double latency;          // seconds
+   bool small;              // by its true cost, for the report
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double s_timeScale = 0.05;   // simulated microseconds to real ones
+
+static void RunMock(SimJob & job, bool lockFilter)
+{
+   MockFilter & filter = s_filters[job.filter];
+   std::unique_lock<std::mutex> hold(s_filterLocks[job.filter], std::defer_lock);
+
+   if (lockFilter && filter.singleThreaded)
+      hold.lock();
+
+   if (++filter.inside > 1 && filter.singleThreaded)
+      ++filter.failures;
+
+   double us = (2000 + job.size / 1024.0 * filter.usPerKB) * s_timeScale;
+   std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>(us)));
+
+   --filter.inside;
+}
+
+static std::vector<SimJob> MakeWorkload(size_t count, double seconds, unsigned seed)
+{
+   std::mt19937 rng(seed);
+   std::lognormal_distribution<double> size(11.5, 2.0);    // median ~100 KB, long tail
+   std::uniform_int_distribution<size_t> type(0, c_filterCount - 1);
+   std::uniform_real_distribution<double> arrival(0, seconds);
+
+   std::vector<SimJob> jobs(count);
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      jobs[i].filter = type(rng);
+      jobs[i].size = std::min(static_cast<unsigned long long>(size(rng)), 512ULL << 20);
+      jobs[i].arrival = arrival(rng);
+      jobs[i].latency = 0;
+      jobs[i].small = 2000 + jobs[i].size / 1024.0 * s_filters[jobs[i].filter].usPerKB <= 500000;
+   }
+
+   std::sort(jobs.begin(), jobs.end(), [](const SimJob & a, const SimJob & b) { return a.arrival < b.arrival; });
+   return jobs;
+}
+
+// Submits each job at its arrival time (scaled), calls submit(index).
+template <typename Submit>
+static void Replay(std::vector<SimJob> & jobs, Clock::time_point start, Submit submit)
+{
+   for (size_t i = 0; i < jobs.size(); ++i)
+   {
+      std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<long long>(jobs[i].arrival * 1e6 * s_timeScale)));
+      submit(i);
+   }
+}
+
+static double Finish(SimJob & job, Clock::time_point start)
+{
+   double now = std::chrono::duration<double>(Clock::now() - start).count() / s_timeScale;
+   job.latency = now - job.arrival;
+   return now;
+}
+
+static double RunFifo(std::vector<SimJob> & jobs, unsigned workers, bool lockFilters)
+{
+   std::mutex lock;
+   std::condition_variable ready;
+   std::deque<size_t> queue;
+   bool done = false;
+
+   Clock::time_point start = Clock::now();
+   std::vector<std::thread> threads;
+
+   for (unsigned w = 0; w < workers; ++w)
+   {
+      threads.emplace_back([&]
+      {
+         for (;;)
+         {
+            std::unique_lock<std::mutex> hold(lock);
+            ready.wait(hold, [&] { return done || !queue.empty(); });
+
+            if (queue.empty())
+               return;
+
+            size_t i = queue.front();
+            queue.pop_front();
+            hold.unlock();
+
+            RunMock(jobs[i], lockFilters);
+            Finish(jobs[i], start);
+         }
+      });
+   }
+
+   Replay(jobs, start, [&](size_t i)
+   {
+      std::lock_guard<std::mutex> hold(lock);
+      queue.push_back(i);
+      ready.notify_one();
+   });
+
+   {
+      std::lock_guard<std::mutex> hold(lock);
+      done = true;
+      ready.notify_all();
+   }
+
+   for (std::thread & t : threads)
+      t.join();
+
+   return std::chrono::duration<double>(Clock::now() - start).count() / s_timeScale;
+}
+
+static double RunScheduler(std::vector<SimJob> & jobs, unsigned smallWorkers, unsigned largeWorkers)
+{
+   // the scheduler works in simulated microseconds, aging in real milliseconds
+   ExtractScheduler scheduler(500000, static_cast<unsigned long>(std::max(1.0, 1000 * s_timeScale)));
+
+   for (size_t f = 0; f < c_filterCount; ++f)
+   {
+      if (s_filters[f].singleThreaded)
+         scheduler.SetConcurrency(s_filters[f].extension, 1);
+   }
+
+   std::atomic<size_t> remaining(jobs.size());
+   Clock::time_point start = Clock::now();
+   std::vector<std::thread> threads;
+
+   for (unsigned w = 0; w < smallWorkers + largeWorkers; ++w)
+   {
+      SchedulerLane lane = w < smallWorkers ? LANE_SMALL : LANE_LARGE;
+
+      threads.emplace_back([&, lane]
+      {
+         ScheduledJob job;
+
+         while (scheduler.Next(lane, job, c_waitForever))
+         {
+            SimJob & sim = *static_cast<SimJob *>(job.context);
+            Clock::time_point begin = Clock::now();
+
+            RunMock(sim, false);
+            Finish(sim, start);
+
+            double us = std::chrono::duration<double, std::micro>(Clock::now() - begin).count() / s_timeScale;
+            scheduler.Done(job, static_cast<unsigned long long>(us));
+
+            if (0 == --remaining)
+               scheduler.Shutdown();
+         }
+      });
+   }
+
+   Replay(jobs, start, [&](size_t i)
+   {
+      scheduler.Submit(s_filters[jobs[i].filter].extension, jobs[i].size, &jobs[i]);
+   });
+
+   for (std::thread & t : threads)
+      t.join();
+
+   return std::chrono::duration<double>(Clock::now() - start).count() / s_timeScale;
+}
+
+static double Percentile(std::vector<double> values, double p)
+{
+   if (values.empty())
+      return 0;
+
+   std::sort(values.begin(), values.end());
+   return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+}
+
+static void Report(const char *name, const std::vector<SimJob> & jobs, double makespan)
+{
+   std::vector<double> small, large;
+   int failures = 0;
+
+   for (const SimJob & job : jobs)
+      (job.small ? small : large).push_back(job.latency * 1000);
+
+   for (size_t f = 0; f < c_filterCount; ++f)
+   {
+      failures += s_filters[f].failures;
+      s_filters[f].failures = 0;
+   }
+
+   printf("%-10s small p50 %8.1f ms  p95 %8.1f ms | large p50 %8.1f ms  p95 %8.1f ms | failures %4d | total %.1f s\n",
+          name, Percentile(small, 0.5), Percentile(small, 0.95), Percentile(large, 0.5), Percentile(large, 0.95),
+          failures, makespan);
+}
+
+// Prints what Cancel gets wrong and returns how many.
+static int CheckCancel()
+{
+   ExtractScheduler scheduler;
+   int failures = 0;
+   int contexts[3];
+
+   unsigned long first = scheduler.Submit(L".txt", 1024, &contexts[0]);
+   unsigned long second = scheduler.Submit(L".txt", 1024, &contexts[1]);
+   unsigned long third = scheduler.Submit(L".txt", 1024, &contexts[2]);
+
+   ScheduledJob job;
+
+   if (!scheduler.Cancel(second) || scheduler.Cancel(second))
+   {
+      printf("cancel     a queued job isn't taken off exactly once\n");
+      ++failures;
+   }
+
+   if (!scheduler.Next(LANE_SMALL, job, 0) || first != job.id || scheduler.Cancel(first))
+   {
+      printf("cancel     a job handed to a worker can still be cancelled\n");
+      ++failures;
+   }
+
+   scheduler.Done(job, 1000);
+
+   if (!scheduler.Next(LANE_SMALL, job, 0) || third != job.id || 0 != scheduler.Queued())
+   {
+      printf("cancel     the cancelled job is still handed out\n");
+      ++failures;
+   }
+
+   return failures;
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: schedulesim [options]\n"
+      "  -n COUNT   jobs in the workload (default: 2000)\n"
+      "  -t SECS    simulated seconds the arrivals are spread over (default: 60)\n"
+      "  -w COUNT   workers, the scheduler keeps a quarter for small jobs (default: 8)\n"
+      "  -x SCALE   real time per simulated microsecond (default: 0.05)\n"
+      "  -r SEED    workload seed (default: 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+   size_t count = 2000;
+   double seconds = 60;
+   unsigned workers = 8;
+   unsigned seed = 1;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "n:t:w:x:r:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'n': count = strtoul(optarg, NULL, 10); break;
+         case 't': seconds = atof(optarg); break;
+         case 'w': workers = static_cast<unsigned>(atoi(optarg)); break;
+         case 'x': s_timeScale = atof(optarg); break;
+         case 'r': seed = static_cast<unsigned>(atoi(optarg)); break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   if (0 == count || workers < 2 || s_timeScale <= 0)
+   {
+      Usage();
+      return 2;
+   }
+
+   int failures = CheckCancel();
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   std::vector<SimJob> fifo = MakeWorkload(count, seconds, seed);
+   std::vector<SimJob> locked = fifo;
+   std::vector<SimJob> scheduled = fifo;
+
+   unsigned smallWorkers = std::max(1u, workers / 4);
+
+   Report("fifo", fifo, RunFifo(fifo, workers, false));
+   Report("fifo+lock", locked, RunFifo(locked, workers, true));
+   Report("scheduler", scheduled, RunScheduler(scheduled, smallWorkers, workers - smallWorkers));
+
+   return 0;
+}
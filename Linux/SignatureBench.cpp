@@ -0,0 +1,315 @@
+// SignatureBench.cpp : Checks that the SimHash and MinHash signatures of
+//                      SignatureSink are stable, and times it, on Linux.
+//
+// The checks, run first, fail the tool if any of them doesn't hold:
+//  - the signatures don't depend on how the text is cut up: each text fed in
+//    one go, in buffers of one, seven and 4096 characters, in random pieces
+//    with TEXT_BREAK_NONE chunks in between and with chunk breaks where the
+//    text has a blank anyway gives the same SimHash, MinHash and shingles
+//  - they don't change between runs: a fixed text gives the signature
+//    pinned below, the seeds and hashes are all constants
+//  - they do what they're for: a copy with one word added stays within a
+//    few bits and above 90% similarity, an unrelated text doesn't
+//
+// Then times the sink over a few MB of prose fed in 4096-character buffers,
+// with SimHash alone (no MinHash values) and with more and more MinHash
+// values, as the median throughput over the runs.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o signaturebench SignatureBench.cpp ../Signature.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Signature.h"
+
+static const size_t c_bufferChars = 4096;
+
+static const wchar_t * const s_words[] =
+{
+   L"the", L"The", L"extraction", L"loop", L"hands", L"over", L"text", L"in", L"buffers", L"of", L"characters",
+   L"na\x00EFve", L"CAF\x00C9", L"stra\x00DF" L"e", L"\x4E2D\x6587", L"\x65E5\x672C", L"2026", L"42", L"a", L"signature",
+   L"near", L"duplicate", L"documents", L"share", L"most", L"shingles", L"\x0434\x043E\x043A\x0443\x043C\x0435\x043D\x0442"
+};
+
+static const wchar_t * const s_separators[] = { L" ", L" ", L" ", L", ", L". ", L"\r\n", L" - ", L"\t" };
+
+static std::wstring MakeText(size_t words, unsigned long seed)
+{
+   std::wstring text;
+
+   for (size_t i = 0; i < words; ++i)
+   {
+      seed = (seed * 1103515245 + 12345) & 0x7FFFFFFF;
+      text += s_words[(seed >> 8) % (sizeof(s_words) / sizeof(s_words[0]))];
+      text += s_separators[(seed >> 3) % (sizeof(s_separators) / sizeof(s_separators[0]))];
+   }
+
+   return text;
+}
+
+struct Signature
+{
+   unsigned long long simHash;
+   std::vector<unsigned long long> minHash;
+   unsigned long long shingles;
+
+   bool operator==(const Signature & other) const
+   {
+      return simHash == other.simHash && minHash == other.minHash && shingles == other.shingles;
+   }
+};
+
+static Signature Take(SignatureSink & sink)
+{
+   Signature signature;
+   signature.simHash = sink.SimHash();
+   signature.minHash = sink.MinHash();
+   signature.shingles = sink.Shingles();
+   return signature;
+}
+
+static ChunkInfo Chunk(unsigned long id, TextBreak breakType)
+{
+   ChunkInfo chunk = { id, breakType, 0x409, 0, 0, 0 };
+   return chunk;
+}
+
+enum Cutting
+{
+   CUT_WHOLE,
+   CUT_ONES,
+   CUT_SEVENS,
+   CUT_BUFFERS,
+   CUT_RANDOM_NONE,     // random pieces, TEXT_BREAK_NONE chunks in between
+   CUT_BREAKS_AT_BLANKS,
+   CUTTINGS
+};
+
+static const char * const c_cuttingNames[CUTTINGS] = { "whole", "ones", "sevens", "buffers", "random", "breaks" };
+
+static Signature Sign(const std::wstring & text, Cutting cutting)
+{
+   SignatureSink sink;
+   unsigned long seed = 7;
+   unsigned long id = 1;
+
+   sink.OnChunk(Chunk(id++, TEXT_BREAK_NONE));
+
+   for (size_t start = 0; start < text.length(); )
+   {
+      size_t cch = text.length() - start;
+
+      switch (cutting)
+      {
+         case CUT_ONES:    cch = 1; break;
+         case CUT_SEVENS:  cch = 7; break;
+         case CUT_BUFFERS: cch = c_bufferChars; break;
+
+         case CUT_RANDOM_NONE:
+            seed = (seed * 1103515245 + 12345) & 0x7FFFFFFF;
+            cch = 1 + (seed >> 8) % 100;
+            break;
+
+         case CUT_BREAKS_AT_BLANKS:
+         {
+            // up to the next blank, then a new chunk with a real break
+            size_t blank = text.find(L' ', start + 1);
+            cch = std::wstring::npos == blank ? cch : blank - start;
+            break;
+         }
+
+         default:
+            break;
+      }
+
+      cch = std::min(cch, text.length() - start);
+      sink.OnText(text.data() + start, cch);
+      start += cch;
+
+      if (CUT_RANDOM_NONE == cutting)
+         sink.OnChunk(Chunk(id++, TEXT_BREAK_NONE));
+      else if (CUT_BREAKS_AT_BLANKS == cutting)
+      {
+         sink.OnChunk(Chunk(id, 0 == id % 3 ? TEXT_BREAK_EOP : TEXT_BREAK_EOW));
+         ++id;
+      }
+   }
+
+   sink.OnEnd();
+   return Take(sink);
+}
+
+// What the text below has to sign as, whatever the run or the machine.
+static const wchar_t c_pinnedText[] =
+   L"The extraction loop hands over the text in buffers of 4096 characters, "
+   L"and near-duplicate documents share most of their shingles. Na\x00EFve CAF\x00C9 \x4E2D\x6587.";
+
+static const unsigned long long c_pinnedSimHash = 0xF21898B692303234ULL;
+static const unsigned long long c_pinnedMinHash[3] = { 0x05DE79261F9A85BCULL, 0x116FF92C1A35A622ULL, 0x05DC0BF8020EABDEULL };   // values 0, 31 and 63
+static const unsigned long long c_pinnedShingles = 22;
+
+static int CheckStability()
+{
+   int failures = 0;
+
+   struct
+   {
+      const char *name;
+      std::wstring text;
+   } texts[] =
+   {
+      { "prose", MakeText(20000, 1) },
+      { "short", L"two words" },
+      { "one", L"word" },
+      { "long-word", std::wstring(10000, L'x') + L" and then some more words" },
+      { "empty", L"" }
+   };
+
+   for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); ++t)
+   {
+      Signature whole = Sign(texts[t].text, CUT_WHOLE);
+      int before = failures;
+
+      for (int c = CUT_WHOLE + 1; c < CUTTINGS; ++c)
+      {
+         if (!(Sign(texts[t].text, static_cast<Cutting>(c)) == whole))
+         {
+            printf("%-10s cut into %-8s: the signature changed\n", texts[t].name, c_cuttingNames[c]);
+            ++failures;
+         }
+      }
+
+      if (before == failures)
+         printf("%-10s %8llu shingles, simhash %016llx, the same however it's cut\n", texts[t].name, whole.shingles, whole.simHash);
+   }
+
+   Signature pinned = Sign(c_pinnedText, CUT_WHOLE);
+
+   if (pinned.simHash != c_pinnedSimHash || pinned.minHash[0] != c_pinnedMinHash[0] ||
+       pinned.minHash[31] != c_pinnedMinHash[1] || pinned.minHash[63] != c_pinnedMinHash[2] ||
+       pinned.shingles != c_pinnedShingles)
+   {
+      printf("pinned text signs as simhash %016llx, minhash %016llx %016llx %016llx, %llu shingles\n",
+             pinned.simHash, pinned.minHash[0], pinned.minHash[31], pinned.minHash[63], pinned.shingles);
+      ++failures;
+   }
+   else
+   {
+      printf("pinned text signs as pinned\n");
+   }
+
+   std::wstring original = MakeText(2000, 2);
+   std::wstring edited = original;
+   size_t middle = edited.find(L' ', edited.length() / 2);
+   edited.insert(middle, L" inserted");
+
+   std::wstring unrelated = MakeText(2000, 3);
+
+   Signature a = Sign(original, CUT_BUFFERS);
+   Signature b = Sign(edited, CUT_BUFFERS);
+   Signature c = Sign(unrelated, CUT_BUFFERS);
+
+   unsigned nearBits = SignatureSink::SimHashDistance(a.simHash, b.simHash);
+   double nearSimilarity = SignatureSink::MinHashSimilarity(a.minHash, b.minHash);
+   unsigned farBits = SignatureSink::SimHashDistance(a.simHash, c.simHash);
+   double farSimilarity = SignatureSink::MinHashSimilarity(a.minHash, c.minHash);
+
+   printf("one word added: %u bits apart, %.0f%% similar; unrelated: %u bits apart, %.0f%% similar\n",
+          nearBits, 100 * nearSimilarity, farBits, 100 * farSimilarity);
+
+   if (nearBits > 3 || nearSimilarity < 0.9 || farBits < 16 || farSimilarity > 0.5)
+   {
+      printf("near-duplicates aren't told from unrelated text\n");
+      ++failures;
+   }
+
+   return failures;
+}
+
+int main(int argc, char *argv[])
+{
+   size_t megabytes = 16;
+   unsigned runs = 5;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "m:r:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'm': megabytes = strtoul(optarg, NULL, 10); break;
+         case 'r': runs = static_cast<unsigned>(atoi(optarg)); break;
+
+         default:
+            fprintf(stderr,
+               "usage: signaturebench [options]\n"
+               "  -m MB     text to sign, in MB of wchar_t (default: 16)\n"
+               "  -r RUNS   timed runs, the median counts (default: 5)\n");
+            return 2;
+      }
+   }
+
+   if (0 == megabytes)
+      megabytes = 1;
+
+   if (0 == runs)
+      runs = 1;
+
+   int failures = CheckStability();
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   std::wstring text;
+
+   for (unsigned long seed = 10; text.length() * sizeof(wchar_t) < megabytes * 1024 * 1024; ++seed)
+      text += MakeText(10000, seed);
+
+   double mb = static_cast<double>(text.length() * sizeof(wchar_t)) / (1024 * 1024);
+
+   static const struct
+   {
+      unsigned shingleWords;
+      unsigned minHashes;
+   } c_settings[] = { { 3, 0 }, { 3, 16 }, { 3, 64 }, { 3, 128 }, { 3, 256 }, { 5, 64 } };
+
+   printf("\n%8s %10s %10s %12s %14s\n", "shingle", "minhashes", "MB/s", "Mshingles/s", "ns per shingle");
+
+   for (size_t s = 0; s < sizeof(c_settings) / sizeof(c_settings[0]); ++s)
+   {
+      std::vector<double> times;
+      unsigned long long shingles = 0;
+
+      for (unsigned run = 0; run < runs; ++run)
+      {
+         SignatureSink sink(c_settings[s].shingleWords, c_settings[s].minHashes);
+
+         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+         for (size_t i = 0; i < text.length(); i += c_bufferChars)
+            sink.OnText(text.data() + i, std::min(c_bufferChars, text.length() - i));
+
+         sink.OnEnd();
+         times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+         shingles = sink.Shingles();
+      }
+
+      std::sort(times.begin(), times.end());
+      double seconds = times[times.size() / 2];
+
+      printf("%8u %10u %10.0f %12.1f %14.1f\n", c_settings[s].shingleWords, c_settings[s].minHashes,
+             mb / seconds, shingles / seconds / 1e6, seconds * 1e9 / shingles);
+   }
+
+   return 0;
+}
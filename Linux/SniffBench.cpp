@@ -0,0 +1,447 @@
+// SniffBench.cpp : Checks and times content sniffing on Linux.
+//
+// Writes a set of small synthetic files to a scratch directory: the real
+// formats under their own names and misnamed ones (a .doc that is RTF, HTML
+// or plain text, a Word file named .xls, an extensionless mail message),
+// sniffs each, prints what ChooseRoute makes of it and checks that against
+// what it should be. Then times the sniff itself, from memory and through a
+// pread of the head the way the DLL reads it, and optionally over every
+// regular file under a directory.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o sniffbench SniffBench.cpp ../ContentSniffer.cpp ../PlainText.cpp ../TextCleanup.cpp
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "ContentSniffer.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef std::vector<unsigned char> Bytes;
+
+class FileReader : public ByteReader
+{
+public:
+   explicit FileReader(int fd) : m_fd(fd) {}
+
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb)
+   {
+      while (cb)
+      {
+         ssize_t n = pread(m_fd, buf, cb, static_cast<off_t>(offset));
+
+         if (n < 0 && EINTR == errno)
+            continue;
+
+         if (n <= 0)
+            return false;
+
+         buf += n;
+         cb -= n;
+         offset += n;
+      }
+
+      return true;
+   }
+
+private:
+   int m_fd;
+};
+
+static const char * FormatName(ContentFormat format)
+{
+   static const char * const c_names[] =
+   {
+      "unknown", "ole2", "word", "excel", "powerpoint", "outlook", "zip", "ooxml", "docx", "xlsx", "pptx",
+      "odt", "ods", "odp", "pdf", "rtf", "html", "xml", "mime", "png", "jpeg", "gif",
+      "text-utf8", "text-utf16", "text-ansi"
+   };
+
+   return c_names[format];
+}
+
+static const char * RouteName(ContentRoute route)
+{
+   switch (route)
+   {
+      case ROUTE_BY_CONTENT: return "content";
+      case ROUTE_PLAIN_TEXT: return "plain text";
+      default: return "extension";
+   }
+}
+
+static void PutU16(Bytes & bytes, size_t offset, unsigned value)
+{
+   bytes[offset] = static_cast<unsigned char>(value);
+   bytes[offset + 1] = static_cast<unsigned char>(value >> 8);
+}
+
+static void PutU32(Bytes & bytes, size_t offset, unsigned long value)
+{
+   PutU16(bytes, offset, value & 0xFFFF);
+   PutU16(bytes, offset + 2, value >> 16);
+}
+
+static void Append(Bytes & bytes, const std::string & text)
+{
+   bytes.insert(bytes.end(), text.begin(), text.end());
+}
+
+// A compound file with 512 byte sectors whose directory starts at sector
+// directorySector and holds the root and the given streams. The FAT isn't
+// filled in, the sniffer doesn't look at it.
+static Bytes Ole(unsigned long directorySector, const std::vector<std::string> & streams)
+{
+   Bytes bytes((directorySector + 2) * 512 + 512, 0);
+   static const unsigned char c_magic[] = { 0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1 };
+
+   memcpy(&bytes[0], c_magic, sizeof(c_magic));
+   PutU16(bytes, 0x18, 0x3E);
+   PutU16(bytes, 0x1A, 3);
+   PutU16(bytes, 0x1C, 0xFFFE);
+   PutU16(bytes, 0x1E, 9);
+   PutU16(bytes, 0x20, 6);
+   PutU32(bytes, 0x30, directorySector);
+
+   std::vector<std::string> names(1, "Root Entry");
+   names.insert(names.end(), streams.begin(), streams.end());
+
+   size_t directory = (directorySector + 1) * 512;
+
+   for (size_t i = 0; i < names.size() && i < 4; ++i)
+   {
+      size_t entry = directory + i * 128;
+
+      for (size_t c = 0; c < names[i].size(); ++c)
+         bytes[entry + 2 * c] = static_cast<unsigned char>(names[i][c]);
+
+      PutU16(bytes, entry + 0x40, static_cast<unsigned>((names[i].size() + 1) * 2));
+      bytes[entry + 0x42] = 0 == i ? 5 : 2;
+   }
+
+   return bytes;
+}
+
+// A ZIP of stored entries, local headers only.
+static Bytes Zip(const std::vector<std::pair<std::string, std::string> > & entries)
+{
+   Bytes bytes;
+
+   for (size_t i = 0; i < entries.size(); ++i)
+   {
+      size_t header = bytes.size();
+
+      bytes.resize(header + 30, 0);
+      memcpy(&bytes[header], "PK\x03\x04", 4);
+      PutU16(bytes, header + 4, 20);
+      PutU32(bytes, header + 18, static_cast<unsigned long>(entries[i].second.size()));
+      PutU32(bytes, header + 22, static_cast<unsigned long>(entries[i].second.size()));
+      PutU16(bytes, header + 26, static_cast<unsigned>(entries[i].first.size()));
+
+      Append(bytes, entries[i].first);
+      Append(bytes, entries[i].second);
+   }
+
+   Append(bytes, std::string("PK\x05\x06", 4));
+   bytes.resize(bytes.size() + 18, 0);
+   return bytes;
+}
+
+static Bytes Text(const std::string & text)
+{
+   return Bytes(text.begin(), text.end());
+}
+
+static Bytes Utf16(const std::string & text)
+{
+   Bytes bytes;
+
+   bytes.push_back(0xFF);
+   bytes.push_back(0xFE);
+
+   for (size_t i = 0; i < text.size(); ++i)
+   {
+      bytes.push_back(static_cast<unsigned char>(text[i]));
+      bytes.push_back(0);
+   }
+
+   return bytes;
+}
+
+struct Sample
+{
+   std::string name;
+   Bytes bytes;
+   ContentRoute route;           // expected
+   std::wstring routeExtension;  // expected
+};
+
+static std::wstring Extension(const std::string & name)
+{
+   size_t dot = name.rfind('.');
+
+   if (std::string::npos == dot)
+      return std::wstring();
+
+   std::wstring extension;
+
+   for (size_t i = dot; i < name.size(); ++i)
+      extension += static_cast<wchar_t>(tolower(static_cast<unsigned char>(name[i])));
+
+   return extension;
+}
+
+static std::string Narrow(const std::wstring & text)
+{
+   return std::string(text.begin(), text.end());
+}
+
+static std::vector<Sample> Samples()
+{
+   const std::string html = "<!DOCTYPE html>\r\n<html><head><title>Minutes</title></head><body><p>Budget review</p></body></html>\r\n";
+   const std::string rtf = "{\\rtf1\\ansi\\deff0 {\\fonttbl {\\f0 Times New Roman;}} Budget review\\par }";
+   const std::string mail = "Received: from mail.example.com by mx.example.org; Mon, 5 Oct 2026 09:12:01 +0000\r\n"
+                            "From: Ann <ann@example.com>\r\nTo: Bob <bob@example.org>\r\nSubject: Budget review\r\n"
+                            "MIME-Version: 1.0\r\nContent-Type: text/plain; charset=utf-8\r\n\r\nSee attached.\r\n";
+   const std::string note = "From: the desk of the treasurer\r\nPlease file the budget review by Friday.\r\n";
+
+   std::vector<std::pair<std::string, std::string> > docx;
+   docx.push_back(std::make_pair("[Content_Types].xml", "<?xml version=\"1.0\"?><Types/>"));
+   docx.push_back(std::make_pair("_rels/.rels", "<?xml version=\"1.0\"?><Relationships/>"));
+   docx.push_back(std::make_pair("word/document.xml", "<?xml version=\"1.0\"?><w:document/>"));
+
+   std::vector<std::pair<std::string, std::string> > odt;
+   odt.push_back(std::make_pair("mimetype", "application/vnd.oasis.opendocument.text"));
+   odt.push_back(std::make_pair("content.xml", "<?xml version=\"1.0\"?><office:document-content/>"));
+
+   std::vector<std::pair<std::string, std::string> > plainZip;
+   plainZip.push_back(std::make_pair("readme.txt", "hello"));
+
+   Bytes png = Text("\x89PNG\r\n\x1A\n");
+   png.resize(64, 0);
+
+   std::vector<Sample> samples;
+   Sample sample;
+
+#define SAMPLE(n, b, r, e) sample.name = n; sample.bytes = b; sample.route = r; sample.routeExtension = e; samples.push_back(sample)
+
+   SAMPLE("report.doc", Ole(1, std::vector<std::string>(1, "WordDocument")), ROUTE_BY_EXTENSION, L".doc");
+   SAMPLE("report-big.doc", Ole(20, std::vector<std::string>(1, "WordDocument")), ROUTE_BY_EXTENSION, L".doc");
+   SAMPLE("sheet.xls", Ole(1, std::vector<std::string>(1, "Workbook")), ROUTE_BY_EXTENSION, L".xls");
+   SAMPLE("message.msg", Ole(1, std::vector<std::string>(1, "__substg1.0_0037001F")), ROUTE_BY_EXTENSION, L".msg");
+   SAMPLE("report.docx", Zip(docx), ROUTE_BY_EXTENSION, L".docx");
+   SAMPLE("notes.odt", Zip(odt), ROUTE_BY_EXTENSION, L".odt");
+   SAMPLE("archive.zip", Zip(plainZip), ROUTE_BY_EXTENSION, L".zip");
+   SAMPLE("paper.pdf", Text("%PDF-1.7\n%\xE2\xE3\xCF\xD3\n1 0 obj\n<< /Type /Catalog >>\nendobj\n"), ROUTE_BY_EXTENSION, L".pdf");
+   SAMPLE("letter.rtf", Text(rtf), ROUTE_BY_EXTENSION, L".rtf");
+   SAMPLE("page.htm", Text(html), ROUTE_BY_EXTENSION, L".htm");
+   SAMPLE("page16.htm", Utf16(html), ROUTE_BY_EXTENSION, L".htm");
+   SAMPLE("feed.xml", Text("<?xml version=\"1.0\"?>\n<rss><channel/></rss>\n"), ROUTE_BY_EXTENSION, L".xml");
+   SAMPLE("mail.eml", Text(mail), ROUTE_BY_EXTENSION, L".eml");
+   SAMPLE("readme.txt", Text("Budget review\r\nSee the attached figures.\r\n"), ROUTE_BY_EXTENSION, L".txt");
+   SAMPLE("chart.png", png, ROUTE_BY_EXTENSION, L".png");
+
+   SAMPLE("rtf-named.doc", Text(rtf), ROUTE_BY_CONTENT, L".rtf");
+   SAMPLE("html-named.doc", Text(html), ROUTE_BY_CONTENT, L".htm");
+   SAMPLE("text-named.doc", Text("Budget review\r\nSee the attached figures.\r\n"), ROUTE_PLAIN_TEXT, L".txt");
+   SAMPLE("utf16-named.doc", Utf16("Budget review\r\n"), ROUTE_PLAIN_TEXT, L".txt");
+   SAMPLE("word-named.xls", Ole(1, std::vector<std::string>(1, "WordDocument")), ROUTE_BY_CONTENT, L".doc");
+   SAMPLE("docx-named.doc", Zip(docx), ROUTE_BY_CONTENT, L".docx");
+   SAMPLE("ATT00001", Text(mail), ROUTE_BY_CONTENT, L".eml");
+   SAMPLE("note-from", Text(note), ROUTE_PLAIN_TEXT, L".txt");
+   SAMPLE("pdf-named.txt", Text("%PDF-1.4\n1 0 obj\n"), ROUTE_BY_CONTENT, L".pdf");
+   SAMPLE("drawing.vsd", Ole(1, std::vector<std::string>(1, "VisioDocument")), ROUTE_BY_EXTENSION, L".vsd");
+
+#undef SAMPLE
+
+   return samples;
+}
+
+static bool WriteFile(const std::string & path, const Bytes & bytes)
+{
+   int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+   if (fd < 0)
+      return false;
+
+   bool ok = write(fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size());
+   close(fd);
+   return ok;
+}
+
+static ContentFormat SniffPath(const char *path)
+{
+   int fd = open(path, O_RDONLY);
+
+   if (fd < 0)
+      return FORMAT_UNKNOWN;
+
+   struct stat st;
+   ContentFormat format = FORMAT_UNKNOWN;
+
+   if (0 == fstat(fd, &st))
+   {
+      FileReader reader(fd);
+      format = SniffContent(reader, static_cast<unsigned long long>(st.st_size));
+   }
+
+   close(fd);
+   return format;
+}
+
+static double Ns(Clock::time_point from, Clock::time_point to, size_t count)
+{
+   return std::chrono::duration<double, std::nano>(to - from).count() / count;
+}
+
+// The tree scan, counts per sniffed format.
+static size_t s_scanned;
+static size_t s_formats[FORMAT_TEXT_ANSI + 1];
+
+static int ScanEntry(const char *path, const struct stat *st, int type, struct FTW *)
+{
+   if (FTW_F == type && S_ISREG(st->st_mode))
+   {
+      ++s_formats[SniffPath(path)];
+      ++s_scanned;
+   }
+
+   return 0;
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: sniffbench [options]\n"
+      "  -d DIR  scratch directory for the samples (default: /tmp)\n"
+      "  -n N    sniffs per sample for the timings (default: 20000)\n"
+      "  -r DIR  also sniff every regular file under DIR\n");
+}
+
+int main(int argc, char *argv[])
+{
+   std::string scratch = "/tmp";
+   size_t rounds = 20000;
+   const char *tree = NULL;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "d:n:r:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'd': scratch = optarg; break;
+         case 'n': rounds = static_cast<size_t>(strtoul(optarg, NULL, 10)); break;
+         case 'r': tree = optarg; break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   if (!rounds)
+      rounds = 1;
+
+   std::string dir = scratch + "/sniffbench.XXXXXX";
+
+   if (!mkdtemp(&dir[0]))
+   {
+      perror("mkdtemp");
+      return 1;
+   }
+
+   std::vector<Sample> samples = Samples();
+   std::vector<std::string> paths;
+   int failures = 0;
+
+   printf("%-16s %-11s %-11s %-6s\n", "file", "format", "route", "via");
+
+   for (size_t i = 0; i < samples.size(); ++i)
+   {
+      std::string path = dir + "/" + samples[i].name;
+
+      if (!WriteFile(path, samples[i].bytes))
+      {
+         perror(path.c_str());
+         return 1;
+      }
+
+      paths.push_back(path);
+
+      ContentFormat format = SniffPath(path.c_str());
+      std::wstring routeExtension;
+      ContentRoute route = ChooseRoute(Extension(samples[i].name), format, routeExtension);
+      bool ok = route == samples[i].route && routeExtension == samples[i].routeExtension;
+
+      printf("%-16s %-11s %-11s %-6s%s\n", samples[i].name.c_str(), FormatName(format), RouteName(route),
+             Narrow(routeExtension).c_str(), ok ? "" : "  MISMATCH");
+
+      if (!ok)
+         ++failures;
+   }
+
+   // from memory: the tries and the container walks alone
+   volatile int sink = 0;
+   Clock::time_point start = Clock::now();
+
+   for (size_t round = 0; round < rounds; ++round)
+   {
+      for (size_t i = 0; i < samples.size(); ++i)
+      {
+         const Bytes & bytes = samples[i].bytes;
+         sink += SniffBuffer(bytes.data(), bytes.size() < c_sniffBytes ? bytes.size() : c_sniffBytes);
+      }
+   }
+
+   double memoryNs = Ns(start, Clock::now(), rounds * samples.size());
+
+   // through the file: open, fstat, pread of the head (and the directory of
+   // a compound file), close, from the page cache
+   size_t fileRounds = rounds / 10 ? rounds / 10 : 1;
+   start = Clock::now();
+
+   for (size_t round = 0; round < fileRounds; ++round)
+   {
+      for (size_t i = 0; i < paths.size(); ++i)
+         sink += SniffPath(paths[i].c_str());
+   }
+
+   double fileNs = Ns(start, Clock::now(), fileRounds * paths.size());
+
+   printf("\nsniff from memory  %8.0f ns\nsniff from file    %8.0f ns  (open, pread, close)\n", memoryNs, fileNs);
+
+   if (tree)
+   {
+      start = Clock::now();
+      nftw(tree, ScanEntry, 32, FTW_PHYS);
+      double scanNs = s_scanned ? Ns(start, Clock::now(), s_scanned) : 0;
+
+      printf("\n%zu files under %s, %.0f ns each\n", s_scanned, tree, scanNs);
+
+      for (size_t i = 0; i <= FORMAT_TEXT_ANSI; ++i)
+      {
+         if (s_formats[i])
+            printf("   %-11s %zu\n", FormatName(static_cast<ContentFormat>(i)), s_formats[i]);
+      }
+   }
+
+   for (size_t i = 0; i < paths.size(); ++i)
+      unlink(paths[i].c_str());
+
+   rmdir(dir.c_str());
+
+   if (failures)
+      printf("\n%d samples routed wrongly\n", failures);
+
+   return failures ? 1 : 0;
+}
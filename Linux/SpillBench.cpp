@@ -0,0 +1,604 @@
+// SpillBench.cpp : Feeds SpillSink gigabytes of generated text and checks that
+//                  resident memory stays flat once it spills, on Linux.
+//
+// The checks, run first with small thresholds, fail the tool if any of them
+// doesn't hold:
+//  - the sink keeps the text in memory up to the threshold and spills on the
+//    first buffer that takes it past, not before
+//  - the temp file holds the text as UTF-16LE, characters past U+FFFF (a
+//    wchar_t is 32 bits here) as surrogate pairs, whether they came before
+//    the spill and were moved over or came after, and Length() counts them
+//    as two
+//  - a surrogate pair split by the end of a mapped window reads back whole
+//  - maxLength stops the text a buffer or so past it, spilled or not
+//  - the temp file goes away with the sink unless DetachPath took it
+//
+// Then it streams the generated text through the sink in 4096-character
+// buffers, the way the extraction loop does, sampling the resident set
+// about every MB. It prints the most it reached every 512 MB, fails if the
+// resident set after the spill grows past a couple of mapped windows over
+// where it started, and reads the file back against the generator.
+//
+// The temp files go to a directory of their own under $TMPDIR, which needs
+// room for the whole text (-g GB of UTF-16).
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o spillbench SpillBench.cpp ../SpillText.cpp
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "SpillText.h"
+
+static const size_t c_bufferChars = 4096;
+static const size_t c_windowBytes = 16 * 1024 * 1024;   // SpillText.cpp maps the file this much at a time
+
+// Generated text: words of ASCII, Latin-1 and CJK with spaces between, and
+// now and then an emoji past U+FFFF. The same seed gives the same text.
+class TextStream
+{
+public:
+   explicit TextStream(unsigned long long seed) : m_state(seed | 1), m_units(0) {}
+
+   void Next(wchar_t *text, size_t cch)
+   {
+      for (size_t i = 0; i < cch; ++i)
+      {
+         m_state ^= m_state << 13;
+         m_state ^= m_state >> 7;
+         m_state ^= m_state << 17;
+         unsigned long r = static_cast<unsigned long>(m_state >> 24);
+
+         switch (r % 64)
+         {
+            case 0:           text[i] = static_cast<wchar_t>(0x1F600 + (r >> 6) % 80); break;
+            case 1:  case 2:  text[i] = static_cast<wchar_t>(0x4E00 + (r >> 6) % 0x5000); break;
+            case 3:           text[i] = static_cast<wchar_t>(0xC0 + (r >> 6) % 0x40); break;
+            case 4:  case 5:
+            case 6:  case 7:  text[i] = L' '; break;
+            default:          text[i] = static_cast<wchar_t>(L'a' + (r >> 6) % 26); break;
+         }
+
+         m_units += text[i] > 0xFFFF ? 2 : 1;
+      }
+   }
+
+   // UTF-16 code units handed out so far.
+   unsigned long long Units() const { return m_units; }
+
+private:
+   unsigned long long m_state;
+   unsigned long long m_units;
+};
+
+static void AppendUtf16(const wchar_t *text, size_t cch, std::vector<unsigned char> & bytes)
+{
+   for (size_t i = 0; i < cch; ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(text[i]);
+      unsigned long units[2] = { c, 0 };
+      int n = 1;
+
+      if (c > 0xFFFF)
+      {
+         units[0] = 0xD800 + ((c - 0x10000) >> 10);
+         units[1] = 0xDC00 + ((c - 0x10000) & 0x3FF);
+         n = 2;
+      }
+
+      for (int u = 0; u < n; ++u)
+      {
+         bytes.push_back(static_cast<unsigned char>(units[u]));
+         bytes.push_back(static_cast<unsigned char>(units[u] >> 8));
+      }
+   }
+}
+
+// Reads a file front to back in large blocks, for comparing against text
+// that is generated again as it goes.
+class FileReader
+{
+public:
+   explicit FileReader(const std::string & path) : m_buffer(1024 * 1024), m_start(0), m_end(0), m_offset(0)
+   {
+      m_fd = open(path.c_str(), O_RDONLY);
+   }
+
+   ~FileReader()
+   {
+      if (m_fd >= 0)
+         close(m_fd);
+   }
+
+   bool IsOpen() const { return m_fd >= 0; }
+
+   // Compares the next bytes of the file; false if they differ or it ends,
+   // Offset() is then where the first difference is.
+   bool Compare(const unsigned char *expected, size_t cb)
+   {
+      while (cb)
+      {
+         if (m_start == m_end)
+         {
+            ssize_t got = read(m_fd, &m_buffer[0], m_buffer.size());
+
+            if (got <= 0)
+               return false;
+
+            m_start = 0;
+            m_end = static_cast<size_t>(got);
+         }
+
+         size_t piece = std::min(cb, m_end - m_start);
+
+         for (size_t i = 0; i < piece; ++i)
+         {
+            if (m_buffer[m_start + i] != expected[i])
+            {
+               m_offset += i;
+               return false;
+            }
+         }
+
+         m_start += piece;
+         m_offset += piece;
+         expected += piece;
+         cb -= piece;
+      }
+
+      return true;
+   }
+
+   // Nothing left to read.
+   bool AtEnd()
+   {
+      char c;
+      return m_start == m_end && 0 == read(m_fd, &c, 1);
+   }
+
+   unsigned long long Offset() const { return m_offset; }
+
+private:
+   int m_fd;
+   std::vector<unsigned char> m_buffer;
+   size_t m_start;
+   size_t m_end;
+   unsigned long long m_offset;
+};
+
+static unsigned long long FileSize(const std::string & path)
+{
+   struct stat st;
+   return 0 == stat(path.c_str(), &st) ? static_cast<unsigned long long>(st.st_size) : ~0ULL;
+}
+
+static size_t FilesIn(const std::string & directory)
+{
+   size_t files = 0;
+   DIR *dir = opendir(directory.c_str());
+
+   if (NULL == dir)
+      return 0;
+
+   while (struct dirent *entry = readdir(dir))
+   {
+      if (0 != strcmp(entry->d_name, ".") && 0 != strcmp(entry->d_name, ".."))
+         ++files;
+   }
+
+   closedir(dir);
+   return files;
+}
+
+// Resident set in bytes, from /proc.
+static unsigned long long ResidentBytes()
+{
+   unsigned long long pages = 0;
+   unsigned long long resident = 0;
+   FILE *statm = fopen("/proc/self/statm", "r");
+
+   if (statm)
+   {
+      if (2 != fscanf(statm, "%llu %llu", &pages, &resident))
+         resident = 0;
+
+      fclose(statm);
+   }
+
+   return resident * static_cast<unsigned long long>(sysconf(_SC_PAGESIZE));
+}
+
+static int Failed(const char *check, const char *what)
+{
+   printf("%-22s %s\n", check, what);
+   return 1;
+}
+
+// Checks the detached file holds exactly the UTF-16LE bytes expected, and
+// deletes it.
+static int CheckFile(const char *check, SpillSink & sink, const std::vector<unsigned char> & expected)
+{
+   std::string path = sink.DetachPath();
+
+   if (path.empty())
+      return Failed(check, "no temp file to detach");
+
+   int failures = 0;
+
+   {
+      FileReader file(path);
+
+      if (!file.IsOpen() || (!expected.empty() && !file.Compare(&expected[0], expected.size())) || !file.AtEnd())
+      {
+         printf("%-22s the temp file differs from the text at byte %llu\n", check, file.Offset());
+         ++failures;
+      }
+   }
+
+   if (!failures && sink.Length() * 2 != expected.size())
+   {
+      printf("%-22s Length() is %llu, the file holds %lu units\n", check, sink.Length(),
+             static_cast<unsigned long>(expected.size() / 2));
+      ++failures;
+   }
+
+   unlink(path.c_str());
+   return failures;
+}
+
+// Runs the checks with small thresholds; returns the number of failures.
+static int CheckEdges(const std::string & directory)
+{
+   int failures = 0;
+   std::vector<wchar_t> buffer(c_bufferChars);
+
+   // spills on the first buffer past the threshold, with surrogates on both sides of it
+   {
+      const unsigned long long threshold = 10 * c_bufferChars * sizeof(wchar_t) + 100;
+      SpillSink sink(0, threshold);
+      TextStream stream(1);
+      std::vector<unsigned char> expected;
+      int failuresBefore = failures;
+
+      for (size_t n = 1; n <= 20; ++n)
+      {
+         stream.Next(&buffer[0], c_bufferChars);
+         AppendUtf16(&buffer[0], c_bufferChars, expected);
+         sink.OnText(&buffer[0], c_bufferChars);
+
+         bool past = n * c_bufferChars * sizeof(wchar_t) > threshold;
+
+         if (sink.Spilled() != past)
+         {
+            printf("%-22s spilled is %d after %lu buffers\n", "threshold", sink.Spilled(), static_cast<unsigned long>(n));
+            ++failures;
+            break;
+         }
+
+         if (!past && sink.Length() != n * c_bufferChars)
+         {
+            failures += Failed("threshold", "Length() doesn't count the characters in memory");
+            break;
+         }
+      }
+
+      sink.OnEnd();
+
+      if (sink.Failed())
+         failures += Failed("threshold", "the temp file failed");
+      else
+         failures += CheckFile("threshold", sink, expected);
+
+      if (failuresBefore == failures && stream.Units() == 20 * c_bufferChars)
+         failures += Failed("threshold", "no characters past U+FFFF were fed");
+   }
+
+   // exactly at the threshold stays in memory, one more character spills
+   {
+      const size_t cch = 3 * c_bufferChars;
+      SpillSink sink(0, cch * sizeof(wchar_t));
+      std::wstring text(cch, L'x');
+      text[cch / 2] = static_cast<wchar_t>(0x10348);
+
+      sink.OnText(text.data(), text.length());
+
+      if (sink.Spilled() || sink.Text() != text || sink.Length() != cch)
+         failures += Failed("at the threshold", "the text doesn't stay in memory");
+
+      const wchar_t more[] = { static_cast<wchar_t>(0x1F600) };
+      sink.OnText(more, 1);
+      sink.OnEnd();
+
+      std::vector<unsigned char> expected;
+      AppendUtf16(text.data(), text.length(), expected);
+      AppendUtf16(more, 1, expected);
+
+      if (!sink.Spilled() || !sink.Text().empty())
+         failures += Failed("at the threshold", "one character more doesn't spill");
+      else
+         failures += CheckFile("at the threshold", sink, expected);
+   }
+
+   // a surrogate pair across the end of the first mapped window
+   {
+      SpillSink sink(0, 0);
+      std::vector<unsigned char> expected;
+      std::wstring text(c_bufferChars, L'a');
+      size_t before = c_windowBytes / 2 - 1;
+
+      for (size_t done = 0; done < before; done += c_bufferChars)
+         sink.OnText(text.data(), std::min(c_bufferChars, before - done));
+
+      expected.assign(before * 2, 0);
+
+      for (size_t i = 0; i < expected.size(); i += 2)
+         expected[i] = 'a';
+
+      const wchar_t tail[] = { static_cast<wchar_t>(0x1F600), L'b', static_cast<wchar_t>(0x10FFFF) };
+      sink.OnText(tail, 3);
+      AppendUtf16(tail, 3, expected);
+      sink.OnEnd();
+
+      if (expected[c_windowBytes - 2] != 0x3D || expected[c_windowBytes - 1] != 0xD8 || expected[c_windowBytes] != 0x00 ||
+          expected[c_windowBytes + 1] != 0xDE)
+         failures += Failed("window boundary", "the pair isn't where it should be");
+      else if (sink.Failed())
+         failures += Failed("window boundary", "the temp file failed");
+      else
+         failures += CheckFile("window boundary", sink, expected);
+   }
+
+   // maxLength, in characters before the spill and in UTF-16 units after it
+   static const struct
+   {
+      unsigned long long maxLength;
+      unsigned long long threshold;
+      bool spills;
+   } c_limits[] = { { 5000, 1 << 20, false }, { 5000, 100, true }, { 50000, 30000, true } };
+
+   for (size_t l = 0; l < sizeof(c_limits) / sizeof(c_limits[0]); ++l)
+   {
+      SpillSink sink(c_limits[l].maxLength, c_limits[l].threshold);
+      TextStream stream(2);
+      std::vector<unsigned char> expected;
+      std::wstring text;
+
+      for (size_t n = 0; n < 100 && sink.WantsMore(); ++n)
+      {
+         stream.Next(&buffer[0], c_bufferChars);
+         AppendUtf16(&buffer[0], c_bufferChars, expected);
+         text.append(&buffer[0], c_bufferChars);
+         sink.OnText(&buffer[0], c_bufferChars);
+      }
+
+      sink.OnEnd();
+
+      char check[32];
+      snprintf(check, sizeof(check), "maxLength %llu", c_limits[l].maxLength);
+
+      if (!sink.Truncated() || sink.WantsMore() || sink.Length() <= c_limits[l].maxLength ||
+          sink.Length() > c_limits[l].maxLength + 2 * c_bufferChars)
+      {
+         printf("%-22s Length() is %llu, truncated %d\n", check, sink.Length(), sink.Truncated());
+         ++failures;
+      }
+      else if (sink.Spilled() != c_limits[l].spills)
+      {
+         failures += Failed(check, c_limits[l].spills ? "doesn't spill" : "spills");
+      }
+      else if (!sink.Spilled())
+      {
+         if (sink.Text() != text || !sink.DetachPath().empty())
+            failures += Failed(check, "the text in memory differs");
+      }
+      else
+      {
+         failures += CheckFile(check, sink, expected);
+      }
+   }
+
+   // a sink dropped without DetachPath takes its file with it
+   {
+      SpillSink *sink = new SpillSink(0, 0);
+      std::wstring text(1000, L'z');
+      sink->OnText(text.data(), text.length());
+
+      if (1 != FilesIn(directory))
+         failures += Failed("dropped", "no temp file while spilled");
+
+      sink->OnEnd();
+      delete sink;
+
+      if (0 != FilesIn(directory))
+         failures += Failed("dropped", "the temp file outlives the sink");
+   }
+
+   return failures;
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned long long gigabytes = 4;
+   unsigned long long thresholdMB = 64;
+   bool verify = true;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "g:t:nh")) != -1)
+   {
+      switch (opt)
+      {
+         case 'g': gigabytes = strtoull(optarg, NULL, 10); break;
+         case 't': thresholdMB = strtoull(optarg, NULL, 10); break;
+         case 'n': verify = false; break;
+
+         default:
+            fprintf(stderr,
+               "usage: spillbench [options]\n"
+               "  -g GB     text to feed, in GB of UTF-16 (default: 4)\n"
+               "  -t MB     memory threshold before the sink spills (default: 64)\n"
+               "  -n        don't read the temp file back against the text\n");
+            return 2;
+      }
+   }
+
+   if (0 == gigabytes)
+      gigabytes = 1;
+
+   const char *tmp = getenv("TMPDIR");
+   std::string directory = std::string(tmp && *tmp ? tmp : "/tmp") + "/spillbenchXXXXXX";
+
+   if (NULL == mkdtemp(&directory[0]))
+   {
+      perror("mkdtemp");
+      return 1;
+   }
+
+   // SpillSink makes its temp files under $TMPDIR, so the checks can count them
+   setenv("TMPDIR", directory.c_str(), 1);
+
+   int failures = CheckEdges(directory);
+
+   if (failures)
+   {
+      rmdir(directory.c_str());
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   printf("spills past the threshold, surrogates and windows read back, maxLength holds, the temp file goes away\n\n");
+
+   const unsigned long long target = gigabytes * 1024 * 1024 * 1024 / 2;   // UTF-16 units
+   const unsigned long long threshold = thresholdMB * 1024 * 1024;
+   const unsigned long long printUnits = 256ULL * 1024 * 1024;
+
+   unsigned long long startRss = ResidentBytes();
+   unsigned long long spillRss = 0;     // just after the spill
+   unsigned long long peakRss = 0;      // the most after it
+   unsigned long long peakBefore = 0;   // the most before it
+
+   std::vector<wchar_t> buffer(c_bufferChars);
+   TextStream stream(3);
+   SpillSink sink(0, threshold);
+
+   printf("%10s %14s %10s\n", "fed MB", "most resident", "MB/s");
+
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   std::chrono::steady_clock::time_point last = start;
+   unsigned long long lastUnits = 0;
+   unsigned long long nextPrint = printUnits;
+   unsigned long long printPeak = 0;
+
+   for (size_t n = 0; stream.Units() < target; ++n)
+   {
+      bool wasSpilled = sink.Spilled();
+
+      stream.Next(&buffer[0], c_bufferChars);
+      sink.OnText(&buffer[0], c_bufferChars);
+
+      // every buffer up to the spill, then about every MB, so the samples
+      // don't all land where a window has just been mapped
+      if (!wasSpilled || 0 == n % 127)
+      {
+         unsigned long long rss = ResidentBytes();
+         printPeak = std::max(printPeak, rss);
+
+         if (wasSpilled)
+            peakRss = std::max(peakRss, rss);
+         else if (sink.Spilled())
+            spillRss = rss;
+         else
+            peakBefore = std::max(peakBefore, rss);
+      }
+
+      if (stream.Units() >= nextPrint || stream.Units() >= target)
+      {
+         std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+         double seconds = std::chrono::duration<double>(now - last).count();
+
+         printf("%10llu %14.1f %10.0f\n", stream.Units() * 2 >> 20, printPeak / 1048576.0,
+                (stream.Units() - lastUnits) * 2 / 1048576.0 / seconds);
+
+         last = now;
+         lastUnits = stream.Units();
+         nextPrint += printUnits;
+         printPeak = 0;
+      }
+   }
+
+   sink.OnEnd();
+
+   double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+   if (sink.Failed())
+   {
+      printf("the temp file failed: %s\n", strerror(static_cast<int>(sink.Error())));
+      rmdir(directory.c_str());
+      return 1;
+   }
+
+   std::string path = sink.DetachPath();
+
+   printf("\n%llu MB in %.1f s, %.0f MB/s\n", stream.Units() * 2 >> 20, seconds, stream.Units() * 2 / 1048576.0 / seconds);
+   printf("resident: %.1f MB at the start, %.1f MB before the spill, %.1f MB after it, %.1f MB at most after it\n",
+          startRss / 1048576.0, peakBefore / 1048576.0, spillRss / 1048576.0, peakRss / 1048576.0);
+
+   if (path.empty() || sink.Length() != stream.Units() || FileSize(path) != stream.Units() * 2)
+   {
+      printf("the temp file doesn't hold the %llu units fed\n", stream.Units());
+      ++failures;
+   }
+
+   // flat: the text in memory went back, only a window or two is mapped
+   if (peakRss > spillRss + 2 * c_windowBytes || peakRss > startRss + 3 * c_windowBytes)
+   {
+      printf("the resident set grows after the spill\n");
+      ++failures;
+   }
+
+   if (verify && !path.empty() && !failures)
+   {
+      FileReader file(path);
+      TextStream again(3);
+      std::vector<unsigned char> expected;
+
+      while (again.Units() < stream.Units())
+      {
+         again.Next(&buffer[0], c_bufferChars);
+         expected.clear();
+         AppendUtf16(&buffer[0], c_bufferChars, expected);
+
+         if (!file.Compare(&expected[0], expected.size()))
+         {
+            printf("the temp file differs from the text at byte %llu\n", file.Offset());
+            ++failures;
+            break;
+         }
+      }
+
+      if (!failures)
+         printf("the temp file reads back as the text fed\n");
+   }
+
+   if (!path.empty())
+      unlink(path.c_str());
+
+   rmdir(directory.c_str());
+
+   if (failures)
+   {
+      printf("MISMATCH: %d\n", failures);
+      return 1;
+   }
+
+   return 0;
+}
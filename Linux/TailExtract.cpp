@@ -0,0 +1,292 @@
+// TailExtract.cpp : Incremental extractor for append-only text files on Linux.
+//
+// Keeps a state file with one line per extracted file (path, tab, state
+// token). Each run checks that every file still starts with what was seen
+// last time, then extracts only the bytes appended since, and writes one NDJSON
+// record per file:
+//
+//    {"path":"...","text":"...","status":"delta","offset":1234,"length":56}
+//
+// status is delta (text is what was appended), restarted (the file was
+// rewritten or truncated, text is all of it), unsupported (not text) or error.
+// Bytes decoded and MB/sec are reported on stderr at the end, so the cost of
+// a run can be checked against the size of the change. The text is written
+// out as it's decoded, so the first run over a multi-GB file doesn't have to
+// hold all of it.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -I.. -o tailextract TailExtract.cpp ../AppendText.cpp ../TokenText.cpp ../PlainText.cpp ../TextCleanup.cpp
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "AppendText.h"
+#include "Ndjson.h"
+
+class FileReader : public ByteReader
+{
+public:
+   explicit FileReader(int fd) : m_fd(fd), m_bytesRead(0) {}
+
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb)
+   {
+      while (cb)
+      {
+         ssize_t n = pread(m_fd, buf, cb, static_cast<off_t>(offset));
+
+         if (n < 0 && EINTR == errno)
+            continue;
+
+         if (n <= 0)
+            return false;
+
+         buf += n;
+         cb -= n;
+         offset += n;
+         m_bytesRead += n;
+      }
+
+      return true;
+   }
+
+   unsigned long long BytesRead() const { return m_bytesRead; }
+
+private:
+   int m_fd;
+   unsigned long long m_bytesRead;
+};
+
+// Writes the text straight into the record's "text" value.
+class JsonTextSink : public TextSink
+{
+public:
+   explicit JsonTextSink(FILE *out) : m_out(out), m_length(0) {}
+
+   virtual void OnText(const wchar_t *text, size_t cch)
+   {
+      AppendJsonCharacters(m_buffer, text, cch);
+      m_length += cch;
+
+      if (m_buffer.size() >= 65536)
+         Flush();
+   }
+
+   void Flush()
+   {
+      fwrite(m_buffer.data(), 1, m_buffer.size(), m_out);
+      m_buffer.clear();
+   }
+
+   unsigned long long Length() const { return m_length; }
+
+private:
+   FILE *m_out;
+   std::string m_buffer;
+   unsigned long long m_length;
+};
+
+static std::wstring Widen(const std::string & s)
+{
+   return std::wstring(s.begin(), s.end());
+}
+
+static std::string Narrow(const std::wstring & s)
+{
+   // tokens are plain ASCII
+   return std::string(s.begin(), s.end());
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: tailextract -s STATEFILE [options] file...\n"
+      "  -s FILE   where the state of each file is kept between runs\n"
+      "  -p NAME   folding profile: display, index or compact (default: display)\n"
+      "  -o FILE   write the NDJSON records to FILE instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+   const char *stateName = NULL;
+   const char *outName = NULL;
+   CleanupProfile profile = CLEANUP_DISPLAY;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "s:p:o:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 's':
+            stateName = optarg;
+            break;
+
+         case 'p':
+            if (0 == strcmp(optarg, "display"))
+               profile = CLEANUP_DISPLAY;
+            else if (0 == strcmp(optarg, "index"))
+               profile = CLEANUP_INDEX;
+            else if (0 == strcmp(optarg, "compact"))
+               profile = CLEANUP_COMPACT;
+            else
+            {
+               Usage();
+               return 2;
+            }
+            break;
+
+         case 'o':
+            outName = optarg;
+            break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   if (NULL == stateName || optind == argc)
+   {
+      Usage();
+      return 2;
+   }
+
+   std::map<std::string, std::string> states;
+
+   {
+      std::ifstream stateFile(stateName);
+      std::string line;
+
+      while (std::getline(stateFile, line))
+      {
+         size_t tab = line.rfind('\t');
+
+         if (tab != std::string::npos)
+            states[line.substr(0, tab)] = line.substr(tab + 1);
+      }
+   }
+
+   FILE *out = stdout;
+
+   if (outName && NULL == (out = fopen(outName, "w")))
+   {
+      fprintf(stderr, "tailextract: can't create %s: %s\n", outName, strerror(errno));
+      return 2;
+   }
+
+   unsigned long long bytesRead = 0;
+   unsigned long long bytesDecoded = 0;
+   int failures = 0;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   for (int i = optind; i < argc; ++i)
+   {
+      std::string path = argv[i];
+      std::string record = "{\"path\":";
+      AppendJsonString(record, path);
+
+      AppendState state;
+      std::wstring token = Widen(states[path]);
+
+      if (!DecodeAppendState(token.data(), token.length(), state))
+         InitAppendState(state, profile);
+
+      unsigned long long before = state.offset;
+      int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat st;
+
+      if (fd < 0 || fstat(fd, &st) != 0)
+      {
+         record += ",\"status\":\"error\",\"error\":";
+         AppendJsonString(record, std::string(strerror(errno)));
+         ++failures;
+      }
+      else
+      {
+         // the text goes out as it's decoded, the status and lengths
+         // follow once they're known
+         FileReader reader(fd);
+         record += ",\"text\":\"";
+         fwrite(record.data(), 1, record.size(), out);
+
+         JsonTextSink sink(out);
+         AppendResult result = ExtractAppendedText(reader, static_cast<unsigned long long>(st.st_size), profile, state, sink);
+         sink.Flush();
+
+         bytesRead += reader.BytesRead();
+         record = "\"";
+
+         switch (result)
+         {
+            case APPEND_DELTA:
+            case APPEND_RESTARTED:
+               bytesDecoded += state.offset - (APPEND_DELTA == result ? before : 0);
+               record += APPEND_DELTA == result ? ",\"status\":\"delta\"" : ",\"status\":\"restarted\"";
+               record += ",\"offset\":" + std::to_string(state.offset);
+               record += ",\"length\":" + std::to_string(sink.Length());
+               states[path] = Narrow(EncodeAppendState(state));
+               break;
+
+            case APPEND_NOT_TEXT:
+               record += ",\"status\":\"unsupported\"";
+               break;
+
+            default:
+               record += ",\"status\":\"error\",\"error\":\"read failed\"";
+               ++failures;
+               break;
+         }
+      }
+
+      if (fd >= 0)
+         close(fd);
+
+      record += "}\n";
+      fwrite(record.data(), 1, record.size(), out);
+   }
+
+   if (out != stdout)
+      fclose(out);
+
+   // write the new states next to the old file and swap them in
+   std::string tempName = std::string(stateName) + ".tmp";
+
+   {
+      std::ofstream stateFile(tempName.c_str(), std::ios::trunc);
+
+      for (std::map<std::string, std::string>::const_iterator it = states.begin(); it != states.end(); ++it)
+      {
+         if (!it->second.empty())
+            stateFile << it->first << '\t' << it->second << '\n';
+      }
+
+      if (!stateFile)
+      {
+         fprintf(stderr, "tailextract: can't write %s\n", tempName.c_str());
+         return 2;
+      }
+   }
+
+   if (rename(tempName.c_str(), stateName) != 0)
+   {
+      fprintf(stderr, "tailextract: can't replace %s: %s\n", stateName, strerror(errno));
+      return 2;
+   }
+
+   double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+   fprintf(stderr, "tailextract: %d files, %llu bytes decoded, %llu bytes read, %.3f s, %.1f MB/sec\n",
+           argc - optind, bytesDecoded, bytesRead, seconds,
+           seconds > 0 ? bytesDecoded / seconds / 1e6 : 0.0);
+
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,1091 @@
+// WatchExtract.cpp : Watches directory trees and extracts files as they change, on Linux.
+//
+// Subscribes to inotify events for every directory under the given roots and
+// coalesces the burst of events a save or an append produces into one change
+// per file. Once a file has been quiet for the debounce time (or has kept
+// changing for the maximum delay) it goes to a bounded queue of extraction
+// workers, which run it through the built-in plain text path and the same
+// CleanUpCharacters folding as batchextract. With -a a file that was only
+// appended to gives up just the new text, as with tailextract. One NDJSON
+// record per change:
+//
+//    {"path":"...","status":"changed","length":1234,"text":"..."}
+//
+// status is changed, delta (-a, text is what was appended since the last
+// record), restarted (-a, the file was rewritten, text is all of it),
+// truncated (-m), unsupported (not text), deleted or error.
+//
+// The progress file keeps the size, mtime and append state of every file
+// extracted. At startup the trees are scanned against it, so only what
+// changed while the watcher was down is extracted again, and an inotify
+// queue overflow falls back to the same rescan.
+//
+// On exit (SIGINT, SIGTERM or -t) stderr gets the events read, the changes
+// extracted, the event-to-text latency (last event for a file to its record
+// being written) and the CPU time used. -c writes synthetic churn into the
+// first root to measure them under load; without it the watcher sleeps in
+// poll between events and the CPU time is the idle cost.
+//
+// Build with:
+//    g++ -std=c++11 -O2 -pthread -I.. -o watchextract WatchExtract.cpp ../AppendText.cpp ../TokenText.cpp ../PlainText.cpp ../TextCleanup.cpp
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "AppendText.h"
+#include "Ndjson.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned c_watchMask = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                    IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void OnSignal(int)
+{
+   s_stop = 1;
+}
+
+class FileReader : public ByteReader
+{
+public:
+   explicit FileReader(int fd) : m_fd(fd) {}
+
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb)
+   {
+      while (cb)
+      {
+         ssize_t n = pread(m_fd, buf, cb, static_cast<off_t>(offset));
+
+         if (n < 0 && EINTR == errno)
+            continue;
+
+         if (n <= 0)
+            return false;
+
+         buf += n;
+         cb -= n;
+         offset += n;
+      }
+
+      return true;
+   }
+
+private:
+   int m_fd;
+};
+
+// Builds the record's "text" value. Like TextBufferSink, it stops once it
+// holds more than maxLength (if non-zero) characters.
+class JsonTextSink : public TextSink
+{
+public:
+   explicit JsonTextSink(size_t maxLength) : m_maxLength(maxLength), m_length(0) {}
+
+   virtual void OnText(const wchar_t *text, size_t cch)
+   {
+      if (WantsMore())
+      {
+         AppendJsonCharacters(m_text, text, cch);
+         m_length += cch;
+      }
+   }
+
+   virtual bool WantsMore() const { return 0 == m_maxLength || m_length <= m_maxLength; }
+
+   const std::string & Text() const { return m_text; }
+   size_t Length() const { return m_length; }
+
+private:
+   size_t m_maxLength;
+   size_t m_length;
+   std::string m_text;
+};
+
+struct Progress
+{
+   unsigned long long size;
+   long long mtime;            // ns
+   std::string state;          // EncodeAppendState, empty for files that aren't text
+};
+
+static long long ModifiedNs(const struct stat & st)
+{
+   return static_cast<long long>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+struct Change
+{
+   std::string path;
+   Clock::time_point lastEvent;
+};
+
+// Changed files waiting for a worker. Bounded, so a burst of changes waits
+// in the watcher's coalescing map rather than here, and never hands out a
+// file that a worker is still extracting.
+class ChangeQueue
+{
+public:
+   enum PushResult { PUSHED, FULL, BUSY };
+
+   explicit ChangeQueue(size_t capacity) : m_capacity(capacity), m_closed(false) {}
+
+   PushResult TryPush(const Change & change)
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+
+      if (m_inFlight.count(change.path))
+         return BUSY;
+
+      if (m_items.size() >= m_capacity)
+         return FULL;
+
+      m_items.push_back(change);
+      m_inFlight.insert(change.path);
+      m_notEmpty.notify_one();
+      return PUSHED;
+   }
+
+   bool Pop(Change & change)
+   {
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_notEmpty.wait(lock, [this] { return !m_items.empty() || m_closed; });
+
+      if (m_items.empty())
+         return false;
+
+      change = m_items.front();
+      m_items.pop_front();
+      return true;
+   }
+
+   void Done(const std::string & path)
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_inFlight.erase(path);
+   }
+
+   bool Idle()
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      return m_inFlight.empty();
+   }
+
+   void Close()
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_closed = true;
+      m_notEmpty.notify_all();
+   }
+
+private:
+   size_t m_capacity;
+   bool m_closed;
+   std::deque<Change> m_items;
+   std::set<std::string> m_inFlight;     // queued or being extracted
+   std::mutex m_lock;
+   std::condition_variable m_notEmpty;
+};
+
+struct Options
+{
+   CleanupProfile profile;
+   bool appendMode;
+   size_t maxLength;
+   std::chrono::milliseconds debounce;
+   std::chrono::milliseconds maxDelay;
+};
+
+class Watcher
+{
+public:
+   Watcher(const Options & options, const std::string & progressName, FILE *out, size_t queueCapacity)
+      : m_options(options), m_progressName(progressName), m_out(out), m_fd(-1), m_queue(queueCapacity),
+        m_progressDirty(false), m_events(0), m_coalesced(0), m_extracted(0), m_unchanged(0), m_failed(0)
+   {
+   }
+
+   bool Start(const std::vector<std::string> & roots);
+   void Run(Clock::time_point stopAt);
+   void Work();
+   void Close() { m_queue.Close(); }
+   bool SaveProgress();
+   void Report(double seconds);
+
+private:
+   struct Pending
+   {
+      Clock::time_point first;
+      Clock::time_point last;
+   };
+
+   // Due times go on the heap once per pending file and are checked against
+   // the file's latest event when they come up, so an event costs a map
+   // update rather than a heap operation.
+   typedef std::pair<Clock::time_point, std::string> Due;
+
+   static int OnWalk(const char *path, const struct stat *st, int type, struct FTW *);
+
+   void Scan(bool forgetMissing);
+   void Walk(const std::string & dir, bool pendAll);
+   void ReadEvents(Clock::time_point now);
+   void Pend(const std::string & path, Clock::time_point now);
+   void Forget(const std::string & path);
+   void ForgetTree(const std::string & dir);
+   void Dispatch(Clock::time_point now);
+   Clock::time_point DueTime(const Pending & pending) const;
+   void Extract(const Change & change);
+   void Write(const std::string & record);
+
+   Options m_options;
+   std::string m_progressName;
+   FILE *m_out;
+   int m_fd;
+
+   std::vector<std::string> m_roots;
+   std::unordered_map<int, std::string> m_dirs;     // watch descriptor to directory
+
+   std::map<std::string, Pending> m_pending;
+   std::priority_queue<Due, std::vector<Due>, std::greater<Due> > m_due;
+   ChangeQueue m_queue;
+
+   std::mutex m_progressLock;
+   std::map<std::string, Progress> m_progress;
+   std::atomic<bool> m_progressDirty;
+
+   std::mutex m_outLock;
+
+   // set by the walk callback, which nftw gives no context
+   static Watcher *s_walker;
+   static bool s_pendAll;
+   static std::set<std::string> *s_seen;
+   Clock::time_point m_walkTime;
+
+   unsigned long long m_events;
+   unsigned long long m_coalesced;
+   std::atomic<unsigned long long> m_extracted;
+   std::atomic<unsigned long long> m_unchanged;
+   std::atomic<unsigned long long> m_failed;
+   std::mutex m_latencyLock;
+   std::vector<double> m_latencies;        // ms
+};
+
+Watcher *Watcher::s_walker = NULL;
+bool Watcher::s_pendAll = false;
+std::set<std::string> *Watcher::s_seen = NULL;
+
+bool Watcher::Start(const std::vector<std::string> & roots)
+{
+   m_roots = roots;
+
+   {
+      std::ifstream progressFile(m_progressName.c_str());
+      std::string line;
+
+      // path, size, mtime and state, separated by tabs, parsed from the right
+      while (std::getline(progressFile, line))
+      {
+         size_t third = line.rfind('\t');
+         size_t second = third == std::string::npos || 0 == third ? std::string::npos : line.rfind('\t', third - 1);
+         size_t first = second == std::string::npos || 0 == second ? std::string::npos : line.rfind('\t', second - 1);
+
+         if (first == std::string::npos)
+            continue;
+
+         Progress progress;
+         progress.size = strtoull(line.c_str() + first + 1, NULL, 10);
+         progress.mtime = strtoll(line.c_str() + second + 1, NULL, 10);
+         progress.state = line.substr(third + 1);
+         m_progress[line.substr(0, first)] = progress;
+      }
+   }
+
+   m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+   if (m_fd < 0)
+   {
+      fprintf(stderr, "watchextract: can't start inotify: %s\n", strerror(errno));
+      return false;
+   }
+
+   Scan(true);
+   return true;
+}
+
+// Watches every directory under the roots and pends the files that differ
+// from their progress. With forgetMissing, files in the progress that are
+// no longer there are reported deleted.
+void Watcher::Scan(bool forgetMissing)
+{
+   std::set<std::string> seen;
+   s_seen = &seen;
+
+   for (size_t i = 0; i < m_roots.size(); ++i)
+      Walk(m_roots[i], false);
+
+   s_seen = NULL;
+
+   if (!forgetMissing)
+      return;
+
+   std::vector<std::string> missing;
+
+   {
+      std::lock_guard<std::mutex> lock(m_progressLock);
+
+      for (std::map<std::string, Progress>::const_iterator it = m_progress.begin(); it != m_progress.end(); ++it)
+      {
+         if (!seen.count(it->first))
+            missing.push_back(it->first);
+      }
+   }
+
+   for (size_t i = 0; i < missing.size(); ++i)
+      Forget(missing[i]);
+}
+
+void Watcher::Walk(const std::string & dir, bool pendAll)
+{
+   s_walker = this;
+   s_pendAll = pendAll;
+   m_walkTime = Clock::now();
+
+   if (nftw(dir.c_str(), OnWalk, 64, FTW_PHYS) != 0)
+      fprintf(stderr, "watchextract: can't walk %s: %s\n", dir.c_str(), strerror(errno));
+}
+
+int Watcher::OnWalk(const char *path, const struct stat *st, int type, struct FTW *)
+{
+   Watcher *watcher = s_walker;
+
+   if (FTW_D == type)
+   {
+      int wd = inotify_add_watch(watcher->m_fd, path, c_watchMask);
+
+      if (wd < 0)
+         fprintf(stderr, "watchextract: can't watch %s: %s\n", path, strerror(errno));
+      else
+         watcher->m_dirs[wd] = path;
+   }
+   else if (FTW_F == type && S_ISREG(st->st_mode))
+   {
+      if (s_seen)
+         s_seen->insert(path);
+
+      bool changed = s_pendAll;
+
+      if (!changed)
+      {
+         std::lock_guard<std::mutex> lock(watcher->m_progressLock);
+         std::map<std::string, Progress>::const_iterator it = watcher->m_progress.find(path);
+
+         changed = it == watcher->m_progress.end() ||
+                   it->second.size != static_cast<unsigned long long>(st->st_size) || it->second.mtime != ModifiedNs(*st);
+      }
+
+      if (changed)
+         watcher->Pend(path, watcher->m_walkTime);
+   }
+
+   return 0;
+}
+
+void Watcher::Run(Clock::time_point stopAt)
+{
+   const std::chrono::seconds flushInterval(5);
+   Clock::time_point nextFlush = Clock::now() + flushInterval;
+
+   while (!s_stop)
+   {
+      Clock::time_point now = Clock::now();
+
+      if (now >= stopAt)
+         break;
+
+      Dispatch(now);
+
+      if (m_progressDirty && now >= nextFlush)
+      {
+         SaveProgress();
+         nextFlush = now + flushInterval;
+      }
+
+      // sleep until the next file falls due, and for good when there is
+      // nothing to do: no pending files, nothing in flight, progress saved
+      Clock::time_point wake = stopAt;
+
+      if (!m_due.empty())
+         wake = std::min(wake, m_due.top().first);
+
+      if (m_progressDirty || !m_queue.Idle())
+         wake = std::min(wake, nextFlush);
+
+      int timeout = -1;
+
+      if (wake != Clock::time_point::max())
+      {
+         long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1;
+         timeout = static_cast<int>(std::max(0LL, std::min(ms, 3600000LL)));
+      }
+
+      struct pollfd pfd;
+      pfd.fd = m_fd;
+      pfd.events = POLLIN;
+
+      int ready = poll(&pfd, 1, timeout);
+
+      if (ready < 0 && EINTR != errno)
+      {
+         fprintf(stderr, "watchextract: poll failed: %s\n", strerror(errno));
+         break;
+      }
+
+      if (ready > 0)
+         ReadEvents(Clock::now());
+   }
+}
+
+void Watcher::ReadEvents(Clock::time_point now)
+{
+   alignas(struct inotify_event) char buf[65536];
+   bool overflow = false;
+
+   for (;;)
+   {
+      ssize_t n = read(m_fd, buf, sizeof(buf));
+
+      if (n < 0 && EINTR == errno)
+         continue;
+
+      if (n <= 0)
+         break;
+
+      for (char *p = buf; p < buf + n; )
+      {
+         const struct inotify_event *ev = reinterpret_cast<const struct inotify_event *>(p);
+         p += sizeof(struct inotify_event) + ev->len;
+         ++m_events;
+
+         if (ev->mask & IN_Q_OVERFLOW)
+         {
+            overflow = true;
+            continue;
+         }
+
+         std::unordered_map<int, std::string>::iterator dir = m_dirs.find(ev->wd);
+
+         if (dir == m_dirs.end())
+            continue;
+
+         if (ev->mask & IN_IGNORED)
+         {
+            m_dirs.erase(dir);
+            continue;
+         }
+
+         // events about the watched directory itself, its entries come separately
+         if (0 == ev->len)
+            continue;
+
+         std::string path = dir->second + "/" + ev->name;
+
+         if (ev->mask & IN_ISDIR)
+         {
+            // files written before the new directory's watch was added
+            // raise no events of their own
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+               Walk(path, true);
+            else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+               ForgetTree(path);
+         }
+         else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+         {
+            Forget(path);
+         }
+         else
+         {
+            Pend(path, now);
+         }
+      }
+   }
+
+   // events were lost, the progress tells what changed
+   if (overflow)
+   {
+      fprintf(stderr, "watchextract: event queue overflowed, rescanning\n");
+      Scan(true);
+   }
+}
+
+void Watcher::Pend(const std::string & path, Clock::time_point now)
+{
+   std::map<std::string, Pending>::iterator it = m_pending.find(path);
+
+   if (it != m_pending.end())
+   {
+      it->second.last = now;
+      ++m_coalesced;
+      return;
+   }
+
+   Pending pending;
+   pending.first = now;
+   pending.last = now;
+   m_pending[path] = pending;
+   m_due.push(Due(DueTime(pending), path));
+}
+
+Clock::time_point Watcher::DueTime(const Pending & pending) const
+{
+   return std::min(pending.last + m_options.debounce, pending.first + m_options.maxDelay);
+}
+
+// A file went away. Only reported if it was extracted before; a file
+// created and removed between extractions (an editor's temp file) never was.
+void Watcher::Forget(const std::string & path)
+{
+   // the heap entry is dropped when it comes up
+   m_pending.erase(path);
+
+   bool known;
+
+   {
+      std::lock_guard<std::mutex> lock(m_progressLock);
+      known = m_progress.erase(path) > 0;
+   }
+
+   if (known)
+   {
+      m_progressDirty = true;
+
+      std::string record = "{\"path\":";
+      AppendJsonString(record, path);
+      record += ",\"status\":\"deleted\"}\n";
+      Write(record);
+   }
+}
+
+void Watcher::ForgetTree(const std::string & dir)
+{
+   std::string prefix = dir + "/";
+
+   for (std::unordered_map<int, std::string>::iterator it = m_dirs.begin(); it != m_dirs.end(); )
+   {
+      if (it->second == dir || 0 == it->second.compare(0, prefix.length(), prefix))
+      {
+         inotify_rm_watch(m_fd, it->first);
+         it = m_dirs.erase(it);
+      }
+      else
+      {
+         ++it;
+      }
+   }
+
+   std::vector<std::string> paths;
+
+   {
+      std::lock_guard<std::mutex> lock(m_progressLock);
+
+      for (std::map<std::string, Progress>::const_iterator it = m_progress.lower_bound(prefix);
+           it != m_progress.end() && 0 == it->first.compare(0, prefix.length(), prefix); ++it)
+         paths.push_back(it->first);
+   }
+
+   for (std::map<std::string, Pending>::const_iterator it = m_pending.lower_bound(prefix);
+        it != m_pending.end() && 0 == it->first.compare(0, prefix.length(), prefix); ++it)
+      paths.push_back(it->first);
+
+   for (size_t i = 0; i < paths.size(); ++i)
+      Forget(paths[i]);
+}
+
+// Hands the files that have gone quiet to the workers.
+void Watcher::Dispatch(Clock::time_point now)
+{
+   const std::chrono::milliseconds retry(10);
+
+   while (!m_due.empty() && m_due.top().first <= now)
+   {
+      Due due = m_due.top();
+      m_due.pop();
+
+      std::map<std::string, Pending>::iterator it = m_pending.find(due.second);
+
+      if (it == m_pending.end())
+         continue;
+
+      Clock::time_point actual = DueTime(it->second);
+
+      if (actual > now)
+      {
+         m_due.push(Due(actual, due.second));
+         continue;
+      }
+
+      Change change;
+      change.path = due.second;
+      change.lastEvent = it->second.last;
+
+      ChangeQueue::PushResult result = m_queue.TryPush(change);
+
+      if (ChangeQueue::PUSHED == result)
+      {
+         m_pending.erase(it);
+         continue;
+      }
+
+      // still being extracted, or the workers are behind: it stays pending,
+      // so more events for it keep coalescing
+      m_due.push(Due(now + retry, due.second));
+
+      if (ChangeQueue::FULL == result)
+         break;
+   }
+}
+
+void Watcher::Work()
+{
+   Change change;
+
+   while (m_queue.Pop(change))
+   {
+      Extract(change);
+      m_queue.Done(change.path);
+   }
+}
+
+void Watcher::Extract(const Change & change)
+{
+   int fd = open(change.path.c_str(), O_RDONLY | O_CLOEXEC);
+   struct stat st;
+
+   if (fd < 0 && ENOENT == errno)
+      return;         // gone again, the watcher reports the delete
+
+   std::string record = "{\"path\":";
+   AppendJsonString(record, change.path);
+
+   if (fd < 0 || fstat(fd, &st) != 0)
+   {
+      record += ",\"status\":\"error\",\"error\":";
+      AppendJsonString(record, std::string(strerror(errno)));
+      record += "}\n";
+      Write(record);
+      ++m_failed;
+
+      if (fd >= 0)
+         close(fd);
+
+      return;
+   }
+
+   if (!S_ISREG(st.st_mode))
+   {
+      close(fd);
+      return;
+   }
+
+   AppendState state;
+   bool haveState = false;
+
+   {
+      std::lock_guard<std::mutex> lock(m_progressLock);
+      std::map<std::string, Progress>::const_iterator it = m_progress.find(change.path);
+
+      if (it != m_progress.end())
+      {
+         // touched, or reopened and closed without a write
+         if (it->second.size == static_cast<unsigned long long>(st.st_size) && it->second.mtime == ModifiedNs(st))
+         {
+            close(fd);
+            ++m_unchanged;
+            return;
+         }
+
+         std::wstring token(it->second.state.begin(), it->second.state.end());
+         haveState = m_options.appendMode && DecodeAppendState(token.data(), token.length(), state);
+      }
+   }
+
+   if (!haveState)
+      InitAppendState(state, m_options.profile);
+
+   FileReader reader(fd);
+   JsonTextSink sink(m_options.maxLength);
+   AppendResult result = ExtractAppendedText(reader, static_cast<unsigned long long>(st.st_size), m_options.profile, state, sink);
+
+   close(fd);
+
+   Progress progress;
+   progress.size = static_cast<unsigned long long>(st.st_size);
+   progress.mtime = ModifiedNs(st);
+
+   switch (result)
+   {
+      case APPEND_DELTA:
+      case APPEND_RESTARTED:
+      {
+         const char *status = !sink.WantsMore() ? "truncated" :
+                              !m_options.appendMode ? "changed" :
+                              APPEND_DELTA == result ? "delta" : "restarted";
+
+         std::wstring token = EncodeAppendState(state);
+         progress.state.assign(token.begin(), token.end());
+
+         record += ",\"status\":\"";
+         record += status;
+         record += "\",\"length\":";
+         record += std::to_string(sink.Length());
+         record += ",\"text\":\"";
+         record += sink.Text();
+         record += "\"}\n";
+         break;
+      }
+
+      case APPEND_NOT_TEXT:
+         record += ",\"status\":\"unsupported\"}\n";
+         break;
+
+      default:
+         record += ",\"status\":\"error\",\"error\":\"read failed\"}\n";
+         ++m_failed;
+         Write(record);
+         return;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(m_progressLock);
+      m_progress[change.path] = progress;
+   }
+
+   m_progressDirty = true;
+   Write(record);
+   ++m_extracted;
+
+   double latency = std::chrono::duration<double, std::milli>(Clock::now() - change.lastEvent).count();
+   std::lock_guard<std::mutex> lock(m_latencyLock);
+   m_latencies.push_back(latency);
+}
+
+void Watcher::Write(const std::string & record)
+{
+   std::lock_guard<std::mutex> lock(m_outLock);
+   fwrite(record.data(), 1, record.size(), m_out);
+   fflush(m_out);
+}
+
+// Writes the progress next to the old file and swaps it in.
+bool Watcher::SaveProgress()
+{
+   std::string tempName = m_progressName + ".tmp";
+
+   m_progressDirty = false;
+
+   {
+      std::ofstream progressFile(tempName.c_str(), std::ios::trunc);
+      std::lock_guard<std::mutex> lock(m_progressLock);
+
+      for (std::map<std::string, Progress>::const_iterator it = m_progress.begin(); it != m_progress.end(); ++it)
+         progressFile << it->first << '\t' << it->second.size << '\t' << it->second.mtime << '\t' << it->second.state << '\n';
+
+      if (!progressFile)
+      {
+         fprintf(stderr, "watchextract: can't write %s\n", tempName.c_str());
+         m_progressDirty = true;
+         return false;
+      }
+   }
+
+   if (rename(tempName.c_str(), m_progressName.c_str()) != 0)
+   {
+      fprintf(stderr, "watchextract: can't replace %s: %s\n", m_progressName.c_str(), strerror(errno));
+      m_progressDirty = true;
+      return false;
+   }
+
+   return true;
+}
+
+void Watcher::Report(double seconds)
+{
+   std::sort(m_latencies.begin(), m_latencies.end());
+
+   double p50 = 0, p90 = 0, p99 = 0, worst = 0;
+
+   if (!m_latencies.empty())
+   {
+      p50 = m_latencies[m_latencies.size() * 50 / 100];
+      p90 = m_latencies[m_latencies.size() * 90 / 100];
+      p99 = m_latencies[m_latencies.size() * 99 / 100];
+      worst = m_latencies.back();
+   }
+
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+
+   double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+   fprintf(stderr, "watchextract: %zu directories, %llu events (%llu coalesced), %llu extracted, %llu unchanged, %llu failed in %.1f s\n",
+           m_dirs.size(), m_events, m_coalesced,
+           static_cast<unsigned long long>(m_extracted), static_cast<unsigned long long>(m_unchanged),
+           static_cast<unsigned long long>(m_failed), seconds);
+   fprintf(stderr, "watchextract: event to text p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", p50, p90, p99, worst);
+   fprintf(stderr, "watchextract: %.3f s CPU, %.2f ms CPU per second\n", cpu, seconds > 0 ? cpu * 1000 / seconds : 0.0);
+}
+
+// Synthetic churn: every tick one of files small text files gets appended to
+// in a burst of a few writes a couple of ms apart, the pattern a logger or an
+// editor's save produces, then closed.
+static void Churn(const std::string & dir, unsigned rate, unsigned files)
+{
+   mkdir(dir.c_str(), 0755);
+
+   std::chrono::microseconds tick(1000000 / rate);
+   Clock::time_point next = Clock::now();
+   unsigned long long n = 0;
+
+   while (!s_stop)
+   {
+      std::string path = dir + "/churn" + std::to_string(n % files) + ".log";
+      int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+      if (fd >= 0)
+      {
+         for (int burst = 0; burst < 4; ++burst)
+         {
+            std::string line = "line " + std::to_string(n) + "." + std::to_string(burst) + " of synthetic churn for the watcher\n";
+
+            if (write(fd, line.data(), line.size()) < 0)
+               break;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+         }
+
+         close(fd);
+      }
+
+      ++n;
+      next += tick;
+      std::this_thread::sleep_until(next);
+   }
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: watchextract -s PROGRESSFILE [options] dir...\n"
+      "  -s FILE   where the size, mtime and append state of each file are kept\n"
+      "  -a        give just the appended text for files only appended to\n"
+      "  -d MS     extract a file once it has been quiet this long (default: 200)\n"
+      "  -D MS     or once it has been changing this long (default: 2000)\n"
+      "  -j N      number of worker threads (default: number of CPUs)\n"
+      "  -q N      changes queued for the workers at most (default: 4 per worker)\n"
+      "  -m N      stop after more than N characters per change (default: no limit)\n"
+      "  -p NAME   folding profile: display, index or compact (default: display)\n"
+      "  -o FILE   write the NDJSON records to FILE instead of stdout\n"
+      "  -t SECS   exit after this long (default: at SIGINT or SIGTERM)\n"
+      "  -c N      write synthetic churn into the first dir, N bursts a second\n"
+      "  -n N      number of files the churn goes to (default: 100)\n");
+}
+
+int main(int argc, char *argv[])
+{
+   Options options;
+   options.profile = CLEANUP_DISPLAY;
+   options.appendMode = false;
+   options.maxLength = 0;
+   options.debounce = std::chrono::milliseconds(200);
+   options.maxDelay = std::chrono::milliseconds(2000);
+
+   const char *progressName = NULL;
+   const char *outName = NULL;
+   unsigned workers = std::thread::hardware_concurrency();
+   size_t capacity = 0;
+   double runSeconds = 0;
+   unsigned churnRate = 0;
+   unsigned churnFiles = 100;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "s:ad:D:j:q:m:p:o:t:c:n:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 's':
+            progressName = optarg;
+            break;
+
+         case 'a':
+            options.appendMode = true;
+            break;
+
+         case 'd':
+            options.debounce = std::chrono::milliseconds(strtoul(optarg, NULL, 10));
+            break;
+
+         case 'D':
+            options.maxDelay = std::chrono::milliseconds(strtoul(optarg, NULL, 10));
+            break;
+
+         case 'j':
+            workers = static_cast<unsigned>(strtoul(optarg, NULL, 10));
+            break;
+
+         case 'q':
+            capacity = static_cast<size_t>(strtoul(optarg, NULL, 10));
+            break;
+
+         case 'm':
+            options.maxLength = static_cast<size_t>(strtoull(optarg, NULL, 10));
+            break;
+
+         case 'p':
+            if (0 == strcmp(optarg, "display"))
+               options.profile = CLEANUP_DISPLAY;
+            else if (0 == strcmp(optarg, "index"))
+               options.profile = CLEANUP_INDEX;
+            else if (0 == strcmp(optarg, "compact"))
+               options.profile = CLEANUP_COMPACT;
+            else
+            {
+               Usage();
+               return 2;
+            }
+            break;
+
+         case 'o':
+            outName = optarg;
+            break;
+
+         case 't':
+            runSeconds = strtod(optarg, NULL);
+            break;
+
+         case 'c':
+            churnRate = static_cast<unsigned>(strtoul(optarg, NULL, 10));
+            break;
+
+         case 'n':
+            churnFiles = static_cast<unsigned>(strtoul(optarg, NULL, 10));
+            break;
+
+         default:
+            Usage();
+            return 2;
+      }
+   }
+
+   if (NULL == progressName || optind == argc || 0 == churnFiles)
+   {
+      Usage();
+      return 2;
+   }
+
+   if (0 == workers)
+      workers = 1;
+
+   if (0 == capacity)
+      capacity = workers * 4;
+
+   std::vector<std::string> roots;
+
+   for (int i = optind; i < argc; ++i)
+   {
+      std::string root = argv[i];
+
+      while (root.length() > 1 && '/' == root[root.length() - 1])
+         root.erase(root.length() - 1);
+
+      roots.push_back(root);
+   }
+
+   FILE *out = stdout;
+
+   if (outName && NULL == (out = fopen(outName, "w")))
+   {
+      fprintf(stderr, "watchextract: can't create %s: %s\n", outName, strerror(errno));
+      return 2;
+   }
+
+   // no SA_RESTART, so the signal breaks poll out of its sleep
+   struct sigaction action;
+   memset(&action, 0, sizeof(action));
+   action.sa_handler = OnSignal;
+   sigaction(SIGINT, &action, NULL);
+   sigaction(SIGTERM, &action, NULL);
+
+   Clock::time_point started = Clock::now();
+   Watcher watcher(options, progressName, out, capacity);
+
+   std::vector<std::thread> pool;
+
+   for (unsigned i = 0; i < workers; ++i)
+      pool.push_back(std::thread([&watcher] { watcher.Work(); }));
+
+   if (!watcher.Start(roots))
+   {
+      watcher.Close();
+
+      for (size_t i = 0; i < pool.size(); ++i)
+         pool[i].join();
+
+      return 2;
+   }
+
+   std::thread churn;
+
+   if (churnRate)
+      churn = std::thread(Churn, roots[0] + "/.churn", churnRate, churnFiles);
+
+   Clock::time_point stopAt = runSeconds > 0 ?
+      started + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(runSeconds)) :
+      Clock::time_point::max();
+
+   watcher.Run(stopAt);
+
+   // changes still pending when it stopped are picked up by the next start's scan
+   s_stop = 1;
+
+   if (churn.joinable())
+      churn.join();
+
+   watcher.Close();
+
+   for (size_t i = 0; i < pool.size(); ++i)
+      pool[i].join();
+
+   bool saved = watcher.SaveProgress();
+
+   if (out != stdout)
+      fclose(out);
+
+   watcher.Report(std::chrono::duration<double>(Clock::now() - started).count());
+
+   return saved ? 0 : 2;
+}
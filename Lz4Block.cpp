@@ -0,0 +1,296 @@
+// Lz4Block.cpp : In-tree compressor/decompressor for the LZ4 block format
+
+#include <string.h>
+#include <vector>
+
+#include "Lz4Block.h"
+
+// LZ4 block format rules: the last five bytes are always literals and the
+// last match starts at least twelve bytes before the end.
+static const size_t c_minMatch = 4;
+static const size_t c_lastLiterals = 5;
+static const size_t c_matchLimit = 12;
+
+static const int c_hashLog = 12;
+static const int c_chainHashLog = 15;
+static const int c_chainDepth = 64;
+
+inline static unsigned long Read32(const unsigned char *p)
+{
+   return static_cast<unsigned long>(p[0]) | (static_cast<unsigned long>(p[1]) << 8) |
+          (static_cast<unsigned long>(p[2]) << 16) | (static_cast<unsigned long>(p[3]) << 24);
+}
+
+inline static unsigned Hash32(unsigned long value, int hashLog)
+{
+   return static_cast<unsigned>(((value * 2654435761UL) & 0xFFFFFFFFUL) >> (32 - hashLog));
+}
+
+inline static size_t MatchLength(const unsigned char *a, const unsigned char *b, const unsigned char *limit)
+{
+   const unsigned char *start = b;
+
+   while (b < limit && *a == *b)
+   {
+      ++a;
+      ++b;
+   }
+
+   return b - start;
+}
+
+// Appends one sequence; returns false if dst is full.
+static bool WriteSequence(unsigned char *& op, unsigned char *oend,
+                          const unsigned char *literals, size_t literalLength,
+                          size_t offset, size_t matchLength)
+{
+   // worst case: token, length bytes, literals, offset, length bytes
+   if (static_cast<size_t>(oend - op) < 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1)
+      return false;
+
+   unsigned char *token = op++;
+   *token = 0;
+
+   if (literalLength >= 15)
+   {
+      *token = 15 << 4;
+      size_t rest = literalLength - 15;
+
+      for (; rest >= 255; rest -= 255)
+         *op++ = 255;
+
+      *op++ = static_cast<unsigned char>(rest);
+   }
+   else
+   {
+      *token = static_cast<unsigned char>(literalLength << 4);
+   }
+
+   memcpy(op, literals, literalLength);
+   op += literalLength;
+
+   if (0 == matchLength)   // the closing literal run
+      return true;
+
+   *op++ = static_cast<unsigned char>(offset);
+   *op++ = static_cast<unsigned char>(offset >> 8);
+
+   size_t code = matchLength - c_minMatch;
+
+   if (code >= 15)
+   {
+      *token |= 15;
+      code -= 15;
+
+      for (; code >= 255; code -= 255)
+         *op++ = 255;
+
+      *op++ = static_cast<unsigned char>(code);
+   }
+   else
+   {
+      *token |= static_cast<unsigned char>(code);
+   }
+
+   return true;
+}
+
+size_t Lz4CompressBlock(const unsigned char *src, size_t cb, unsigned char *dst, size_t dstCapacity, Lz4Level level)
+{
+   if (cb > c_lz4MaxBlock)
+      return 0;
+
+   unsigned char *op = dst;
+   unsigned char *oend = dst + dstCapacity;
+
+   const unsigned char *anchor = src;
+   const unsigned char *iend = src + cb;
+   const unsigned char *matchEnd = iend - c_lastLiterals;
+
+   if (cb > c_matchLimit)
+   {
+      const unsigned char *mflimit = iend - c_matchLimit;
+      const unsigned char *ip = src;
+
+      // positions are relative to src and the block is at most 64K, so
+      // the tables hold them in 16 bits. Slot 0 doubles as "empty", so
+      // position 0 never matches, which costs nothing worth mentioning.
+      std::vector<unsigned short> table(static_cast<size_t>(1) << (LZ4_LEVEL_HIGH == level ? c_chainHashLog : c_hashLog), 0);
+      std::vector<unsigned short> chain;
+
+      if (LZ4_LEVEL_HIGH == level)
+         chain.resize(c_lz4MaxBlock, 0);
+
+      int hashLog = LZ4_LEVEL_HIGH == level ? c_chainHashLog : c_hashLog;
+      size_t inserted = 0;   // high level: positions below this are in the chain
+
+      while (ip < mflimit)
+      {
+         size_t pos = ip - src;
+         const unsigned char *match = NULL;
+         size_t length = 0;
+
+         if (LZ4_LEVEL_HIGH == level)
+         {
+            for (; inserted <= pos; ++inserted)
+            {
+               unsigned h = Hash32(Read32(src + inserted), hashLog);
+               chain[inserted] = static_cast<unsigned short>(inserted - table[h]);
+               table[h] = static_cast<unsigned short>(inserted);
+            }
+
+            size_t candidate = pos - chain[pos];
+
+            for (int depth = 0; depth < c_chainDepth && candidate < pos && candidate != 0; ++depth)
+            {
+               const unsigned char *m = src + candidate;
+
+               if (Read32(m) == Read32(ip))
+               {
+                  size_t l = c_minMatch + MatchLength(m + c_minMatch, ip + c_minMatch, matchEnd);
+
+                  if (l > length)
+                  {
+                     length = l;
+                     match = m;
+                  }
+               }
+
+               if (0 == chain[candidate])
+                  break;
+
+               candidate -= chain[candidate];
+            }
+         }
+         else
+         {
+            unsigned h = Hash32(Read32(ip), hashLog);
+            size_t candidate = table[h];
+            table[h] = static_cast<unsigned short>(pos);
+
+            if (candidate != 0 && candidate < pos && Read32(src + candidate) == Read32(ip))
+            {
+               match = src + candidate;
+               length = c_minMatch + MatchLength(match + c_minMatch, ip + c_minMatch, matchEnd);
+            }
+         }
+
+         if (NULL == match)
+         {
+            ++ip;
+            continue;
+         }
+
+         // stretch the match backwards over literals that also match
+         while (ip > anchor && match > src && ip[-1] == match[-1])
+         {
+            --ip;
+            --match;
+            ++length;
+         }
+
+         if (!WriteSequence(op, oend, anchor, ip - anchor, ip - match, length))
+            return 0;
+
+         ip += length;
+         anchor = ip;
+
+         if (LZ4_LEVEL_FAST == level && ip < mflimit)
+         {
+            // seed the table with the end of the match
+            size_t back = ip - 2 - src;
+            table[Hash32(Read32(ip - 2), hashLog)] = static_cast<unsigned short>(back);
+         }
+      }
+   }
+
+   if (!WriteSequence(op, oend, anchor, iend - anchor, 0, 0))
+      return 0;
+
+   return op - dst;
+}
+
+bool Lz4DecompressBlock(const unsigned char *src, size_t cb, unsigned char *dst, size_t cbOut)
+{
+   const unsigned char *ip = src;
+   const unsigned char *iend = src + cb;
+   unsigned char *op = dst;
+   unsigned char *oend = dst + cbOut;
+
+   while (ip < iend)
+   {
+      unsigned token = *ip++;
+      size_t literalLength = token >> 4;
+
+      if (15 == literalLength)
+      {
+         unsigned char b;
+
+         do
+         {
+            if (ip == iend)
+               return false;
+
+            b = *ip++;
+            literalLength += b;
+         } while (255 == b);
+      }
+
+      if (literalLength > static_cast<size_t>(iend - ip) || literalLength > static_cast<size_t>(oend - op))
+         return false;
+
+      memcpy(op, ip, literalLength);
+      ip += literalLength;
+      op += literalLength;
+
+      if (ip == iend)   // the closing literal run
+         break;
+
+      if (iend - ip < 2)
+         return false;
+
+      size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+      ip += 2;
+
+      if (0 == offset || offset > static_cast<size_t>(op - dst))
+         return false;
+
+      size_t matchLength = token & 15;
+
+      if (15 == matchLength)
+      {
+         unsigned char b;
+
+         do
+         {
+            if (ip == iend)
+               return false;
+
+            b = *ip++;
+            matchLength += b;
+         } while (255 == b);
+      }
+
+      matchLength += c_minMatch;
+
+      if (matchLength > static_cast<size_t>(oend - op))
+         return false;
+
+      const unsigned char *match = op - offset;
+
+      if (offset >= matchLength)
+      {
+         memcpy(op, match, matchLength);
+      }
+      else
+      {
+         // byte by byte, overlapping matches repeat the pattern
+         for (size_t i = 0; i < matchLength; ++i)
+            op[i] = match[i];
+      }
+
+      op += matchLength;
+   }
+
+   return op == oend;
+}
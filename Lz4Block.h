@@ -0,0 +1,30 @@
+// Lz4Block.h : In-tree compressor/decompressor for the LZ4 block format,
+//              used for the compressed output mode
+
+#ifndef __LZ4BLOCK_H_
+#define __LZ4BLOCK_H_
+
+#include <stddef.h>
+
+// Both levels write standard LZ4 blocks, so either decodes with
+// Lz4DecompressBlock (or any other LZ4 block decoder). The high level
+// searches a hash chain for longer matches at a few times the cost.
+enum Lz4Level
+{
+   LZ4_LEVEL_FAST = 0,
+   LZ4_LEVEL_HIGH
+};
+
+// Largest input Lz4CompressBlock takes, matches never reach back further
+// than LZ4's 16-bit offsets allow.
+const size_t c_lz4MaxBlock = 65536;
+
+// Compresses src[0..cb) into dst. Returns the compressed size, or 0 if it
+// wouldn't fit in dstCapacity bytes (store the block uncompressed then).
+size_t Lz4CompressBlock(const unsigned char *src, size_t cb, unsigned char *dst, size_t dstCapacity, Lz4Level level);
+
+// Decompresses a block that must expand to exactly cbOut bytes. Returns false
+// if the block is malformed, never reads or writes outside the buffers.
+bool Lz4DecompressBlock(const unsigned char *src, size_t cb, unsigned char *dst, size_t cbOut);
+
+#endif //__LZ4BLOCK_H_
@@ -0,0 +1,202 @@
+// MemoryGovernor.cpp : Process-wide budget for the memory held by extractions
+
+#include "MemoryGovernor.h"
+
+// reservations grow in steps at least this big, to keep the lock quiet
+static const unsigned long long c_growthStep = 1024 * 1024;
+
+// default wait for room in the budget
+static const unsigned long c_defaultWaitMs = 30000;
+
+// constructed when the module loads, before any extraction can run
+static MemoryGovernor s_governor;
+
+MemoryGovernor::MemoryGovernor()
+   : m_budget(0), m_inUse(0), m_waitMs(c_defaultWaitMs)
+{
+}
+
+MemoryGovernor & MemoryGovernor::Instance()
+{
+   return s_governor;
+}
+
+void MemoryGovernor::Configure(unsigned long long budget, unsigned long waitMs)
+{
+   AutoLock lock(m_lock);
+
+   m_budget = budget;
+   m_waitMs = waitMs;
+
+   GrantWaiters();
+}
+
+unsigned long MemoryGovernor::WaitMs() const
+{
+   AutoLock lock(m_lock);
+   return m_waitMs;
+}
+
+bool MemoryGovernor::Fits(unsigned long long bytes) const
+{
+   return 0 == m_budget || 0 == m_inUse || bytes <= m_budget - (m_inUse < m_budget ? m_inUse : m_budget);
+}
+
+bool MemoryGovernor::Acquire(unsigned long long bytes, unsigned long waitMs, bool growth)
+{
+   Waiter waiter;
+   waiter.bytes = bytes;
+   waiter.granted = false;
+
+   {
+      AutoLock lock(m_lock);
+
+      // nobody queued ahead of this request, so it can go straight through
+      bool first = m_growth.empty() && (growth || m_admission.empty());
+
+      if (first && Fits(bytes))
+      {
+         m_inUse += bytes;
+         return true;
+      }
+
+      if (0 == waitMs)
+         return false;
+
+      (growth ? m_growth : m_admission).push_back(&waiter);
+   }
+
+   waiter.event.Wait(waitMs);
+
+   AutoLock lock(m_lock);
+
+   // granted, possibly just as the wait timed out
+   if (waiter.granted)
+      return true;
+
+   std::deque<Waiter *> & queue = growth ? m_growth : m_admission;
+
+   for (std::deque<Waiter *>::iterator it = queue.begin(); it != queue.end(); ++it)
+   {
+      if (*it == &waiter)
+      {
+         queue.erase(it);
+         break;
+      }
+   }
+
+   // whoever was queued behind this request may fit now
+   GrantWaiters();
+   return false;
+}
+
+void MemoryGovernor::Release(unsigned long long bytes)
+{
+   if (0 == bytes)
+      return;
+
+   AutoLock lock(m_lock);
+
+   m_inUse -= bytes < m_inUse ? bytes : m_inUse;
+   GrantWaiters();
+}
+
+void MemoryGovernor::Usage(unsigned long long *inUse, unsigned long long *budget, unsigned long *waiting) const
+{
+   AutoLock lock(m_lock);
+
+   *inUse = m_inUse;
+   *budget = m_budget;
+   *waiting = static_cast<unsigned long>(m_growth.size() + m_admission.size());
+}
+
+// Called with the lock held. Strictly in order, the first waiter that
+// doesn't fit holds up everyone behind it so big requests can't starve.
+void MemoryGovernor::GrantWaiters()
+{
+   GrantFrom(m_growth);
+
+   if (m_growth.empty())
+      GrantFrom(m_admission);
+}
+
+void MemoryGovernor::GrantFrom(std::deque<Waiter *> & queue)
+{
+   while (!queue.empty() && Fits(queue.front()->bytes))
+   {
+      Waiter *waiter = queue.front();
+      queue.pop_front();
+
+      m_inUse += waiter->bytes;
+      waiter->granted = true;
+      waiter->event.Set();
+   }
+}
+
+MemoryReservation::MemoryReservation(MemoryGovernor & governor)
+   : m_governor(governor), m_held(0), m_overBudget(false)
+{
+}
+
+MemoryReservation::~MemoryReservation()
+{
+   m_governor.Release(m_held);
+}
+
+bool MemoryReservation::Admit(unsigned long long estimate)
+{
+   if (!m_governor.Acquire(estimate, m_governor.WaitMs(), false))
+      return false;
+
+   m_held += estimate;
+   return true;
+}
+
+bool MemoryReservation::Grow(unsigned long long bytes)
+{
+   if (bytes < c_growthStep)
+      bytes = c_growthStep;
+
+   if (!m_governor.Acquire(bytes, m_governor.WaitMs(), true))
+   {
+      m_overBudget = true;
+      return false;
+   }
+
+   m_held += bytes;
+   return true;
+}
+
+GovernedSink::GovernedSink(TextSink & inner, MemoryReservation & reservation, unsigned bytesPerChar, unsigned long long maxChars)
+   : m_inner(inner), m_reservation(reservation), m_bytesPerChar(bytesPerChar), m_maxBytes(maxChars * bytesPerChar), m_used(0)
+{
+}
+
+void GovernedSink::OnChunk(const ChunkInfo & chunk)
+{
+   m_inner.OnChunk(chunk);
+}
+
+void GovernedSink::OnText(const wchar_t *text, size_t cch)
+{
+   m_used += static_cast<unsigned long long>(cch) * m_bytesPerChar;
+
+   if (0 != m_maxBytes && m_used > m_maxBytes)
+      m_used = m_maxBytes;
+
+   // the text in hand still goes through, the extraction stops after it
+   if (m_used > m_reservation.Held())
+      m_reservation.Grow(m_used - m_reservation.Held());
+
+   m_inner.OnText(text, cch);
+}
+
+bool GovernedSink::WantsMore() const
+{
+   return !m_reservation.OverBudget() && m_inner.WantsMore();
+}
+
+void GovernedSink::OnEnd()
+{
+   m_inner.OnEnd();
+}
@@ -0,0 +1,105 @@
+// MemoryGovernor.h : Process-wide budget for the memory held by extractions,
+//                    with FIFO admission and paced growth
+
+#ifndef __MEMORYGOVERNOR_H_
+#define __MEMORYGOVERNOR_H_
+
+#include <deque>
+
+#include "Sync.h"
+#include "TextSink.h"
+
+class MemoryGovernor
+{
+public:
+   MemoryGovernor();
+
+   // The one shared by every extraction in the process.
+   static MemoryGovernor & Instance();
+
+   // budget in bytes, 0 for no limit (usage is still counted). waitMs is how
+   // long admission and growth requests wait for room before giving up.
+   void Configure(unsigned long long budget, unsigned long waitMs);
+
+   unsigned long WaitMs() const;
+
+   // Takes bytes out of the budget, waiting up to waitMs for them. Requests
+   // are granted in arrival order, growth of running extractions ahead of
+   // new admissions. A request bigger than the whole budget is let through
+   // once nothing else is held, or it would never run.
+   bool Acquire(unsigned long long bytes, unsigned long waitMs, bool growth);
+   void Release(unsigned long long bytes);
+
+   void Usage(unsigned long long *inUse, unsigned long long *budget, unsigned long *waiting) const;
+
+private:
+   struct Waiter
+   {
+      unsigned long long bytes;
+      bool granted;
+      WaitEvent event;
+   };
+
+   bool Fits(unsigned long long bytes) const;
+   void GrantWaiters();
+   void GrantFrom(std::deque<Waiter *> & queue);
+
+   mutable CriticalLock m_lock;
+   unsigned long long m_budget;
+   unsigned long long m_inUse;
+   unsigned long m_waitMs;
+   std::deque<Waiter *> m_growth;
+   std::deque<Waiter *> m_admission;
+};
+
+// What one extraction holds from the governor, given back when it goes away.
+class MemoryReservation
+{
+public:
+   explicit MemoryReservation(MemoryGovernor & governor);
+   ~MemoryReservation();
+
+   // Admission, waits for the estimated footprint to fit.
+   bool Admit(unsigned long long estimate);
+
+   // Growth past what's held so far, false (and OverBudget from then on)
+   // if there's no room in time.
+   bool Grow(unsigned long long bytes);
+
+   unsigned long long Held() const { return m_held; }
+   bool OverBudget() const { return m_overBudget; }
+
+private:
+   MemoryReservation(const MemoryReservation &);
+   MemoryReservation & operator=(const MemoryReservation &);
+
+   MemoryGovernor & m_governor;
+   unsigned long long m_held;
+   bool m_overBudget;
+};
+
+// Counts the text going through to the sink behind it against a reservation,
+// growing it a step at a time. Stops the extraction when it can't grow.
+class GovernedSink : public TextSink
+{
+public:
+   // bytesPerChar covers every copy the caller keeps of each character.
+   // Only the first maxChars characters are counted (0 counts them all),
+   // for callers that hold no more than that in memory however long the
+   // text gets.
+   GovernedSink(TextSink & inner, MemoryReservation & reservation, unsigned bytesPerChar, unsigned long long maxChars = 0);
+
+   virtual void OnChunk(const ChunkInfo & chunk);
+   virtual void OnText(const wchar_t *text, size_t cch);
+   virtual bool WantsMore() const;
+   virtual void OnEnd();
+
+private:
+   TextSink & m_inner;
+   MemoryReservation & m_reservation;
+   unsigned m_bytesPerChar;
+   unsigned long long m_maxBytes;
+   unsigned long long m_used;
+};
+
+#endif //__MEMORYGOVERNOR_H_
@@ -0,0 +1,191 @@
+// OffsetMap.cpp : Maps ranges of the cleaned-up text back to the filter chunks
+
+#include <string.h>
+
+#include "OffsetMap.h"
+
+static const unsigned char c_offsetMapVersion = 1;
+
+inline static void PutVarint(std::vector<unsigned char> & out, unsigned long value)
+{
+   while (value >= 0x80)
+   {
+      out.push_back(static_cast<unsigned char>(value | 0x80));
+      value >>= 7;
+   }
+
+   out.push_back(static_cast<unsigned char>(value));
+}
+
+// small differences either way stay small
+inline static void PutDelta(std::vector<unsigned char> & out, unsigned long value, unsigned long base)
+{
+   unsigned long delta = value - base;
+   bool negative = (delta & 0x80000000UL) != 0;
+
+   delta &= 0xFFFFFFFFUL;
+   PutVarint(out, negative ? ((~delta & 0xFFFFFFFFUL) << 1) | 1 : delta << 1);
+}
+
+inline static bool GetVarint(const unsigned char *& p, const unsigned char *end, unsigned long & value)
+{
+   value = 0;
+
+   for (int shift = 0; shift < 35; shift += 7)
+   {
+      if (p == end)
+         return false;
+
+      unsigned char b = *p++;
+      value |= static_cast<unsigned long>(b & 0x7F) << shift;
+
+      if (0 == (b & 0x80))
+      {
+         value &= 0xFFFFFFFFUL;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+inline static bool GetDelta(const unsigned char *& p, const unsigned char *end, unsigned long base, unsigned long & value)
+{
+   unsigned long zigzag;
+
+   if (!GetVarint(p, end, zigzag))
+      return false;
+
+   unsigned long delta = (zigzag & 1) ? ~(zigzag >> 1) : (zigzag >> 1);
+   value = (base + delta) & 0xFFFFFFFFUL;
+   return true;
+}
+
+OffsetMapSink::OffsetMapSink(size_t maxLength)
+   : m_maxLength(maxLength), m_offset(0), m_inChunk(false), m_separatorPending(false), m_chunks(0)
+{
+   memset(&m_current, 0, sizeof(m_current));
+   memset(&m_previous, 0, sizeof(m_previous));
+
+   m_encoded.push_back(c_offsetMapVersion);
+}
+
+void OffsetMapSink::OnChunk(const ChunkInfo & chunk)
+{
+   CloseChunk();
+
+   m_inChunk = true;
+   m_separatorPending = TEXT_BREAK_NONE != chunk.breakType;
+
+   m_current.outputStart = static_cast<unsigned long>(m_offset);
+   m_current.outputLength = 0;
+   m_current.idChunk = chunk.idChunk;
+   m_current.idChunkSource = chunk.idChunkSource;
+   m_current.cwcStartSource = chunk.cwcStartSource;
+   m_current.cwcLenSource = chunk.cwcLenSource;
+}
+
+void OffsetMapSink::OnText(const wchar_t * /*text*/, size_t cch)
+{
+   m_offset += cch;
+
+   // FilterText passes the separator in a single call right after OnChunk
+   if (m_separatorPending)
+   {
+      m_separatorPending = false;
+      m_current.outputStart = static_cast<unsigned long>(m_offset);
+   }
+}
+
+bool OffsetMapSink::WantsMore() const
+{
+   return 0 == m_maxLength || m_offset <= m_maxLength;
+}
+
+void OffsetMapSink::OnEnd()
+{
+   CloseChunk();
+}
+
+void OffsetMapSink::CloseChunk()
+{
+   if (!m_inChunk)
+      return;
+
+   m_inChunk = false;
+   m_current.outputLength = static_cast<unsigned long>(m_offset) - m_current.outputStart;
+
+   PutVarint(m_encoded, m_current.outputStart - (m_previous.outputStart + m_previous.outputLength));
+   PutVarint(m_encoded, m_current.outputLength);
+   PutDelta(m_encoded, m_current.idChunk, m_previous.idChunk);
+   PutDelta(m_encoded, m_current.idChunkSource, m_current.idChunk);
+   PutDelta(m_encoded, m_current.cwcStartSource, m_previous.cwcStartSource + m_previous.cwcLenSource);
+   PutVarint(m_encoded, m_current.cwcLenSource);
+
+   m_previous = m_current;
+   ++m_chunks;
+}
+
+bool DecodeOffsetMap(const unsigned char *data, size_t cb, std::vector<OffsetEntry> & entries)
+{
+   entries.clear();
+
+   if (0 == cb || c_offsetMapVersion != data[0])
+      return false;
+
+   const unsigned char *p = data + 1;
+   const unsigned char *end = data + cb;
+
+   OffsetEntry previous;
+   memset(&previous, 0, sizeof(previous));
+
+   while (p != end)
+   {
+      OffsetEntry entry;
+      unsigned long gap;
+
+      if (!GetVarint(p, end, gap) ||
+          !GetVarint(p, end, entry.outputLength) ||
+          !GetDelta(p, end, previous.idChunk, entry.idChunk))
+         return false;
+
+      if (!GetDelta(p, end, entry.idChunk, entry.idChunkSource) ||
+          !GetDelta(p, end, previous.cwcStartSource + previous.cwcLenSource, entry.cwcStartSource) ||
+          !GetVarint(p, end, entry.cwcLenSource))
+         return false;
+
+      entry.outputStart = previous.outputStart + previous.outputLength + gap;
+
+      entries.push_back(entry);
+      previous = entry;
+   }
+
+   return true;
+}
+
+const OffsetEntry *FindOffset(const std::vector<OffsetEntry> & entries, unsigned long offset)
+{
+   // binary search for the last entry starting at or before offset
+   size_t lo = 0;
+   size_t hi = entries.size();
+
+   while (lo < hi)
+   {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (entries[mid].outputStart <= offset)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   if (0 == lo)
+      return NULL;
+
+   const OffsetEntry & entry = entries[lo - 1];
+
+   if (offset - entry.outputStart >= entry.outputLength)
+      return NULL;
+
+   return &entry;
+}
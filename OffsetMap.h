@@ -0,0 +1,70 @@
+// OffsetMap.h : Maps ranges of the cleaned-up text back to the filter chunks
+//               (and source text) they came from, delta-encoded as it streams
+//               out of the extraction loop
+
+#ifndef __OFFSETMAP_H_
+#define __OFFSETMAP_H_
+
+#include <vector>
+
+#include "TextSink.h"
+
+// One text chunk. outputStart/outputLength cover the chunk's own text in the
+// returned string, not the separator in front of it.
+struct OffsetEntry
+{
+   unsigned long outputStart;
+   unsigned long outputLength;
+   unsigned long idChunk;
+   unsigned long idChunkSource;
+   unsigned long cwcStartSource;
+   unsigned long cwcLenSource;
+};
+
+// Encoded map layout: a version byte (1) followed by one record per chunk of
+// six LEB128 varints,
+//
+//    outputStart - end of the previous chunk's output
+//    outputLength
+//    zigzag(idChunk - previous idChunk)
+//    zigzag(idChunkSource - idChunk)
+//    zigzag(cwcStartSource - end of the previous chunk's source range)
+//    cwcLenSource
+//
+// so a run of chunks from one source usually takes six or seven bytes each.
+class OffsetMapSink : public TextSink
+{
+public:
+   // Like TextBufferSink, stops once more than maxLength (if non-zero)
+   // characters have gone by so the map covers the same text.
+   explicit OffsetMapSink(size_t maxLength);
+
+   virtual void OnChunk(const ChunkInfo & chunk);
+   virtual void OnText(const wchar_t *text, size_t cch);
+   virtual bool WantsMore() const;
+   virtual void OnEnd();
+
+   const std::vector<unsigned char> & Encoded() const { return m_encoded; }
+   unsigned long Chunks() const { return m_chunks; }
+
+private:
+   void CloseChunk();
+
+   size_t m_maxLength;
+   size_t m_offset;
+   bool m_inChunk;
+   bool m_separatorPending;   // the next OnText is the separator in front of the chunk
+   OffsetEntry m_current;
+   OffsetEntry m_previous;    // last record written, all zeros before the first
+   unsigned long m_chunks;
+   std::vector<unsigned char> m_encoded;
+};
+
+// Decodes a map produced by OffsetMapSink, false if it's malformed.
+bool DecodeOffsetMap(const unsigned char *data, size_t cb, std::vector<OffsetEntry> & entries);
+
+// The entry whose output range holds offset, NULL if offset falls on a separator
+// or past the end. entries must be in output order, as DecodeOffsetMap leaves them.
+const OffsetEntry *FindOffset(const std::vector<OffsetEntry> & entries, unsigned long offset);
+
+#endif //__OFFSETMAP_H_
@@ -0,0 +1,268 @@
+// PagedText.cpp : Reads the cleaned-up text a page at a time
+
+#include "PagedText.h"
+#include "TokenText.h"
+
+static const wchar_t c_tokenPrefix[] = L"pg1";
+
+PageCheckpoints::PageCheckpoints(unsigned long spacing)
+   : m_spacing(spacing)
+{
+}
+
+void PageCheckpoints::Record(const PageCheckpoint & checkpoint)
+{
+   if (!m_checkpoints.empty())
+   {
+      const PageCheckpoint & last = m_checkpoints.back();
+
+      if (checkpoint.offset < last.offset + m_spacing)
+         return;
+   }
+
+   m_checkpoints.push_back(checkpoint);
+}
+
+void PageCheckpoints::Merge(const PageCheckpoints & other)
+{
+   std::vector<PageCheckpoint> merged;
+   merged.reserve(m_checkpoints.size() + other.m_checkpoints.size());
+
+   size_t i = 0;
+   size_t j = 0;
+
+   while (i < m_checkpoints.size() || j < other.m_checkpoints.size())
+   {
+      const PageCheckpoint *next;
+
+      if (j == other.m_checkpoints.size() ||
+          (i < m_checkpoints.size() && m_checkpoints[i].offset <= other.m_checkpoints[j].offset))
+         next = &m_checkpoints[i++];
+      else
+         next = &other.m_checkpoints[j++];
+
+      if (merged.empty() || next->offset >= merged.back().offset + m_spacing)
+         merged.push_back(*next);
+   }
+
+   m_checkpoints.swap(merged);
+}
+
+PageCheckpoint PageCheckpoints::Find(unsigned long long offset) const
+{
+   PageCheckpoint found;
+   found.chunkOrdinal = 0;
+   found.offset = 0;
+   found.lastWasSpace = CleanupState().lastWasSpace;
+
+   size_t lo = 0;
+   size_t hi = m_checkpoints.size();
+
+   while (lo < hi)
+   {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (m_checkpoints[mid].offset <= offset)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   if (lo)
+      found = m_checkpoints[lo - 1];
+
+   return found;
+}
+
+PageReader::PageReader(ChunkSource & source, CleanupProfile profile)
+   : m_source(source), m_cleanUp(GetCleanupFunction(profile)), m_chunkOrdinal(0),
+     m_inText(false), m_end(false), m_pendingStart(0), m_offset(0)
+{
+   m_last.chunkOrdinal = 0;
+   m_last.offset = 0;
+   m_last.lastWasSpace = m_cleanupState.lastWasSpace;
+}
+
+bool PageReader::Seek(const PageCheckpoint & checkpoint)
+{
+   while (m_chunkOrdinal < checkpoint.chunkOrdinal)
+   {
+      ChunkInfo chunk;
+      ChunkRead read = m_source.NextChunk(chunk);
+
+      if (CHUNK_READ_END == read || CHUNK_READ_ERROR == read)
+         return false;
+
+      ++m_chunkOrdinal;
+   }
+
+   m_offset = checkpoint.offset;
+   m_cleanupState.lastWasSpace = checkpoint.lastWasSpace;
+   m_last = checkpoint;
+   return true;
+}
+
+// Reads ahead until there's some text pending or the source runs out.
+bool PageReader::Fill()
+{
+   if (m_pendingStart == m_pending.length())
+   {
+      m_pending.erase();
+      m_pendingStart = 0;
+   }
+
+   while (m_pendingStart == m_pending.length() && !m_end)
+   {
+      if (m_inText)
+      {
+         static const unsigned long cChunkSize = 4096;
+
+         wchar_t buf[cChunkSize + 1];
+         unsigned long chBuf = cChunkSize;
+
+         TextRead read = m_source.GetText(buf, &chBuf);
+
+         if (TEXT_READ_ERROR == read)
+            return false;
+
+         if (TEXT_READ_END == read)
+            chBuf = 0;
+
+         if (TEXT_READ_MORE != read)
+            m_inText = false;
+
+         size_t cch = m_cleanUp(chBuf, buf, m_cleanupState);
+         m_pending.append(buf, cch);
+         continue;
+      }
+
+      // nothing is pending, so this is exactly where the next chunk starts
+      PageCheckpoint checkpoint;
+      checkpoint.chunkOrdinal = m_chunkOrdinal;
+      checkpoint.offset = m_offset;
+      checkpoint.lastWasSpace = m_cleanupState.lastWasSpace;
+
+      ChunkInfo chunk;
+      ChunkRead read = m_source.NextChunk(chunk);
+
+      if (CHUNK_READ_ERROR == read)
+         return false;
+
+      if (CHUNK_READ_END == read)
+      {
+         m_end = true;
+         break;
+      }
+
+      ++m_chunkOrdinal;
+
+      if (CHUNK_READ_TEXT != read)
+         continue;
+
+      m_last = checkpoint;
+      m_checkpoints.Record(checkpoint);
+      m_inText = true;
+
+      const wchar_t *separator = NULL;
+
+      switch (chunk.breakType)
+      {
+         case TEXT_BREAK_EOW:
+            separator = L" ";
+            break;
+
+         case TEXT_BREAK_EOS:
+         case TEXT_BREAK_EOP:
+         case TEXT_BREAK_EOC:
+            separator = L"\r\n";
+            break;
+
+         default:
+            break;
+      }
+
+      if (separator)
+      {
+         wchar_t buf[3];
+         size_t cch = separator[1] ? 2 : 1;
+
+         buf[0] = separator[0];
+         buf[1] = separator[1];
+         cch = m_cleanUp(cch, buf, m_cleanupState);
+         m_pending.append(buf, cch);
+      }
+   }
+
+   return true;
+}
+
+bool PageReader::Read(unsigned long long start, size_t count, std::wstring & page)
+{
+   // skip up to start
+   while (m_offset < start)
+   {
+      if (!Fill())
+         return false;
+
+      size_t available = m_pending.length() - m_pendingStart;
+
+      if (0 == available)
+         return true;
+
+      size_t skip = start - m_offset < available ? static_cast<size_t>(start - m_offset) : available;
+      m_pendingStart += skip;
+      m_offset += skip;
+   }
+
+   while (count)
+   {
+      if (!Fill())
+         return false;
+
+      size_t available = m_pending.length() - m_pendingStart;
+
+      if (0 == available)
+         return true;
+
+      size_t take = count < available ? count : available;
+      page.append(m_pending, m_pendingStart, take);
+
+      m_pendingStart += take;
+      m_offset += take;
+      count -= take;
+   }
+
+   // look ahead so AtEnd() knows whether another page follows
+   return Fill();
+}
+
+std::wstring EncodePageToken(const PageToken & token)
+{
+   unsigned long long fields[7];
+   fields[0] = token.session;
+   fields[1] = token.stamp;
+   fields[2] = token.profile;
+   fields[3] = token.offset;
+   fields[4] = token.checkpoint.chunkOrdinal;
+   fields[5] = token.checkpoint.offset;
+   fields[6] = token.checkpoint.lastWasSpace ? 1 : 0;
+
+   return EncodeToken(c_tokenPrefix, fields, 7);
+}
+
+bool DecodePageToken(const wchar_t *text, size_t cch, PageToken & token)
+{
+   unsigned long long fields[7];
+
+   if (!DecodeToken(text, cch, c_tokenPrefix, fields, 7))
+      return false;
+
+   token.session = static_cast<unsigned long>(fields[0]);
+   token.stamp = fields[1];
+   token.profile = static_cast<unsigned long>(fields[2]);
+   token.offset = fields[3];
+   token.checkpoint.chunkOrdinal = static_cast<unsigned long>(fields[4]);
+   token.checkpoint.offset = fields[5];
+   token.checkpoint.lastWasSpace = 0 != fields[6];
+   return true;
+}
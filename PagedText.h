@@ -0,0 +1,133 @@
+// PagedText.h : Reads the cleaned-up text a page at a time from a chunk
+//               source that can be left open between pages, or reopened and
+//               fast-forwarded to a checkpoint without pulling earlier text
+
+#ifndef __PAGEDTEXT_H_
+#define __PAGEDTEXT_H_
+
+#include <string>
+#include <vector>
+
+#include "TextCleanup.h"
+#include "TextSink.h"
+
+enum ChunkRead
+{
+   CHUNK_READ_TEXT = 0,    // a text chunk, GetText may follow
+   CHUNK_READ_SKIP,        // a chunk without text (or one that's unavailable)
+   CHUNK_READ_END,
+   CHUNK_READ_ERROR,
+   CHUNK_READ_VALUE        // a value chunk, only from sources asked for them, see PropertyBag.h
+};
+
+enum TextRead
+{
+   TEXT_READ_MORE = 0,
+   TEXT_READ_LAST,         // the chunk has no more text after this
+   TEXT_READ_END,          // nothing returned, the chunk had no more text
+   TEXT_READ_ERROR
+};
+
+// The GetChunk/GetText half of an IFilter, so the paging logic can be driven
+// by something other than a filter.
+class ChunkSource
+{
+public:
+   virtual ~ChunkSource() {}
+
+   virtual ChunkRead NextChunk(ChunkInfo & chunk) = 0;
+
+   // *cch holds the room in buf on the way in, the characters returned on the way out.
+   virtual TextRead GetText(wchar_t *buf, unsigned long *cch) = 0;
+};
+
+// Where a text chunk starts in the cleaned-up text. Reopening the source
+// and calling NextChunk chunkOrdinal times (no GetText needed) gets back there.
+struct PageCheckpoint
+{
+   unsigned long chunkOrdinal;   // NextChunk calls before this chunk
+   unsigned long long offset;    // in the cleaned-up text, before the chunk's separator
+   bool lastWasSpace;            // CleanupState at that point
+};
+
+// Sparse, ordered list of checkpoints for one document.
+class PageCheckpoints
+{
+public:
+   // Keeps at most one checkpoint per spacing characters of text.
+   explicit PageCheckpoints(unsigned long spacing = 16384);
+
+   void Record(const PageCheckpoint & checkpoint);
+   void Merge(const PageCheckpoints & other);
+
+   // The last checkpoint at or before offset, the start of the text if there's none.
+   PageCheckpoint Find(unsigned long long offset) const;
+
+   size_t Count() const { return m_checkpoints.size(); }
+
+private:
+   unsigned long m_spacing;
+   std::vector<PageCheckpoint> m_checkpoints;
+};
+
+class PageReader
+{
+public:
+   PageReader(ChunkSource & source, CleanupProfile profile);
+
+   // Fast-forwards a fresh reader to the checkpoint by calling NextChunk
+   // without GetText. False if the source ran out of chunks on the way.
+   bool Seek(const PageCheckpoint & checkpoint);
+
+   // Appends the characters from start (which must be at or after Offset())
+   // to start + count, or to the end of the text, to page. False if the
+   // source failed.
+   bool Read(unsigned long long start, size_t count, std::wstring & page);
+
+   // Offset of the next character Read would return.
+   unsigned long long Offset() const { return m_offset; }
+
+   // There's no text left after Offset().
+   bool AtEnd() const { return m_end && m_pendingStart == m_pending.length(); }
+
+   // The chunk start at or before Offset() to resume from after reopening.
+   const PageCheckpoint & LastCheckpoint() const { return m_last; }
+
+   // Chunk starts seen so far, to keep for later readers of the same document.
+   const PageCheckpoints & Checkpoints() const { return m_checkpoints; }
+
+private:
+   bool Fill();
+
+   ChunkSource & m_source;
+   CleanupFunction m_cleanUp;
+   CleanupState m_cleanupState;
+
+   unsigned long m_chunkOrdinal;
+   bool m_inText;
+   bool m_end;
+
+   std::wstring m_pending;          // cleaned text read ahead of Offset()
+   size_t m_pendingStart;
+   unsigned long long m_offset;
+
+   PageCheckpoint m_last;
+   PageCheckpoints m_checkpoints;
+};
+
+// Continuation token for paged extraction, handed to the caller as an opaque string.
+struct PageToken
+{
+   unsigned long session;           // reader left open for the next page, 0 for none
+   unsigned long long stamp;        // identifies the version of the file
+   unsigned long profile;
+   unsigned long long offset;       // where the next page starts
+   PageCheckpoint checkpoint;
+};
+
+std::wstring EncodePageToken(const PageToken & token);
+
+// False if text isn't a token EncodePageToken produced.
+bool DecodePageToken(const wchar_t *text, size_t cch, PageToken & token);
+
+#endif //__PAGEDTEXT_H_
@@ -0,0 +1,1292 @@
+// PatternMatcher.cpp : Keyword and regular expression matching over the cleaned-up text
+
+#include <wchar.h>
+
+#include <algorithm>
+#include <map>
+
+#include "PatternMatcher.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define PATTERN_SSE2
+#include <emmintrin.h>
+#endif
+
+static const unsigned long c_noClass = ~0UL;
+static const unsigned long c_unbounded = ~0UL;
+static const unsigned long c_maxRepeat = 1000;
+static const size_t c_maxInstructions = 100000;   // per expression, {m,n} copies its operand
+static const unsigned c_maxDepth = 200;
+static const size_t c_maxSseStarts = 4;
+
+// \w and \b: letters, digits and the underscore, most of the non-ASCII
+// range being letters once CleanUpCharacters has folded the punctuation
+inline static bool IsWordCharacter(unsigned long c)
+{
+   if (c < 0x80)
+      return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || '_' == c;
+
+   if (c < 0xC0 || 0xD7 == c || 0xF7 == c)
+      return false;
+
+   if ((c >= 0x2000 && c <= 0x2BFF) || (c >= 0x3000 && c <= 0x303F) || (c >= 0xFE30 && c <= 0xFE6F))
+      return false;
+
+   return true;
+}
+
+inline static bool IsLineBreak(unsigned long c)
+{
+   return '\n' == c || '\r' == c;
+}
+
+#ifdef PATTERN_SSE2
+
+// Eight characters as 16-bit lanes, a 32-bit wchar_t saturating at 0x7FFF,
+// which no first character compared against is allowed to be.
+inline static __m128i LoadEight(const wchar_t *p)
+{
+   if (sizeof(wchar_t) == 2)
+      return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+
+   __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+   __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4));
+   return _mm_packs_epi32(lo, hi);
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// CharacterSet
+
+CharacterSet::CharacterSet()
+   : m_bits(0x10000 / 8, 0), m_highInverted(false)
+{
+}
+
+void CharacterSet::AddRange(unsigned long lo, unsigned long hi)
+{
+   for (unsigned long c = lo; c <= hi && c < 0x10000; ++c)
+      m_bits[c >> 3] |= static_cast<unsigned char>(1 << (c & 7));
+
+   if (hi >= 0x10000)
+   {
+      m_high.push_back(lo < 0x10000 ? 0x10000 : lo);
+      m_high.push_back(hi);
+   }
+}
+
+void CharacterSet::AddSet(const CharacterSet & other)
+{
+   for (size_t i = 0; i < m_bits.size(); ++i)
+      m_bits[i] |= other.m_bits[i];
+
+   if (!other.m_highInverted)
+      m_high.insert(m_high.end(), other.m_high.begin(), other.m_high.end());
+   else if (!(2 == other.m_high.size() && 0x10000 == other.m_high[0] && ~0UL == other.m_high[1]))
+      AddRange(0x10000, ~0UL);   // all of it, unless the other set held all of it before inverting
+}
+
+void CharacterSet::Invert()
+{
+   for (size_t i = 0; i < m_bits.size(); ++i)
+      m_bits[i] = static_cast<unsigned char>(~m_bits[i]);
+
+   m_highInverted = !m_highInverted;
+}
+
+bool CharacterSet::ContainsHigh(unsigned long c) const
+{
+   bool found = false;
+
+   for (size_t i = 0; i + 1 < m_high.size() && !found; i += 2)
+      found = c >= m_high[i] && c <= m_high[i + 1];
+
+   return found != m_highInverted;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// KeywordMatcher
+
+KeywordMatcher::KeywordMatcher()
+{
+}
+
+void KeywordMatcher::Build(const std::vector<std::wstring> & keywords)
+{
+   m_nodes.clear();
+   m_edges.clear();
+   m_lengths.assign(keywords.size(), 0);
+   m_nextKeyword.assign(keywords.size(), -1);
+   m_starts.clear();
+
+   // the trie, children in maps until the nodes are all there
+   std::vector<std::map<unsigned long, unsigned long> > children(1);
+   Node root = { 0, 0, -1, 0, 0 };
+   m_nodes.push_back(root);
+
+   for (size_t k = 0; k < keywords.size(); ++k)
+   {
+      unsigned long node = 0;
+
+      for (size_t i = 0; i < keywords[k].length(); ++i)
+      {
+         unsigned long c = static_cast<unsigned long>(keywords[k][i]);
+         std::map<unsigned long, unsigned long>::const_iterator it = children[node].find(c);
+
+         if (it != children[node].end())
+         {
+            node = it->second;
+            continue;
+         }
+
+         unsigned long child = static_cast<unsigned long>(m_nodes.size());
+         m_nodes.push_back(root);
+         children.push_back(std::map<unsigned long, unsigned long>());
+         children[node][c] = child;
+         node = child;
+      }
+
+      m_lengths[k] = static_cast<unsigned long>(keywords[k].length());
+      m_nextKeyword[k] = m_nodes[node].firstKeyword;
+      m_nodes[node].firstKeyword = static_cast<long>(k);
+   }
+
+   for (size_t n = 0; n < m_nodes.size(); ++n)
+   {
+      m_nodes[n].firstEdge = static_cast<unsigned long>(m_edges.size());
+      m_nodes[n].edgeCount = static_cast<unsigned long>(children[n].size());
+
+      for (std::map<unsigned long, unsigned long>::const_iterator it = children[n].begin(); it != children[n].end(); ++it)
+      {
+         Edge edge = { it->first, it->second };
+         m_edges.push_back(edge);
+      }
+   }
+
+   m_root.assign(0x10000, 0);
+
+   for (unsigned long e = 0; e < m_nodes[0].edgeCount; ++e)
+   {
+      const Edge & edge = m_edges[e];
+
+      if (edge.c < 0x10000)
+         m_root[edge.c] = edge.node;
+
+      if (m_nodes[0].edgeCount <= c_maxSseStarts && edge.c < 0x7FFF)
+         m_starts.push_back(edge.c);
+   }
+
+   if (m_starts.size() != m_nodes[0].edgeCount)
+      m_starts.clear();
+
+   // fail links breadth first, each from its parent's
+   std::vector<unsigned long> queue;
+   queue.push_back(0);
+
+   for (size_t q = 0; q < queue.size(); ++q)
+   {
+      unsigned long parent = queue[q];
+
+      for (unsigned long e = m_nodes[parent].firstEdge; e < m_nodes[parent].firstEdge + m_nodes[parent].edgeCount; ++e)
+      {
+         unsigned long child = m_edges[e].node;
+         unsigned long fail = 0 == parent ? 0 : Next(m_nodes[parent].fail, m_edges[e].c);
+
+         m_nodes[child].fail = fail;
+         m_nodes[child].output = m_nodes[fail].firstKeyword >= 0 ? fail : m_nodes[fail].output;
+         queue.push_back(child);
+      }
+   }
+}
+
+unsigned long KeywordMatcher::Child(unsigned long node, unsigned long c) const
+{
+   const Node & parent = m_nodes[node];
+   unsigned long lo = parent.firstEdge;
+   unsigned long hi = parent.firstEdge + parent.edgeCount;
+
+   while (lo < hi)
+   {
+      unsigned long mid = lo + (hi - lo) / 2;
+
+      if (m_edges[mid].c < c)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return lo < parent.firstEdge + parent.edgeCount && m_edges[lo].c == c ? m_edges[lo].node : 0;
+}
+
+unsigned long KeywordMatcher::Next(unsigned long state, unsigned long c) const
+{
+   while (state)
+   {
+      unsigned long child = Child(state, c);
+
+      if (child)
+         return child;
+
+      state = m_nodes[state].fail;
+   }
+
+   return c < 0x10000 ? m_root[c] : Child(0, c);
+}
+
+size_t KeywordMatcher::SkipToStart(const wchar_t *text, size_t start, size_t cch) const
+{
+   size_t i = start;
+
+#ifdef PATTERN_SSE2
+   // With only a few first characters, compare eight characters at a time
+   // against each; the table below takes over at the first possible hit.
+   if (!m_starts.empty())
+   {
+      __m128i first[c_maxSseStarts];
+
+      for (size_t s = 0; s < c_maxSseStarts; ++s)
+         first[s] = _mm_set1_epi16(static_cast<short>(m_starts[s < m_starts.size() ? s : 0]));
+
+      for (; i + 8 <= cch; i += 8)
+      {
+         __m128i v = LoadEight(text + i);
+         __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(v, first[0]), _mm_cmpeq_epi16(v, first[1])),
+                                    _mm_or_si128(_mm_cmpeq_epi16(v, first[2]), _mm_cmpeq_epi16(v, first[3])));
+
+         if (_mm_movemask_epi8(hit))
+            break;
+      }
+   }
+#endif
+
+   for (; i < cch; ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(text[i]);
+
+      if (0 != (c < 0x10000 ? m_root[c] : Child(0, c)))
+         break;
+   }
+
+   return i;
+}
+
+void KeywordMatcher::Report(unsigned long state, unsigned long long offset, std::vector<PatternMatch> & matches) const
+{
+   for (unsigned long node = state; node; node = m_nodes[node].output)
+   {
+      for (long k = m_nodes[node].firstKeyword; k >= 0; k = m_nextKeyword[k])
+      {
+         PatternMatch match;
+         match.pattern = static_cast<unsigned long>(k);
+         match.offset = offset + 1 - m_lengths[k];
+         match.length = m_lengths[k];
+         matches.push_back(match);
+      }
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Regular expressions
+
+enum RegexNodeKind
+{
+   NODE_CHAR = 0,
+   NODE_ANY,
+   NODE_CLASS,
+   NODE_ASSERT,
+   NODE_CONCAT,
+   NODE_ALTERNATE,
+   NODE_REPEAT
+};
+
+struct RegexNode
+{
+   RegexNodeKind kind;
+   unsigned long value;
+   unsigned long min;
+   unsigned long max;
+   std::vector<size_t> children;
+};
+
+// Recursive descent over one expression into a tree, literals folded on the way.
+class RegexParser
+{
+public:
+   RegexParser(const std::wstring & pattern, CleanupFunction cleanUp,
+               std::vector<CharacterSet> & classes, unsigned long *shorthands)
+      : m_pattern(pattern), m_pos(0), m_cleanUp(cleanUp), m_classes(classes), m_shorthands(shorthands)
+   {
+   }
+
+   bool Parse(size_t *root)
+   {
+      return Alternation(root, 0) && m_pos == m_pattern.length();
+   }
+
+   const RegexNode & Node(size_t index) const { return m_nodes[index]; }
+
+private:
+   bool At(wchar_t c) const { return m_pos < m_pattern.length() && c == m_pattern[m_pos]; }
+
+   size_t NewNode(RegexNodeKind kind, unsigned long value)
+   {
+      RegexNode node;
+      node.kind = kind;
+      node.value = value;
+      node.min = 0;
+      node.max = 0;
+      m_nodes.push_back(node);
+      return m_nodes.size() - 1;
+   }
+
+   // c as the text would have it, c itself if the profile drops it
+   unsigned long Fold(unsigned long c) const
+   {
+      if (c > 0xFFFF && sizeof(wchar_t) == 2)
+         return c;
+
+      wchar_t buf[2] = { static_cast<wchar_t>(c), 0 };
+      CleanupState state;
+      state.lastWasSpace = false;
+
+      return m_cleanUp(1, buf, state) ? static_cast<unsigned long>(buf[0]) : c;
+   }
+
+   bool Alternation(size_t *node, unsigned depth)
+   {
+      if (depth > c_maxDepth)
+         return false;
+
+      size_t first;
+
+      if (!Concatenation(&first, depth))
+         return false;
+
+      if (!At('|'))
+      {
+         *node = first;
+         return true;
+      }
+
+      size_t alternate = NewNode(NODE_ALTERNATE, 0);
+      m_nodes[alternate].children.push_back(first);
+
+      while (At('|'))
+      {
+         ++m_pos;
+
+         size_t next;
+
+         if (!Concatenation(&next, depth))
+            return false;
+
+         m_nodes[alternate].children.push_back(next);
+      }
+
+      *node = alternate;
+      return true;
+   }
+
+   bool Concatenation(size_t *node, unsigned depth)
+   {
+      size_t concat = NewNode(NODE_CONCAT, 0);
+
+      while (m_pos < m_pattern.length() && !At('|') && !At(')'))
+      {
+         size_t item;
+
+         if (!Repetition(&item, depth))
+            return false;
+
+         m_nodes[concat].children.push_back(item);
+      }
+
+      *node = concat;
+      return true;
+   }
+
+   bool Number(unsigned long *value)
+   {
+      size_t start = m_pos;
+      *value = 0;
+
+      while (m_pos < m_pattern.length() && m_pattern[m_pos] >= '0' && m_pattern[m_pos] <= '9' && *value <= c_maxRepeat)
+         *value = *value * 10 + (m_pattern[m_pos++] - '0');
+
+      return m_pos > start;
+   }
+
+   bool Repetition(size_t *node, unsigned depth)
+   {
+      size_t atom;
+
+      if (!Atom(&atom, depth))
+         return false;
+
+      for (;;)
+      {
+         unsigned long min;
+         unsigned long max;
+
+         if (At('*'))
+         {
+            min = 0;
+            max = c_unbounded;
+            ++m_pos;
+         }
+         else if (At('+'))
+         {
+            min = 1;
+            max = c_unbounded;
+            ++m_pos;
+         }
+         else if (At('?'))
+         {
+            min = 0;
+            max = 1;
+            ++m_pos;
+         }
+         else if (At('{'))
+         {
+            ++m_pos;
+
+            if (!Number(&min))
+               return false;
+
+            max = min;
+
+            if (At(','))
+            {
+               ++m_pos;
+
+               if (!Number(&max))
+                  max = c_unbounded;
+            }
+
+            if (!At('}'))
+               return false;
+
+            ++m_pos;
+         }
+         else
+         {
+            break;
+         }
+
+         // lazy or not, leftmost-longest comes out the same
+         if (At('?'))
+            ++m_pos;
+
+         if (min > c_maxRepeat || (max != c_unbounded && (max < min || max > c_maxRepeat)))
+            return false;
+
+         size_t repeat = NewNode(NODE_REPEAT, 0);
+         m_nodes[repeat].min = min;
+         m_nodes[repeat].max = max;
+         m_nodes[repeat].children.push_back(atom);
+         atom = repeat;
+      }
+
+      *node = atom;
+      return true;
+   }
+
+   bool Hex(size_t digits, unsigned long *value)
+   {
+      *value = 0;
+
+      for (size_t i = 0; i < digits; ++i, ++m_pos)
+      {
+         if (m_pos >= m_pattern.length())
+            return false;
+
+         unsigned long c = static_cast<unsigned long>(m_pattern[m_pos]);
+
+         if (c >= '0' && c <= '9')
+            *value = *value * 16 + (c - '0');
+         else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            *value = *value * 16 + ((c | 0x20) - 'a' + 10);
+         else
+            return false;
+      }
+
+      return true;
+   }
+
+   // The character an escape stands for, after the backslash.
+   bool Escaped(unsigned long *c)
+   {
+      if (m_pos >= m_pattern.length())
+         return false;
+
+      unsigned long e = static_cast<unsigned long>(m_pattern[m_pos++]);
+
+      switch (e)
+      {
+         case 'n':
+            *c = '\n';
+            return true;
+
+         case 'r':
+            *c = '\r';
+            return true;
+
+         case 't':
+            *c = '\t';
+            return true;
+
+         case 'x':
+            return Hex(2, c);
+
+         case 'u':
+            return Hex(4, c);
+
+         default:
+            // unknown letter and digit escapes are mistakes, not literals
+            if ((e >= '0' && e <= '9') || ((e | 0x20) >= 'a' && (e | 0x20) <= 'z'))
+               return false;
+
+            *c = e;
+            return true;
+      }
+   }
+
+   // \d \D \w \W \s \S, built once per program
+   bool Shorthand(wchar_t e, unsigned long *index)
+   {
+      static const wchar_t c_shorthands[] = L"dDwWsS";
+      const wchar_t *found = e ? wcschr(c_shorthands, e) : NULL;
+
+      if (NULL == found)
+         return false;
+
+      size_t which = found - c_shorthands;
+
+      if (c_noClass == m_shorthands[which])
+      {
+         CharacterSet set;
+
+         switch (which / 2)
+         {
+            case 0:
+               set.AddRange('0', '9');
+               break;
+
+            case 1:
+               for (unsigned long c = 0; c < 0x10000; ++c)
+               {
+                  if (IsWordCharacter(c))
+                     set.Add(c);
+               }
+
+               set.AddRange(0x10000, ~0UL);
+               break;
+
+            default:
+               set.AddRange('\t', '\r');
+               set.Add(' ');
+               set.Add(0xA0);
+               set.AddRange(0x2000, 0x200A);
+               set.AddRange(0x2028, 0x2029);
+               set.Add(0x3000);
+               break;
+         }
+
+         if (which & 1)
+            set.Invert();
+
+         m_classes.push_back(set);
+         m_shorthands[which] = static_cast<unsigned long>(m_classes.size() - 1);
+      }
+
+      *index = m_shorthands[which];
+      return true;
+   }
+
+   // Both the range and what the profile folds it to, so [A-Z] still
+   // matches once the text has been lowercased.
+   void AddFolded(CharacterSet & set, unsigned long lo, unsigned long hi) const
+   {
+      set.AddRange(lo, hi);
+
+      if (hi - lo > 0x1000)
+         return;
+
+      for (unsigned long c = lo; c <= hi; ++c)
+         set.Add(Fold(c));
+   }
+
+   bool Class(size_t *node)
+   {
+      CharacterSet set;
+      bool negate = At('^');
+
+      if (negate)
+         ++m_pos;
+
+      for (bool first = true; ; first = false)
+      {
+         if (m_pos >= m_pattern.length())
+            return false;
+
+         unsigned long lo = static_cast<unsigned long>(m_pattern[m_pos++]);
+
+         if (']' == lo && !first)
+            break;
+
+         if ('\\' == lo)
+         {
+            unsigned long index;
+
+            if (m_pos < m_pattern.length() && Shorthand(m_pattern[m_pos], &index))
+            {
+               ++m_pos;
+               set.AddSet(m_classes[index]);
+               continue;
+            }
+
+            if (!Escaped(&lo))
+               return false;
+         }
+
+         unsigned long hi = lo;
+
+         if (At('-') && m_pos + 1 < m_pattern.length() && ']' != m_pattern[m_pos + 1])
+         {
+            ++m_pos;
+            hi = static_cast<unsigned long>(m_pattern[m_pos++]);
+
+            if ('\\' == hi && !Escaped(&hi))
+               return false;
+
+            if (hi < lo)
+               return false;
+         }
+
+         AddFolded(set, lo, hi);
+      }
+
+      if (negate)
+         set.Invert();
+
+      m_classes.push_back(set);
+      *node = NewNode(NODE_CLASS, static_cast<unsigned long>(m_classes.size() - 1));
+      return true;
+   }
+
+   bool Atom(size_t *node, unsigned depth)
+   {
+      unsigned long c = static_cast<unsigned long>(m_pattern[m_pos++]);
+      unsigned long index;
+
+      switch (c)
+      {
+         case '(':
+            if (At('?'))
+            {
+               if (m_pos + 1 >= m_pattern.length() || ':' != m_pattern[m_pos + 1])
+                  return false;
+
+               m_pos += 2;
+            }
+
+            if (!Alternation(node, depth + 1) || !At(')'))
+               return false;
+
+            ++m_pos;
+            return true;
+
+         case '*':
+         case '+':
+         case '?':
+         case '{':
+            return false;     // nothing to repeat
+
+         case '[':
+            return Class(node);
+
+         case '.':
+            *node = NewNode(NODE_ANY, 0);
+            return true;
+
+         case '^':
+            *node = NewNode(NODE_ASSERT, REGEX_LINE_START);
+            return true;
+
+         case '$':
+            *node = NewNode(NODE_ASSERT, REGEX_LINE_END);
+            return true;
+
+         case '\\':
+            if (At('b') || At('B'))
+            {
+               *node = NewNode(NODE_ASSERT, At('b') ? REGEX_WORD_BOUNDARY : REGEX_NOT_WORD_BOUNDARY);
+               ++m_pos;
+               return true;
+            }
+
+            if (m_pos < m_pattern.length() && Shorthand(m_pattern[m_pos], &index))
+            {
+               ++m_pos;
+               *node = NewNode(NODE_CLASS, index);
+               return true;
+            }
+
+            if (!Escaped(&c))
+               return false;
+
+            break;
+
+         default:
+            break;
+      }
+
+      *node = NewNode(NODE_CHAR, Fold(c));
+      return true;
+   }
+
+   const std::wstring & m_pattern;
+   size_t m_pos;
+   CleanupFunction m_cleanUp;
+   std::vector<CharacterSet> & m_classes;
+   unsigned long *m_shorthands;
+   std::vector<RegexNode> m_nodes;
+};
+
+static size_t Emit(std::vector<RegexInstruction> & program, RegexOp op, unsigned long arg)
+{
+   RegexInstruction instruction = { op, arg, 0, 0 };
+   program.push_back(instruction);
+   return program.size() - 1;
+}
+
+// Thompson's construction. False once the program gets too big.
+static bool EmitNode(const RegexParser & parser, size_t index, std::vector<RegexInstruction> & program, size_t limit)
+{
+   if (program.size() > limit)
+      return false;
+
+   const RegexNode & node = parser.Node(index);
+
+   switch (node.kind)
+   {
+      case NODE_CHAR:
+         Emit(program, REGEX_CHAR, node.value);
+         return true;
+
+      case NODE_ANY:
+         Emit(program, REGEX_ANY, 0);
+         return true;
+
+      case NODE_CLASS:
+         Emit(program, REGEX_CLASS, node.value);
+         return true;
+
+      case NODE_ASSERT:
+         Emit(program, REGEX_ASSERT, node.value);
+         return true;
+
+      case NODE_CONCAT:
+         for (size_t i = 0; i < node.children.size(); ++i)
+         {
+            if (!EmitNode(parser, node.children[i], program, limit))
+               return false;
+         }
+
+         return true;
+
+      case NODE_ALTERNATE:
+      {
+         std::vector<size_t> jumps;
+
+         for (size_t i = 0; i + 1 < node.children.size(); ++i)
+         {
+            size_t split = Emit(program, REGEX_SPLIT, 0);
+            program[split].x = static_cast<unsigned long>(split + 1);
+
+            if (!EmitNode(parser, node.children[i], program, limit))
+               return false;
+
+            jumps.push_back(Emit(program, REGEX_JUMP, 0));
+            program[split].y = static_cast<unsigned long>(program.size());
+         }
+
+         if (!EmitNode(parser, node.children.back(), program, limit))
+            return false;
+
+         for (size_t i = 0; i < jumps.size(); ++i)
+            program[jumps[i]].x = static_cast<unsigned long>(program.size());
+
+         return true;
+      }
+
+      case NODE_REPEAT:
+      {
+         for (unsigned long i = 0; i < node.min; ++i)
+         {
+            if (!EmitNode(parser, node.children[0], program, limit))
+               return false;
+         }
+
+         if (c_unbounded == node.max)
+         {
+            size_t loop = Emit(program, REGEX_SPLIT, 0);
+            program[loop].x = static_cast<unsigned long>(loop + 1);
+
+            if (!EmitNode(parser, node.children[0], program, limit))
+               return false;
+
+            size_t jump = Emit(program, REGEX_JUMP, 0);
+            program[jump].x = static_cast<unsigned long>(loop);
+            program[loop].y = static_cast<unsigned long>(program.size());
+            return true;
+         }
+
+         std::vector<size_t> splits;
+
+         for (unsigned long i = node.min; i < node.max; ++i)
+         {
+            size_t split = Emit(program, REGEX_SPLIT, 0);
+            program[split].x = static_cast<unsigned long>(split + 1);
+            splits.push_back(split);
+
+            if (!EmitNode(parser, node.children[0], program, limit))
+               return false;
+         }
+
+         for (size_t i = 0; i < splits.size(); ++i)
+            program[splits[i]].y = static_cast<unsigned long>(program.size());
+
+         return true;
+      }
+   }
+
+   return false;
+}
+
+RegexProgram::RegexProgram()
+{
+   for (size_t i = 0; i < 6; ++i)
+      m_shorthands[i] = c_noClass;
+}
+
+bool RegexProgram::Add(const std::wstring & pattern, unsigned long id, CleanupFunction cleanUp)
+{
+   size_t start = m_program.size();
+   size_t classes = m_classes.size();
+
+   RegexParser parser(pattern, cleanUp, m_classes, m_shorthands);
+   size_t root;
+
+   if (pattern.empty() || !parser.Parse(&root) || !EmitNode(parser, root, m_program, start + c_maxInstructions))
+   {
+      m_program.resize(start);
+      m_classes.resize(classes, CharacterSet());
+
+      for (size_t i = 0; i < 6; ++i)
+      {
+         if (c_noClass != m_shorthands[i] && m_shorthands[i] >= classes)
+            m_shorthands[i] = c_noClass;
+      }
+
+      return false;
+   }
+
+   Emit(m_program, REGEX_MATCH, id);
+
+   m_expressionOf.resize(m_program.size(), static_cast<unsigned long>(m_starts.size()));
+   m_starts.push_back(static_cast<unsigned long>(start));
+   m_ids.push_back(id);
+
+   m_firsts.push_back(CharacterSet());
+   AddFirstCharacters(static_cast<unsigned long>(start), m_firsts.back());
+   m_first.AddSet(m_firsts.back());
+   return true;
+}
+
+// What the characters consumed first can be, assertions taken as met.
+void RegexProgram::AddFirstCharacters(unsigned long start, CharacterSet & first) const
+{
+   std::vector<bool> seen(m_program.size(), false);
+   std::vector<unsigned long> stack(1, start);
+
+   while (!stack.empty())
+   {
+      unsigned long pc = stack.back();
+      stack.pop_back();
+
+      if (seen[pc])
+         continue;
+
+      seen[pc] = true;
+
+      const RegexInstruction & instruction = m_program[pc];
+
+      switch (instruction.op)
+      {
+         case REGEX_CHAR:
+            first.Add(instruction.arg);
+            break;
+
+         case REGEX_ANY:
+            first.AddRange(0, ~0UL);
+            break;
+
+         case REGEX_CLASS:
+            first.AddSet(m_classes[instruction.arg]);
+            break;
+
+         case REGEX_SPLIT:
+            stack.push_back(instruction.y);
+            stack.push_back(instruction.x);
+            break;
+
+         case REGEX_JUMP:
+            stack.push_back(instruction.x);
+            break;
+
+         case REGEX_ASSERT:
+            stack.push_back(pc + 1);
+            break;
+
+         default:
+            break;
+      }
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// PatternSet
+
+PatternSet::PatternSet()
+   : m_profile(CLEANUP_DISPLAY), m_keywordCount(0)
+{
+}
+
+bool PatternSet::Compile(const std::vector<std::wstring> & keywords, const std::vector<std::wstring> & regexes,
+                         CleanupProfile profile, size_t *badPattern)
+{
+   CleanupFunction cleanUp = GetCleanupFunction(profile);
+   std::vector<std::wstring> folded(keywords.size());
+
+   m_profile = profile;
+   m_keywordCount = keywords.size();
+
+   for (size_t i = 0; i < keywords.size(); ++i)
+   {
+      std::vector<wchar_t> buf(keywords[i].begin(), keywords[i].end());
+      buf.push_back(0);
+
+      // mid-text, so a leading blank isn't taken for the start of the document
+      CleanupState state;
+      state.lastWasSpace = false;
+
+      size_t cch = cleanUp(keywords[i].length(), &buf[0], state);
+
+      if (0 == cch)
+      {
+         *badPattern = i;
+         return false;
+      }
+
+      folded[i].assign(&buf[0], cch);
+   }
+
+   m_keywords.Build(folded);
+   m_regexes = RegexProgram();
+
+   for (size_t i = 0; i < regexes.size(); ++i)
+   {
+      if (!m_regexes.Add(regexes[i], static_cast<unsigned long>(keywords.size() + i), cleanUp))
+      {
+         *badPattern = keywords.size() + i;
+         return false;
+      }
+   }
+
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// MatchSink
+
+MatchSink::MatchSink(const PatternSet & patterns, size_t maxMatches)
+   : m_patterns(patterns), m_maxMatches(maxMatches), m_state(0), m_keywordOffset(0),
+     m_offset(0), m_previous(0), m_marks(patterns.m_regexes.Size(), 0), m_generation(0)
+{
+   Candidate closed = { false, 0, 0 };
+
+   m_candidates.resize(patterns.m_regexes.Count(), closed);
+   m_lastEnd.resize(patterns.m_regexes.Count(), 0);
+}
+
+bool MatchSink::WantsMore() const
+{
+   return 0 == m_maxMatches || m_matches.size() < m_maxMatches;
+}
+
+void MatchSink::OnText(const wchar_t *text, size_t cch)
+{
+   if (!WantsMore())
+      return;
+
+   if (!m_patterns.m_keywords.Empty())
+      ScanKeywords(text, cch);
+
+   if (!m_patterns.m_regexes.Empty())
+      ScanRegexes(text, cch);
+}
+
+static bool MatchBefore(const PatternMatch & a, const PatternMatch & b)
+{
+   return a.offset != b.offset ? a.offset < b.offset : a.pattern < b.pattern;
+}
+
+void MatchSink::OnEnd()
+{
+   // the end of the text, unless the loop stopped early for us
+   if (WantsMore() && !m_patterns.m_regexes.Empty())
+      Step(0, true);
+
+   Settle(true);
+
+   std::stable_sort(m_matches.begin(), m_matches.end(), MatchBefore);
+
+   if (m_maxMatches && m_matches.size() > m_maxMatches)
+      m_matches.resize(m_maxMatches);
+}
+
+void MatchSink::ScanKeywords(const wchar_t *text, size_t cch)
+{
+   const KeywordMatcher & keywords = m_patterns.m_keywords;
+
+   for (size_t i = 0; i < cch; ++i)
+   {
+      if (0 == m_state)
+      {
+         i = keywords.SkipToStart(text, i, cch);
+
+         if (i == cch)
+            break;
+      }
+
+      m_state = keywords.Next(m_state, static_cast<unsigned long>(text[i]));
+
+      if (keywords.HasOutput(m_state))
+         keywords.Report(m_state, m_keywordOffset + i, m_matches);
+   }
+
+   m_keywordOffset += cch;
+}
+
+void MatchSink::ScanRegexes(const wchar_t *text, size_t cch)
+{
+   const CharacterSet & first = m_patterns.m_regexes.FirstCharacters();
+
+   for (size_t i = 0; i < cch; ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(text[i]);
+
+      // nothing under way and nothing can start here
+      if (m_pending.empty() && !first.Contains(c))
+      {
+         m_previous = c;
+         ++m_offset;
+         continue;
+      }
+
+      Step(c, false);
+   }
+}
+
+// One Pike VM step: the threads so far, then new ones starting at c, in
+// that order so the leftmost thread gets each instruction.
+void MatchSink::Step(unsigned long c, bool atEnd)
+{
+   const RegexProgram & regexes = m_patterns.m_regexes;
+
+   if (0 == ++m_generation)
+   {
+      std::fill(m_marks.begin(), m_marks.end(), 0);
+      m_generation = 1;
+   }
+
+   m_next.clear();
+
+   for (size_t i = 0; i < m_pending.size(); ++i)
+      AddThread(m_pending[i].pc, m_pending[i].start, c, atEnd);
+
+   if (!atEnd && regexes.FirstCharacters().Contains(c))
+   {
+      for (size_t r = 0; r < regexes.Count(); ++r)
+      {
+         if (regexes.FirstCharacters(r).Contains(c))
+            AddThread(regexes.Start(r), m_offset, c, atEnd);
+      }
+   }
+
+   m_pending.swap(m_next);
+
+   if (atEnd)
+      return;
+
+   m_previous = c;
+   ++m_offset;
+
+   if (!m_open.empty())
+      Settle(false);
+}
+
+// Follows pc through the instructions that don't consume anything, queueing
+// the threads that consume c for the next step.
+void MatchSink::AddThread(unsigned long pc, unsigned long long start, unsigned long c, bool atEnd)
+{
+   const RegexProgram & regexes = m_patterns.m_regexes;
+
+   m_stack.clear();
+   m_stack.push_back(pc);
+
+   while (!m_stack.empty())
+   {
+      pc = m_stack.back();
+      m_stack.pop_back();
+
+      if (m_marks[pc] == m_generation)
+         continue;
+
+      m_marks[pc] = m_generation;
+
+      const RegexInstruction & instruction = regexes.Instruction(pc);
+      bool consumed = false;
+      bool holds = false;
+
+      switch (instruction.op)
+      {
+         case REGEX_CHAR:
+            consumed = !atEnd && c == instruction.arg;
+            break;
+
+         case REGEX_ANY:
+            consumed = !atEnd && !IsLineBreak(c);
+            break;
+
+         case REGEX_CLASS:
+            consumed = !atEnd && regexes.Class(instruction.arg).Contains(c);
+            break;
+
+         case REGEX_SPLIT:
+            m_stack.push_back(instruction.y);
+            m_stack.push_back(instruction.x);
+            break;
+
+         case REGEX_JUMP:
+            m_stack.push_back(instruction.x);
+            break;
+
+         case REGEX_ASSERT:
+            switch (instruction.arg)
+            {
+               case REGEX_LINE_START:
+                  holds = 0 == m_offset || IsLineBreak(m_previous);
+                  break;
+
+               case REGEX_LINE_END:
+                  holds = atEnd || IsLineBreak(c);
+                  break;
+
+               default:
+               {
+                  bool before = 0 != m_offset && IsWordCharacter(m_previous);
+                  bool after = !atEnd && IsWordCharacter(c);
+                  holds = (before != after) == (REGEX_WORD_BOUNDARY == instruction.arg);
+                  break;
+               }
+            }
+
+            if (holds)
+               m_stack.push_back(pc + 1);
+
+            break;
+
+         case REGEX_MATCH:
+            Found(regexes.ExpressionOf(pc), start);
+            break;
+      }
+
+      if (consumed)
+      {
+         Thread thread = { pc + 1, start };
+         m_next.push_back(thread);
+      }
+   }
+}
+
+// A match of expression from start to here. It's held as a candidate while
+// a thread that started no later might still make it longer or move it left.
+void MatchSink::Found(unsigned long expression, unsigned long long start)
+{
+   // empty matches are never reported, nor ones overlapping the last
+   if (start == m_offset || start < m_lastEnd[expression])
+      return;
+
+   Candidate & candidate = m_candidates[expression];
+
+   if (!candidate.open)
+   {
+      candidate.open = true;
+      candidate.start = start;
+      candidate.end = m_offset;
+      m_open.push_back(expression);
+   }
+   else if (start < candidate.start || (start == candidate.start && m_offset > candidate.end))
+   {
+      candidate.start = start;
+      candidate.end = m_offset;
+   }
+}
+
+// Reports the candidates no running thread can improve on, all of them at the end.
+void MatchSink::Settle(bool all)
+{
+   const RegexProgram & regexes = m_patterns.m_regexes;
+
+   for (size_t i = 0; i < m_open.size(); )
+   {
+      unsigned long expression = m_open[i];
+      Candidate & candidate = m_candidates[expression];
+      bool running = false;
+
+      for (size_t t = 0; t < m_pending.size() && !all && !running; ++t)
+         running = regexes.ExpressionOf(m_pending[t].pc) == expression && m_pending[t].start <= candidate.start;
+
+      if (running)
+      {
+         ++i;
+         continue;
+      }
+
+      PatternMatch match;
+      match.pattern = regexes.Id(expression);
+      match.offset = candidate.start;
+      match.length = candidate.end - candidate.start;
+      m_matches.push_back(match);
+
+      m_lastEnd[expression] = candidate.end;
+      candidate.open = false;
+
+      // threads of the expression that started inside the match would overlap it
+      size_t kept = 0;
+
+      for (size_t t = 0; t < m_pending.size(); ++t)
+      {
+         if (regexes.ExpressionOf(m_pending[t].pc) != expression || m_pending[t].start >= candidate.end)
+            m_pending[kept++] = m_pending[t];
+      }
+
+      m_pending.resize(kept);
+
+      m_open[i] = m_open.back();
+      m_open.pop_back();
+   }
+}
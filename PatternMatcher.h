@@ -0,0 +1,245 @@
+// PatternMatcher.h : Keyword and regular expression matching over the
+//                    cleaned-up text as it streams out of the extraction loop
+
+#ifndef __PATTERNMATCHER_H_
+#define __PATTERNMATCHER_H_
+
+#include <string>
+#include <vector>
+
+#include "TextCleanup.h"
+#include "TextSink.h"
+
+struct PatternMatch
+{
+   unsigned long pattern;         // keywords first, then the regular expressions
+   unsigned long long offset;     // in the cleaned-up text
+   unsigned long long length;
+};
+
+// A bitmap over the BMP plus ranges for anything above it (32-bit wchar_t).
+class CharacterSet
+{
+public:
+   CharacterSet();
+
+   void Add(unsigned long c) { AddRange(c, c); }
+   void AddRange(unsigned long lo, unsigned long hi);
+   void AddSet(const CharacterSet & other);
+   void Invert();
+
+   bool Contains(unsigned long c) const
+   {
+      if (c < 0x10000)
+         return 0 != (m_bits[c >> 3] & (1 << (c & 7)));
+
+      return ContainsHigh(c);
+   }
+
+private:
+   bool ContainsHigh(unsigned long c) const;
+
+   std::vector<unsigned char> m_bits;
+   std::vector<unsigned long> m_high;   // lo, hi pairs
+   bool m_highInverted;
+};
+
+// Aho-Corasick automaton over the keywords. Nodes keep their children
+// sorted for a binary search, the root has a table for the BMP.
+class KeywordMatcher
+{
+public:
+   KeywordMatcher();
+
+   void Build(const std::vector<std::wstring> & keywords);
+   bool Empty() const { return m_lengths.empty(); }
+
+   // The state after c, 0 is the root.
+   unsigned long Next(unsigned long state, unsigned long c) const;
+
+   // Skips text the root stays in, from start. Returns where the next
+   // keyword could begin, cch if nowhere.
+   size_t SkipToStart(const wchar_t *text, size_t start, size_t cch) const;
+
+   // Reports the keywords ending in state, the last character at offset.
+   void Report(unsigned long state, unsigned long long offset, std::vector<PatternMatch> & matches) const;
+
+   bool HasOutput(unsigned long state) const
+   {
+      return m_nodes[state].firstKeyword >= 0 || 0 != m_nodes[state].output;
+   }
+
+private:
+   struct Node
+   {
+      unsigned long fail;
+      unsigned long output;     // nearest node down the fail links with keywords of its own
+      long firstKeyword;        // keywords ending here, chained through m_nextKeyword
+      unsigned long firstEdge;
+      unsigned long edgeCount;
+   };
+
+   struct Edge
+   {
+      unsigned long c;
+      unsigned long node;
+   };
+
+   unsigned long Child(unsigned long node, unsigned long c) const;
+
+   std::vector<Node> m_nodes;
+   std::vector<Edge> m_edges;
+   std::vector<unsigned long> m_root;      // BMP characters out of the root
+   std::vector<unsigned long> m_lengths;
+   std::vector<long> m_nextKeyword;
+   std::vector<unsigned long> m_starts;    // distinct first characters, while there are few
+};
+
+enum RegexOp
+{
+   REGEX_CHAR = 0,
+   REGEX_ANY,            // anything but a line break
+   REGEX_CLASS,
+   REGEX_SPLIT,          // x first, then y
+   REGEX_JUMP,
+   REGEX_ASSERT,
+   REGEX_MATCH
+};
+
+enum RegexAssert
+{
+   REGEX_LINE_START = 0,
+   REGEX_LINE_END,
+   REGEX_WORD_BOUNDARY,
+   REGEX_NOT_WORD_BOUNDARY
+};
+
+struct RegexInstruction
+{
+   RegexOp op;
+   unsigned long arg;    // character, class, assertion or the pattern matched
+   unsigned long x;
+   unsigned long y;
+};
+
+// Regular expressions compiled to one program for a Pike VM, so they all
+// advance together a character at a time and need no lookback into text
+// that has gone by. Supports literals, ., [...] and [^...] classes, \d \w \s
+// (and their negations), \b \B, ^ and $ at line breaks, \n \r \t \xHH
+// \uHHHH, groups, | and the * + ? {m} {m,} {m,n} quantifiers. Matches are
+// leftmost-longest and don't overlap other matches of the same expression.
+class RegexProgram
+{
+public:
+   RegexProgram();
+
+   // Literals are folded by cleanUp like the text. False if pattern doesn't parse.
+   bool Add(const std::wstring & pattern, unsigned long id, CleanupFunction cleanUp);
+
+   bool Empty() const { return m_starts.empty(); }
+   size_t Count() const { return m_starts.size(); }
+
+   const RegexInstruction & Instruction(unsigned long pc) const { return m_program[pc]; }
+   const CharacterSet & Class(unsigned long index) const { return m_classes[index]; }
+   const CharacterSet & FirstCharacters() const { return m_first; }
+   const CharacterSet & FirstCharacters(size_t expression) const { return m_firsts[expression]; }
+
+   size_t Size() const { return m_program.size(); }
+   unsigned long Start(size_t expression) const { return m_starts[expression]; }
+   unsigned long Id(size_t expression) const { return m_ids[expression]; }
+   unsigned long ExpressionOf(unsigned long pc) const { return m_expressionOf[pc]; }
+
+private:
+   void AddFirstCharacters(unsigned long start, CharacterSet & first) const;
+
+   std::vector<RegexInstruction> m_program;
+   std::vector<CharacterSet> m_classes;
+   std::vector<unsigned long> m_starts;
+   std::vector<unsigned long> m_ids;
+   std::vector<unsigned long> m_expressionOf;
+   unsigned long m_shorthands[6];        // classes for \d \D \w \W \s \S, shared by every expression
+   std::vector<CharacterSet> m_firsts;   // characters a match of each can start with
+   CharacterSet m_first;                 // and of any of them
+};
+
+// Compiled keywords and regular expressions. Only read once compiled, so
+// one set can serve any number of extractions at a time.
+class PatternSet
+{
+public:
+   PatternSet();
+
+   // Keywords and the regex literals are folded with profile, the way the
+   // text will be. False with *badPattern set to the index of the first empty
+   // keyword or regular expression that doesn't parse.
+   bool Compile(const std::vector<std::wstring> & keywords, const std::vector<std::wstring> & regexes,
+                CleanupProfile profile, size_t *badPattern);
+
+   CleanupProfile Profile() const { return m_profile; }
+   size_t Count() const { return m_keywordCount + m_regexes.Count(); }
+
+private:
+   friend class MatchSink;
+
+   CleanupProfile m_profile;
+   size_t m_keywordCount;
+   KeywordMatcher m_keywords;
+   RegexProgram m_regexes;
+};
+
+// Runs a pattern set over the text, carrying the automaton state and the
+// regex threads across buffers so matches spanning GetText calls are found.
+// Stops the extraction once maxMatches (if non-zero) have been found.
+class MatchSink : public TextSink
+{
+public:
+   MatchSink(const PatternSet & patterns, size_t maxMatches);
+
+   virtual void OnText(const wchar_t *text, size_t cch);
+   virtual bool WantsMore() const;
+   virtual void OnEnd();
+
+   // In order of offset, no more than maxMatches.
+   const std::vector<PatternMatch> & Matches() const { return m_matches; }
+
+private:
+   struct Thread
+   {
+      unsigned long pc;
+      unsigned long long start;
+   };
+
+   struct Candidate
+   {
+      bool open;
+      unsigned long long start;
+      unsigned long long end;
+   };
+
+   void ScanKeywords(const wchar_t *text, size_t cch);
+   void ScanRegexes(const wchar_t *text, size_t cch);
+   void Step(unsigned long c, bool atEnd);
+   void AddThread(unsigned long pc, unsigned long long start, unsigned long c, bool atEnd);
+   void Found(unsigned long expression, unsigned long long start);
+   void Settle(bool all);
+
+   const PatternSet & m_patterns;
+   size_t m_maxMatches;
+   std::vector<PatternMatch> m_matches;
+
+   unsigned long m_state;
+   unsigned long long m_keywordOffset;
+
+   unsigned long long m_offset;
+   unsigned long m_previous;
+   std::vector<Thread> m_pending;
+   std::vector<Thread> m_next;
+   std::vector<unsigned long> m_stack;
+   std::vector<unsigned long> m_marks;
+   unsigned long m_generation;
+   std::vector<Candidate> m_candidates;
+   std::vector<unsigned long long> m_lastEnd;
+   std::vector<unsigned long> m_open;
+};
+
+#endif //__PATTERNMATCHER_H_
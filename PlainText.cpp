@@ -0,0 +1,367 @@
+// PlainText.cpp : Built-in extraction path for plain text files
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "PlainText.h"
+#include "TextCleanup.h"
+
+TextEncoding DetectTextEncoding(const unsigned char *buf, size_t cb, size_t *bomLength)
+{
+   *bomLength = 0;
+
+   if (cb >= 3 && buf[0] == 0xEF && buf[1] == 0xBB && buf[2] == 0xBF)
+   {
+      *bomLength = 3;
+      return TEXT_ENCODING_UTF8;
+   }
+
+   if (cb >= 2 && buf[0] == 0xFF && buf[1] == 0xFE)
+   {
+      *bomLength = 2;
+      return TEXT_ENCODING_UTF16LE;
+   }
+
+   if (cb >= 2 && buf[0] == 0xFE && buf[1] == 0xFF)
+   {
+      *bomLength = 2;
+      return TEXT_ENCODING_UTF16BE;
+   }
+
+   // no BOM, so sniff the first few KB
+   size_t cbSample = cb < 4096 ? cb : 4096;
+   size_t evenNulls = 0;
+   size_t oddNulls = 0;
+   size_t controls = 0;
+
+   for (size_t i = 0; i < cbSample; ++i)
+   {
+      unsigned char b = buf[i];
+
+      if (0 == b)
+      {
+         if (i & 1)
+            ++oddNulls;
+         else
+            ++evenNulls;
+      }
+      else if (b < 0x20 && b != '\t' && b != '\n' && b != '\r' && b != '\f' && b != 0x1B)
+      {
+         ++controls;
+      }
+   }
+
+   // BOM-less UTF-16 has a NUL in (nearly) every other byte for Latin text
+   size_t cPairs = cbSample / 2;
+
+   if (cPairs && oddNulls > cPairs / 2 && evenNulls < cPairs / 16)
+      return TEXT_ENCODING_UTF16LE;
+
+   if (cPairs && evenNulls > cPairs / 2 && oddNulls < cPairs / 16)
+      return TEXT_ENCODING_UTF16BE;
+
+   if (evenNulls || oddNulls || controls * 10 > cbSample)
+      return TEXT_ENCODING_BINARY;
+
+   // decide between UTF-8 and ANSI by validating the sample
+   for (size_t i = 0; i < cbSample; )
+   {
+      unsigned char b = buf[i];
+      size_t cbSeq;
+
+      if (b < 0x80)
+         cbSeq = 1;
+      else if (b >= 0xC2 && b <= 0xDF)
+         cbSeq = 2;
+      else if (b >= 0xE0 && b <= 0xEF)
+         cbSeq = 3;
+      else if (b >= 0xF0 && b <= 0xF4)
+         cbSeq = 4;
+      else
+         return TEXT_ENCODING_ANSI;
+
+      if (i + cbSeq > cbSample)
+         break;   // sequence cut off by the end of the sample, give it the benefit of the doubt
+
+      for (size_t j = 1; j < cbSeq; ++j)
+      {
+         if ((buf[i + j] & 0xC0) != 0x80)
+            return TEXT_ENCODING_ANSI;
+      }
+
+      i += cbSeq;
+   }
+
+   return TEXT_ENCODING_UTF8;
+}
+
+inline static void PutCodePoint(unsigned long cp, wchar_t *dst, size_t & cch)
+{
+   if (cp > 0xFFFF && sizeof(wchar_t) == 2)
+   {
+      // surrogate pair, CleanUpCharacters will morph these to blanks
+      cp -= 0x10000;
+      dst[cch++] = static_cast<wchar_t>(0xD800 + (cp >> 10));
+      dst[cch++] = static_cast<wchar_t>(0xDC00 + (cp & 0x3FF));
+   }
+   else
+   {
+      dst[cch++] = static_cast<wchar_t>(cp);
+   }
+}
+
+static size_t DecodeUtf8(const unsigned char *src, size_t cb, wchar_t *dst, size_t *cchOut, bool final)
+{
+   size_t cch = 0;
+   size_t i = 0;
+
+   while (i < cb)
+   {
+      unsigned char b = src[i];
+
+      if (b < 0x80)
+      {
+         dst[cch++] = b;
+         ++i;
+         continue;
+      }
+
+      size_t cbSeq;
+      unsigned long cp;
+      unsigned long cpMin;
+
+      if (b >= 0xC2 && b <= 0xDF)
+      {
+         cbSeq = 2;
+         cp = b & 0x1F;
+         cpMin = 0x80;
+      }
+      else if (b >= 0xE0 && b <= 0xEF)
+      {
+         cbSeq = 3;
+         cp = b & 0x0F;
+         cpMin = 0x800;
+      }
+      else if (b >= 0xF0 && b <= 0xF4)
+      {
+         cbSeq = 4;
+         cp = b & 0x07;
+         cpMin = 0x10000;
+      }
+      else
+      {
+         dst[cch++] = b;   // stray byte, treat as Latin-1
+         ++i;
+         continue;
+      }
+
+      if (i + cbSeq > cb)
+      {
+         if (!final)
+            break;         // wait for the rest of the sequence
+
+         dst[cch++] = b;
+         ++i;
+         continue;
+      }
+
+      bool valid = true;
+
+      for (size_t j = 1; j < cbSeq; ++j)
+      {
+         unsigned char c = src[i + j];
+
+         if ((c & 0xC0) != 0x80)
+         {
+            valid = false;
+            break;
+         }
+
+         cp = (cp << 6) | (c & 0x3F);
+      }
+
+      if (!valid || cp < cpMin || cp > 0x10FFFF)
+      {
+         dst[cch++] = b;
+         ++i;
+         continue;
+      }
+
+      PutCodePoint(cp, dst, cch);
+      i += cbSeq;
+   }
+
+   *cchOut = cch;
+   return i;
+}
+
+static size_t DecodeUtf16(const unsigned char *src, size_t cb, wchar_t *dst, size_t *cchOut, bool bigEndian, bool final)
+{
+   size_t cch = 0;
+   size_t i = 0;
+   int lo = bigEndian ? 1 : 0;
+   int hi = bigEndian ? 0 : 1;
+
+   while (i + 2 <= cb)
+   {
+      unsigned long unit = src[i + lo] | (src[i + hi] << 8);
+
+      if (sizeof(wchar_t) > 2 && unit >= 0xD800 && unit <= 0xDBFF)
+      {
+         if (i + 4 > cb)
+         {
+            if (!final)
+               break;      // wait for the low surrogate
+         }
+         else
+         {
+            unsigned long low = src[i + 2 + lo] | (src[i + 2 + hi] << 8);
+
+            if (low >= 0xDC00 && low <= 0xDFFF)
+            {
+               PutCodePoint(0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00), dst, cch);
+               i += 4;
+               continue;
+            }
+         }
+      }
+
+      dst[cch++] = static_cast<wchar_t>(unit);
+      i += 2;
+   }
+
+   if (final && i < cb)
+      dst[cch++] = src[i++];   // odd trailing byte
+
+   *cchOut = cch;
+   return i;
+}
+
+// Text without a BOM that isn't UTF-8 or UTF-16. On Windows it is in the
+// system's ANSI code page, as the system text filter reads it (smart quotes
+// and dashes in 0x80-0x9F for Western European, double-byte characters for
+// East Asian ones); elsewhere there's no such thing and it goes as Latin-1.
+static size_t DecodeAnsi(const unsigned char *src, size_t cb, wchar_t *dst, size_t *cchOut, bool final)
+{
+#ifdef _WIN32
+   size_t cbWhole = cb;
+
+   // a double-byte character cut at the end waits for the rest
+   if (!final)
+   {
+      size_t i = 0;
+
+      while (i < cb)
+         i += ::IsDBCSLeadByte(src[i]) ? 2 : 1;
+
+      if (i > cb)
+         cbWhole = cb - 1;
+   }
+
+   int cch = 0;
+
+   if (cbWhole)
+      cch = ::MultiByteToWideChar(CP_ACP, 0, reinterpret_cast<const char *>(src), static_cast<int>(cbWhole), dst, static_cast<int>(cbWhole));
+
+   *cchOut = cch;
+   return cbWhole;
+#else
+   (void)final;
+
+   for (size_t i = 0; i < cb; ++i)
+      dst[i] = src[i];
+
+   *cchOut = cb;
+   return cb;
+#endif
+}
+
+size_t DecodeText(TextEncoding encoding, const unsigned char *src, size_t cb,
+                  wchar_t *dst, size_t *cchOut, bool final)
+{
+   switch (encoding)
+   {
+      case TEXT_ENCODING_UTF8:
+         return DecodeUtf8(src, cb, dst, cchOut, final);
+
+      case TEXT_ENCODING_UTF16LE:
+         return DecodeUtf16(src, cb, dst, cchOut, false, final);
+
+      case TEXT_ENCODING_UTF16BE:
+         return DecodeUtf16(src, cb, dst, cchOut, true, final);
+
+      default:
+         return DecodeAnsi(src, cb, dst, cchOut, final);
+   }
+}
+
+bool ExtractPlainText(const unsigned char *buf, size_t cb, size_t maxLength,
+                      CleanupProfile profile, std::wstring & text, bool *truncated)
+{
+   *truncated = false;
+
+   size_t bomLength = 0;
+   TextEncoding encoding = DetectTextEncoding(buf, cb, &bomLength);
+
+   if (TEXT_ENCODING_BINARY == encoding)
+      return false;
+
+   // same block size the IFilter path hands to CleanUpCharacters
+   static const size_t cChunkSize = 4096;
+   wchar_t chunk[cChunkSize + 1];
+
+   CleanupFunction cleanUp = GetCleanupFunction(profile);
+   CleanupState cleanupState;
+
+   size_t pos = bomLength;
+
+   while (pos < cb)
+   {
+      if (maxLength && text.length() > maxLength)
+      {
+         *truncated = true;
+         break;
+      }
+
+      size_t cbBlock = cb - pos;
+      bool final = true;
+
+      if (cbBlock > cChunkSize)
+      {
+         cbBlock = cChunkSize;
+         final = false;
+      }
+
+      size_t cch = 0;
+      size_t consumed = DecodeText(encoding, buf + pos, cbBlock, chunk, &cch, final);
+
+      if (0 == consumed)
+         consumed = DecodeText(encoding, buf + pos, cbBlock, chunk, &cch, true);
+
+      pos += consumed;
+
+      cch = cleanUp(cch, chunk, cleanupState);
+      text.append(chunk, cch);
+   }
+
+   return true;
+}
+
+bool IsPlainTextExtension(const std::wstring & extension)
+{
+   static const wchar_t * const c_extensions[] =
+   {
+      L".txt", L".text", L".log", L".csv", L".tsv", L".md", L".ini", L".cfg", L".json", L".ndjson", L".jsonl"
+   };
+
+   for (size_t i = 0; i < sizeof(c_extensions) / sizeof(c_extensions[0]); ++i)
+   {
+      if (extension == c_extensions[i])
+         return true;
+   }
+
+   return false;
+}
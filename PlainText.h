@@ -0,0 +1,44 @@
+// PlainText.h : Built-in extraction path for plain text files
+
+#ifndef __PLAINTEXT_H_
+#define __PLAINTEXT_H_
+
+#include <stddef.h>
+#include <string>
+
+#include "TextCleanup.h"
+
+enum TextEncoding
+{
+   TEXT_ENCODING_BINARY = 0,  // doesn't look like text at all
+   TEXT_ENCODING_UTF8,
+   TEXT_ENCODING_UTF16LE,
+   TEXT_ENCODING_UTF16BE,
+   TEXT_ENCODING_ANSI         // the ANSI code page on Windows, Latin-1 elsewhere
+};
+
+// Looks at the first cb bytes of a file and decides how it is encoded.
+// *bomLength receives the number of leading bytes to skip (byte order mark).
+TextEncoding DetectTextEncoding(const unsigned char *buf, size_t cb, size_t *bomLength);
+
+// Decodes as many complete characters from src[0..cb) as possible into dst,
+// which must have room for cb characters. *cchOut receives the number of
+// characters written. Returns the number of bytes consumed; a trailing partial
+// sequence is left for the next call unless final is set, in which case it is
+// decoded byte-wise.
+size_t DecodeText(TextEncoding encoding, const unsigned char *src, size_t cb,
+                  wchar_t *dst, size_t *cchOut, bool final);
+
+// Decodes and cleans up an in-memory file image with the given profile the
+// same way the IFilter path does, stopping once more than maxLength (if non-zero) characters have
+// been produced. Returns false if the buffer doesn't look like text,
+// *truncated is set if maxLength cut the text short.
+bool ExtractPlainText(const unsigned char *buf, size_t cb, size_t maxLength,
+                      CleanupProfile profile, std::wstring & text, bool *truncated);
+
+// True for extensions (lowercased, with the dot, see FilterKey) that are
+// plain text by convention, so they can be read directly rather than
+// through a filter. The content still has to look like text.
+bool IsPlainTextExtension(const std::wstring & extension);
+
+#endif //__PLAINTEXT_H_
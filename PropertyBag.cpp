@@ -0,0 +1,344 @@
+// PropertyBag.cpp : Property names, the bounded bag and the text and value loop
+
+#include "PropertyBag.h"
+
+struct KnownProperty
+{
+   const wchar_t *set;
+   unsigned long id;
+   const wchar_t *name;
+};
+
+static const wchar_t c_summaryInformation[] = L"{F29F85E0-4FF9-1068-AB91-08002B27B3D9}";
+static const wchar_t c_documentSummaryInformation[] = L"{D5CDD502-2E9C-101B-9397-08002B2CF9AE}";
+static const wchar_t c_storage[] = L"{B725F130-47EF-101A-A5F1-02608C9EEBAC}";
+
+static const KnownProperty c_knownProperties[] =
+{
+   { c_summaryInformation, 2, L"System.Title" },
+   { c_summaryInformation, 3, L"System.Subject" },
+   { c_summaryInformation, 4, L"System.Author" },
+   { c_summaryInformation, 5, L"System.Keywords" },
+   { c_summaryInformation, 6, L"System.Comment" },
+   { c_summaryInformation, 7, L"System.Document.Template" },
+   { c_summaryInformation, 8, L"System.Document.LastAuthor" },
+   { c_summaryInformation, 9, L"System.Document.RevisionNumber" },
+   { c_summaryInformation, 10, L"System.Document.TotalEditingTime" },
+   { c_summaryInformation, 11, L"System.Document.DatePrinted" },
+   { c_summaryInformation, 12, L"System.Document.DateCreated" },
+   { c_summaryInformation, 13, L"System.Document.DateSaved" },
+   { c_summaryInformation, 14, L"System.Document.PageCount" },
+   { c_summaryInformation, 15, L"System.Document.WordCount" },
+   { c_summaryInformation, 16, L"System.Document.CharacterCount" },
+   { c_summaryInformation, 18, L"System.ApplicationName" },
+   { c_documentSummaryInformation, 2, L"System.Category" },
+   { c_documentSummaryInformation, 5, L"System.Document.LineCount" },
+   { c_documentSummaryInformation, 6, L"System.Document.ParagraphCount" },
+   { c_documentSummaryInformation, 7, L"System.Presentation.SlideCount" },
+   { c_documentSummaryInformation, 14, L"System.Document.Manager" },
+   { c_documentSummaryInformation, 15, L"System.Company" },
+   { c_storage, 10, L"System.ItemNameDisplay" },
+   { c_storage, 12, L"System.Size" },
+   { c_storage, 14, L"System.DateModified" },
+   { c_storage, 15, L"System.DateCreated" },
+   { c_storage, 16, L"System.DateAccessed" }
+};
+
+// Byte order of the GUID's text form over its in-memory layout: Data1,
+// Data2 and Data3 are little-endian, Data4 goes as it is.
+static const int c_guidOrder[16] = { 3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+std::wstring FormatPropertySet(const unsigned char set[16])
+{
+   static const wchar_t c_hex[] = L"0123456789ABCDEF";
+   std::wstring text(L"{");
+
+   for (int i = 0; i < 16; ++i)
+   {
+      if (4 == i || 6 == i || 8 == i || 10 == i)
+         text += L'-';
+
+      unsigned char b = set[c_guidOrder[i]];
+      text += c_hex[b >> 4];
+      text += c_hex[b & 0x0F];
+   }
+
+   text += L'}';
+   return text;
+}
+
+static int HexDigit(wchar_t c)
+{
+   if (c >= L'0' && c <= L'9')
+      return c - L'0';
+
+   if (c >= L'a' && c <= L'f')
+      return c - L'a' + 10;
+
+   if (c >= L'A' && c <= L'F')
+      return c - L'A' + 10;
+
+   return -1;
+}
+
+bool ParsePropertySet(const wchar_t *text, unsigned char set[16])
+{
+   bool braced = L'{' == *text;
+
+   if (braced)
+      ++text;
+
+   for (int i = 0; i < 16; ++i)
+   {
+      if ((4 == i || 6 == i || 8 == i || 10 == i) && L'-' != *text++)
+         return false;
+
+      int high = HexDigit(*text++);
+
+      if (high < 0)
+         return false;
+
+      int low = HexDigit(*text++);
+
+      if (low < 0)
+         return false;
+
+      set[c_guidOrder[i]] = static_cast<unsigned char>(high << 4 | low);
+   }
+
+   if (braced && L'}' != *text++)
+      return false;
+
+   return 0 == *text;
+}
+
+std::wstring PropertyName(const PropertyKey & key)
+{
+   std::wstring set = FormatPropertySet(key.set);
+
+   if (!key.name.empty())
+      return set + L" " + key.name;
+
+   for (size_t i = 0; i < sizeof(c_knownProperties) / sizeof(c_knownProperties[0]); ++i)
+   {
+      if (key.id == c_knownProperties[i].id && set == c_knownProperties[i].set)
+         return c_knownProperties[i].name;
+   }
+
+   wchar_t digits[12];
+   size_t cch = 0;
+   unsigned long id = key.id;
+
+   do
+   {
+      digits[cch++] = static_cast<wchar_t>(L'0' + id % 10);
+      id /= 10;
+   } while (id);
+
+   set += L' ';
+
+   while (cch)
+      set += digits[--cch];
+
+   return set;
+}
+
+PropertyBag::PropertyBag(size_t maxProperties, size_t maxChars)
+   : m_maxProperties(maxProperties), m_maxChars(maxChars), m_chars(0)
+{
+}
+
+bool PropertyBag::Add(const PropertyKey & key, const PropertyValue & value)
+{
+   std::wstring name = PropertyName(key);
+   Property *existing = NULL;
+
+   for (size_t i = 0; i < m_properties.size(); ++i)
+   {
+      if (m_properties[i].name == name)
+      {
+         existing = &m_properties[i];
+         break;
+      }
+   }
+
+   size_t room = m_maxChars - m_chars;
+
+   if (existing)
+   {
+      if (PROPERTY_STRING != existing->value.type || PROPERTY_STRING != value.type)
+         return true;
+
+      static const wchar_t c_separator[] = L"; ";
+      size_t cchSeparator = sizeof(c_separator) / sizeof(c_separator[0]) - 1;
+
+      // a value it already has (filters repeat some in their own stream)
+      if (value.text.empty())
+         return true;
+
+      const std::wstring & text = existing->value.text;
+
+      for (size_t start = 0; start <= text.length(); )
+      {
+         size_t end = text.find(c_separator, start);
+
+         if (std::wstring::npos == end)
+            end = text.length();
+
+         if (0 == text.compare(start, end - start, value.text))
+            return true;
+
+         start = end + cchSeparator;
+      }
+
+      if (room <= cchSeparator)
+         return false;
+
+      size_t cch = value.text.length() < room - cchSeparator ? value.text.length() : room - cchSeparator;
+
+      existing->value.text.append(c_separator);
+      existing->value.text.append(value.text, 0, cch);
+      m_chars += cchSeparator + cch;
+
+      return cch == value.text.length();
+   }
+
+   if (m_properties.size() >= m_maxProperties)
+      return false;
+
+   // the names count against the budget too, a filter can make up any number of them
+   if (room < name.length())
+      return false;
+
+   room -= name.length();
+
+   Property property;
+   property.name = name;
+   property.value = value;
+
+   bool whole = true;
+
+   if (PROPERTY_STRING == value.type && value.text.length() > room)
+   {
+      property.value.text.resize(room);
+      whole = false;
+   }
+
+   m_chars += name.length() + property.value.text.length();
+   m_properties.push_back(property);
+
+   return whole;
+}
+
+const Property * PropertyBag::Find(const std::wstring & name) const
+{
+   for (size_t i = 0; i < m_properties.size(); ++i)
+   {
+      if (m_properties[i].name == name)
+         return &m_properties[i];
+   }
+
+   return NULL;
+}
+
+static void AppendSeparator(TextSink & sink, TextBreak breakType, CleanupFunction cleanUp, CleanupState & cleanupState)
+{
+   wchar_t buf[2];
+   size_t cch;
+
+   switch (breakType)
+   {
+      case TEXT_BREAK_EOW:
+         buf[0] = L' ';
+         cch = 1;
+         break;
+
+      case TEXT_BREAK_EOS:
+      case TEXT_BREAK_EOP:
+      case TEXT_BREAK_EOC:
+         buf[0] = L'\r';
+         buf[1] = L'\n';
+         cch = 2;
+         break;
+
+      default:
+         return;
+   }
+
+   cch = cleanUp(cch, buf, cleanupState);
+   sink.OnText(buf, cch);
+}
+
+PullResult PullChunks(ValueChunkSource & source, CleanupProfile profile, TextSink & sink, PropertyBag & properties)
+{
+   const int cChunkSize = 4096;
+
+   CleanupFunction cleanUp = GetCleanupFunction(profile);
+   CleanupState cleanupState;
+
+   PullResult result = PULL_DONE;
+
+   while (PULL_DONE == result)
+   {
+      if (!sink.WantsMore())
+      {
+         result = PULL_STOPPED;
+         break;
+      }
+
+      ChunkInfo chunk;
+      ChunkRead read = source.NextChunk(chunk);
+
+      if (CHUNK_READ_ERROR == read)
+         return PULL_ERROR;
+
+      if (CHUNK_READ_END == read)
+         break;
+
+      if (CHUNK_READ_SKIP == read)
+         continue;
+
+      if (CHUNK_READ_VALUE == read)
+      {
+         PropertyKey key;
+         PropertyValue value;
+
+         // a full bag only drops the value, the text goes on
+         if (source.GetValue(key, value))
+            properties.Add(key, value);
+
+         continue;
+      }
+
+      sink.OnChunk(chunk);
+      AppendSeparator(sink, chunk.breakType, cleanUp, cleanupState);
+
+      for (;;)
+      {
+         wchar_t buf[cChunkSize];
+         unsigned long chBuf = cChunkSize;
+         TextRead text = source.GetText(buf, &chBuf);
+
+         if (TEXT_READ_ERROR == text)
+            return PULL_ERROR;
+
+         if (TEXT_READ_END == text)
+            break;
+
+         size_t cch = cleanUp(chBuf, buf, cleanupState);
+         sink.OnText(buf, cch);
+
+         if (!sink.WantsMore())
+         {
+            result = PULL_STOPPED;
+            break;
+         }
+
+         if (TEXT_READ_LAST == text)
+            break;
+      }
+   }
+
+   sink.OnEnd();
+   return result;
+}
@@ -0,0 +1,107 @@
+// PropertyBag.h : Typed properties gathered from a filter's value chunks in
+//                 the same GetChunk loop that pulls its text
+
+#ifndef __PROPERTYBAG_H_
+#define __PROPERTYBAG_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "PagedText.h"
+#include "TextCleanup.h"
+#include "TextSink.h"
+
+enum PropertyType
+{
+   PROPERTY_STRING = 0,
+   PROPERTY_INTEGER,
+   PROPERTY_REAL,
+   PROPERTY_BOOLEAN,
+   PROPERTY_TIME              // FILETIME, 100 ns ticks since 1601 UTC
+};
+
+// A value chunk's FULLPROPSPEC.
+struct PropertyKey
+{
+   unsigned char set[16];     // property set GUID, laid out as in memory
+   unsigned long id;          // property id, unused when name is set
+   std::wstring name;         // the name of a named property
+};
+
+struct PropertyValue
+{
+   PropertyType type;
+   std::wstring text;         // PROPERTY_STRING, vectors of strings joined with "; "
+   long long integer;         // PROPERTY_INTEGER and PROPERTY_TIME, 0 or 1 for PROPERTY_BOOLEAN
+   double real;               // PROPERTY_REAL
+};
+
+struct Property
+{
+   std::wstring name;         // see PropertyName
+   PropertyValue value;
+};
+
+// "{F29F85E0-4FF9-1068-AB91-08002B27B3D9}" for the set's GUID.
+std::wstring FormatPropertySet(const unsigned char set[16]);
+
+// The other way round, braces optional. False if text isn't a GUID.
+bool ParsePropertySet(const wchar_t *text, unsigned char set[16]);
+
+// The property system's canonical name for the summary, document summary
+// and storage properties ("System.Title"), "{set} id" or "{set} name" for
+// the rest.
+std::wstring PropertyName(const PropertyKey & key);
+
+// The properties of one document, in the order the filter first gave them.
+// A filter that gives a string property more than once (one chunk per
+// author, say) has the values joined with "; "; for other types the first
+// value stands. Bounded in both the number of properties and the
+// characters of all the strings together, whatever doesn't fit is dropped.
+class PropertyBag
+{
+public:
+   explicit PropertyBag(size_t maxProperties = 256, size_t maxChars = 65536);
+
+   // False if the value was dropped for want of room.
+   bool Add(const PropertyKey & key, const PropertyValue & value);
+
+   size_t Count() const { return m_properties.size(); }
+   const Property & At(size_t i) const { return m_properties[i]; }
+
+   // NULL if there's no property of that name.
+   const Property * Find(const std::wstring & name) const;
+
+private:
+   std::vector<Property> m_properties;
+   size_t m_maxProperties;
+   size_t m_maxChars;
+   size_t m_chars;
+};
+
+// A chunk source that can also return the chunks holding values, as
+// CHUNK_READ_VALUE. Only sources asked for values return them, so the
+// paging and sampling readers never see one.
+class ValueChunkSource : public ChunkSource
+{
+public:
+   // The value of the chunk NextChunk just returned CHUNK_READ_VALUE for.
+   // False if it has none, or of a type the bag doesn't keep.
+   virtual bool GetValue(PropertyKey & key, PropertyValue & value) = 0;
+};
+
+enum PullResult
+{
+   PULL_DONE = 0,             // the chunks ran out
+   PULL_STOPPED,              // the sink didn't want more
+   PULL_ERROR                 // the source failed
+};
+
+// The extraction loop over a source that has values as well: text chunks
+// are cleaned up with the profile and passed to sink with the usual chunk
+// separators, values go into properties. Stops with the sink, so values
+// that come after the text was cut short are missed.
+PullResult PullChunks(ValueChunkSource & source, CleanupProfile profile, TextSink & sink, PropertyBag & properties);
+
+#endif //__PROPERTYBAG_H_
@@ -0,0 +1,488 @@
+// SampledText.cpp : Head, tail and interior window samples of a document
+
+#include "PlainText.h"
+#include "SampledText.h"
+
+// sniffed for the encoding, like the other plain text paths
+static const size_t c_sniffBytes = 4096;
+
+static unsigned long long SampleBudget(const SampleSpec & spec)
+{
+   return static_cast<unsigned long long>(spec.headLength) + spec.tailLength +
+          static_cast<unsigned long long>(spec.windowCount) * spec.windowLength;
+}
+
+static void AddSample(std::vector<TextSample> & samples, SampleKind kind, unsigned long long position,
+                      const wchar_t *text, size_t cch, CleanupProfile profile)
+{
+   if (0 == cch)
+      return;
+
+   TextSample sample;
+   sample.kind = kind;
+   sample.position = position;
+
+   // each sample on its own, as if it started the document
+   std::vector<wchar_t> buf(text, text + cch);
+   buf.push_back(0);
+
+   CleanupState state;
+   size_t cleaned = GetCleanupFunction(profile)(cch, &buf[0], state);
+
+   sample.text.assign(&buf[0], cleaned);
+   samples.push_back(sample);
+}
+
+// Start of window index of count, centred in equal slices of [first, end).
+static unsigned long long WindowStart(unsigned long long first, unsigned long long end, unsigned long long length,
+                                      unsigned long index, unsigned long count)
+{
+   unsigned long long centre = first + (end - first) * (2 * index + 1) / (2 * static_cast<unsigned long long>(count));
+   unsigned long long start = centre > first + length / 2 ? centre - length / 2 : first;
+
+   if (start + length > end)
+      start = end - length > first ? end - length : first;
+
+   return start;
+}
+
+// Bytes per character at most, for sizing reads.
+static unsigned MaxBytesPerChar(TextEncoding encoding)
+{
+   switch (encoding)
+   {
+      case TEXT_ENCODING_UTF8:
+         return 3;   // four byte sequences make two UTF-16 characters
+
+      case TEXT_ENCODING_UTF16LE:
+      case TEXT_ENCODING_UTF16BE:
+         return 2;
+
+      default:
+         return 1;
+   }
+}
+
+// Decodes bytes[0..cb) a sequence at a time, so offsets[i] is where the
+// bytes of text[i] start. Only short stretches are decoded this way.
+static void DecodeMapped(TextEncoding encoding, const unsigned char *bytes, size_t cb, bool final,
+                         std::wstring & text, std::vector<size_t> & offsets)
+{
+   text.clear();
+   offsets.clear();
+
+   size_t i = 0;
+   size_t n = 1;
+
+   while (i < cb && i + n <= cb)
+   {
+      wchar_t chars[4];
+      size_t cch = 0;
+      size_t consumed = DecodeText(encoding, bytes + i, n, chars, &cch, (final && i + n == cb) || 4 == n);
+
+      if (0 == consumed)
+      {
+         ++n;   // a sequence longer than n bytes
+         continue;
+      }
+
+      for (size_t j = 0; j < cch; ++j)
+      {
+         text += chars[j];
+         offsets.push_back(i);
+      }
+
+      i += consumed;
+      n = 1;
+   }
+}
+
+// Reads up to cb bytes at offset, moved forward to the next character
+// boundary, and decodes them. *start receives the offset of the first
+// character. Returns false if the read failed.
+static bool DecodeAt(ByteReader & file, unsigned long long size, TextEncoding encoding, size_t bomLength,
+                     unsigned long long offset, size_t cb, unsigned long long *start,
+                     std::wstring & text, std::vector<size_t> & offsets)
+{
+   if (TEXT_ENCODING_UTF16LE == encoding || TEXT_ENCODING_UTF16BE == encoding)
+      offset = bomLength + ((offset - bomLength) & ~1ULL);
+
+   if (offset + cb > size)
+      cb = static_cast<size_t>(size - offset);
+
+   std::vector<unsigned char> bytes(cb + 1);
+
+   if (cb && !file.ReadAt(offset, &bytes[0], cb))
+      return false;
+
+   size_t skip = 0;
+
+   if (offset > bomLength)
+   {
+      if (TEXT_ENCODING_UTF8 == encoding)
+      {
+         // past continuation bytes to the start of a sequence
+         while (skip < cb && skip < 3 && 0x80 == (bytes[skip] & 0xC0))
+            ++skip;
+      }
+      else if (TEXT_ENCODING_UTF16LE == encoding || TEXT_ENCODING_UTF16BE == encoding)
+      {
+         // past the second half of a surrogate pair
+         if (cb >= 2)
+         {
+            unsigned unit = TEXT_ENCODING_UTF16LE == encoding ? bytes[0] | (bytes[1] << 8) : (bytes[0] << 8) | bytes[1];
+
+            if (unit >= 0xDC00 && unit <= 0xDFFF)
+               skip = 2;
+         }
+      }
+   }
+
+   *start = offset + skip;
+
+   // final only at the end of the file, a sequence cut off by the read is left out
+   DecodeMapped(encoding, &bytes[0] + skip, cb - skip, offset + cb == size, text, offsets);
+   return true;
+}
+
+SampleStatus SamplePlainText(ByteReader & file, unsigned long long size, const SampleSpec & spec,
+                             CleanupProfile profile, std::vector<TextSample> & samples)
+{
+   samples.clear();
+
+   unsigned char sniff[c_sniffBytes];
+   size_t cbSniff = size < c_sniffBytes ? static_cast<size_t>(size) : c_sniffBytes;
+
+   if (cbSniff && !file.ReadAt(0, sniff, cbSniff))
+      return SAMPLE_READ_ERROR;
+
+   size_t bomLength = 0;
+   TextEncoding encoding = DetectTextEncoding(sniff, cbSniff, &bomLength);
+
+   if (0 == cbSniff)
+      return SAMPLE_OK;
+
+   if (TEXT_ENCODING_BINARY == encoding)
+      return SAMPLE_NOT_TEXT;
+
+   unsigned long long budget = SampleBudget(spec);
+   unsigned long long bytesPerChar = MaxBytesPerChar(encoding);
+   unsigned long long start;
+   std::wstring text;
+   std::vector<size_t> offsets;
+
+   // small enough to read it all, then the samples are cut out of the text
+   if (size - bomLength <= budget * bytesPerChar)
+   {
+      if (!DecodeAt(file, size, encoding, bomLength, bomLength, static_cast<size_t>(size - bomLength), &start, text, offsets))
+         return SAMPLE_READ_ERROR;
+
+      size_t length = text.length();
+
+      if (length <= budget)
+      {
+         AddSample(samples, SAMPLE_HEAD, start, text.data(), length, profile);
+         return SAMPLE_OK;
+      }
+
+      size_t tailStart = length - spec.tailLength;
+
+      AddSample(samples, SAMPLE_HEAD, start, text.data(), spec.headLength, profile);
+
+      for (unsigned long i = 0; i < spec.windowCount; ++i)
+      {
+         size_t from = static_cast<size_t>(WindowStart(spec.headLength, tailStart, spec.windowLength, i, spec.windowCount));
+         AddSample(samples, SAMPLE_WINDOW, start + offsets[from], text.data() + from, spec.windowLength, profile);
+      }
+
+      if (tailStart < length)
+         AddSample(samples, SAMPLE_TAIL, start + offsets[tailStart], text.data() + tailStart, spec.tailLength, profile);
+
+      return SAMPLE_OK;
+   }
+
+   // otherwise read just the bytes each sample needs, the head and tail
+   // reads get at least as many characters as asked for
+   unsigned long long headBytes = spec.headLength * bytesPerChar;
+   unsigned long long tailBytes = spec.tailLength * bytesPerChar;
+   unsigned long long windowBytes = spec.windowLength * bytesPerChar;
+
+   if (spec.headLength)
+   {
+      if (!DecodeAt(file, size, encoding, bomLength, bomLength, static_cast<size_t>(headBytes), &start, text, offsets))
+         return SAMPLE_READ_ERROR;
+
+      size_t cch = text.length() < spec.headLength ? text.length() : spec.headLength;
+      AddSample(samples, SAMPLE_HEAD, start, text.data(), cch, profile);
+   }
+
+   // the interior windows share out the bytes between the head and tail reads,
+   // which may hold fewer characters than windowLength
+   unsigned long long interiorStart = bomLength + headBytes;
+   unsigned long long interiorEnd = size - tailBytes;
+
+   for (unsigned long i = 0; i < spec.windowCount && spec.windowLength && interiorEnd > interiorStart; ++i)
+   {
+      unsigned long long offset = WindowStart(interiorStart, interiorEnd, windowBytes, i, spec.windowCount);
+      size_t cb = static_cast<size_t>(interiorEnd - offset < windowBytes ? interiorEnd - offset : windowBytes);
+
+      if (!DecodeAt(file, size, encoding, bomLength, offset, cb, &start, text, offsets))
+         return SAMPLE_READ_ERROR;
+
+      size_t cch = text.length() < spec.windowLength ? text.length() : spec.windowLength;
+      AddSample(samples, SAMPLE_WINDOW, start, text.data(), cch, profile);
+   }
+
+   // the last tailLength of the characters the last tailBytes decode to
+   if (spec.tailLength)
+   {
+      if (!DecodeAt(file, size, encoding, bomLength, interiorEnd, static_cast<size_t>(tailBytes), &start, text, offsets))
+         return SAMPLE_READ_ERROR;
+
+      size_t cch = text.length() < spec.tailLength ? text.length() : spec.tailLength;
+      size_t from = text.length() - cch;
+
+      if (cch)
+         AddSample(samples, SAMPLE_TAIL, start + offsets[from], text.data() + from, cch, profile);
+   }
+
+   return SAMPLE_OK;
+}
+
+// Collects the samples from text passing through once, see SampleChunks.
+class ChunkSampler
+{
+public:
+   ChunkSampler(const SampleSpec & spec)
+      : m_spec(spec), m_budget(SampleBudget(spec)), m_position(0),
+        m_stride(spec.windowLength ? spec.windowLength : 1), m_tailStart(0)
+   {
+   }
+
+   // Nothing but the head to sample, and it's full.
+   bool Done() const
+   {
+      return 0 == m_spec.tailLength && (0 == m_spec.windowCount || 0 == m_spec.windowLength) &&
+             m_position >= m_spec.headLength;
+   }
+
+   void Add(const wchar_t *text, size_t cch)
+   {
+      // everything while it might all fit in the samples
+      if (m_position + cch <= m_budget)
+         m_whole.append(text, cch);
+      else if (!m_whole.empty())
+         std::wstring().swap(m_whole);
+
+      size_t i = 0;
+
+      if (m_position < m_spec.headLength)
+      {
+         i = static_cast<size_t>(m_spec.headLength - m_position) < cch ? static_cast<size_t>(m_spec.headLength - m_position) : cch;
+         m_head.append(text, i);
+      }
+
+      if (m_spec.windowCount && m_spec.windowLength)
+         AddToWindows(text + i, cch - i, m_position + i);
+
+      if (m_spec.tailLength <= cch)
+      {
+         // only the end of a long buffer can be in the tail
+         m_tail.assign(text + cch - m_spec.tailLength, m_spec.tailLength);
+         m_tailStart = m_position + cch - m_spec.tailLength;
+      }
+      else if (m_spec.tailLength)
+      {
+         m_tail.append(text, cch);
+
+         // trimmed now and then rather than on every call
+         if (m_tail.length() > 2 * static_cast<size_t>(m_spec.tailLength) + 4096)
+         {
+            size_t drop = m_tail.length() - m_spec.tailLength;
+            m_tail.erase(0, drop);
+            m_tailStart += drop;
+         }
+      }
+
+      m_position += cch;
+   }
+
+   void Finish(CleanupProfile profile, std::vector<TextSample> & samples)
+   {
+      samples.clear();
+
+      if (m_position <= m_budget)
+      {
+         AddSample(samples, SAMPLE_HEAD, 0, m_whole.data(), m_whole.length(), profile);
+         return;
+      }
+
+      AddSample(samples, SAMPLE_HEAD, 0, m_head.data(), m_head.length(), profile);
+
+      // only windows clear of the tail, the ones nearest where
+      // SamplePlainText would have put them
+      unsigned long long tailStart = m_position - m_spec.tailLength;
+      size_t usable = 0;
+
+      while (usable < m_windows.size() &&
+             m_windows[usable].start + m_windows[usable].text.length() <= tailStart)
+      {
+         ++usable;
+      }
+
+      size_t count = usable < m_spec.windowCount ? usable : m_spec.windowCount;
+      size_t j = 0;
+
+      for (unsigned long i = 0; i < count; ++i, ++j)
+      {
+         unsigned long long target = WindowStart(m_spec.headLength, tailStart, m_spec.windowLength, i, static_cast<unsigned long>(count));
+
+         // leaving enough windows for the rest
+         while (j + 1 < usable - (count - 1 - i) && Distance(m_windows[j + 1].start, target) <= Distance(m_windows[j].start, target))
+            ++j;
+
+         const Window & window = m_windows[j];
+         AddSample(samples, SAMPLE_WINDOW, window.start, window.text.data(), window.text.length(), profile);
+      }
+
+      if (m_spec.tailLength)
+      {
+         size_t from = m_tail.length() - m_spec.tailLength;
+         AddSample(samples, SAMPLE_TAIL, m_tailStart + from, m_tail.data() + from, m_spec.tailLength, profile);
+      }
+   }
+
+private:
+   struct Window
+   {
+      unsigned long long start;
+      std::wstring text;
+   };
+
+   static unsigned long long Distance(unsigned long long a, unsigned long long b)
+   {
+      return a > b ? a - b : b - a;
+   }
+
+   // Windows start every m_stride characters past the head. Once there are
+   // more than four times as many as wanted every other one goes and the
+   // stride doubles, so they always cover the text so far evenly and one is
+   // never far from where each sample should go.
+   void AddToWindows(const wchar_t *text, size_t cch, unsigned long long position)
+   {
+      size_t i = 0;
+
+      while (i < cch)
+      {
+         if (!m_windows.empty() && m_windows.back().text.length() < m_spec.windowLength)
+         {
+            Window & window = m_windows.back();
+            size_t take = m_spec.windowLength - window.text.length();
+
+            if (take > cch - i)
+               take = cch - i;
+
+            window.text.append(text + i, take);
+            i += take;
+            continue;
+         }
+
+         unsigned long long next = m_spec.headLength + m_windows.size() * m_stride;
+
+         if (position + i < next)
+         {
+            i += next - (position + i) < cch - i ? static_cast<size_t>(next - (position + i)) : cch - i;
+            continue;
+         }
+
+         Window window;
+         window.start = position + i;
+         m_windows.push_back(window);
+
+         if (m_windows.size() > 4 * static_cast<size_t>(m_spec.windowCount))
+         {
+            // an odd number, so the window just opened stays
+            for (size_t j = 1; 2 * j < m_windows.size(); ++j)
+            {
+               m_windows[j].start = m_windows[2 * j].start;
+               m_windows[j].text.swap(m_windows[2 * j].text);
+            }
+
+            m_windows.resize((m_windows.size() + 1) / 2);
+            m_stride *= 2;
+         }
+      }
+   }
+
+   SampleSpec m_spec;
+   unsigned long long m_budget;
+   unsigned long long m_position;
+   unsigned long long m_stride;
+   std::wstring m_whole;
+   std::wstring m_head;
+   std::vector<Window> m_windows;
+   std::wstring m_tail;
+   unsigned long long m_tailStart;
+};
+
+bool SampleChunks(ChunkSource & source, const SampleSpec & spec, CleanupProfile profile,
+                  std::vector<TextSample> & samples)
+{
+   const int cChunkSize = 4096;
+
+   ChunkSampler sampler(spec);
+
+   while (!sampler.Done())
+   {
+      ChunkInfo chunk;
+      ChunkRead read = source.NextChunk(chunk);
+
+      if (CHUNK_READ_ERROR == read)
+         return false;
+
+      if (CHUNK_READ_END == read)
+         break;
+
+      if (CHUNK_READ_TEXT != read)
+         continue;
+
+      // the same separators as the extraction loop, cleaned up with the samples
+      switch (chunk.breakType)
+      {
+         case TEXT_BREAK_EOW:
+            sampler.Add(L" ", 1);
+            break;
+
+         case TEXT_BREAK_EOS:
+         case TEXT_BREAK_EOP:
+         case TEXT_BREAK_EOC:
+            sampler.Add(L"\r\n", 2);
+            break;
+
+         default:
+            break;
+      }
+
+      for (;;)
+      {
+         wchar_t buf[cChunkSize];
+         unsigned long chBuf = cChunkSize;
+
+         TextRead text = source.GetText(buf, &chBuf);
+
+         if (TEXT_READ_ERROR == text)
+            return false;
+
+         if (TEXT_READ_END == text)
+            break;
+
+         sampler.Add(buf, chBuf);
+
+         if (TEXT_READ_LAST == text || sampler.Done())
+            break;
+      }
+   }
+
+   sampler.Finish(profile, samples);
+   return true;
+}
@@ -0,0 +1,59 @@
+// SampledText.h : Bounded samples of a document, the head, the tail and
+//                 evenly spaced windows in between, without extracting the
+//                 rest of it
+
+#ifndef __SAMPLEDTEXT_H_
+#define __SAMPLEDTEXT_H_
+
+#include <string>
+#include <vector>
+
+#include "AppendText.h"
+#include "PagedText.h"
+#include "TextCleanup.h"
+
+// Lengths count characters as the source delivers them, the cleanup that
+// follows can only make a sample shorter (CLEANUP_COMPACT).
+struct SampleSpec
+{
+   unsigned long headLength;
+   unsigned long tailLength;
+   unsigned long windowCount;
+   unsigned long windowLength;
+};
+
+enum SampleKind
+{
+   SAMPLE_HEAD = 0,         // also the whole text when it fits in the samples
+   SAMPLE_WINDOW,
+   SAMPLE_TAIL
+};
+
+struct TextSample
+{
+   SampleKind kind;
+   unsigned long long position;   // bytes into a plain text file, characters into a filter's text
+   std::wstring text;
+};
+
+enum SampleStatus
+{
+   SAMPLE_OK = 0,
+   SAMPLE_NOT_TEXT,
+   SAMPLE_READ_ERROR
+};
+
+// Plain text files: reads just the bytes around each sample, at a cost
+// independent of the file's size. Samples come back in document order.
+SampleStatus SamplePlainText(ByteReader & file, unsigned long long size, const SampleSpec & spec,
+                             CleanupProfile profile, std::vector<TextSample> & samples);
+
+// Anything else: a single pass over the chunks, since the length isn't known
+// up front. Text outside the samples is counted and dropped, neither cleaned
+// up nor kept, and the interior windows are thinned out as the text grows so
+// they stay evenly spaced in bounded memory. Stops after the head when
+// there's nothing else to sample. False if the source failed.
+bool SampleChunks(ChunkSource & source, const SampleSpec & spec, CleanupProfile profile,
+                  std::vector<TextSample> & samples);
+
+#endif //__SAMPLEDTEXT_H_
@@ -0,0 +1,191 @@
+// Signature.cpp : SimHash and MinHash signatures over word shingles
+
+#include <string.h>
+
+#include "Signature.h"
+
+// splitmix64 finalizer, spreads every input bit over the whole word
+inline static unsigned long long Mix64(unsigned long long x)
+{
+   x ^= x >> 30;
+   x *= 0xBF58476D1CE4E5B9ULL;
+   x ^= x >> 27;
+   x *= 0x94D049BB133111EBULL;
+   x ^= x >> 31;
+   return x;
+}
+
+// Letters and digits make up words. CleanUpCharacters has already folded
+// most punctuation to ASCII, so the rest of the non-ASCII range is mostly letters.
+inline static bool IsWordCharacter(unsigned long c)
+{
+   if (c < 0x80)
+      return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+
+   if (c < 0xC0 || 0xD7 == c || 0xF7 == c)
+      return false;
+
+   if ((c >= 0x2000 && c <= 0x2BFF) || (c >= 0x3000 && c <= 0x303F) || (c >= 0xFE30 && c <= 0xFE6F))
+      return false;
+
+   return true;
+}
+
+// Case folding for the common cases, so "The" and "the" shingle the same
+inline static unsigned long FoldCase(unsigned long c)
+{
+   if (c >= 'A' && c <= 'Z')
+      return c + 0x20;
+
+   if (c >= 0xC0 && c <= 0xDE && c != 0xD7)
+      return c + 0x20;
+
+   return c;
+}
+
+static const unsigned long long c_fnvOffset = 0xCBF29CE484222325ULL;
+static const unsigned long long c_fnvPrime = 0x100000001B3ULL;
+
+SignatureSink::SignatureSink(unsigned shingleWords, unsigned minHashes)
+   : m_shingleWords(shingleWords ? shingleWords : 1), m_wordCount(0),
+     m_inWord(false), m_wordHash(c_fnvOffset), m_simHash(0), m_shingles(0)
+{
+   m_words.resize(m_shingleWords, 0);
+   memset(m_simCounts, 0, sizeof(m_simCounts));
+
+   m_minHash.resize(minHashes, ~0ULL);
+   m_seeds.resize(minHashes);
+
+   // fixed seeds, so signatures compare across runs, machines and platforms
+   unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+
+   for (unsigned i = 0; i < minHashes; ++i)
+   {
+      seed += 0x9E3779B97F4A7C15ULL;
+      m_seeds[i] = Mix64(seed);
+   }
+}
+
+void SignatureSink::OnChunk(const ChunkInfo & chunk)
+{
+   if (TEXT_BREAK_NONE != chunk.breakType)
+      EndWord();
+}
+
+void SignatureSink::OnText(const wchar_t *text, size_t cch)
+{
+   for (size_t i = 0; i < cch; ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(text[i]);
+
+      if (IsWordCharacter(c))
+      {
+         // FNV-1a, carried across buffers so words split between GetText
+         // calls hash the same as whole ones
+         m_wordHash = (m_wordHash ^ FoldCase(c)) * c_fnvPrime;
+         m_inWord = true;
+      }
+      else if (m_inWord)
+      {
+         EndWord();
+      }
+   }
+}
+
+void SignatureSink::OnEnd()
+{
+   EndWord();
+
+   // documents shorter than one shingle still get a signature
+   if (m_wordCount && m_wordCount < m_shingleWords)
+   {
+      unsigned long long shingle = 0;
+
+      for (unsigned long long i = 0; i < m_wordCount; ++i)
+         shingle = Mix64(shingle ^ m_words[static_cast<size_t>(i)]);
+
+      AddShingle(shingle);
+   }
+
+   m_simHash = 0;
+
+   for (int bit = 0; bit < 64; ++bit)
+   {
+      if (m_simCounts[bit] > 0)
+         m_simHash |= 1ULL << bit;
+   }
+}
+
+void SignatureSink::EndWord()
+{
+   if (!m_inWord)
+      return;
+
+   m_words[static_cast<size_t>(m_wordCount % m_shingleWords)] = m_wordHash;
+   ++m_wordCount;
+
+   m_inWord = false;
+   m_wordHash = c_fnvOffset;
+
+   if (m_wordCount < m_shingleWords)
+      return;
+
+   // oldest word first, so the shingle is order sensitive
+   unsigned long long shingle = 0;
+
+   for (unsigned j = 0; j < m_shingleWords; ++j)
+      shingle = Mix64(shingle ^ m_words[static_cast<size_t>((m_wordCount + j) % m_shingleWords)]);
+
+   AddShingle(shingle);
+}
+
+void SignatureSink::AddShingle(unsigned long long shingle)
+{
+   ++m_shingles;
+
+   for (int bit = 0; bit < 64; ++bit)
+      m_simCounts[bit] += ((shingle >> bit) & 1) ? 1 : -1;
+
+   for (size_t i = 0; i < m_minHash.size(); ++i)
+   {
+      // cheap per-seed permutation of the already well mixed shingle hash
+      unsigned long long h = (shingle ^ m_seeds[i]) * 0xFF51AFD7ED558CCDULL;
+      h ^= h >> 33;
+
+      if (h < m_minHash[i])
+         m_minHash[i] = h;
+   }
+}
+
+unsigned SignatureSink::SimHashDistance(unsigned long long a, unsigned long long b)
+{
+   unsigned long long x = a ^ b;
+   unsigned count = 0;
+
+   while (x)
+   {
+      x &= x - 1;
+      ++count;
+   }
+
+   return count;
+}
+
+double SignatureSink::MinHashSimilarity(const std::vector<unsigned long long> & a,
+                                        const std::vector<unsigned long long> & b)
+{
+   size_t n = a.size() < b.size() ? a.size() : b.size();
+
+   if (0 == n)
+      return 0;
+
+   size_t same = 0;
+
+   for (size_t i = 0; i < n; ++i)
+   {
+      if (a[i] == b[i])
+         ++same;
+   }
+
+   return static_cast<double>(same) / n;
+}
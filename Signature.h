@@ -0,0 +1,54 @@
+// Signature.h : SimHash and MinHash signatures over word shingles, computed
+//               as the cleaned-up text streams out of the extraction loop
+
+#ifndef __SIGNATURE_H_
+#define __SIGNATURE_H_
+
+#include <vector>
+
+#include "TextSink.h"
+
+class SignatureSink : public TextSink
+{
+public:
+   // Shingles are runs of shingleWords consecutive words. The MinHash
+   // signature holds minHashes values. Unlike the other sinks this one never
+   // stops early, so the signatures cover the whole document even when
+   // maxLength cuts the returned text short.
+   explicit SignatureSink(unsigned shingleWords = 3, unsigned minHashes = 64);
+
+   // Chunk breaks other than CHUNK_NO_BREAK always end the current word.
+   virtual void OnChunk(const ChunkInfo & chunk);
+   virtual void OnText(const wchar_t *text, size_t cch);
+   virtual void OnEnd();
+
+   unsigned long long SimHash() const { return m_simHash; }
+   const std::vector<unsigned long long> & MinHash() const { return m_minHash; }
+   unsigned long long Shingles() const { return m_shingles; }
+
+   // Number of differing bits, near-duplicates are within a few bits
+   static unsigned SimHashDistance(unsigned long long a, unsigned long long b);
+
+   // Estimated Jaccard similarity of the two documents' shingle sets
+   static double MinHashSimilarity(const std::vector<unsigned long long> & a,
+                                   const std::vector<unsigned long long> & b);
+
+private:
+   void EndWord();
+   void AddShingle(unsigned long long shingle);
+
+   unsigned m_shingleWords;
+   std::vector<unsigned long long> m_words;   // ring of the last shingleWords word hashes
+   unsigned long long m_wordCount;
+
+   bool m_inWord;
+   unsigned long long m_wordHash;
+
+   long m_simCounts[64];
+   unsigned long long m_simHash;
+   std::vector<unsigned long long> m_minHash;
+   std::vector<unsigned long long> m_seeds;
+   unsigned long long m_shingles;
+};
+
+#endif //__SIGNATURE_H_
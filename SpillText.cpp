@@ -0,0 +1,361 @@
+// SpillText.cpp : Collects the cleaned-up text in memory, then in a temp file
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "SpillText.h"
+
+// The mapped window moves along the file in steps this big, which is about
+// all of the text that's ever resident at once.
+static const unsigned long long c_windowSize = 16 * 1024 * 1024;
+
+// Grows a temp file through a window mapped at its end. Only the window is
+// mapped, the pages behind it go back to the system cache.
+class SpillFile
+{
+public:
+   SpillFile() : m_windowStart(0), m_window(NULL), m_used(0), m_error(0)
+   {
+#ifdef _WIN32
+      m_hFile = INVALID_HANDLE_VALUE;
+      m_hMapping = NULL;
+#else
+      m_fd = -1;
+#endif
+   }
+
+   // Deletes the file unless Detach took it.
+   ~SpillFile()
+   {
+      Close(false);
+   }
+
+   bool Create()
+   {
+#ifdef _WIN32
+      wchar_t directory[MAX_PATH];
+      wchar_t name[MAX_PATH];
+
+      if (0 == ::GetTempPathW(MAX_PATH, directory) || 0 == ::GetTempFileNameW(directory, L"ext", 0, name))
+         return Fail(::GetLastError());
+
+      m_path = name;
+      m_hFile = ::CreateFileW(name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY, NULL);
+
+      if (INVALID_HANDLE_VALUE == m_hFile)
+      {
+         DWORD error = ::GetLastError();
+         ::DeleteFileW(name);
+         m_path.erase();
+         return Fail(error);
+      }
+#else
+      const char *directory = getenv("TMPDIR");
+      m_path = std::string(directory && *directory ? directory : "/tmp") + "/extXXXXXX";
+
+      std::string name(m_path);
+      m_fd = mkstemp(&name[0]);
+
+      if (m_fd < 0)
+      {
+         m_path.erase();
+         return Fail(errno);
+      }
+
+      m_path = name;
+#endif
+      return true;
+   }
+
+   bool Write(const unsigned char *data, size_t cb)
+   {
+      while (cb)
+      {
+         if (NULL == m_window || m_used == c_windowSize)
+         {
+            if (!MapNext())
+               return false;
+         }
+
+         size_t room = static_cast<size_t>(c_windowSize - m_used);
+         size_t piece = cb < room ? cb : room;
+
+         memcpy(m_window + m_used, data, piece);
+         m_used += piece;
+         data += piece;
+         cb -= piece;
+      }
+
+      return true;
+   }
+
+   // Unmaps the window and closes the file, trimmed to what was written if
+   // keep is set. Otherwise (or if trimming fails) the file is deleted.
+   bool Close(bool keep)
+   {
+      unsigned long long length = m_windowStart + m_used;
+      bool ok = Unmap();
+
+#ifdef _WIN32
+      if (INVALID_HANDLE_VALUE != m_hFile)
+      {
+         LONG high = static_cast<LONG>(length >> 32);
+
+         if (keep)
+         {
+            ::SetLastError(NO_ERROR);
+
+            if ((INVALID_SET_FILE_POINTER == ::SetFilePointer(m_hFile, static_cast<LONG>(length), &high, FILE_BEGIN) &&
+                 NO_ERROR != ::GetLastError()) || !::SetEndOfFile(m_hFile))
+               ok = Fail(::GetLastError());
+         }
+
+         ::CloseHandle(m_hFile);
+         m_hFile = INVALID_HANDLE_VALUE;
+      }
+
+      if (!m_path.empty() && (!keep || !ok))
+         ::DeleteFileW(m_path.c_str());
+#else
+      if (m_fd >= 0)
+      {
+         if (keep && ftruncate(m_fd, static_cast<off_t>(length)) != 0)
+            ok = Fail(errno);
+
+         close(m_fd);
+         m_fd = -1;
+      }
+
+      if (!m_path.empty() && (!keep || !ok))
+         unlink(m_path.c_str());
+#endif
+
+      if (!keep || !ok)
+         m_path.erase();
+
+      return ok;
+   }
+
+   // Takes the closed file away, so it outlives this object.
+   SpillPath Detach()
+   {
+      SpillPath path;
+      path.swap(m_path);
+      return path;
+   }
+
+   unsigned long Error() const { return m_error; }
+
+private:
+   bool Fail(unsigned long error)
+   {
+      m_error = error;
+      return false;
+   }
+
+   bool Unmap()
+   {
+      if (NULL == m_window)
+         return true;
+
+#ifdef _WIN32
+      ::UnmapViewOfFile(m_window);
+      ::CloseHandle(m_hMapping);
+      m_hMapping = NULL;
+#else
+      munmap(m_window, static_cast<size_t>(c_windowSize));
+#endif
+      m_window = NULL;
+      return true;
+   }
+
+   // Grows the file by a window and maps the new part.
+   bool MapNext()
+   {
+      if (NULL != m_window)
+      {
+         Unmap();
+         m_windowStart += c_windowSize;
+         m_used = 0;
+      }
+
+      unsigned long long size = m_windowStart + c_windowSize;
+
+#ifdef _WIN32
+      // mapping past the end of the file grows it
+      m_hMapping = ::CreateFileMappingW(m_hFile, NULL, PAGE_READWRITE,
+                                        static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), NULL);
+
+      if (NULL == m_hMapping)
+         return Fail(::GetLastError());
+
+      m_window = static_cast<unsigned char *>(::MapViewOfFile(m_hMapping, FILE_MAP_WRITE,
+                                                              static_cast<DWORD>(m_windowStart >> 32),
+                                                              static_cast<DWORD>(m_windowStart),
+                                                              static_cast<SIZE_T>(c_windowSize)));
+
+      if (NULL == m_window)
+      {
+         DWORD error = ::GetLastError();
+         ::CloseHandle(m_hMapping);
+         m_hMapping = NULL;
+         return Fail(error);
+      }
+#else
+      if (ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+         return Fail(errno);
+
+      void *window = mmap(NULL, static_cast<size_t>(c_windowSize), PROT_READ | PROT_WRITE, MAP_SHARED,
+                          m_fd, static_cast<off_t>(m_windowStart));
+
+      if (MAP_FAILED == window)
+         return Fail(errno);
+
+      m_window = static_cast<unsigned char *>(window);
+#endif
+      return true;
+   }
+
+#ifdef _WIN32
+   HANDLE m_hFile;
+   HANDLE m_hMapping;
+#else
+   int m_fd;
+#endif
+   SpillPath m_path;
+   unsigned long long m_windowStart;
+   unsigned char *m_window;
+   unsigned long long m_used;
+   unsigned long m_error;
+};
+
+SpillSink::SpillSink(unsigned long long maxLength, unsigned long long memoryThreshold)
+   : m_maxLength(maxLength), m_threshold(memoryThreshold), m_length(0),
+     m_failed(false), m_error(0), m_file(NULL)
+{
+}
+
+SpillSink::~SpillSink()
+{
+   delete m_file;
+}
+
+void SpillSink::OnText(const wchar_t *text, size_t cch)
+{
+   if (!WantsMore())
+      return;
+
+   if (NULL == m_file)
+   {
+      m_text.append(text, cch);
+      m_length += cch;
+
+      if (static_cast<unsigned long long>(m_text.length()) * sizeof(wchar_t) > m_threshold)
+         Spill();
+
+      return;
+   }
+
+   Write(text, cch);
+}
+
+bool SpillSink::WantsMore() const
+{
+   return !m_failed && (0 == m_maxLength || m_length <= m_maxLength);
+}
+
+void SpillSink::OnEnd()
+{
+   if (m_file && !m_failed)
+   {
+      // trims the file to the text, the caller gets it with DetachPath
+      if (!m_file->Close(true))
+      {
+         m_failed = true;
+         m_error = m_file->Error();
+      }
+   }
+}
+
+SpillPath SpillSink::DetachPath()
+{
+   if (NULL == m_file)
+      return SpillPath();
+
+   SpillPath path = m_file->Detach();
+   delete m_file;
+   m_file = NULL;
+   return path;
+}
+
+bool SpillSink::Spill()
+{
+   m_file = new SpillFile;
+
+   if (!m_file->Create())
+   {
+      m_failed = true;
+      m_error = m_file->Error();
+      return false;
+   }
+
+   // everything so far goes first, then the buffer is given back
+   std::wstring text;
+   text.swap(m_text);
+
+   m_length = 0;
+   Write(text.data(), text.length());
+   return !m_failed;
+}
+
+// Writes text as UTF-16LE, a 32-bit wchar_t needs surrogate pairs above U+FFFF.
+void SpillSink::Write(const wchar_t *text, size_t cch)
+{
+   unsigned char buf[8192];
+   size_t cb = 0;
+
+   for (size_t i = 0; i < cch; ++i)
+   {
+      unsigned long c = static_cast<unsigned long>(text[i]);
+
+      if (c > 0xFFFF && c <= 0x10FFFF)
+      {
+         unsigned long high = 0xD800 + ((c - 0x10000) >> 10);
+         unsigned long low = 0xDC00 + ((c - 0x10000) & 0x3FF);
+
+         buf[cb++] = static_cast<unsigned char>(high);
+         buf[cb++] = static_cast<unsigned char>(high >> 8);
+         buf[cb++] = static_cast<unsigned char>(low);
+         buf[cb++] = static_cast<unsigned char>(low >> 8);
+         m_length += 2;
+      }
+      else
+      {
+         buf[cb++] = static_cast<unsigned char>(c);
+         buf[cb++] = static_cast<unsigned char>(c >> 8);
+         m_length += 1;
+      }
+
+      if (cb + 4 > sizeof(buf) || i + 1 == cch)
+      {
+         if (!m_file->Write(buf, cb))
+         {
+            m_failed = true;
+            m_error = m_file->Error();
+            return;
+         }
+
+         cb = 0;
+      }
+   }
+}
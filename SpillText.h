@@ -0,0 +1,65 @@
+// SpillText.h : Collects the cleaned-up text in memory up to a threshold and
+//               moves it to a memory-mapped temp file past that, so very
+//               large documents don't need one huge buffer
+
+#ifndef __SPILLTEXT_H_
+#define __SPILLTEXT_H_
+
+#include <string>
+
+#include "TextSink.h"
+
+#ifdef _WIN32
+typedef std::wstring SpillPath;
+#else
+typedef std::string SpillPath;
+#endif
+
+class SpillFile;
+
+class SpillSink : public TextSink
+{
+public:
+   // Like TextBufferSink with a 64-bit maxLength (0 for no limit). Once the
+   // text passes memoryThreshold bytes it moves to a temp file, as UTF-16LE,
+   // and everything after goes straight there through a small mapped window.
+   SpillSink(unsigned long long maxLength, unsigned long long memoryThreshold);
+   virtual ~SpillSink();
+
+   virtual void OnText(const wchar_t *text, size_t cch);
+   virtual bool WantsMore() const;
+   virtual void OnEnd();
+
+   bool Truncated() const { return !m_failed && 0 != m_maxLength && m_length > m_maxLength; }
+
+   // The temp file couldn't be created or grown, Error() has the system error code.
+   bool Failed() const { return m_failed; }
+   unsigned long Error() const { return m_error; }
+
+   // Characters (UTF-16 code units once spilled) collected.
+   unsigned long long Length() const { return m_length; }
+
+   bool Spilled() const { return NULL != m_file; }
+
+   // The text, while it hasn't spilled.
+   const std::wstring & Text() const { return m_text; }
+
+   // After OnEnd, hands the temp file over to the caller, who deletes it
+   // when done. Otherwise it goes away with the sink.
+   SpillPath DetachPath();
+
+private:
+   bool Spill();
+   void Write(const wchar_t *text, size_t cch);
+
+   unsigned long long m_maxLength;
+   unsigned long long m_threshold;
+   unsigned long long m_length;
+   bool m_failed;
+   unsigned long m_error;
+
+   std::wstring m_text;
+   SpillFile *m_file;
+};
+
+#endif //__SPILLTEXT_H_
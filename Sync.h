@@ -0,0 +1,151 @@
+// Sync.h : Minimal lock and event wrappers over the Win32 and pthread
+//          primitives, for the bits of state shared across extractions
+
+#ifndef __SYNC_H_
+#define __SYNC_H_
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#endif
+
+// Timeout for WaitEvent::Wait that never expires.
+const unsigned long c_waitForever = 0xFFFFFFFF;
+
+// Millisecond tick that wraps every 49 days, subtract two to get the time
+// between them.
+inline unsigned long TickMs()
+{
+#ifdef _WIN32
+   return ::GetTickCount();
+#else
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return static_cast<unsigned long>(static_cast<unsigned long long>(now.tv_sec) * 1000 + now.tv_nsec / 1000000);
+#endif
+}
+
+class CriticalLock
+{
+public:
+#ifdef _WIN32
+   CriticalLock() { ::InitializeCriticalSection(&m_cs); }
+   ~CriticalLock() { ::DeleteCriticalSection(&m_cs); }
+
+   void Enter() { ::EnterCriticalSection(&m_cs); }
+   void Leave() { ::LeaveCriticalSection(&m_cs); }
+#else
+   CriticalLock() { pthread_mutex_init(&m_mutex, NULL); }
+   ~CriticalLock() { pthread_mutex_destroy(&m_mutex); }
+
+   void Enter() { pthread_mutex_lock(&m_mutex); }
+   void Leave() { pthread_mutex_unlock(&m_mutex); }
+#endif
+
+private:
+   CriticalLock(const CriticalLock &);
+   CriticalLock & operator=(const CriticalLock &);
+
+#ifdef _WIN32
+   CRITICAL_SECTION m_cs;
+#else
+   pthread_mutex_t m_mutex;
+#endif
+};
+
+class AutoLock
+{
+public:
+   explicit AutoLock(CriticalLock & lock) : m_lock(lock) { m_lock.Enter(); }
+   ~AutoLock() { m_lock.Leave(); }
+
+private:
+   AutoLock(const AutoLock &);
+   AutoLock & operator=(const AutoLock &);
+
+   CriticalLock & m_lock;
+};
+
+// Manual-reset event, one per waiter so wakeups can go out in a chosen order.
+class WaitEvent
+{
+public:
+#ifdef _WIN32
+   WaitEvent() : m_hEvent(::CreateEvent(NULL, TRUE, FALSE, NULL)) {}
+   ~WaitEvent() { ::CloseHandle(m_hEvent); }
+
+   void Set() { ::SetEvent(m_hEvent); }
+
+   // False if timeoutMs (milliseconds, or c_waitForever) went by first.
+   bool Wait(unsigned long timeoutMs)
+   {
+      return WAIT_OBJECT_0 == ::WaitForSingleObject(m_hEvent, c_waitForever == timeoutMs ? INFINITE : timeoutMs);
+   }
+#else
+   WaitEvent() : m_set(false)
+   {
+      pthread_mutex_init(&m_mutex, NULL);
+      pthread_cond_init(&m_cond, NULL);
+   }
+
+   ~WaitEvent()
+   {
+      pthread_cond_destroy(&m_cond);
+      pthread_mutex_destroy(&m_mutex);
+   }
+
+   void Set()
+   {
+      pthread_mutex_lock(&m_mutex);
+      m_set = true;
+      pthread_cond_broadcast(&m_cond);
+      pthread_mutex_unlock(&m_mutex);
+   }
+
+   bool Wait(unsigned long timeoutMs)
+   {
+      struct timeval now;
+      gettimeofday(&now, NULL);
+
+      struct timespec deadline;
+      unsigned long long nanoseconds = static_cast<unsigned long long>(now.tv_usec) * 1000 +
+                                       static_cast<unsigned long long>(timeoutMs % 1000) * 1000000;
+      deadline.tv_sec = now.tv_sec + timeoutMs / 1000 + static_cast<time_t>(nanoseconds / 1000000000);
+      deadline.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+
+      pthread_mutex_lock(&m_mutex);
+
+      int rc = 0;
+
+      while (!m_set && ETIMEDOUT != rc)
+      {
+         if (c_waitForever == timeoutMs)
+            rc = pthread_cond_wait(&m_cond, &m_mutex);
+         else
+            rc = pthread_cond_timedwait(&m_cond, &m_mutex, &deadline);
+      }
+
+      bool set = m_set;
+      pthread_mutex_unlock(&m_mutex);
+      return set;
+   }
+#endif
+
+private:
+   WaitEvent(const WaitEvent &);
+   WaitEvent & operator=(const WaitEvent &);
+
+#ifdef _WIN32
+   HANDLE m_hEvent;
+#else
+   bool m_set;
+   pthread_mutex_t m_mutex;
+   pthread_cond_t m_cond;
+#endif
+};
+
+#endif //__SYNC_H_
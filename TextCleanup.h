@@ -0,0 +1,47 @@
+// TextCleanup.h : Character folding shared by the IFilter and built-in extraction paths
+
+#ifndef __TEXTCLEANUP_H_
+#define __TEXTCLEANUP_H_
+
+#include <stddef.h>
+
+// Folds the "cute" versions of characters in buf[0..chBuf) to their
+// simplified form and morphs anything that isn't valid XML Unicode to a blank.
+// buf must have room for chBuf + 1 characters, as it is null terminated.
+void CleanUpCharacters(size_t chBuf, wchar_t *buf);
+
+// Folding profiles, each one builds on the previous.
+enum CleanupProfile
+{
+   CLEANUP_DISPLAY = 0,    // just the CleanUpCharacters folding
+   CLEANUP_INDEX,          // also lowercased with the diacritics stripped
+   CLEANUP_COMPACT,        // also with whitespace runs collapsed to one blank
+   CLEANUP_PROFILES
+};
+
+// Carries what a profile needs to know about the previous buffer.
+struct CleanupState
+{
+   bool lastWasSpace;
+
+   CleanupState() : lastWasSpace(true) {}
+};
+
+// Applies profile P to buf[0..chBuf) in a single pass, returning the new
+// length (only CLEANUP_COMPACT ever shrinks the text). buf must have room for
+// chBuf + 1 characters, as it is null terminated.
+template <CleanupProfile P>
+size_t CleanUpText(size_t chBuf, wchar_t *buf, CleanupState & state);
+
+typedef size_t (*CleanupFunction)(size_t chBuf, wchar_t *buf, CleanupState & state);
+
+// Picks the kernel once per extraction so the per-character loop never looks
+// at the profile.
+CleanupFunction GetCleanupFunction(CleanupProfile profile);
+
+// The same folding a step at a time, one pass over buf per step of the
+// profile, walking the character switches instead of the tables. The
+// reference the kernels are checked and timed against (Linux/CleanupBench.cpp).
+size_t CleanUpTextStepwise(CleanupProfile profile, size_t chBuf, wchar_t *buf, CleanupState & state);
+
+#endif //__TEXTCLEANUP_H_
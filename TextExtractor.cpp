@@ -11,497 +11,2323 @@
 extern CComModule _Module;
 #include <atlcom.h>
 
+#include <limits.h>
+
 #include <string>
-#include <sstream>
+#include <vector>
+
+#include "dispimpl2.h"
+#include "ExtractText.h"
+#include "TextExtractor.h"
+#include "Filter.h"
+#include "FiltErr.h"
+#include "NTQuery.h"
+#include "TextCleanup.h"
+#include "TextSink.h"
+#include "Tokenizer.h"
+#include "LanguageDetector.h"
+#include "Signature.h"
+#include "OffsetMap.h"
+#include "CompressedText.h"
+#include "PagedText.h"
+#include "AppendText.h"
+#include "SpillText.h"
+#include "MemoryGovernor.h"
+#include "ExtractQueue.h"
+#include "ExtractScheduler.h"
+#include "FilterHealth.h"
+#include "PlainText.h"
+#include "SampledText.h"
+#include "PatternMatcher.h"
+#include "FilterRegistry.h"
+#include "ContentSniffer.h"
+#include "PropertyBag.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// CTextExtractor
+
+STDMETHODIMP CTextExtractor::InterfaceSupportsErrorInfo(REFIID riid)
+{
+   static const IID* arr[] =
+   {
+      &IID_ITextExtractor,
+      &IID_ITextExtractor2
+   };
+   for (int i=0; i < sizeof(arr) / sizeof(arr[0]); i++)
+   {
+      if (InlineIsEqualGUID(*arr[i],riid))
+         return S_OK;
+   }
+   return S_FALSE;
+}
+
+static void ToChunkInfo(const STAT_CHUNK & statChunk, ChunkInfo & chunk)
+{
+   chunk.idChunk = statChunk.idChunk;
+   chunk.breakType = static_cast<TextBreak>(statChunk.breakType);
+   chunk.locale = statChunk.locale;
+   chunk.idChunkSource = statChunk.idChunkSource;
+   chunk.cwcStartSource = statChunk.cwcStartSource;
+   chunk.cwcLenSource = statChunk.cwcLenSource;
+}
+
+static void ToPropertyKey(const FULLPROPSPEC & attribute, PropertyKey & key)
+{
+   memcpy(key.set, &attribute.guidPropSet, sizeof(key.set));
+   key.id = 0;
+   key.name.clear();
+
+   if (PRSPEC_PROPID == attribute.psProperty.ulKind)
+      key.id = attribute.psProperty.propid;
+   else if (NULL != attribute.psProperty.lpwstr)
+      key.name = attribute.psProperty.lpwstr;
+}
+
+static void AppendAnsi(const char *text, std::wstring & value)
+{
+   int cch = ::MultiByteToWideChar(CP_ACP, 0, text, -1, NULL, 0);
+
+   if (cch > 1)
+   {
+      std::vector<wchar_t> buf(cch);
+      ::MultiByteToWideChar(CP_ACP, 0, text, -1, &buf[0], cch);
+      value.append(&buf[0], cch - 1);
+   }
+}
+
+static void AppendSeparated(std::wstring & value, const std::wstring & item)
+{
+   if (item.empty())
+      return;
+
+   if (!value.empty())
+      value += L"; ";
+
+   value += item;
+}
+
+// The PROPVARIANT types filters give values in, false for the rest (blobs,
+// streams, arrays of numbers).
+static bool ToPropertyValue(const PROPVARIANT & pv, PropertyValue & value)
+{
+   value.type = PROPERTY_STRING;
+   value.text.clear();
+   value.integer = 0;
+   value.real = 0;
+
+   switch (pv.vt)
+   {
+      case VT_LPWSTR:
+         if (NULL != pv.pwszVal)
+            value.text = pv.pwszVal;
+         return true;
+
+      case VT_BSTR:
+         if (NULL != pv.bstrVal)
+            value.text.assign(pv.bstrVal, ::SysStringLen(pv.bstrVal));
+         return true;
+
+      case VT_LPSTR:
+         if (NULL != pv.pszVal)
+            AppendAnsi(pv.pszVal, value.text);
+         return true;
+
+      case VT_VECTOR | VT_LPWSTR:
+         for (ULONG i = 0; i < pv.calpwstr.cElems; ++i)
+         {
+            if (NULL != pv.calpwstr.pElems[i])
+               AppendSeparated(value.text, pv.calpwstr.pElems[i]);
+         }
+         return true;
+
+      case VT_VECTOR | VT_BSTR:
+         for (ULONG i = 0; i < pv.cabstr.cElems; ++i)
+         {
+            if (NULL != pv.cabstr.pElems[i])
+               AppendSeparated(value.text, std::wstring(pv.cabstr.pElems[i], ::SysStringLen(pv.cabstr.pElems[i])));
+         }
+         return true;
+
+      case VT_VECTOR | VT_LPSTR:
+         for (ULONG i = 0; i < pv.calpstr.cElems; ++i)
+         {
+            if (NULL != pv.calpstr.pElems[i])
+            {
+               std::wstring item;
+               AppendAnsi(pv.calpstr.pElems[i], item);
+               AppendSeparated(value.text, item);
+            }
+         }
+         return true;
+
+      case VT_CLSID:
+      {
+         if (NULL == pv.puuid)
+            return false;
+
+         wchar_t buf[40];
+         ::StringFromGUID2(*pv.puuid, buf, sizeof(buf) / sizeof(buf[0]));
+         value.text = buf;
+         return true;
+      }
+
+      case VT_I1:    value.integer = pv.cVal; break;
+      case VT_UI1:   value.integer = pv.bVal; break;
+      case VT_I2:    value.integer = pv.iVal; break;
+      case VT_UI2:   value.integer = pv.uiVal; break;
+      case VT_I4:    value.integer = pv.lVal; break;
+      case VT_UI4:   value.integer = pv.ulVal; break;
+      case VT_INT:   value.integer = pv.intVal; break;
+      case VT_UINT:  value.integer = pv.uintVal; break;
+      case VT_I8:    value.integer = pv.hVal.QuadPart; break;
+      case VT_UI8:   value.integer = static_cast<long long>(pv.uhVal.QuadPart); break;
+
+      case VT_R4:
+         value.type = PROPERTY_REAL;
+         value.real = pv.fltVal;
+         return true;
+
+      case VT_R8:
+         value.type = PROPERTY_REAL;
+         value.real = pv.dblVal;
+         return true;
+
+      case VT_BOOL:
+         value.type = PROPERTY_BOOLEAN;
+         value.integer = VARIANT_FALSE != pv.boolVal ? 1 : 0;
+         return true;
+
+      case VT_FILETIME:
+         value.type = PROPERTY_TIME;
+         value.integer = static_cast<long long>((static_cast<unsigned long long>(pv.filetime.dwHighDateTime) << 32) |
+                                                pv.filetime.dwLowDateTime);
+         return true;
+
+      case VT_DATE:
+      {
+         SYSTEMTIME st;
+         FILETIME ft;
+
+         if (!::VariantTimeToSystemTime(pv.date, &st) || !::SystemTimeToFileTime(&st, &ft))
+            return false;
+
+         value.type = PROPERTY_TIME;
+         value.integer = static_cast<long long>((static_cast<unsigned long long>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime);
+         return true;
+      }
+
+      default:
+         return false;
+   }
+
+   value.type = PROPERTY_INTEGER;
+   return true;
+}
+
+// Times become dates (UTC), integers longs where they fit.
+static HRESULT ToVariant(const PropertyValue & value, CComVariant & variant)
+{
+   variant.Clear();
+
+   switch (value.type)
+   {
+      case PROPERTY_STRING:
+         variant.vt = VT_BSTR;
+         variant.bstrVal = ::SysAllocStringLen(value.text.data(), static_cast<UINT>(value.text.length()));
+
+         if (NULL == variant.bstrVal)
+         {
+            variant.vt = VT_EMPTY;
+            return E_OUTOFMEMORY;
+         }
+
+         break;
+
+      case PROPERTY_INTEGER:
+         if (value.integer >= LONG_MIN && value.integer <= LONG_MAX)
+         {
+            variant = static_cast<long>(value.integer);
+         }
+         else
+         {
+            variant.vt = VT_I8;
+            variant.llVal = value.integer;
+         }
+
+         break;
+
+      case PROPERTY_REAL:
+         variant = value.real;
+         break;
+
+      case PROPERTY_BOOLEAN:
+         variant = 0 != value.integer;
+         break;
+
+      case PROPERTY_TIME:
+      {
+         FILETIME ft;
+         SYSTEMTIME st;
+         DATE date;
+
+         ft.dwLowDateTime = static_cast<DWORD>(value.integer);
+         ft.dwHighDateTime = static_cast<DWORD>(static_cast<unsigned long long>(value.integer) >> 32);
+
+         if (::FileTimeToSystemTime(&ft, &st) && ::SystemTimeToVariantTime(&st, &date))
+         {
+            variant.vt = VT_DATE;
+            variant.date = date;
+         }
+         else
+         {
+            variant.vt = VT_I8;
+            variant.llVal = value.integer;
+         }
+
+         break;
+      }
+   }
+
+   return S_OK;
+}
+
+// Feeds a PageReader or PullChunks straight from an IFilter, with its
+// values as well when asked for them. Failures are kept for the caller to
+// report, the reader only learns that something went wrong.
+class FilterChunkSource : public ValueChunkSource
+{
+public:
+   explicit FilterChunkSource(IFilter *pFilter, bool values = false)
+      : m_spIFilter(pFilter), m_values(values), m_hr(S_OK), m_inGetText(false)
+   {
+   }
+
+   virtual ChunkRead NextChunk(ChunkInfo & chunk)
+   {
+      STAT_CHUNK statChunk;
+      memset(&statChunk, 0, sizeof(statChunk));
+
+      HRESULT hr = m_spIFilter->GetChunk(&statChunk);
+
+      if (SUCCEEDED(hr))
+      {
+         if (m_values && CHUNK_VALUE == (CHUNK_VALUE & statChunk.flags))
+         {
+            ToPropertyKey(statChunk.attribute, m_valueKey);
+            return CHUNK_READ_VALUE;
+         }
+
+         // non-text chunks still count, seeking replays every GetChunk
+         if (CHUNK_TEXT != (CHUNK_TEXT & statChunk.flags))
+            return CHUNK_READ_SKIP;
+
+         ToChunkInfo(statChunk, chunk);
+         return CHUNK_READ_TEXT;
+      }
+
+      switch (hr)
+      {
+         case FILTER_E_EMBEDDING_UNAVAILABLE:
+         case FILTER_E_LINK_UNAVAILABLE:
+            return CHUNK_READ_SKIP;
+
+         case FILTER_E_END_OF_CHUNKS:
+            return CHUNK_READ_END;
+
+         default:
+            m_hr = hr;
+            m_inGetText = false;
+            return CHUNK_READ_ERROR;
+      }
+   }
+
+   virtual TextRead GetText(wchar_t *buf, unsigned long *cch)
+   {
+      HRESULT hr = m_spIFilter->GetText(cch, buf);
+
+      if (SUCCEEDED(hr))
+         return FILTER_S_LAST_TEXT == hr ? TEXT_READ_LAST : TEXT_READ_MORE;
+
+      *cch = 0;
+
+      if (FILTER_E_NO_MORE_TEXT == hr)
+         return TEXT_READ_END;
+
+      m_hr = hr;
+      m_inGetText = true;
+      return TEXT_READ_ERROR;
+   }
+
+   // A value the filter can't give is only missing from the bag, the
+   // text still comes.
+   virtual bool GetValue(PropertyKey & key, PropertyValue & value)
+   {
+      PROPVARIANT *pValue = NULL;
+      HRESULT hr = m_spIFilter->GetValue(&pValue);
+
+      if (FAILED(hr) || NULL == pValue)
+         return false;
+
+      bool converted = false;
+
+      try
+      {
+         converted = ToPropertyValue(*pValue, value);
+      }
+      catch (...)
+      {
+      }
+
+      ::PropVariantClear(pValue);
+      ::CoTaskMemFree(pValue);
+
+      key = m_valueKey;
+      return converted;
+   }
+
+   HRESULT LastError() const { return m_hr; }
+   bool InGetText() const { return m_inGetText; }
+
+private:
+   CComPtr<IFilter> m_spIFilter;
+   bool m_values;
+   PropertyKey m_valueKey;
+   HRESULT m_hr;
+   bool m_inGetText;
+};
+
+// Chunk checkpoints gathered for one version of a file, so a page anywhere in
+// it can be reached by reopening the filter and skipping the GetText calls.
+class PageIndex
+{
+public:
+   PageIndex(BSTR fileName, unsigned long long stamp, CleanupProfile profile)
+      : m_fileName(fileName), m_stamp(stamp), m_profile(profile), m_lastUsed(0)
+   {
+   }
+
+   std::wstring m_fileName;
+   unsigned long long m_stamp;
+   CleanupProfile m_profile;
+   unsigned long m_lastUsed;
+
+   PageCheckpoints m_checkpoints;
+};
+
+// Positional reads through a synchronous handle, the OVERLAPPED only
+// carries the offset.
+class HandleReader : public ByteReader
+{
+public:
+   explicit HandleReader(HANDLE hFile) : m_hFile(hFile), m_error(ERROR_SUCCESS) {}
+
+   virtual bool ReadAt(unsigned long long offset, unsigned char *buf, size_t cb)
+   {
+      while (cb)
+      {
+         OVERLAPPED overlapped;
+         memset(&overlapped, 0, sizeof(overlapped));
+         overlapped.Offset = static_cast<DWORD>(offset);
+         overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+         DWORD cbWanted = cb > 0x10000000 ? 0x10000000 : static_cast<DWORD>(cb);
+         DWORD cbRead = 0;
+
+         if (!::ReadFile(m_hFile, buf, cbWanted, &cbRead, &overlapped))
+         {
+            m_error = ::GetLastError();
+            return false;
+         }
+
+         if (0 == cbRead)
+         {
+            m_error = ERROR_HANDLE_EOF;
+            return false;
+         }
+
+         buf += cbRead;
+         cb -= cbRead;
+         offset += cbRead;
+      }
+
+      return true;
+   }
+
+   DWORD LastError() const { return m_error; }
+
+private:
+   HANDLE m_hFile;
+   DWORD m_error;
+};
+
+// the text buffer and the BSTR copied from it on the way out
+static const unsigned c_governedBytesPerChar = 2 * sizeof(wchar_t);
+
+// admission never asks for more than this, bigger files grow past it
+static const unsigned long long c_maxAdmission = 64 * 1024 * 1024;
+
+// a sink can take one filter buffer past its maxLength before it stops
+static const unsigned long long c_filterBufferChars = 4096;
+
+// Footprint of up to maxLength characters (0 for all of them) of the text
+// of fileName at bytesPerChar, capped at c_maxAdmission. The file's size is
+// a fair guess for text formats and a generous one for the rest; if it
+// can't be had FilterText will report why.
+static unsigned long long EstimateFootprint(BSTR fileName, size_t maxLength, unsigned bytesPerChar)
+{
+   unsigned long long estimate = 0;
+   WIN32_FILE_ATTRIBUTE_DATA data;
+
+   if (NULL != fileName && ::GetFileAttributesExW(fileName, GetFileExInfoStandard, &data))
+      estimate = ((static_cast<unsigned long long>(data.nFileSizeHigh) << 32) | data.nFileSizeLow) * bytesPerChar;
+
+   if (0 != maxLength && estimate > (static_cast<unsigned long long>(maxLength) + 1) * bytesPerChar)
+      estimate = (static_cast<unsigned long long>(maxLength) + 1) * bytesPerChar;
+
+   return estimate > c_maxAdmission ? c_maxAdmission : estimate;
+}
+
+// Sniffs the first few KB of fileName, FORMAT_UNKNOWN if it can't be read
+// (opening it for the filter will say why).
+static ContentFormat SniffFile(BSTR fileName)
+{
+   HANDLE hFile = ::CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+   if (INVALID_HANDLE_VALUE == hFile)
+      return FORMAT_UNKNOWN;
+
+   DWORD sizeHigh = 0;
+   DWORD sizeLow = ::GetFileSize(hFile, &sizeHigh);
+   ContentFormat format = FORMAT_UNKNOWN;
+
+   if (INVALID_FILE_SIZE != sizeLow || ERROR_SUCCESS == ::GetLastError())
+   {
+      HandleReader reader(hFile);
+      format = SniffContent(reader, (static_cast<unsigned long long>(sizeHigh) << 32) | sizeLow);
+   }
+
+   ::CloseHandle(hFile);
+   return format;
+}
+
+// Decides from fileName's name and content which extension's filter reads
+// it, see ChooseRoute.
+static ContentRoute RouteFile(BSTR fileName, std::wstring & extension)
+{
+   return ChooseRoute(FilterKey(fileName), SniffFile(fileName), extension);
+}
+
+// The built-in plain text path over an open file, for paging through the
+// files FilterText reads that way. Owns the handle.
+class FileChunkSource : public ChunkSource
+{
+public:
+   FileChunkSource(HANDLE hFile, unsigned long long size)
+      : m_hFile(hFile), m_reader(hFile), m_source(m_reader, size)
+   {
+   }
+
+   virtual ~FileChunkSource()
+   {
+      ::CloseHandle(m_hFile);
+   }
+
+   AppendResult Open() { return m_source.Open(); }
+
+   virtual ChunkRead NextChunk(ChunkInfo & chunk) { return m_source.NextChunk(chunk); }
+   virtual TextRead GetText(wchar_t *buf, unsigned long *cch) { return m_source.GetText(buf, cch); }
+
+   DWORD LastError() const { return m_reader.LastError(); }
+
+private:
+   FileChunkSource(const FileChunkSource &);
+   FileChunkSource & operator=(const FileChunkSource &);
+
+   HANDLE m_hFile;
+   HandleReader m_reader;
+   PlainChunkSource m_source;
+};
+
+// A filter, or the built-in path for plain text, left open where the last
+// page ended, so the next page carries on from there. Kept by the object
+// until the text runs out or it gets evicted.
+class PageSession
+{
+public:
+   PageSession(unsigned long id, BSTR fileName, unsigned long long stamp, CleanupProfile profile, IFilter *pFilter)
+      : m_id(id), m_fileName(fileName), m_stamp(stamp), m_profile(profile), m_lastUsed(0),
+        m_filter(new FilterChunkSource(pFilter)), m_file(NULL), m_reader(*m_filter, profile)
+   {
+   }
+
+   // takes over pFile
+   PageSession(unsigned long id, BSTR fileName, unsigned long long stamp, CleanupProfile profile, FileChunkSource *pFile)
+      : m_id(id), m_fileName(fileName), m_stamp(stamp), m_profile(profile), m_lastUsed(0),
+        m_filter(NULL), m_file(pFile), m_reader(*m_file, profile)
+   {
+   }
+
+   ~PageSession()
+   {
+      delete m_filter;
+      delete m_file;
+   }
+
+   unsigned long m_id;
+   std::wstring m_fileName;
+   unsigned long long m_stamp;
+   CleanupProfile m_profile;
+   unsigned long m_lastUsed;
+
+   FilterChunkSource *m_filter;     // one or the other
+   FileChunkSource *m_file;
+   PageReader m_reader;
+
+private:
+   PageSession(const PageSession &);
+   PageSession & operator=(const PageSession &);
+};
+
+static const size_t c_maxPageSessions = 4;
+static const size_t c_maxPageIndexes = 16;
+
+// Health of the filters by extension and by filter class. Both get a say
+// before a call, so a filter that fails for every extension it handles, or
+// an extension whose files trip up its filter, stops being sent work.
+static HealthTracker s_extensionHealth;
+static HealthTracker s_filterHealth;
+
+// Size and last write time, so tokens and checkpoints for an older version
+// of the file don't get used.
+static HRESULT GetFileStamp(BSTR fileName, unsigned long long *stamp)
+{
+   WIN32_FILE_ATTRIBUTE_DATA data;
+
+   if (!::GetFileAttributesExW(fileName, GetFileExInfoStandard, &data))
+      return HRESULT_FROM_WIN32(::GetLastError());
+
+   unsigned long long written = (static_cast<unsigned long long>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+   unsigned long long size = (static_cast<unsigned long long>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+
+   *stamp = written ^ (size * 0x9E3779B97F4A7C15ULL);
+   return S_OK;
+}
+
+static bool ToCleanupProfile(NormalizationProfile profile, CleanupProfile *cleanupProfile)
+{
+   switch (profile)
+   {
+      case NormalizeDisplay:
+         *cleanupProfile = CLEANUP_DISPLAY;
+         return true;
+
+      case NormalizeIndex:
+         *cleanupProfile = CLEANUP_INDEX;
+         return true;
+
+      case NormalizeCompact:
+         *cleanupProfile = CLEANUP_COMPACT;
+         return true;
+
+      default:
+         return false;
+   }
+}
+
+static bool ToLz4Level(CompressionLevel level, Lz4Level *lz4Level)
+{
+   switch (level)
+   {
+      case CompressFast:
+         *lz4Level = LZ4_LEVEL_FAST;
+         return true;
+
+      case CompressHigh:
+         *lz4Level = LZ4_LEVEL_HIGH;
+         return true;
+
+      default:
+         return false;
+   }
+}
+
+// Hands the collected text back, S_FALSE tells the caller it was cut short
+// at maxLength, EXTRACT_S_OVER_BUDGET that the memory budget cut it short.
+static HRESULT ReturnText(const TextBufferSink & text, const MemoryReservation & reservation, BSTR * fileText)
+{
+   *fileText = ::SysAllocStringLen(text.Text().data(), static_cast<UINT>(text.Text().length()));
+
+   if (NULL == *fileText)
+      return E_OUTOFMEMORY;
+
+   if (reservation.OverBudget())
+      return EXTRACT_S_OVER_BUDGET;
+
+   return text.Truncated() ? S_FALSE : S_OK;
+}
+
+// Takes no text at all.
+class NoTextSink : public TextSink
+{
+public:
+   virtual void OnText(const wchar_t * /*text*/, size_t /*cch*/) {}
+   virtual bool WantsMore() const { return false; }
+};
+
+STDMETHODIMP CTextExtractor::ExtractText(BSTR fileName, long maxLength, BSTR * fileText)
+{
+   // A negative maxLength has always been taken here to cut the text short
+   // before its first character: the file is still opened, so its errors
+   // come back as before, and the text is empty with S_FALSE. The methods
+   // that came later turn it down.
+   if (maxLength < 0)
+   {
+      if (NULL == fileName || NULL == fileText)
+         return E_POINTER;
+
+      *fileText = NULL;
+
+      NoTextSink none;
+      HRESULT hr = FilterText(fileName, CLEANUP_DISPLAY, none);
+
+      if (FAILED(hr))
+         return hr;
+
+      *fileText = ::SysAllocString(L"");
+      return NULL == *fileText ? E_OUTOFMEMORY : S_FALSE;
+   }
+
+   return ExtractTextEx(fileName, maxLength, NormalizeDisplay, fileText);
+}
+
+STDMETHODIMP CTextExtractor::ExtractTextEx(BSTR fileName, long maxLength, NormalizationProfile profile, BSTR * fileText)
+{
+   if (NULL == fileText)
+      return E_POINTER;
+
+   *fileText = NULL;
+
+   CleanupProfile cleanupProfile;
+
+   if (maxLength < 0 || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   MemoryReservation reservation(MemoryGovernor::Instance());
+   TextBufferSink text(maxLength);
+
+   HRESULT hr = GovernedFilterText(fileName, maxLength, cleanupProfile, text, reservation);
+
+   if (FAILED(hr))
+      return hr;
+
+   return ReturnText(text, reservation, fileText);
+}
+
+STDMETHODIMP CTextExtractor::ExtractTokens(BSTR fileName, long maxLength, NormalizationProfile profile, VARIANT * tokens, BSTR * fileText)
+{
+   if (NULL == tokens || NULL == fileText)
+      return E_POINTER;
+
+   ::VariantInit(tokens);
+   *fileText = NULL;
+
+   CleanupProfile cleanupProfile;
+
+   if (maxLength < 0 || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   MemoryReservation reservation(MemoryGovernor::Instance());
+   TextBufferSink text(maxLength);
+   TokenSink tokenSink(maxLength);
+
+   TeeSink tee;
+   tee.Add(&text);
+   tee.Add(&tokenSink);
+
+   HRESULT hr = GovernedFilterText(fileName, maxLength, cleanupProfile, tee, reservation);
+
+   if (FAILED(hr))
+      return hr;
+
+   // three longs per token: offset, length and TokenClass
+   const std::vector<Token> & list = tokenSink.Tokens();
+   SAFEARRAY *psa = ::SafeArrayCreateVector(VT_I4, 0, static_cast<ULONG>(list.size() * 3));
+
+   if (NULL == psa)
+      return E_OUTOFMEMORY;
+
+   long *data = NULL;
+   hr = ::SafeArrayAccessData(psa, reinterpret_cast<void**>(&data));
+
+   if (FAILED(hr))
+   {
+      ::SafeArrayDestroy(psa);
+      return hr;
+   }
+
+   for (size_t i = 0; i < list.size(); ++i)
+   {
+      data[i * 3] = static_cast<long>(list[i].offset);
+      data[i * 3 + 1] = list[i].length;
+      data[i * 3 + 2] = list[i].kind;
+   }
+
+   ::SafeArrayUnaccessData(psa);
+
+   tokens->vt = VT_ARRAY | VT_I4;
+   tokens->parray = psa;
+
+   return ReturnText(text, reservation, fileText);
+}
+
+STDMETHODIMP CTextExtractor::ExtractTextWithLanguage(BSTR fileName, long maxLength, NormalizationProfile profile, VARIANT_BOOL perChunk,
+                                                     BSTR * language, BSTR * script, double * confidence, VARIANT * chunkScripts, BSTR * fileText)
+{
+   if (NULL == language || NULL == script || NULL == confidence || NULL == chunkScripts || NULL == fileText)
+      return E_POINTER;
+
+   *language = NULL;
+   *script = NULL;
+   *confidence = 0;
+   ::VariantInit(chunkScripts);
+   *fileText = NULL;
+
+   CleanupProfile cleanupProfile;
+
+   if (maxLength < 0 || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   MemoryReservation reservation(MemoryGovernor::Instance());
+   TextBufferSink text(maxLength);
+   LanguageSink languageSink(maxLength, VARIANT_FALSE != perChunk);
+
+   TeeSink tee;
+   tee.Add(&text);
+   tee.Add(&languageSink);
+
+   HRESULT hr = GovernedFilterText(fileName, maxLength, cleanupProfile, tee, reservation);
+
+   if (FAILED(hr))
+      return hr;
+
+   LanguageGuess guess = languageSink.Guess();
+
+   *language = CComBSTR(guess.language).Detach();
+   *script = CComBSTR(ScriptName(guess.script)).Detach();
+   *confidence = guess.confidence;
+
+   if (VARIANT_FALSE != perChunk)
+   {
+      // rows of (chunk id, locale, script, letters)
+      const std::vector<ChunkScript> & chunks = languageSink.Chunks();
+
+      SAFEARRAYBOUND bounds[2];
+      bounds[0].lLbound = 0;
+      bounds[0].cElements = static_cast<ULONG>(chunks.size());
+      bounds[1].lLbound = 0;
+      bounds[1].cElements = 4;
+
+      SAFEARRAY *psa = ::SafeArrayCreate(VT_VARIANT, 2, bounds);
+
+      if (NULL == psa)
+         return E_OUTOFMEMORY;
+
+      for (size_t i = 0; i < chunks.size(); ++i)
+      {
+         CComVariant cells[4];
+         cells[0] = static_cast<long>(chunks[i].idChunk);
+         cells[1] = static_cast<long>(chunks[i].locale);
+         cells[2] = ScriptName(chunks[i].script);
+         cells[3] = static_cast<long>(chunks[i].letters);
+
+         for (long column = 0; column < 4; ++column)
+         {
+            // SafeArrayPutElement wants the indices right-most dimension first
+            long indices[2] = { column, static_cast<long>(i) };
+            ::SafeArrayPutElement(psa, indices, &cells[column]);
+         }
+      }
+
+      chunkScripts->vt = VT_ARRAY | VT_VARIANT;
+      chunkScripts->parray = psa;
+   }
+
+   return ReturnText(text, reservation, fileText);
+}
+
+STDMETHODIMP CTextExtractor::ExtractTextWithSignatures(BSTR fileName, long maxLength, NormalizationProfile profile,
+                                                       hyper * simHash, VARIANT * minHash, BSTR * fileText)
+{
+   if (NULL == simHash || NULL == minHash || NULL == fileText)
+      return E_POINTER;
+
+   *simHash = 0;
+   ::VariantInit(minHash);
+   *fileText = NULL;
+
+   CleanupProfile cleanupProfile;
+
+   if (maxLength < 0 || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   // the signature sink always wants more, so the tee keeps the filter going
+   // to the end of the document after the text buffer has filled up
+   MemoryReservation reservation(MemoryGovernor::Instance());
+   TextBufferSink text(maxLength);
+   SignatureSink signatureSink;
+
+   TeeSink tee;
+   tee.Add(&text);
+   tee.Add(&signatureSink);
+
+   HRESULT hr = GovernedFilterText(fileName, maxLength, cleanupProfile, tee, reservation);
+
+   if (FAILED(hr))
+      return hr;
+
+   const std::vector<unsigned long long> & values = signatureSink.MinHash();
+   SAFEARRAY *psa = ::SafeArrayCreateVector(VT_I8, 0, static_cast<ULONG>(values.size()));
+
+   if (NULL == psa)
+      return E_OUTOFMEMORY;
+
+   LONGLONG *data = NULL;
+   hr = ::SafeArrayAccessData(psa, reinterpret_cast<void**>(&data));
+
+   if (FAILED(hr))
+   {
+      ::SafeArrayDestroy(psa);
+      return hr;
+   }
+
+   for (size_t i = 0; i < values.size(); ++i)
+      data[i] = static_cast<LONGLONG>(values[i]);
+
+   ::SafeArrayUnaccessData(psa);
+
+   minHash->vt = VT_ARRAY | VT_I8;
+   minHash->parray = psa;
+
+   *simHash = static_cast<hyper>(signatureSink.SimHash());
+
+   return ReturnText(text, reservation, fileText);
+}
+
+STDMETHODIMP CTextExtractor::ExtractTextWithOffsets(BSTR fileName, long maxLength, NormalizationProfile profile, VARIANT * offsetMap, BSTR * fileText)
+{
+   if (NULL == offsetMap || NULL == fileText)
+      return E_POINTER;
+
+   ::VariantInit(offsetMap);
+   *fileText = NULL;
+
+   CleanupProfile cleanupProfile;
+
+   if (maxLength < 0 || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   MemoryReservation reservation(MemoryGovernor::Instance());
+   TextBufferSink text(maxLength);
+   OffsetMapSink offsetSink(maxLength);
+
+   TeeSink tee;
+   tee.Add(&text);
+   tee.Add(&offsetSink);
+
+   HRESULT hr = GovernedFilterText(fileName, maxLength, cleanupProfile, tee, reservation);
+
+   if (FAILED(hr))
+      return hr;
+
+   const std::vector<unsigned char> & encoded = offsetSink.Encoded();
+   SAFEARRAY *psa = ::SafeArrayCreateVector(VT_UI1, 0, static_cast<ULONG>(encoded.size()));
+
+   if (NULL == psa)
+      return E_OUTOFMEMORY;
+
+   unsigned char *data = NULL;
+   hr = ::SafeArrayAccessData(psa, reinterpret_cast<void**>(&data));
+
+   if (FAILED(hr))
+   {
+      ::SafeArrayDestroy(psa);
+      return hr;
+   }
+
+   memcpy(data, &encoded[0], encoded.size());
+   ::SafeArrayUnaccessData(psa);
+
+   offsetMap->vt = VT_ARRAY | VT_UI1;
+   offsetMap->parray = psa;
+
+   return ReturnText(text, reservation, fileText);
+}
+
+STDMETHODIMP CTextExtractor::ExtractCompressedText(BSTR fileName, long maxLength, NormalizationProfile profile, CompressionLevel level, VARIANT * compressedText)
+{
+   if (NULL == compressedText)
+      return E_POINTER;
+
+   ::VariantInit(compressedText);
+
+   CleanupProfile cleanupProfile;
+   Lz4Level lz4Level;
+
+   if (maxLength < 0 || !ToCleanupProfile(profile, &cleanupProfile) || !ToLz4Level(level, &lz4Level))
+      return E_INVALIDARG;
+
+   // no TextBufferSink here, the text only ever exists a block at a time
+   CompressedTextSink compressed(maxLength, lz4Level);
+
+   // admitted for the frame and its copy in the array at their largest, as
+   // big as the text when it doesn't compress at all
+   MemoryReservation reservation(MemoryGovernor::Instance());
+
+   HRESULT hr = AdmittedFilterText(fileName, EstimateFootprint(fileName, maxLength, c_governedBytesPerChar), cleanupProfile,
+                                   compressed, reservation);
+
+   if (FAILED(hr))
+      return hr;
+
+   SAFEARRAY *psa = ::SafeArrayCreateVector(VT_UI1, 0, static_cast<ULONG>(compressed.FrameSize()));
+
+   if (NULL == psa)
+      return E_OUTOFMEMORY;
+
+   unsigned char *data = NULL;
+   hr = ::SafeArrayAccessData(psa, reinterpret_cast<void**>(&data));
+
+   if (FAILED(hr))
+   {
+      ::SafeArrayDestroy(psa);
+      return hr;
+   }
+
+   compressed.WriteFrame(data);
+   ::SafeArrayUnaccessData(psa);
+
+   compressedText->vt = VT_ARRAY | VT_UI1;
+   compressedText->parray = psa;
+
+   return compressed.Truncated() ? S_FALSE : S_OK;
+}
+
+STDMETHODIMP CTextExtractor::ExtractLargeText(BSTR fileName, hyper maxLength, NormalizationProfile profile, hyper memoryThreshold,
+                                              hyper * length, BSTR * spillPath, BSTR * fileText)
+{
+   if (NULL == length || NULL == spillPath || NULL == fileText)
+      return E_POINTER;
+
+   *length = 0;
+   *spillPath = NULL;
+   *fileText = NULL;
+
+   CleanupProfile cleanupProfile;
+
+   if (maxLength < 0 || memoryThreshold < 0 || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   // the text kept in memory comes back as a BSTR, which holds no more
+   unsigned long long threshold = static_cast<unsigned long long>(memoryThreshold);
+
+   if (threshold > UINT_MAX)
+      threshold = UINT_MAX;
+
+   SpillSink text(static_cast<unsigned long long>(maxLength), threshold);
+
+   // only what stays in memory counts against the budget, past the threshold
+   // the text goes to the temp file through a small window
+   unsigned long long inMemory = threshold / sizeof(wchar_t);
+
+   if (0 != maxLength && static_cast<unsigned long long>(maxLength) < inMemory)
+      inMemory = static_cast<unsigned long long>(maxLength);
+
+   MemoryReservation reservation(MemoryGovernor::Instance());
+
+   // 0 would be no limit at all
+   HRESULT hr = GovernedFilterText(fileName, static_cast<size_t>(inMemory ? inMemory : 1), cleanupProfile, text, reservation);
+
+   if (FAILED(hr))
+      return hr;
+
+   if (text.Failed())
+      return Error("Unable to write the text to a temp file.", __uuidof(TextExtractor), HRESULT_FROM_WIN32(text.Error()));
+
+   *length = static_cast<hyper>(text.Length());
+
+   if (text.Spilled())
+   {
+      std::wstring path = text.DetachPath();
+      *spillPath = ::SysAllocStringLen(path.data(), static_cast<UINT>(path.length()));
+
+      if (NULL == *spillPath)
+      {
+         ::DeleteFileW(path.c_str());
+         return E_OUTOFMEMORY;
+      }
+   }
+   else
+   {
+      *fileText = ::SysAllocStringLen(text.Text().data(), static_cast<UINT>(text.Text().length()));
+
+      if (NULL == *fileText)
+         return E_OUTOFMEMORY;
+   }
+
+   if (reservation.OverBudget())
+      return EXTRACT_S_OVER_BUDGET;
+
+   return text.Truncated() ? S_FALSE : S_OK;
+}
+
+STDMETHODIMP CTextExtractor::ExtractTextPage(BSTR fileName, long start, long pageLength, NormalizationProfile profile, BSTR * continuation, BSTR * pageText)
+{
+   if (NULL == fileName || NULL == continuation || NULL == pageText)
+      return E_POINTER;
+
+   *pageText = NULL;
+
+   CleanupProfile cleanupProfile;
+
+   if (0 == ::SysStringLen(fileName) || start < 0 || pageLength <= 0 || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   PageToken token;
+   bool haveToken = false;
+
+   if (::SysStringLen(*continuation))
+   {
+      if (!DecodePageToken(*continuation, ::SysStringLen(*continuation), token))
+         return E_INVALIDARG;
+
+      haveToken = true;
+   }
+
+   try
+   {
+      unsigned long long stamp;
+      HRESULT hr = GetFileStamp(fileName, &stamp);
+
+      if (FAILED(hr))
+         return Error("Unable to access file.", __uuidof(TextExtractor), hr);
+
+      // a token for another version of the file or another profile is no help
+      if (haveToken && (token.stamp != stamp || token.profile != static_cast<unsigned long>(cleanupProfile)))
+         haveToken = false;
+
+      ++m_pageClock;
+
+      PageIndex *index = GetPageIndex(fileName, stamp, cleanupProfile);
+
+      // carry on with an open filter that hasn't gone past start yet,
+      // the one the token came from if it's still around
+      PageSession *session = NULL;
+
+      for (size_t i = 0; i < m_pageSessions.size(); ++i)
+      {
+         PageSession *candidate = m_pageSessions[i];
+
+         if (candidate->m_stamp != stamp || candidate->m_profile != cleanupProfile ||
+             candidate->m_reader.Offset() > static_cast<unsigned long long>(start) ||
+             0 != _wcsicmp(candidate->m_fileName.c_str(), fileName))
+            continue;
+
+         if (haveToken && candidate->m_id == token.session)
+         {
+            session = candidate;
+            break;
+         }
+
+         if (NULL == session || candidate->m_reader.Offset() > session->m_reader.Offset())
+            session = candidate;
+      }
+
+      if (NULL == session)
+      {
+         // reopen the filter and skip to the closest checkpoint before start
+         PageCheckpoint checkpoint = index->m_checkpoints.Find(start);
+
+         if (haveToken && token.checkpoint.offset <= static_cast<unsigned long long>(start) && token.checkpoint.offset > checkpoint.offset)
+            checkpoint = token.checkpoint;
+
+         hr = OpenPageSession(fileName, stamp, cleanupProfile, &session);
+
+         if (FAILED(hr))
+            return hr;
+
+         if (!session->m_reader.Seek(checkpoint))
+         {
+            // the filter came up with fewer chunks this time, start over
+            delete session;
+            session = NULL;
+
+            hr = OpenPageSession(fileName, stamp, cleanupProfile, &session);
+
+            if (FAILED(hr))
+               return hr;
+         }
+
+         if (m_pageSessions.size() >= c_maxPageSessions)
+         {
+            size_t oldest = 0;
+
+            for (size_t i = 1; i < m_pageSessions.size(); ++i)
+            {
+               if (m_pageSessions[i]->m_lastUsed < m_pageSessions[oldest]->m_lastUsed)
+                  oldest = i;
+            }
+
+            ClosePageSession(m_pageSessions[oldest]);
+         }
+
+         m_pageSessions.push_back(session);
+      }
+
+      session->m_lastUsed = m_pageClock;
+
+      std::wstring page;
+      bool read = session->m_reader.Read(start, pageLength, page);
+
+      index->m_checkpoints.Merge(session->m_reader.Checkpoints());
+
+      if (!read)
+      {
+         if (session->m_file)
+            hr = Error("Unable to read file.", __uuidof(TextExtractor), HRESULT_FROM_WIN32(session->m_file->LastError()));
+         else
+            hr = FilterError(session->m_filter->InGetText(), session->m_filter->LastError());
+
+         ClosePageSession(session);
+         return hr;
+      }
+
+      *pageText = ::SysAllocStringLen(page.data(), static_cast<UINT>(page.length()));
+
+      if (NULL == *pageText)
+         return E_OUTOFMEMORY;
+
+      ::SysFreeString(*continuation);
+      *continuation = NULL;
+
+      if (session->m_reader.AtEnd())
+      {
+         ClosePageSession(session);
+         return S_OK;
+      }
+
+      token.session = session->m_id;
+      token.stamp = stamp;
+      token.profile = cleanupProfile;
+      token.offset = session->m_reader.Offset();
+      token.checkpoint = session->m_reader.LastCheckpoint();
+
+      std::wstring text = EncodePageToken(token);
+      *continuation = ::SysAllocStringLen(text.data(), static_cast<UINT>(text.length()));
+
+      if (NULL == *continuation)
+         return E_OUTOFMEMORY;
+
+      // more text follows, like ExtractText's S_FALSE when maxLength cuts it short
+      return S_FALSE;
+   }
+   catch (...)
+   {
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+   }
+}
+
+STDMETHODIMP CTextExtractor::ExtractAppendedText(BSTR fileName, NormalizationProfile profile, BSTR * appendState, BSTR * appendedText)
+{
+   if (NULL == fileName || NULL == appendState || NULL == appendedText)
+      return E_POINTER;
+
+   *appendedText = NULL;
+
+   CleanupProfile cleanupProfile;
+
+   if (0 == ::SysStringLen(fileName) || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   AppendState state;
+
+   if (::SysStringLen(*appendState))
+   {
+      if (!DecodeAppendState(*appendState, ::SysStringLen(*appendState), state))
+         return E_INVALIDARG;
+   }
+   else
+   {
+      InitAppendState(state, cleanupProfile);
+   }
+
+   // the writer still has the file open, so share everything
+   HANDLE hFile = ::CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+   if (INVALID_HANDLE_VALUE == hFile)
+      return Error("Unable to access file.", __uuidof(TextExtractor), HRESULT_FROM_WIN32(::GetLastError()));
+
+   DWORD sizeHigh = 0;
+   DWORD sizeLow = ::GetFileSize(hFile, &sizeHigh);
+
+   if (INVALID_FILE_SIZE == sizeLow && ERROR_SUCCESS != ::GetLastError())
+   {
+      HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+      ::CloseHandle(hFile);
+      return Error("Unable to access file.", __uuidof(TextExtractor), hr);
+   }
+
+   unsigned long long size = (static_cast<unsigned long long>(sizeHigh) << 32) | sizeLow;
+
+   TextBufferSink text(0);
+   HandleReader reader(hFile);
+   AppendResult result;
+
+   try
+   {
+      result = ExtractAppendedText(reader, size, cleanupProfile, state, text);
+   }
+   catch (...)
+   {
+      ::CloseHandle(hFile);
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+   }
+
+   ::CloseHandle(hFile);
+
+   switch (result)
+   {
+      case APPEND_NOT_TEXT:
+         return Error("The file does not look like plain text.", __uuidof(TextExtractor), FILTER_E_UNKNOWNFORMAT);
+
+      case APPEND_READ_ERROR:
+         return Error("Unable to read file.", __uuidof(TextExtractor), HRESULT_FROM_WIN32(reader.LastError()));
+
+      default:
+         break;
+   }
+
+   std::wstring token = EncodeAppendState(state);
+   BSTR newState = ::SysAllocStringLen(token.data(), static_cast<UINT>(token.length()));
+
+   if (NULL == newState)
+      return E_OUTOFMEMORY;
+
+   *appendedText = ::SysAllocStringLen(text.Text().data(), static_cast<UINT>(text.Text().length()));
+
+   if (NULL == *appendedText)
+   {
+      ::SysFreeString(newState);
+      return E_OUTOFMEMORY;
+   }
+
+   ::SysFreeString(*appendState);
+   *appendState = newState;
+
+   // S_FALSE: the file was rewritten, so this is all of it rather than a delta
+   return APPEND_RESTARTED == result ? S_FALSE : S_OK;
+}
+
+STDMETHODIMP CTextExtractor::SetMemoryBudget(hyper budget, long waitMilliseconds)
+{
+   if (budget < 0 || waitMilliseconds < 0)
+      return E_INVALIDARG;
+
+   MemoryGovernor::Instance().Configure(static_cast<unsigned long long>(budget), static_cast<unsigned long>(waitMilliseconds));
+   return S_OK;
+}
+
+STDMETHODIMP CTextExtractor::GetMemoryUsage(hyper * inUse, hyper * budget, long * waiting)
+{
+   if (NULL == inUse || NULL == budget || NULL == waiting)
+      return E_POINTER;
+
+   unsigned long long bytesInUse;
+   unsigned long long bytesBudget;
+   unsigned long waiters;
+
+   MemoryGovernor::Instance().Usage(&bytesInUse, &bytesBudget, &waiters);
+
+   *inUse = static_cast<hyper>(bytesInUse);
+   *budget = static_cast<hyper>(bytesBudget);
+   *waiting = static_cast<long>(waiters);
+   return S_OK;
+}
+
+STDMETHODIMP CTextExtractor::QueueExtraction(BSTR fileName, long maxLength, NormalizationProfile profile, long * jobId)
+{
+   if (NULL == jobId)
+      return E_POINTER;
+
+   *jobId = 0;
+
+   if (NULL == fileName)
+      return E_POINTER;
+
+   CleanupProfile cleanupProfile;
+
+   if (0 == ::SysStringLen(fileName) || maxLength < 0 || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   unsigned long id;
+   HRESULT hr = ExtractQueue::Instance().Queue(fileName, maxLength, profile, &id);
+
+   if (FAILED(hr))
+      return Error("Unable to start a worker for the queued extraction.", __uuidof(TextExtractor), hr);
+
+   *jobId = static_cast<long>(id);
+   return S_OK;
+}
+
+STDMETHODIMP CTextExtractor::GetQueuedResult(long jobId, long waitMilliseconds, BSTR * fileText)
+{
+   if (NULL == fileText)
+      return E_POINTER;
+
+   *fileText = NULL;
+
+   if (waitMilliseconds < 0)
+      return E_INVALIDARG;
+
+   HRESULT result;
+   BSTR text = NULL;
+   BSTR description = NULL;
+
+   HRESULT hr = ExtractQueue::Instance().Collect(static_cast<unsigned long>(jobId), static_cast<unsigned long>(waitMilliseconds), &result, &text, &description);
+
+   if (FAILED(hr))
+      return hr;
+
+   if (FAILED(result))
+   {
+      // raised again here, the worker's error info stayed on its own thread
+      ::SysFreeString(text);
+
+      if (NULL == description)
+         return result;
+
+      hr = Error(description, __uuidof(TextExtractor), result);
+      ::SysFreeString(description);
+      return hr;
+   }
+
+   ::SysFreeString(description);
+   *fileText = text;
+   return result;
+}
+
+STDMETHODIMP CTextExtractor::CancelQueuedExtraction(long jobId)
+{
+   return ExtractQueue::Instance().Cancel(static_cast<unsigned long>(jobId));
+}
+
+STDMETHODIMP CTextExtractor::SetFilterConcurrency(BSTR extension, long maxConcurrent)
+{
+   if (NULL == extension)
+      return E_POINTER;
+
+   if (0 == ::SysStringLen(extension) || maxConcurrent < 0)
+      return E_INVALIDARG;
+
+   ExtractQueue::Instance().SetConcurrency(extension, static_cast<unsigned long>(maxConcurrent));
+   return S_OK;
+}
+
+STDMETHODIMP CTextExtractor::GetFilterHealth(VARIANT * health)
+{
+   if (NULL == health)
+      return E_POINTER;
+
+   ::VariantInit(health);
+
+   unsigned long now = TickMs();
+   std::vector<HealthStats> stats;
+   std::vector<HealthStats> filters;
+
+   s_extensionHealth.Snapshot(stats, now);
+   s_filterHealth.Snapshot(filters, now);
+   stats.insert(stats.end(), filters.begin(), filters.end());
+
+   // rows of (key, state, calls, failures, mean ms, max ms, consecutive failures, rejected, retry ms)
+   SAFEARRAYBOUND bounds[2];
+   bounds[0].lLbound = 0;
+   bounds[0].cElements = static_cast<ULONG>(stats.size());
+   bounds[1].lLbound = 0;
+   bounds[1].cElements = 9;
+
+   SAFEARRAY *psa = ::SafeArrayCreate(VT_VARIANT, 2, bounds);
+
+   if (NULL == psa)
+      return E_OUTOFMEMORY;
+
+   for (size_t i = 0; i < stats.size(); ++i)
+   {
+      CComVariant cells[9];
+      cells[0] = stats[i].key.c_str();
+      cells[1] = static_cast<long>(stats[i].state);
+      cells[2] = static_cast<long>(stats[i].calls);
+      cells[3] = static_cast<long>(stats[i].failures);
+      cells[4] = static_cast<long>(stats[i].meanMs);
+      cells[5] = static_cast<long>(stats[i].maxMs);
+      cells[6] = static_cast<long>(stats[i].consecutiveFailures);
+      cells[7] = static_cast<long>(stats[i].rejected);
+      cells[8] = static_cast<long>(stats[i].retryMs);
+
+      for (long column = 0; column < 9; ++column)
+      {
+         // SafeArrayPutElement wants the indices right-most dimension first
+         long indices[2] = { column, static_cast<long>(i) };
+         ::SafeArrayPutElement(psa, indices, &cells[column]);
+      }
+   }
+
+   health->vt = VT_ARRAY | VT_VARIANT;
+   health->parray = psa;
+   return S_OK;
+}
+
+STDMETHODIMP CTextExtractor::ExtractTextSample(BSTR fileName, long headLength, long tailLength, long windowCount, long windowLength,
+                                               NormalizationProfile profile, VARIANT * samples)
+{
+   if (NULL == fileName || NULL == samples)
+      return E_POINTER;
+
+   ::VariantInit(samples);
+
+   CleanupProfile cleanupProfile;
+
+   if (0 == ::SysStringLen(fileName) || headLength < 0 || tailLength < 0 || windowCount < 0 || windowLength < 0 ||
+       !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
+
+   SampleSpec spec;
+   spec.headLength = headLength;
+   spec.tailLength = tailLength;
+   spec.windowCount = windowCount;
+   spec.windowLength = windowLength;
+
+   std::vector<TextSample> parts;
+   bool sampled = false;
+
+   // routed like FilterText, plain text is read only where the samples are
+   // (and by its name too, the samples' positions are in bytes either way)
+   std::wstring extension;
+   ContentRoute route = RouteFile(fileName, extension);
+
+   if (ROUTE_PLAIN_TEXT == route || IsPlainTextExtension(FilterKey(fileName)))
+   {
+      HANDLE hFile = ::CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                   NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+
+      if (INVALID_HANDLE_VALUE == hFile)
+         return Error("Unable to access file.", __uuidof(TextExtractor), HRESULT_FROM_WIN32(::GetLastError()));
+
+      DWORD sizeHigh = 0;
+      DWORD sizeLow = ::GetFileSize(hFile, &sizeHigh);
+
+      if (INVALID_FILE_SIZE == sizeLow && ERROR_SUCCESS != ::GetLastError())
+      {
+         HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+         ::CloseHandle(hFile);
+         return Error("Unable to access file.", __uuidof(TextExtractor), hr);
+      }
+
+      unsigned long long size = (static_cast<unsigned long long>(sizeHigh) << 32) | sizeLow;
+
+      HandleReader reader(hFile);
+      SampleStatus status;
+
+      try
+      {
+         status = SamplePlainText(reader, size, spec, cleanupProfile, parts);
+      }
+      catch (...)
+      {
+         ::CloseHandle(hFile);
+         return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+      }
+
+      ::CloseHandle(hFile);
+
+      if (SAMPLE_READ_ERROR == status)
+         return Error("Unable to read file.", __uuidof(TextExtractor), HRESULT_FROM_WIN32(reader.LastError()));
+
+      // one that doesn't look like text goes to its filter after all
+      sampled = SAMPLE_OK == status;
+
+      if (!sampled && ROUTE_PLAIN_TEXT == route)
+         extension = FilterKey(fileName);
+   }
+
+   try
+   {
+      if (!sampled)
+      {
+         CComPtr<IFilter> spIFilter;
+         HRESULT hr = OpenFilter(fileName, extension, &spIFilter);
+
+         if (FAILED(hr))
+            return hr;
+
+         FilterChunkSource source(spIFilter);
+
+         if (!SampleChunks(source, spec, cleanupProfile, parts))
+            return FilterError(source.InGetText(), source.LastError());
+      }
+   }
+   catch (...)
+   {
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+   }
+
+   // rows of (part, position, text)
+   SAFEARRAYBOUND bounds[2];
+   bounds[0].lLbound = 0;
+   bounds[0].cElements = static_cast<ULONG>(parts.size());
+   bounds[1].lLbound = 0;
+   bounds[1].cElements = 3;
+
+   SAFEARRAY *psa = ::SafeArrayCreate(VT_VARIANT, 2, bounds);
+
+   if (NULL == psa)
+      return E_OUTOFMEMORY;
+
+   for (size_t i = 0; i < parts.size(); ++i)
+   {
+      CComVariant cells[3];
+      cells[0] = static_cast<long>(parts[i].kind);
+
+      cells[1].vt = VT_I8;
+      cells[1].llVal = static_cast<LONGLONG>(parts[i].position);
+
+      cells[2].vt = VT_BSTR;
+      cells[2].bstrVal = ::SysAllocStringLen(parts[i].text.data(), static_cast<UINT>(parts[i].text.length()));
+
+      if (NULL == cells[2].bstrVal)
+      {
+         ::SafeArrayDestroy(psa);
+         return E_OUTOFMEMORY;
+      }
+
+      for (long column = 0; column < 3; ++column)
+      {
+         long indices[2] = { column, static_cast<long>(i) };
+         ::SafeArrayPutElement(psa, indices, &cells[column]);
+      }
+   }
+
+   samples->vt = VT_ARRAY | VT_VARIANT;
+   samples->parray = psa;
+   return S_OK;
+}
+
+// Strings passed as a single BSTR or a one-dimensional array of BSTRs, or of
+// VARIANTs holding anything that converts to one (what script passes). A
+// missing or empty argument is an empty list.
+static HRESULT ToStringList(const VARIANT & value, std::vector<std::wstring> & strings)
+{
+   strings.clear();
+
+   const VARIANT *pvar = &value;
+
+   if ((VT_BYREF | VT_VARIANT) == V_VT(pvar))
+      pvar = V_VARIANTREF(pvar);
+
+   VARTYPE vt = V_VT(pvar);
+
+   if (VT_EMPTY == vt || VT_NULL == vt || VT_ERROR == vt)
+      return S_OK;
+
+   if (VT_BSTR == vt)
+   {
+      strings.push_back(std::wstring(V_BSTR(pvar), ::SysStringLen(V_BSTR(pvar))));
+      return S_OK;
+   }
+
+   if (0 == (vt & VT_ARRAY))
+      return E_INVALIDARG;
+
+   SAFEARRAY *psa = (vt & VT_BYREF) ? *V_ARRAYREF(pvar) : V_ARRAY(pvar);
+   VARTYPE element = vt & VT_TYPEMASK;
+
+   if (NULL == psa || 1 != ::SafeArrayGetDim(psa) || (VT_BSTR != element && VT_VARIANT != element))
+      return E_INVALIDARG;
+
+   long lower = 0;
+   long upper = -1;
+   ::SafeArrayGetLBound(psa, 1, &lower);
+   ::SafeArrayGetUBound(psa, 1, &upper);
+
+   for (long i = lower; i <= upper; ++i)
+   {
+      CComVariant item;
+      HRESULT hr;
+
+      if (VT_BSTR == element)
+      {
+         item.vt = VT_BSTR;
+         item.bstrVal = NULL;
+         hr = ::SafeArrayGetElement(psa, &i, &item.bstrVal);
+      }
+      else
+      {
+         hr = ::SafeArrayGetElement(psa, &i, &item);
+
+         if (SUCCEEDED(hr))
+            hr = item.ChangeType(VT_BSTR);
+      }
+
+      if (FAILED(hr))
+         return E_INVALIDARG;
+
+      strings.push_back(NULL == item.bstrVal ? std::wstring() : std::wstring(item.bstrVal, ::SysStringLen(item.bstrVal)));
+   }
+
+   return S_OK;
+}
+
+STDMETHODIMP CTextExtractor::CompilePatterns(VARIANT keywords, VARIANT regexes, NormalizationProfile profile, long * patternSet)
+{
+   if (NULL == patternSet)
+      return E_POINTER;
+
+   *patternSet = 0;
+
+   CleanupProfile cleanupProfile;
+   std::vector<std::wstring> keywordList;
+   std::vector<std::wstring> regexList;
+
+   if (!ToCleanupProfile(profile, &cleanupProfile) ||
+       FAILED(ToStringList(keywords, keywordList)) || FAILED(ToStringList(regexes, regexList)) ||
+       (keywordList.empty() && regexList.empty()))
+      return E_INVALIDARG;
+
+   PatternSet *patterns = NULL;
+
+   try
+   {
+      patterns = new PatternSet;
+      size_t badPattern = 0;
+
+      if (!patterns->Compile(keywordList, regexList, cleanupProfile, &badPattern))
+      {
+         delete patterns;
+
+         if (badPattern < keywordList.size())
+            return Error("A keyword is empty once normalized.", __uuidof(TextExtractor), E_INVALIDARG);
+
+         return Error("A regular expression doesn't parse or uses unsupported syntax.", __uuidof(TextExtractor), E_INVALIDARG);
+      }
+
+      // handles are the slot + 1, released slots are reused
+      for (size_t i = 0; i < m_patternSets.size(); ++i)
+      {
+         if (NULL == m_patternSets[i])
+         {
+            m_patternSets[i] = patterns;
+            *patternSet = static_cast<long>(i + 1);
+            return S_OK;
+         }
+      }
+
+      m_patternSets.push_back(patterns);
+      *patternSet = static_cast<long>(m_patternSets.size());
+   }
+   catch (...)
+   {
+      delete patterns;
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+   }
+
+   return S_OK;
+}
+
+STDMETHODIMP CTextExtractor::FindMatches(BSTR fileName, long patternSet, long maxMatches, VARIANT * matches)
+{
+   if (NULL == matches)
+      return E_POINTER;
+
+   ::VariantInit(matches);
+
+   if (maxMatches < 0 || patternSet <= 0 || static_cast<size_t>(patternSet) > m_patternSets.size() ||
+       NULL == m_patternSets[patternSet - 1])
+      return E_INVALIDARG;
+
+   const PatternSet & patterns = *m_patternSets[patternSet - 1];
+   std::vector<PatternMatch> found;
+
+   try
+   {
+      // the sink stops the filter once maxMatches are in. It keeps no more
+      // of the text than the filter's buffer and the longest match
+      MatchSink sink(patterns, maxMatches);
+      MemoryReservation reservation(MemoryGovernor::Instance());
+
+      HRESULT hr = AdmittedFilterText(fileName, c_filterBufferChars * c_governedBytesPerChar, patterns.Profile(), sink, reservation);
+
+      if (FAILED(hr))
+         return hr;
+
+      found = sink.Matches();
+   }
+   catch (...)
+   {
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+   }
+
+   // rows of (pattern, offset, length)
+   SAFEARRAYBOUND bounds[2];
+   bounds[0].lLbound = 0;
+   bounds[0].cElements = static_cast<ULONG>(found.size());
+   bounds[1].lLbound = 0;
+   bounds[1].cElements = 3;
+
+   SAFEARRAY *psa = ::SafeArrayCreate(VT_VARIANT, 2, bounds);
+
+   if (NULL == psa)
+      return E_OUTOFMEMORY;
+
+   for (size_t i = 0; i < found.size(); ++i)
+   {
+      CComVariant cells[3];
+      cells[0] = static_cast<long>(found[i].pattern);
+
+      cells[1].vt = VT_I8;
+      cells[1].llVal = static_cast<LONGLONG>(found[i].offset);
+
+      cells[2].vt = VT_I8;
+      cells[2].llVal = static_cast<LONGLONG>(found[i].length);
+
+      for (long column = 0; column < 3; ++column)
+      {
+         long indices[2] = { column, static_cast<long>(i) };
+         ::SafeArrayPutElement(psa, indices, &cells[column]);
+      }
+   }
+
+   matches->vt = VT_ARRAY | VT_VARIANT;
+   matches->parray = psa;
+   return found.empty() ? S_FALSE : S_OK;
+}
+
+STDMETHODIMP CTextExtractor::ReleasePatterns(long patternSet)
+{
+   if (patternSet <= 0 || static_cast<size_t>(patternSet) > m_patternSets.size() || NULL == m_patternSets[patternSet - 1])
+      return E_INVALIDARG;
+
+   delete m_patternSets[patternSet - 1];
+   m_patternSets[patternSet - 1] = NULL;
+   return S_OK;
+}
+
+STDMETHODIMP CTextExtractor::WarmFilterRoutes(BSTR snapshotPath, long preloadCount, long * routes)
+{
+   if (NULL == routes)
+      return E_POINTER;
+
+   *routes = 0;
+
+   if (preloadCount < 0)
+      return E_INVALIDARG;
+
+   HRESULT hr = S_FALSE;
+
+   if (0 != ::SysStringLen(snapshotPath))
+   {
+      hr = LoadRouteSnapshot(snapshotPath);
+
+      if (FAILED(hr))
+         return Error("Unable to read the route snapshot.", __uuidof(TextExtractor), hr);
+   }
+
+   try
+   {
+      *routes = static_cast<long>(FilterRoutes().Validate(TickMs()));
+
+      if (preloadCount > 0)
+         PreloadFilters(static_cast<size_t>(preloadCount));
+   }
+   catch (...)
+   {
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+   }
+
+   return hr;
+}
+
+STDMETHODIMP CTextExtractor::SaveFilterRoutes(BSTR snapshotPath)
+{
+   if (NULL == snapshotPath)
+      return E_POINTER;
+
+   if (0 == ::SysStringLen(snapshotPath))
+      return E_INVALIDARG;
+
+   HRESULT hr;
+
+   try
+   {
+      hr = SaveRouteSnapshot(snapshotPath);
+   }
+   catch (...)
+   {
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+   }
+
+   if (FAILED(hr))
+      return Error("Unable to write the route snapshot.", __uuidof(TextExtractor), hr);
+
+   return S_OK;
+}
+
+STDMETHODIMP CTextExtractor::ExtractTextWithProperties(BSTR fileName, long maxLength, NormalizationProfile profile, VARIANT * properties, BSTR * fileText)
+{
+   if (NULL == properties || NULL == fileText)
+      return E_POINTER;
+
+   ::VariantInit(properties);
+   *fileText = NULL;
+
+   CleanupProfile cleanupProfile;
+
+   if (maxLength < 0 || !ToCleanupProfile(profile, &cleanupProfile))
+      return E_INVALIDARG;
 
-#include "dispimpl2.h"
-#include "ExtractText.h"
-#include "TextExtractor.h"
-#include "Filter.h"
-#include "FiltErr.h"
-#include "NTQuery.h"
+   MemoryReservation reservation(MemoryGovernor::Instance());
+   TextBufferSink text(maxLength);
+   PropertyBag bag;
 
-/////////////////////////////////////////////////////////////////////////////
-// CTextExtractor
+   HRESULT hr = GovernedFilterText(fileName, maxLength, cleanupProfile, text, reservation, &bag);
 
-STDMETHODIMP CTextExtractor::InterfaceSupportsErrorInfo(REFIID riid)
-{
-   static const IID* arr[] =
+   if (FAILED(hr))
+      return hr;
+
+   // rows of (name, value)
+   SAFEARRAYBOUND bounds[2];
+   bounds[0].lLbound = 0;
+   bounds[0].cElements = static_cast<ULONG>(bag.Count());
+   bounds[1].lLbound = 0;
+   bounds[1].cElements = 2;
+
+   SAFEARRAY *psa = ::SafeArrayCreate(VT_VARIANT, 2, bounds);
+
+   if (NULL == psa)
+      return E_OUTOFMEMORY;
+
+   try
    {
-      &IID_ITextExtractor
-   };
-   for (int i=0; i < sizeof(arr) / sizeof(arr[0]); i++)
+      for (size_t i = 0; i < bag.Count(); ++i)
+      {
+         const Property & property = bag.At(i);
+         CComVariant cells[2];
+
+         cells[0] = property.name.c_str();
+         hr = ToVariant(property.value, cells[1]);
+
+         if (FAILED(hr) || VT_BSTR != cells[0].vt)
+         {
+            ::SafeArrayDestroy(psa);
+            return E_OUTOFMEMORY;
+         }
+
+         for (long column = 0; column < 2; ++column)
+         {
+            long indices[2] = { column, static_cast<long>(i) };
+            ::SafeArrayPutElement(psa, indices, &cells[column]);
+         }
+      }
+   }
+   catch (...)
    {
-      if (InlineIsEqualGUID(*arr[i],riid))
-         return S_OK;
+      ::SafeArrayDestroy(psa);
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
    }
-   return S_FALSE;
+
+   hr = ReturnText(text, reservation, fileText);
+
+   if (FAILED(hr))
+   {
+      ::SafeArrayDestroy(psa);
+      return hr;
+   }
+
+   properties->vt = VT_ARRAY | VT_VARIANT;
+   properties->parray = psa;
+   return hr;
 }
 
-// Per W3C spec http://www.w3.org/TR/REC-xml#charsets
-// Valid characters are #x9 | #xA | #xD | [#x20-#xD7FF] | [#xE000-#xFFFD] |
-//                      [#x10000-#x10FFFF]
+void CTextExtractor::FinalRelease()
+{
+   while (!m_pageSessions.empty())
+      ClosePageSession(m_pageSessions.back());
+
+   for (size_t i = 0; i < m_pageIndexes.size(); ++i)
+      delete m_pageIndexes[i];
+
+   m_pageIndexes.clear();
+
+   for (size_t i = 0; i < m_patternSets.size(); ++i)
+      delete m_patternSets[i];
+
+   m_patternSets.clear();
+}
 
-inline static void ValidUnicode(wchar_t & ch)
+// Opens what FilterText would read fileName with: the built-in path for
+// content that is plain text, the routed filter for the rest.
+HRESULT CTextExtractor::OpenPageSession(BSTR fileName, unsigned long long stamp, CleanupProfile profile, PageSession ** ppSession)
 {
-   if (ch < 0x0020)     // if less than ASCII space
+   *ppSession = NULL;
+
+   std::wstring extension;
+
+   if (ROUTE_PLAIN_TEXT == RouteFile(fileName, extension))
    {
-      if ((ch == 0x000D)      // CR
-         || (ch == 0x000A)    // or LF
-         || (ch == 0x0009))   // or TAB
-         return;                 // it's valid!
-      else
-         ch = L' ';              // morph to blank
+      HANDLE hFile = ::CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                   NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+      if (INVALID_HANDLE_VALUE == hFile)
+         return Error("Unable to access file.", __uuidof(TextExtractor), HRESULT_FROM_WIN32(::GetLastError()));
+
+      DWORD sizeHigh = 0;
+      DWORD sizeLow = ::GetFileSize(hFile, &sizeHigh);
+
+      if (INVALID_FILE_SIZE == sizeLow && ERROR_SUCCESS != ::GetLastError())
+      {
+         HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+         ::CloseHandle(hFile);
+         return Error("Unable to access file.", __uuidof(TextExtractor), hr);
+      }
+
+      FileChunkSource *pFile = new FileChunkSource(hFile, (static_cast<unsigned long long>(sizeHigh) << 32) | sizeLow);
+
+      switch (pFile->Open())
+      {
+         case APPEND_READ_ERROR:
+         {
+            HRESULT hr = HRESULT_FROM_WIN32(pFile->LastError());
+            delete pFile;
+            return Error("Unable to read file.", __uuidof(TextExtractor), hr);
+         }
+
+         case APPEND_NOT_TEXT:
+            // not text after all, as in FilterText the filter for its name gets it
+            delete pFile;
+            extension = FilterKey(fileName);
+            break;
+
+         default:
+            *ppSession = new PageSession(m_nextPageSession++, fileName, stamp, profile, pFile);
+            return S_OK;
+      }
    }
-   else if (ch > 0x007e) // or greater than ASCII '~' 
+
+   CComPtr<IFilter> spIFilter;
+   HRESULT hr = OpenFilter(fileName, extension, &spIFilter);
+
+   if (FAILED(hr))
+      return hr;
+
+   *ppSession = new PageSession(m_nextPageSession++, fileName, stamp, profile, spIFilter);
+   return S_OK;
+}
+
+void CTextExtractor::ClosePageSession(PageSession *session)
+{
+   for (size_t i = 0; i < m_pageSessions.size(); ++i)
    {
-      if (ch <= 0xD7FF)
-         return;                 // it's valid!
-      else if (ch >= 0xF8FF && ch <= 0xFFFD)
-         return;                 // it's valid!
-      else
-         ch = L' ';              // morph to blank
-      
-      // note we don't support surrogates, private use or high-Unicode 0x10000-0x10FFFF characters
+      if (m_pageSessions[i] == session)
+      {
+         m_pageSessions.erase(m_pageSessions.begin() + i);
+         break;
+      }
    }
-   else
-      return;                    // it's valid!
+
+   delete session;
 }
 
-static void CleanUpCharacters(size_t chBuf, wchar_t *buf)
+// The checkpoints for this version of the file, a new empty set if there
+// are none yet (evicting the least recently used set past c_maxPageIndexes).
+PageIndex * CTextExtractor::GetPageIndex(BSTR fileName, unsigned long long stamp, CleanupProfile profile)
 {
-   // The game here is to fold any "cute" versions of characters to thier 
-   // simplified form to make parsing easier.
+   size_t oldest = 0;
 
-   buf[chBuf] = 0;   // must be null terminated..
-
-   for (size_t i = 0; i < chBuf; ++i)
+   for (size_t i = 0; i < m_pageIndexes.size(); ++i)
    {
-      wchar_t & ch = buf[i];
+      PageIndex *index = m_pageIndexes[i];
 
-      switch (ch)
+      if (index->m_stamp == stamp && index->m_profile == profile && 0 == _wcsicmp(index->m_fileName.c_str(), fileName))
       {
-         case 0:        // embedded null
-         case 0x2000:   // en quad
-         case 0x2001:   // em quad
-         case 0x2002:   // en space
-         case 0x2003:   // em space
-         case 0x2004:   // three-per-em space
-         case 0x2005:   // four-per-em space
-         case 0x2006:   // six-per-em space
-         case 0x2007:   // figure space
-         case 0x2008:   // puctuation space
-         case 0x2009:   // thin space
-         case 0x200A:   // hair space
-         case 0x200B:   // zero-width space
-         case 0x200C:   // zero-width non-joiner
-         case 0x200D:   // zero-width joiner
-         case 0x202f:   // no-break space
-         case 0x3000:   // ideographic space
-            ch = L' ';
-            break;
+         index->m_lastUsed = m_pageClock;
+         return index;
+      }
 
-         case 0x00B6:   // pilcro
-         case 0x2028:   // line seperator
-         case 0x2029:   // paragraph seperator
-            ch = L'\n';
-            break;
+      if (index->m_lastUsed < m_pageIndexes[oldest]->m_lastUsed)
+         oldest = i;
+   }
 
-         case 0x00AD:   // soft-hyphen
-         case 0x00B7:   // middle dot
-         case 0x2010:   // hyphen
-         case 0x2011:   // non-breaking hyphen
-         case 0x2012:   // figure dash
-         case 0x2013:   // en dash
-         case 0x2014:   // em dash
-         case 0x2015:   // quote dash
-         case 0x2027:   // hyphenation point
-         case 0x2043:   // hyphen bullet
-         case 0x208B:   // subscript minus
-         case 0xFE31:   // vertical em dash
-         case 0xFE32:   // vertical en dash
-         case 0xFE58:   // small em dash
-         case 0xFE63:   // small hyphen minus
-            ch = L'-';
-            break;
+   if (m_pageIndexes.size() >= c_maxPageIndexes)
+   {
+      delete m_pageIndexes[oldest];
+      m_pageIndexes.erase(m_pageIndexes.begin() + oldest);
+   }
 
-         case 0x00B0:   // degree
-         case 0x2018:   // left single quote
-         case 0x2019:   // right single quote
-         case 0x201A:   // low right single quote
-         case 0x201B:   // high left single quote
-         case 0x2032:   // prime
-         case 0x2035:   // reversed prime
-         case 0x2039:   // left-pointing angle quotation mark
-         case 0x203A:   // right-pointing angle quotation mark
-            ch = L'\'';
-            break;
-            
-         case 0x201C:   // left double quote
-         case 0x201D:   // right double quote
-         case 0x201E:   // low right double quote
-         case 0x201F:   // high left double quote
-         case 0x2033:   // double prime
-         case 0x2034:   // triple prime
-         case 0x2036:   // reversed double prime
-         case 0x2037:   // reversed triple prime
-         case 0x00AB:   // left-pointing double angle quotation mark
-         case 0x00BB:   // right-pointing double angle quotation mark
-         case 0x3003:   // ditto mark
-         case 0x301D:   // reversed double prime quotation mark
-         case 0x301E:   // double prime quotation mark
-         case 0x301F:   // low double prime quotation mark
-            ch = L'\"';
-            break;
-            
-         case 0x00A7:   // section-sign
-         case 0x2020:   // dagger
-         case 0x2021:   // double-dagger
-         case 0x2022:   // bullet
-         case 0x2023:   // triangle bullet
-         case 0x203B:   // reference mark
-         case 0xFE55:   // small colon
-            ch = L':';
-            break;
+   PageIndex *index = new PageIndex(fileName, stamp, profile);
+   index->m_lastUsed = m_pageClock;
+   m_pageIndexes.push_back(index);
+   return index;
+}
 
-         case 0x2024:   // one dot leader
-         case 0x2025:   // two dot leader
-         case 0x2026:   // elipsis
-         case 0x3002:   // ideographic full stop
-         case 0xFE30:   // two dot vertical leader
-         case 0xFE52:   // small full stop
-            ch = L'.';
-            break;
+// Class id of the loaded filter as a string, empty if it won't say.
+static std::wstring FilterClassKey(IFilter *pFilter)
+{
+   // IPersistFile and IPersistStream both derive from IPersist
+   CComQIPtr<IPersist> spPersist = pFilter;
+   CLSID clsid;
 
-         case 0x3001:   // ideographic comma
-         case 0xFE50:   // small comma
-         case 0xFE51:   // small ideographic comma
-            ch = L',';
-            break;
-            
-         case 0xFE54:   // small semicolon
-            ch = L';';
-            break;
+   if (!spPersist || FAILED(spPersist->GetClassID(&clsid)))
+      return std::wstring();
 
-         case 0x00A6:   // broken-bar
-         case 0x2016:   // double vertical line
-            ch = L'|';
-            break;
+   wchar_t text[40];
+   ::StringFromGUID2(clsid, text, 40);
+   return text;
+}
 
-         case 0x2017:   // double low line
-         case 0x203E:   // overline
-         case 0x203F:   // undertie
-         case 0x2040:   // character tie
-         case 0xFE33:   // vertical low line
-         case 0xFE49:   // dashed overline
-         case 0xFE4A:   // centerline overline
-         case 0xFE4D:   // dashed low line
-         case 0xFE4E:   // centerline low line
-            ch = L'_';
-            break;
-            
-         case 0x301C:   // wave dash
-         case 0x3030:   // wavy dash
-         case 0xFE34:   // vertical wavy low line
-         case 0xFE4B:   // wavy overline
-         case 0xFE4C:   // double wavy overline
-         case 0xFE4F:   // wavy low line
-            ch = L'~';
-            break;
-            
-         case 0x2038:   // caret
-         case 0x2041:   // caret insertion point
-            ch = L'^';
-            break;
+// The extraction shared by all the entry points but paging. Pulls text from
+// the filter for fileName, cleans it up with the given profile and feeds it
+// to sink until the chunks run out (S_OK) or the sink doesn't want more
+// (S_FALSE). Files whose content says they are plain text go through the
+// built-in path. While the breaker for the file's extension or filter is
+// open, plain text files go there too and the rest fail fast with
+// EXTRACT_E_CIRCUIT_OPEN.
+HRESULT CTextExtractor::FilterText(BSTR fileName, CleanupProfile profile, TextSink & sink, PropertyBag * properties)
+{
+   if (NULL == fileName)
+      return E_POINTER;
 
-         case 0x2030:   // per-mille
-         case 0x2031:   // per-ten thousand
-         case 0xFE6A:   // small per-cent
-            ch = L'%';
-            break;
-            
-         case 0xFE6B:   // small commercial at
-            ch = L'@';
-            break;
-            
-         case 0x00A9:   // copyright
-            ch = L'c';
-            break;
+   // the extension the content is routed to, which the breaker goes by too
+   std::wstring extension;
 
-         case 0x00B5:   // micro
-            ch = L'u';
-            break;
-   
-         case 0x00AE:   // registered
-            ch = L'r';
-            break;
+   if (ROUTE_PLAIN_TEXT == RouteFile(fileName, extension))
+   {
+      HRESULT hr = BuiltInText(fileName, profile, sink, FILTER_E_UNKNOWNFORMAT);
 
-         case 0x207A:   // superscript plus
-         case 0x208A:   // subscript plus
-         case 0xFE62:   // small plus
-            ch = L'+';
-            break;
-            
-         case 0x2044:   // fraction slash
-            ch = L'/';
-            break;
+      // the sniffer only saw the head, nothing was passed to sink before the
+      // built-in path gave up on it, so the filter for its name can have it
+      if (FILTER_E_UNKNOWNFORMAT != hr)
+         return hr;
 
-         case 0x2042:   // asterism
-         case 0xFE61:   // small asterisk
-            ch = L'*';
-            break;
-            
-         case 0x208C:   // subscript equal
-         case 0xFE66:   // small equal
-            ch = L'=';
-            break;
-            
-         case 0xFE68:   // small reverse solidus
-            ch = L'\\';
-            break;
-            
-         case 0xFE5F:   // small number sign
-            ch = L'#';
-            break;
-            
-         case 0xFE60:   // small ampersand
-            ch = L'&';
-            break;
-            
-         case 0xFE69:   // small dollar sign
-            ch = L'$';
-            break;
-            
-         case 0x2045:   // left square bracket with quill
-         case 0x3010:   // left black lenticular bracket
-         case 0x3016:   // left white lenticular bracket
-         case 0x301A:   // left white square bracket
-         case 0xFE3B:   // vertical left lenticular bracket
-         case 0xFF41:   // vertical left corner bracket
-         case 0xFF43:   // vertical white left corner bracket
-            ch = L'[';
-            break;
-            
-         case 0x2046:   // right square bracket with quill
-         case 0x3011:   // right black lenticular bracket
-         case 0x3017:   // right white lenticular bracket
-         case 0x301B:   // right white square bracket
-         case 0xFE3C:   // vertical right lenticular bracket
-         case 0xFF42:   // vertical right corner bracket
-         case 0xFF44:   // vertical white right corner bracket
-            ch = L']';
-            break;
-            
-         case 0x208D:   // subscript left parenthesis
-         case 0x3014:   // left tortise-shell bracket
-         case 0x3018:   // left white tortise-shell bracket
-         case 0xFE35:   // vertical left parenthesis
-         case 0xFE39:   // vertical left tortise-shell bracket
-         case 0xFE59:   // small left parenthesis
-         case 0xFE5D:   // small left tortise-shell bracket
-            ch = L'(';
-            break;
-            
-         case 0x208E:   // subscript right parenthesis
-         case 0x3015:   // right tortise-shell bracket
-         case 0x3019:   // right white tortise-shell bracket
-         case 0xFE36:   // vertical right parenthesis
-         case 0xFE3A:   // vertical right tortise-shell bracket
-         case 0xFE5A:   // small right parenthesis
-         case 0xFE5E:   // small right tortise-shell bracket
-            ch = L')';
-            break;
-            
-         case 0x3008:   // left angle bracket
-         case 0x300A:   // left double angle bracket
-         case 0xFF3D:   // vertical left double angle bracket
-         case 0xFF3F:   // vertical left angle bracket
-         case 0xFF64:   // small less-than
-            ch = L'<';
-            break;
-            
-         case 0x3009:   // right angle bracket
-         case 0x300B:   // right double angle bracket
-         case 0xFF3E:   // vertical right double angle bracket
-         case 0xFF40:   // vertical right angle bracket
-         case 0xFF65:   // small greater-than
-            ch = L'>';
-            break;
-            
-         case 0xFE37:   // vertical left curly bracket
-         case 0xFE5B:   // small left curly bracket
-            ch = L'{';
-            break;
-            
-         case 0xFE38:   // vertical right curly bracket
-         case 0xFE5C:   // small right curly bracket
-            ch = L'}';
-            break;
-            
-         case 0x00A1:   // inverted exclamation mark
-         case 0x00AC:   // not
-         case 0x203C:   // double exclamation mark
-         case 0x203D:   // interrobang
-         case 0xFE57:   // small exclamation mark
-            ch = L'!';
-            break;
+      extension = FilterKey(fileName);
+   }
 
-         case 0x00BF:   // inverted question mark
-         case 0xFE56:   // small question mark
-            ch = L'?';
-            break;
+   unsigned long start = TickMs();
 
-         case 0x00B9:   // superscript one
-            ch = L'1';
-            break;
+   if (!s_extensionHealth.Allow(extension, start))
+      return BuiltInText(fileName, profile, sink, EXTRACT_E_CIRCUIT_OPEN);
 
-         case 0x00B2:   // superscript two
-            ch = L'2';
-            break;
-            
-         case 0x00B3:   // superscript three
-            ch = L'3';
-            break;
+   CComPtr<IFilter> spIFilter;
+   bool loaded = false;
+   HRESULT hr = OpenFilter(fileName, extension, &spIFilter, &loaded);
 
-         case 0x2070:   // superscript zero
-         case 0x2074:   // superscript four
-         case 0x2075:   // superscript five
-         case 0x2076:   // superscript six
-         case 0x2077:   // superscript seven
-         case 0x2078:   // superscript eight
-         case 0x2079:   // superscript nine
-         case 0x2080:   // subscript zero
-         case 0x2081:   // subscript one
-         case 0x2082:   // subscript two
-         case 0x2083:   // subscript three
-         case 0x2084:   // subscript four
-         case 0x2085:   // subscript five
-         case 0x2086:   // subscript six
-         case 0x2087:   // subscript seven
-         case 0x2088:   // subscript eight
-         case 0x2089:   // subscript nine
-         case 0x3021:   // Hangzhou numeral one
-         case 0x3022:   // Hangzhou numeral two
-         case 0x3023:   // Hangzhou numeral three
-         case 0x3024:   // Hangzhou numeral four
-         case 0x3025:   // Hangzhou numeral five
-         case 0x3026:   // Hangzhou numeral six
-         case 0x3027:   // Hangzhou numeral seven
-         case 0x3028:   // Hangzhou numeral eight
-         case 0x3029:   // Hangzhou numeral nine
-            ch = (ch & 0x000F) + L'0';
-            break;
+   std::wstring filter;
 
-         // ONE is at ZERO location... careful
-         case 0x3220:   // parenthesized ideograph one
-         case 0x3221:   // parenthesized ideograph two
-         case 0x3222:   // parenthesized ideograph three
-         case 0x3223:   // parenthesized ideograph four
-         case 0x3224:   // parenthesized ideograph five
-         case 0x3225:   // parenthesized ideograph six
-         case 0x3226:   // parenthesized ideograph seven
-         case 0x3227:   // parenthesized ideograph eight
-         case 0x3228:   // parenthesized ideograph nine
-         case 0x3280:   // circled ideograph one
-         case 0x3281:   // circled ideograph two
-         case 0x3282:   // circled ideograph three
-         case 0x3283:   // circled ideograph four
-         case 0x3284:   // circled ideograph five
-         case 0x3285:   // circled ideograph six
-         case 0x3286:   // circled ideograph seven
-         case 0x3287:   // circled ideograph eight
-         case 0x3288:   // circled ideograph nine
-            ch = (ch & 0x000F) + L'1';
-            break;
-            
-         case 0x3007:   // ideographic number zero
-         case 0x24EA:   // circled number zero
-            ch = L'0';
-            break;
-            
-         default:
-            if (0xFF01 <= ch           // fullwidth exclamation mark 
-                && ch <= 0xFF5E)       // fullwidth tilde
-            {
-               // the fullwidths line up with ASCII low subset
-               ch = ch & 0xFF00 + L'!' - 1;               
-            }
-            else if (0x2460 <= ch      // circled one
-                     && ch <= 0x2468)  // circled nine
-            {
-               ch = ch - 0x2460 + L'1';
-            }
-            else if (0x2474 <= ch      // parenthesized one
-                     && ch <= 0x247C)  // parenthesized nine
-            {
-               ch = ch - 0x2474 + L'1';
-            }
-            else if (0x2488 <= ch      // one full stop
-                     && ch <= 0x2490)  // nine full stop
-            {
-               ch = ch - 0x2488 + L'1';
-            }
-            else if (0x249C <= ch      // parenthesized small a
-                     && ch <= 0x24B5)  // parenthesized small z
-            {
-               ch = ch - 0x249C + L'a';
-            }
-            else if (0x24B6 <= ch      // circled capital A
-                     && ch <= 0x24CF)  // circled capital Z
-            {
-               ch = ch - 0x24B6 + L'A';
-            }
-            else if (0x24D0 <= ch      // circled small a
-                     && ch <= 0x24E9)  // circled small z
-            {
-               ch = ch - 0x24D0 + L'a';
-            }
-            else if (0x2500 <= ch      // box drawing (begin)
-                     && ch <= 0x257F)  // box drawing (end)
-            {
-               ch = L'|';
-            }
-            else if (0x2580 <= ch      // block elements (begin)
-                     && ch <= 0x259F)  // block elements (end)
-            {
-               ch = L'#';
-            }
-            else if (0x25A0 <= ch      // geometric shapes (begin)
-                     && ch <= 0x25FF)  // geometric shapes (end)
-            {
-               ch = L'*';
-            }
-            else if (0x2600 <= ch      // dingbats (begin)
-                     && ch <= 0x267F)  // dingbats (end)
-            {
-               ch = L'.';
-            }
-            else
-               ValidUnicode(ch);   // validate that it's legit Unicode
-            break;
+   if (SUCCEEDED(hr))
+   {
+      filter = FilterClassKey(spIFilter);
+
+      if (!filter.empty() && !s_filterHealth.Allow(filter, start))
+      {
+         // says nothing about the extension, just hands on its probe if it had one
+         s_extensionHealth.Ignore(extension, 0, TickMs());
+
+         spIFilter.Release();
+         return BuiltInText(fileName, profile, sink, EXTRACT_E_CIRCUIT_OPEN);
       }
+
+      hr = PullText(spIFilter, profile, sink, properties);
+   }
+
+   unsigned long end = TickMs();
+
+   if (SUCCEEDED(hr) || IsFilterFault(hr, loaded ? FILTER_STAGE_CALLS : FILTER_STAGE_LOAD))
+   {
+      bool failed = FAILED(hr);
+
+      s_extensionHealth.Record(extension, failed, end - start, end);
+
+      if (!filter.empty())
+         s_filterHealth.Record(filter, failed, end - start, end);
+   }
+   else
+   {
+      s_extensionHealth.Ignore(extension, end - start, end);
+
+      if (!filter.empty())
+         s_filterHealth.Ignore(filter, end - start, end);
    }
+
+   return hr;
 }
 
-STDMETHODIMP CTextExtractor::ExtractText(BSTR fileName, long maxLength, BSTR * fileText)
+// Reads text files whatever their name, and stands in for the filter while
+// its breaker is open. A file that isn't text after all fails with notText,
+// which only carries error info for EXTRACT_E_CIRCUIT_OPEN.
+HRESULT CTextExtractor::BuiltInText(BSTR fileName, CleanupProfile profile, TextSink & sink, HRESULT notText)
+{
+   HANDLE hFile = ::CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+   if (INVALID_HANDLE_VALUE == hFile)
+      return Error("Unable to access file.", __uuidof(TextExtractor), HRESULT_FROM_WIN32(::GetLastError()));
+
+   DWORD sizeHigh = 0;
+   DWORD sizeLow = ::GetFileSize(hFile, &sizeHigh);
+
+   if (INVALID_FILE_SIZE == sizeLow && ERROR_SUCCESS != ::GetLastError())
+   {
+      HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+      ::CloseHandle(hFile);
+      return Error("Unable to access file.", __uuidof(TextExtractor), hr);
+   }
+
+   unsigned long long size = (static_cast<unsigned long long>(sizeHigh) << 32) | sizeLow;
+
+   // a fresh state, so this reads the whole file
+   AppendState state;
+   InitAppendState(state, profile);
+
+   HandleReader reader(hFile);
+   AppendResult result;
+
+   try
+   {
+      result = ExtractAppendedText(reader, size, profile, state, sink);
+   }
+   catch (...)
+   {
+      ::CloseHandle(hFile);
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+   }
+
+   ::CloseHandle(hFile);
+
+   switch (result)
+   {
+      case APPEND_NOT_TEXT:
+         if (EXTRACT_E_CIRCUIT_OPEN != notText)
+            return notText;
+
+         return Error("The filter for this file type keeps failing, calls to it are suspended for now.", __uuidof(TextExtractor), EXTRACT_E_CIRCUIT_OPEN);
+
+      case APPEND_READ_ERROR:
+         return Error("Unable to read file.", __uuidof(TextExtractor), HRESULT_FROM_WIN32(reader.LastError()));
+
+      default:
+         return sink.WantsMore() ? S_OK : S_FALSE;
+   }
+}
+
+// The IFilter loop, feeds sink from a filter OpenFilter has set up. With
+// properties, the value chunks go there in the same loop. Either way the
+// text comes out of PullChunks, so asking for the properties doesn't change
+// it.
+HRESULT CTextExtractor::PullText(IFilter *pFilter, CleanupProfile profile, TextSink & sink, PropertyBag * properties)
+{
+   try
+   {
+      // a source that isn't asked for values never fills the bag
+      PropertyBag none(0, 0);
+
+      FilterChunkSource source(pFilter, NULL != properties);
+      PullResult result = PullChunks(source, profile, sink, NULL != properties ? *properties : none);
+
+      if (PULL_ERROR == result)
+         return FilterError(source.InGetText(), source.LastError());
+
+      return PULL_STOPPED == result ? S_FALSE : S_OK;
+   }
+   catch (...)
+   {
+      return Error("Unexpected exception",  __uuidof(TextExtractor), E_FAIL);
+   }
+}
+
+// FilterText for the entry points that hold the text in memory, up to
+// maxLength characters of it. Waits for the governor to admit the extraction
+// before the filter is loaded, then grows reservation as the text comes in;
+// EXTRACT_E_OVER_BUDGET if there's no room to start, reservation.OverBudget()
+// if it had to stop early.
+HRESULT CTextExtractor::GovernedFilterText(BSTR fileName, size_t maxLength, CleanupProfile profile, TextSink & sink, MemoryReservation & reservation,
+                                          PropertyBag * properties)
+{
+   if (!reservation.Admit(EstimateFootprint(fileName, maxLength, c_governedBytesPerChar)))
+      return Error("There is no room in the memory budget for another extraction.", __uuidof(TextExtractor), EXTRACT_E_OVER_BUDGET);
+
+   GovernedSink governed(sink, reservation, c_governedBytesPerChar, 0 != maxLength ? maxLength + c_filterBufferChars : 0);
+   return FilterText(fileName, profile, governed, properties);
+}
+
+// FilterText for the entry points that don't keep the text as it is: they
+// wait their turn with the governor for footprint bytes like the others,
+// but hold on to that much however long the text gets.
+HRESULT CTextExtractor::AdmittedFilterText(BSTR fileName, unsigned long long footprint, CleanupProfile profile, TextSink & sink,
+                                          MemoryReservation & reservation)
+{
+   if (!reservation.Admit(footprint))
+      return Error("There is no room in the memory budget for another extraction.", __uuidof(TextExtractor), EXTRACT_E_OVER_BUDGET);
+
+   return FilterText(fileName, profile, sink);
+}
+
+// Loads the filter registered for extension, which RouteFile picked, and
+// has it read fileName, initialized the way all the entry points want it.
+// loaded, if given, says whether a filter was loaded and Init called, so a
+// failure is the filter's rather than the file's or the registry's.
+HRESULT CTextExtractor::OpenFilter(BSTR fileName, const std::wstring & extension, IFilter ** ppFilter, bool * loaded)
 {
+   *ppFilter = NULL;
+
+   if (NULL != loaded)
+      *loaded = false;
+
    if (NULL == fileName)
       return E_POINTER;
 
    if (0 == ::SysStringLen(fileName))
       return E_INVALIDARG;
 
-   if (NULL == fileText)
-      return E_POINTER;
-
-   *fileText = NULL;
-
    HRESULT hr = E_UNEXPECTED;
 
    try
    {
       CComPtr<IUnknown> spIUnk;
-      hr = LoadIFilter(fileName, NULL, reinterpret_cast<void**>(&spIUnk));
+      FilterRoute route;
+
+      // the registry is only walked the first time for each type, see FilterRouting.h
+      hr = E_FAIL;
+      bool routed = !extension.empty() && FilterRoutes().Route(extension, TickMs(), route);
+
+      if (routed)
+         hr = CreateRoutedFilter(route, fileName, &spIUnk);
+
+      // LoadIFilter only goes by the file's name, so content routed to
+      // another extension stops here rather than ending up with the filter
+      // the content disagreed with
+      if (FAILED(hr) && extension != FilterKey(fileName))
+      {
+         if (!routed)
+            return Error("No filter is registered for the type of this file's content.", __uuidof(TextExtractor), FILTER_E_UNKNOWNFORMAT);
+
+         return Error("Unable to load the filter for the type of this file's content.", __uuidof(TextExtractor), hr);
+      }
+
+      // types without a route, and failures through one, go the long way,
+      // which knows the system's fallbacks and gives the errors below
+      if (FAILED(hr))
+      {
+         spIUnk.Release();
+         hr = LoadIFilter(fileName, NULL, reinterpret_cast<void**>(&spIUnk));
+      }
 
       if (SUCCEEDED(hr))
       {
@@ -509,6 +2335,9 @@ STDMETHODIMP CTextExtractor::ExtractText(BSTR fileName, long maxLength, BSTR * f
 
          if (spIFilter)
          {
+            if (NULL != loaded)
+               *loaded = true;
+
             DWORD dwFlags = 0;
             hr = spIFilter->Init(IFILTER_INIT_CANON_PARAGRAPHS |
                                  IFILTER_INIT_CANON_HYPHENS |
@@ -520,120 +2349,7 @@ STDMETHODIMP CTextExtractor::ExtractText(BSTR fileName, long maxLength, BSTR * f
 
             if (SUCCEEDED(hr))
             {
-               std::wstringstream wout;
-
-               STAT_CHUNK statChunk;
-               memset(&statChunk, 0, sizeof(statChunk));
-
-               bool moreChunks = true;
-
-               while (moreChunks)
-               {
-                  if (maxLength && wout.tellp() > maxLength)
-                  {
-                     hr = S_FALSE;
-                     break;
-                  }
-
-                  hr = spIFilter->GetChunk(&statChunk);
-                  AtlTrace(_T("GetChunk() hr=%x, breakType=%d, flags=%x\n"), hr, statChunk.breakType, statChunk.flags);
-
-                  if (SUCCEEDED(hr))
-                  {
-                     // ignore non-text chunks...
-                     if (CHUNK_TEXT != (CHUNK_TEXT & statChunk.flags))
-                        continue;
-
-                     switch (statChunk.breakType)
-                     {
-                        case CHUNK_NO_BREAK:
-                           break;
-
-                        case CHUNK_EOW:
-                           wout << L' ';
-                           break;
-
-                        case CHUNK_EOS:
-                        case CHUNK_EOC:
-                        case CHUNK_EOP:
-                           wout << L"\r\n";
-                           break;
-                     }
-
-                     bool moreText = true;
-
-                     while (moreText)
-                     {
-                        static const int cChunkSize = 4096;
-
-                        wchar_t buf[cChunkSize + 1];
-                        unsigned long chBuf = cChunkSize;
-                        memset(buf, 0, sizeof(buf));
-
-                        hr = spIFilter->GetText(&chBuf, buf);
-                        AtlTrace(_T("GetText() hr=%x, chBuf=%d\n"), hr, chBuf);
-
-                        if (SUCCEEDED(hr))
-                        {
-                           CleanUpCharacters(chBuf, buf);
-                           wout << buf;
-
-                           if (maxLength && wout.tellp() > maxLength)
-                           {
-                              hr = S_FALSE;
-                              moreText = false;
-                           }
-
-                           if (FILTER_S_LAST_TEXT == hr)
-                           {
-                              hr = S_OK;
-                              moreText = false;
-                           }
-                        }
-                        else
-                        {
-                           switch (hr)
-                           {
-                              case FILTER_E_NO_MORE_TEXT:
-                                 hr = S_OK;
-                                 moreText = false;
-                                 break;
-                              
-                              case FILTER_E_NO_TEXT:
-                                 return Error("GetText: The current chunk does not contain text.", __uuidof(TextExtractor), hr);
-
-                              default:
-                                 return Error("GetText: Unexpected error.", __uuidof(TextExtractor), hr);
-                           }
-                        }
-                     }
-                  }
-                  else
-                  {
-                     switch (hr)
-                     {
-                        case FILTER_E_EMBEDDING_UNAVAILABLE:
-                        case FILTER_E_LINK_UNAVAILABLE:
-                           continue;   // next chunk...
-
-                        case FILTER_E_END_OF_CHUNKS:
-                           hr = S_OK;
-                           moreChunks = false;
-                           continue;
-
-                        case FILTER_E_PASSWORD:
-                           return Error("GetChunk: Password or other security-related access failure.", __uuidof(TextExtractor), hr);
-
-                        case FILTER_E_ACCESS:
-                           return Error("GetChunk: Access failure.", __uuidof(TextExtractor), hr);
-
-                        default:
-                           return Error("GetChunk: Unexpected error.", __uuidof(TextExtractor), hr);
-                     }
-                  }
-               }
-
-               *fileText = SysAllocString(wout.str().c_str());
+               *ppFilter = spIFilter.Detach();
             }
             else
             {
@@ -698,3 +2414,31 @@ STDMETHODIMP CTextExtractor::ExtractText(BSTR fileName, long maxLength, BSTR * f
 
    return hr;
 }
+
+// Reports a GetText (getText set) or GetChunk failure.
+HRESULT CTextExtractor::FilterError(bool getText, HRESULT hr)
+{
+   if (getText)
+   {
+      switch (hr)
+      {
+         case FILTER_E_NO_TEXT:
+            return Error("GetText: The current chunk does not contain text.", __uuidof(TextExtractor), hr);
+
+         default:
+            return Error("GetText: Unexpected error.", __uuidof(TextExtractor), hr);
+      }
+   }
+
+   switch (hr)
+   {
+      case FILTER_E_PASSWORD:
+         return Error("GetChunk: Password or other security-related access failure.", __uuidof(TextExtractor), hr);
+
+      case FILTER_E_ACCESS:
+         return Error("GetChunk: Access failure.", __uuidof(TextExtractor), hr);
+
+      default:
+         return Error("GetChunk: Unexpected error.", __uuidof(TextExtractor), hr);
+   }
+}
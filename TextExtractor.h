@@ -3,7 +3,19 @@
 #ifndef __TEXTEXTRACTOR_H_
 #define __TEXTEXTRACTOR_H_
 
+#include <string>
+#include <vector>
+
 #include "resource.h"       // main symbols
+#include "TextCleanup.h"
+#include "TextSink.h"
+
+struct IFilter;
+class PageSession;
+class PageIndex;
+class MemoryReservation;
+class PatternSet;
+class PropertyBag;
 
 /////////////////////////////////////////////////////////////////////////////
 // CTextExtractor
@@ -11,19 +23,23 @@ class ATL_NO_VTABLE CTextExtractor :
 	public CComObjectRootEx<CComSingleThreadModel>,
 	public CComCoClass<CTextExtractor, &CLSID_TextExtractor>,
 	public ISupportErrorInfo,
-	public IDelegatingDispImpl<ITextExtractor>
+	public IDelegatingDispImpl<ITextExtractor2>
 {
 public:
 	CTextExtractor()
+		: m_nextPageSession(1), m_pageClock(0)
     {
 	}
 
+	void FinalRelease();
+
 DECLARE_REGISTRY_RESOURCEID(IDR_TEXTEXTRACTOR)
 DECLARE_GET_CONTROLLING_UNKNOWN()
 
 DECLARE_PROTECT_FINAL_CONSTRUCT()
 
 BEGIN_COM_MAP(CTextExtractor)
+	COM_INTERFACE_ENTRY(ITextExtractor2)
 	COM_INTERFACE_ENTRY(ITextExtractor)
 	COM_INTERFACE_ENTRY(IDispatch)
 	COM_INTERFACE_ENTRY(ISupportErrorInfo)
@@ -35,6 +51,60 @@ END_COM_MAP()
 // ITextExtractor
 public:
 	STDMETHOD(ExtractText)(/*[in]*/ BSTR fileName, /*[in]*/ long maxLength, /*[out, retval]*/ BSTR * fileText);
+
+// ITextExtractor2
+public:
+	STDMETHOD(ExtractTextEx)(/*[in]*/ BSTR fileName, /*[in]*/ long maxLength, /*[in]*/ NormalizationProfile profile, /*[out, retval]*/ BSTR * fileText);
+	STDMETHOD(ExtractTokens)(/*[in]*/ BSTR fileName, /*[in]*/ long maxLength, /*[in]*/ NormalizationProfile profile, /*[out]*/ VARIANT * tokens, /*[out, retval]*/ BSTR * fileText);
+	STDMETHOD(ExtractTextWithLanguage)(/*[in]*/ BSTR fileName, /*[in]*/ long maxLength, /*[in]*/ NormalizationProfile profile, /*[in]*/ VARIANT_BOOL perChunk,
+	                                   /*[out]*/ BSTR * language, /*[out]*/ BSTR * script, /*[out]*/ double * confidence, /*[out]*/ VARIANT * chunkScripts, /*[out, retval]*/ BSTR * fileText);
+	STDMETHOD(ExtractTextWithSignatures)(/*[in]*/ BSTR fileName, /*[in]*/ long maxLength, /*[in]*/ NormalizationProfile profile,
+	                                     /*[out]*/ hyper * simHash, /*[out]*/ VARIANT * minHash, /*[out, retval]*/ BSTR * fileText);
+	STDMETHOD(ExtractTextWithOffsets)(/*[in]*/ BSTR fileName, /*[in]*/ long maxLength, /*[in]*/ NormalizationProfile profile, /*[out]*/ VARIANT * offsetMap, /*[out, retval]*/ BSTR * fileText);
+	STDMETHOD(ExtractCompressedText)(/*[in]*/ BSTR fileName, /*[in]*/ long maxLength, /*[in]*/ NormalizationProfile profile, /*[in]*/ CompressionLevel level, /*[out, retval]*/ VARIANT * compressedText);
+	STDMETHOD(ExtractLargeText)(/*[in]*/ BSTR fileName, /*[in]*/ hyper maxLength, /*[in]*/ NormalizationProfile profile, /*[in]*/ hyper memoryThreshold,
+	                            /*[out]*/ hyper * length, /*[out]*/ BSTR * spillPath, /*[out, retval]*/ BSTR * fileText);
+	STDMETHOD(ExtractTextPage)(/*[in]*/ BSTR fileName, /*[in]*/ long start, /*[in]*/ long pageLength, /*[in]*/ NormalizationProfile profile, /*[in, out]*/ BSTR * continuation, /*[out, retval]*/ BSTR * pageText);
+	STDMETHOD(ExtractAppendedText)(/*[in]*/ BSTR fileName, /*[in]*/ NormalizationProfile profile, /*[in, out]*/ BSTR * appendState, /*[out, retval]*/ BSTR * appendedText);
+	STDMETHOD(SetMemoryBudget)(/*[in]*/ hyper budget, /*[in]*/ long waitMilliseconds);
+	STDMETHOD(GetMemoryUsage)(/*[out]*/ hyper * inUse, /*[out]*/ hyper * budget, /*[out, retval]*/ long * waiting);
+	STDMETHOD(QueueExtraction)(/*[in]*/ BSTR fileName, /*[in]*/ long maxLength, /*[in]*/ NormalizationProfile profile, /*[out, retval]*/ long * jobId);
+	STDMETHOD(GetQueuedResult)(/*[in]*/ long jobId, /*[in]*/ long waitMilliseconds, /*[out, retval]*/ BSTR * fileText);
+	STDMETHOD(SetFilterConcurrency)(/*[in]*/ BSTR extension, /*[in]*/ long maxConcurrent);
+	STDMETHOD(GetFilterHealth)(/*[out, retval]*/ VARIANT * health);
+	STDMETHOD(ExtractTextSample)(/*[in]*/ BSTR fileName, /*[in]*/ long headLength, /*[in]*/ long tailLength, /*[in]*/ long windowCount, /*[in]*/ long windowLength,
+	                             /*[in]*/ NormalizationProfile profile, /*[out, retval]*/ VARIANT * samples);
+	STDMETHOD(CompilePatterns)(/*[in]*/ VARIANT keywords, /*[in]*/ VARIANT regexes, /*[in]*/ NormalizationProfile profile, /*[out, retval]*/ long * patternSet);
+	STDMETHOD(FindMatches)(/*[in]*/ BSTR fileName, /*[in]*/ long patternSet, /*[in]*/ long maxMatches, /*[out, retval]*/ VARIANT * matches);
+	STDMETHOD(ReleasePatterns)(/*[in]*/ long patternSet);
+	STDMETHOD(WarmFilterRoutes)(/*[in]*/ BSTR snapshotPath, /*[in]*/ long preloadCount, /*[out, retval]*/ long * routes);
+	STDMETHOD(SaveFilterRoutes)(/*[in]*/ BSTR snapshotPath);
+	STDMETHOD(ExtractTextWithProperties)(/*[in]*/ BSTR fileName, /*[in]*/ long maxLength, /*[in]*/ NormalizationProfile profile, /*[out]*/ VARIANT * properties, /*[out, retval]*/ BSTR * fileText);
+	STDMETHOD(CancelQueuedExtraction)(/*[in]*/ long jobId);
+
+private:
+	HRESULT FilterText(BSTR fileName, CleanupProfile profile, TextSink & sink, PropertyBag * properties = NULL);
+	HRESULT BuiltInText(BSTR fileName, CleanupProfile profile, TextSink & sink, HRESULT notText);
+	HRESULT PullText(IFilter *pFilter, CleanupProfile profile, TextSink & sink, PropertyBag * properties = NULL);
+	HRESULT GovernedFilterText(BSTR fileName, size_t maxLength, CleanupProfile profile, TextSink & sink, MemoryReservation & reservation,
+	                           PropertyBag * properties = NULL);
+	HRESULT AdmittedFilterText(BSTR fileName, unsigned long long footprint, CleanupProfile profile, TextSink & sink,
+	                           MemoryReservation & reservation);
+	HRESULT OpenFilter(BSTR fileName, const std::wstring & extension, IFilter ** ppFilter, bool * loaded = NULL);
+	HRESULT FilterError(bool getText, HRESULT hr);
+
+	HRESULT OpenPageSession(BSTR fileName, unsigned long long stamp, CleanupProfile profile, PageSession ** ppSession);
+	void ClosePageSession(PageSession *session);
+	PageIndex * GetPageIndex(BSTR fileName, unsigned long long stamp, CleanupProfile profile);
+
+	// open filters and checkpoints for ExtractTextPage, least recently used go first
+	std::vector<PageSession *> m_pageSessions;
+	std::vector<PageIndex *> m_pageIndexes;
+	unsigned long m_nextPageSession;
+	unsigned long m_pageClock;
+
+	// compiled by CompilePatterns, the handle is the index + 1
+	std::vector<PatternSet *> m_patternSets;
 };
 
 #endif //__TEXTEXTRACTOR_H_
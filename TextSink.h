@@ -0,0 +1,124 @@
+// TextSink.h : Consumers of the cleaned-up text as the extraction loop produces it
+
+#ifndef __TEXTSINK_H_
+#define __TEXTSINK_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Same values as the IFilter CHUNK_BREAKTYPE
+enum TextBreak
+{
+   TEXT_BREAK_NONE = 0,
+   TEXT_BREAK_EOW = 1,
+   TEXT_BREAK_EOS = 2,
+   TEXT_BREAK_EOP = 3,
+   TEXT_BREAK_EOC = 4
+};
+
+// The parts of a STAT_CHUNK the sinks care about, kept free of the
+// Windows headers so the sinks can be driven by scripted chunks elsewhere.
+struct ChunkInfo
+{
+   unsigned long idChunk;
+   TextBreak breakType;
+   unsigned long locale;
+   unsigned long idChunkSource;
+   unsigned long cwcStartSource;
+   unsigned long cwcLenSource;
+};
+
+class TextSink
+{
+public:
+   virtual ~TextSink() {}
+
+   // A text chunk is starting. Called before the chunk's separator, if any,
+   // is passed to OnText in a single call.
+   virtual void OnChunk(const ChunkInfo & /*chunk*/) {}
+
+   // Cleaned up text, including the separators between chunks.
+   virtual void OnText(const wchar_t *text, size_t cch) = 0;
+
+   // Once no sink wants more the loop stops pulling text from the filter.
+   virtual bool WantsMore() const { return true; }
+
+   // No more text is coming.
+   virtual void OnEnd() {}
+};
+
+// Collects the text returned to the caller. Like the original loop, it
+// stops once it holds more than maxLength (if non-zero) characters.
+class TextBufferSink : public TextSink
+{
+public:
+   explicit TextBufferSink(size_t maxLength) : m_maxLength(maxLength) {}
+
+   virtual void OnText(const wchar_t *text, size_t cch)
+   {
+      if (WantsMore())
+         m_text.append(text, cch);
+   }
+
+   virtual bool WantsMore() const
+   {
+      return 0 == m_maxLength || m_text.length() <= m_maxLength;
+   }
+
+   bool Truncated() const { return !WantsMore(); }
+
+   const std::wstring & Text() const { return m_text; }
+
+private:
+   size_t m_maxLength;
+   std::wstring m_text;
+};
+
+// Fans the text out to several sinks, each one only sees text until it
+// says it doesn't want more.
+class TeeSink : public TextSink
+{
+public:
+   void Add(TextSink *sink) { m_sinks.push_back(sink); }
+
+   virtual void OnChunk(const ChunkInfo & chunk)
+   {
+      for (size_t i = 0; i < m_sinks.size(); ++i)
+      {
+         if (m_sinks[i]->WantsMore())
+            m_sinks[i]->OnChunk(chunk);
+      }
+   }
+
+   virtual void OnText(const wchar_t *text, size_t cch)
+   {
+      for (size_t i = 0; i < m_sinks.size(); ++i)
+      {
+         if (m_sinks[i]->WantsMore())
+            m_sinks[i]->OnText(text, cch);
+      }
+   }
+
+   virtual bool WantsMore() const
+   {
+      for (size_t i = 0; i < m_sinks.size(); ++i)
+      {
+         if (m_sinks[i]->WantsMore())
+            return true;
+      }
+
+      return false;
+   }
+
+   virtual void OnEnd()
+   {
+      for (size_t i = 0; i < m_sinks.size(); ++i)
+         m_sinks[i]->OnEnd();
+   }
+
+private:
+   std::vector<TextSink *> m_sinks;
+};
+
+#endif //__TEXTSINK_H_
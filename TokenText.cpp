@@ -0,0 +1,99 @@
+// TokenText.cpp : Opaque state tokens handed back to callers as strings
+
+#include <wchar.h>
+
+#include "TokenText.h"
+
+static void AppendHex(std::wstring & text, unsigned long long value)
+{
+   static const wchar_t digits[] = L"0123456789abcdef";
+
+   wchar_t buf[17];
+   int i = 16;
+
+   buf[16] = 0;
+
+   do
+   {
+      buf[--i] = digits[value & 0xF];
+      value >>= 4;
+   } while (value);
+
+   text += L'.';
+   text += buf + i;
+}
+
+static unsigned long long TokenCheck(const wchar_t *prefix, const unsigned long long *fields, size_t count)
+{
+   unsigned long long check = 0xCBF29CE484222325ULL;
+
+   for (; *prefix; ++prefix)
+      check = (check ^ static_cast<unsigned long long>(*prefix)) * 0x100000001B3ULL;
+
+   for (size_t i = 0; i < count; ++i)
+      check = (check ^ fields[i]) * 0x100000001B3ULL;
+
+   return check;
+}
+
+std::wstring EncodeToken(const wchar_t *prefix, const unsigned long long *fields, size_t count)
+{
+   std::wstring text(prefix);
+
+   for (size_t i = 0; i < count; ++i)
+      AppendHex(text, fields[i]);
+
+   AppendHex(text, TokenCheck(prefix, fields, count));
+   return text;
+}
+
+bool DecodeToken(const wchar_t *text, size_t cch, const wchar_t *prefix, unsigned long long *fields, size_t count)
+{
+   size_t prefixLength = wcslen(prefix);
+
+   if (NULL == text || cch < prefixLength || 0 != wcsncmp(text, prefix, prefixLength))
+      return false;
+
+   size_t found = 0;
+   unsigned long long check = 0;
+   size_t i = prefixLength;
+
+   while (i < cch)
+   {
+      if (L'.' != text[i] || found > count)
+         return false;
+
+      unsigned long long value = 0;
+      size_t digits = 0;
+
+      for (++i; i < cch && L'.' != text[i]; ++i, ++digits)
+      {
+         wchar_t c = text[i];
+         unsigned long long digit;
+
+         if (c >= L'0' && c <= L'9')
+            digit = c - L'0';
+         else if (c >= L'a' && c <= L'f')
+            digit = c - L'a' + 10;
+         else
+            return false;
+
+         if (16 == digits)
+            return false;
+
+         value = (value << 4) | digit;
+      }
+
+      if (0 == digits)
+         return false;
+
+      if (found < count)
+         fields[found] = value;
+      else
+         check = value;
+
+      ++found;
+   }
+
+   return count + 1 == found && check == TokenCheck(prefix, fields, count);
+}
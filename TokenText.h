@@ -0,0 +1,17 @@
+// TokenText.h : Opaque state tokens handed back to callers as strings
+
+#ifndef __TOKENTEXT_H_
+#define __TOKENTEXT_H_
+
+#include <stddef.h>
+#include <string>
+
+// A token is the prefix (naming its kind and version) followed by the fields
+// as dot separated hex and a check value, so a mangled or truncated token is
+// turned away rather than trusted.
+std::wstring EncodeToken(const wchar_t *prefix, const unsigned long long *fields, size_t count);
+
+// False unless text is a token with the given prefix and exactly count fields.
+bool DecodeToken(const wchar_t *text, size_t cch, const wchar_t *prefix, unsigned long long *fields, size_t count);
+
+#endif //__TOKENTEXT_H_
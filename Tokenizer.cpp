@@ -0,0 +1,242 @@
+// Tokenizer.cpp : Splits the cleaned-up text into word/number/punctuation tokens
+
+#include "Tokenizer.h"
+
+// TOKENIZER_NO_SSE2 builds the scalar classifier alone, to compare against
+#if !defined(TOKENIZER_NO_SSE2) && (defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__))
+#define TOKENIZER_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+enum CharacterClass
+{
+   CHAR_SPACE,
+   CHAR_ALPHA,
+   CHAR_DIGIT,
+   CHAR_PUNCTUATION
+};
+
+// By the time text gets here CleanUpCharacters has already folded most of the
+// fancy punctuation down to ASCII, so the non-ASCII ranges are mostly letters.
+inline static CharacterClass ClassifyCharacter(wchar_t ch)
+{
+   unsigned long c = static_cast<unsigned long>(ch);
+
+   if (c <= 0x20)
+      return CHAR_SPACE;
+
+   if (c < 0x80)
+   {
+      if (c >= '0' && c <= '9')
+         return CHAR_DIGIT;
+
+      if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')
+         return CHAR_ALPHA;
+
+      return CHAR_PUNCTUATION;
+   }
+
+   if (c < 0xC0)                    // Latin-1 symbols
+      return 0xA0 == c ? CHAR_SPACE : CHAR_PUNCTUATION;
+
+   if (0xD7 == c || 0xF7 == c)      // multiplication and division signs
+      return CHAR_PUNCTUATION;
+
+   if (c >= 0x2000 && c <= 0x2BFF)  // general punctuation through misc. symbols
+      return CHAR_PUNCTUATION;
+
+   if (c >= 0x3000 && c <= 0x303F)  // CJK symbols and punctuation
+      return 0x3000 == c ? CHAR_SPACE : CHAR_PUNCTUATION;
+
+   if (c >= 0xFE30 && c <= 0xFE6F)  // CJK compatibility and small forms
+      return CHAR_PUNCTUATION;
+
+   return CHAR_ALPHA;
+}
+
+#ifdef TOKENIZER_SSE2
+
+// Loads eight characters as 16-bit lanes. With a 32-bit wchar_t anything
+// above 0x7FFF saturates, which is still non-ASCII so the masks don't care.
+inline static __m128i LoadEight(const wchar_t *p)
+{
+   if (sizeof(wchar_t) == 2)
+      return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+
+   __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+   __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4));
+   return _mm_packs_epi32(lo, hi);
+}
+
+// lanes where lo <= x <= lo + span, compared unsigned
+inline static __m128i InRange(__m128i x, short lo, short span)
+{
+   __m128i offset = _mm_sub_epi16(x, _mm_set1_epi16(lo));
+   return _mm_cmpeq_epi16(_mm_subs_epu16(offset, _mm_set1_epi16(span)), _mm_setzero_si128());
+}
+
+// one bit per lane
+inline static unsigned LaneMask(__m128i m)
+{
+   return static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(m, _mm_setzero_si128()))) & 0xFF;
+}
+
+inline static unsigned LowestLane(unsigned mask)
+{
+#ifdef _MSC_VER
+   unsigned long index;
+   _BitScanForward(&index, mask);
+   return index;
+#else
+   return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+#endif
+
+TokenSink::TokenSink(size_t maxLength)
+   : m_maxLength(maxLength), m_offset(0), m_inToken(false), m_hasAlpha(false), m_tokenStart(0)
+{
+}
+
+void TokenSink::OnChunk(const ChunkInfo & chunk)
+{
+   if (TEXT_BREAK_NONE != chunk.breakType)
+      EndToken(m_offset);
+}
+
+bool TokenSink::WantsMore() const
+{
+   return 0 == m_maxLength || m_offset <= m_maxLength;
+}
+
+void TokenSink::OnEnd()
+{
+   EndToken(m_offset);
+}
+
+void TokenSink::StartToken(size_t offset)
+{
+   m_inToken = true;
+   m_hasAlpha = false;
+   m_tokenStart = offset;
+}
+
+void TokenSink::EndToken(size_t offset)
+{
+   if (!m_inToken)
+      return;
+
+   Emit(m_tokenStart, offset - m_tokenStart, m_hasAlpha ? TOKEN_WORD : TOKEN_NUMBER);
+   m_inToken = false;
+}
+
+void TokenSink::Emit(size_t offset, size_t length, TokenKind kind)
+{
+   Token token;
+   token.kind = static_cast<unsigned short>(kind);
+
+   while (length)
+   {
+      size_t piece = length > 0xFFFF ? 0xFFFF : length;
+
+      token.offset = static_cast<unsigned int>(offset);
+      token.length = static_cast<unsigned short>(piece);
+      m_tokens.push_back(token);
+
+      offset += piece;
+      length -= piece;
+   }
+}
+
+void TokenSink::ScanScalar(const wchar_t *text, size_t cch, size_t base)
+{
+   for (size_t i = 0; i < cch; ++i)
+   {
+      switch (ClassifyCharacter(text[i]))
+      {
+         case CHAR_SPACE:
+            EndToken(base + i);
+            break;
+
+         case CHAR_ALPHA:
+            if (!m_inToken)
+               StartToken(base + i);
+
+            m_hasAlpha = true;
+            break;
+
+         case CHAR_DIGIT:
+            if (!m_inToken)
+               StartToken(base + i);
+            break;
+
+         case CHAR_PUNCTUATION:
+            EndToken(base + i);
+            Emit(base + i, 1, TOKEN_PUNCTUATION);
+            break;
+      }
+   }
+}
+
+void TokenSink::OnText(const wchar_t *text, size_t cch)
+{
+   size_t i = 0;
+
+#ifdef TOKENIZER_SSE2
+   // Classify eight characters at a time. Blocks holding only ASCII letters,
+   // digits and blanks (the bulk of most text) find their token boundaries
+   // from the lane masks, anything else goes through the scalar path.
+   for (; i + 8 <= cch; i += 8)
+   {
+      __m128i v = LoadEight(text + i);
+
+      unsigned alpha = LaneMask(InRange(_mm_or_si128(v, _mm_set1_epi16(0x20)), 'a', 25));
+      unsigned digit = LaneMask(InRange(v, '0', 9));
+      unsigned space = LaneMask(_mm_cmpeq_epi16(_mm_subs_epu16(v, _mm_set1_epi16(0x20)), _mm_setzero_si128()));
+      unsigned word = alpha | digit;
+
+      if ((word | space) != 0xFF)
+      {
+         ScanScalar(text + i, 8, m_offset + i);
+         continue;
+      }
+
+      unsigned carried = m_inToken ? 1 : 0;
+      unsigned previous = ((word << 1) | carried) & 0xFF;
+      unsigned starts = word & ~previous;
+      unsigned ends = ~word & previous & 0xFF;
+      unsigned events = starts | ends;
+      unsigned startLane = 0;
+
+      while (events)
+      {
+         unsigned lane = LowestLane(events);
+         unsigned bit = 1u << lane;
+
+         events &= events - 1;
+
+         if (ends & bit)
+         {
+            m_hasAlpha = m_hasAlpha || (alpha & (bit - 1) & ~((1u << startLane) - 1)) != 0;
+            EndToken(m_offset + i + lane);
+         }
+         else
+         {
+            StartToken(m_offset + i + lane);
+            startLane = lane;
+         }
+      }
+
+      if (m_inToken)
+         m_hasAlpha = m_hasAlpha || (alpha & ~((1u << startLane) - 1)) != 0;
+   }
+#endif
+
+   ScanScalar(text + i, cch - i, m_offset + i);
+   m_offset += cch;
+}
@@ -0,0 +1,56 @@
+// Tokenizer.h : Splits the cleaned-up text into word/number/punctuation tokens
+//               while it streams out of the extraction loop
+
+#ifndef __TOKENIZER_H_
+#define __TOKENIZER_H_
+
+#include <vector>
+
+#include "TextSink.h"
+
+enum TokenKind
+{
+   TOKEN_WORD = 0,
+   TOKEN_NUMBER = 1,
+   TOKEN_PUNCTUATION = 2
+};
+
+// Eight bytes per token, offsets are into the cleaned-up text.
+// Runs longer than 65535 characters are split into several tokens.
+struct Token
+{
+   unsigned int offset;
+   unsigned short length;
+   unsigned short kind;
+};
+
+class TokenSink : public TextSink
+{
+public:
+   // Like TextBufferSink, stops once more than maxLength (if non-zero)
+   // characters have gone by so the tokens cover the same text.
+   explicit TokenSink(size_t maxLength);
+
+   // Chunk breaks other than CHUNK_NO_BREAK always end the current token.
+   virtual void OnChunk(const ChunkInfo & chunk);
+   virtual void OnText(const wchar_t *text, size_t cch);
+   virtual bool WantsMore() const;
+   virtual void OnEnd();
+
+   const std::vector<Token> & Tokens() const { return m_tokens; }
+
+private:
+   void StartToken(size_t offset);
+   void EndToken(size_t offset);
+   void Emit(size_t offset, size_t length, TokenKind kind);
+   void ScanScalar(const wchar_t *text, size_t cch, size_t base);
+
+   size_t m_maxLength;
+   size_t m_offset;        // characters seen so far
+   bool m_inToken;
+   bool m_hasAlpha;        // current run has a letter in it, so it's a word
+   size_t m_tokenStart;
+   std::vector<Token> m_tokens;
+};
+
+#endif //__TOKENIZER_H_